@@ -4,6 +4,6 @@ set "KERNEL32=C:\Program Files (x86)\Windows Kits\10\Lib\10.0.26100.0\um\x64\ker
 
 make
 
-.\build\assembler.exe
+.\build\assembler.exe test\main.asm -o test\main.obj
 
 gcc -o test\main.exe test\main.obj "%KERNEL32%" & .\test\main.exe
\ No newline at end of file
@@ -0,0 +1,169 @@
+// Decoder microbenchmark
+// Encodes a mix of instructions with encode_batch, then walks the bytes with
+// decode_length alone and with decode, checking both find every instruction
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+
+#include <decoder.h>
+
+#define NUM_INSTRS 1000000
+#define BATCH_SIZE 256
+
+static Operand reg(std::string_view name)
+{
+    const Register *r = find_register(name);
+    Operand op = {};
+
+    op.type = OPND_REG;
+    op.reg = r->num;
+    op.size = r->size;
+    op.reg_class = r->reg_class;
+    op.reg_flags = r->flags;
+    op.base = REG_NONE;
+    op.index = REG_NONE;
+    op.sym = SYM_NONE;
+
+    return op;
+}
+
+static Operand imm(int64_t value)
+{
+    Operand op = {};
+
+    op.type = OPND_IMM;
+    op.value = value;
+    op.base = REG_NONE;
+    op.index = REG_NONE;
+    op.sym = SYM_NONE;
+
+    return op;
+}
+
+static Operand mem(std::string_view base, int64_t disp, std::string_view index = {}, uint8_t scale = 1)
+{
+    Operand op = {};
+
+    op.type = OPND_MEM;
+    op.base = base.empty() ? REG_NONE : base == "rip" ? REG_RIP : find_register(base)->num;
+    op.index = index.empty() ? REG_NONE : find_register(index)->num;
+    op.scale = scale;
+    op.value = disp;
+    op.sym = SYM_NONE;
+
+    return op;
+}
+
+// Operands in Intel order
+static Instr instr(std::string_view mnemonic, std::vector<Operand> ops)
+{
+    Instr instr = {};
+
+    lookup_mnemonic(mnemonic, instr);
+    instr.num_ops = ops.size();
+
+    for (std::size_t i = 0; i < ops.size(); i++)
+    {
+        instr.ops[i] = ops[i];
+    }
+
+    return instr;
+}
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+    std::vector<Instr> mix = {
+        instr("movq", {reg("rax"), reg("rcx")}),
+        instr("addl", {reg("eax"), imm(1000)}),
+        instr("movq", {reg("rdx"), mem("rsp", 8)}),
+        instr("movl", {mem("rbp", -4), reg("r9d")}),
+        instr("leaq", {reg("rdi"), mem("rip", 64)}),
+        instr("cmpq", {reg("r12"), imm(4)}),
+        instr("movzbl", {reg("eax"), mem("rdi", 0, "rcx", 4)}),
+        instr("imull", {reg("edx"), reg("esi"), imm(12)}),
+        instr("pushq", {reg("rbx")}),
+        instr("ret", {}),
+    };
+
+    // The mix encoded back to back
+    std::vector<uint8_t> code;
+    std::vector<Instr> batch(BATCH_SIZE);
+    std::vector<uint8_t> out(BATCH_SIZE * MAX_INSTR_SIZE);
+    std::vector<Enc_Record> records(BATCH_SIZE);
+
+    for (std::size_t i = 0; i < NUM_INSTRS; i += BATCH_SIZE)
+    {
+        std::size_t count = std::min<std::size_t>(BATCH_SIZE, NUM_INSTRS - i);
+
+        for (std::size_t j = 0; j < count; j++)
+        {
+            batch[j] = mix[(i + j) % mix.size()];
+        }
+
+        if (encode_batch(batch.data(), count, out.data(), out.size(), records.data()) != count)
+        {
+            std::cerr << "encode_batch failed" << std::endl;
+            return 1;
+        }
+
+        code.insert(code.end(), out.begin(), out.begin() + records[count - 1].offset + records[count - 1].size);
+    }
+
+    // Lengths only
+    std::size_t length_instrs = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (std::size_t offset = 0; offset < code.size(); length_instrs++)
+    {
+        std::size_t size = decode_length(code.data() + offset, code.size() - offset);
+
+        if (size == 0)
+        {
+            std::cerr << "decode_length failed at " << offset << std::endl;
+            return 1;
+        }
+
+        offset += size;
+    }
+
+    double length_ns = elapsed_ns(start);
+
+    // Lengths and operands
+    std::size_t full_instrs = 0;
+    uint64_t checksum = 0;
+    start = std::chrono::steady_clock::now();
+
+    for (std::size_t offset = 0; offset < code.size(); full_instrs++)
+    {
+        Dec_Instr dec;
+
+        if (!decode(code.data() + offset, code.size() - offset, dec))
+        {
+            std::cerr << "decode failed at " << offset << std::endl;
+            return 1;
+        }
+
+        checksum += dec.form + dec.instr.ops[0].reg;
+        offset += dec.size;
+    }
+
+    double full_ns = elapsed_ns(start);
+
+    std::cout << std::setw(8) << "api" << std::setw(12) << "instrs" << std::setw(12) << "ns/instr" << std::setw(12) << "MB/s" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << std::setw(8) << "length" << std::setw(12) << length_instrs << std::setw(12) << length_ns / length_instrs << std::setw(12)
+              << code.size() * 1e3 / length_ns << std::endl;
+    std::cout << std::setw(8) << "decode" << std::setw(12) << full_instrs << std::setw(12) << full_ns / full_instrs << std::setw(12)
+              << code.size() * 1e3 / full_ns << std::endl;
+
+    // Both walks found every instruction, the checksum keeps the operands read
+    return length_instrs == NUM_INSTRS && full_instrs == NUM_INSTRS && checksum != 0 ? 0 : 1;
+}
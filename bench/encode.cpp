@@ -0,0 +1,182 @@
+// Encoder microbenchmark
+// Encodes a mix of instructions one at a time and in batches, and counts the
+// heap allocations made while doing so, which should be none
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+
+#include <encoder.h>
+
+#define NUM_INSTRS 1000000
+#define BATCH_SIZE 256
+
+static std::size_t allocations = 0;
+
+void *operator new(std::size_t size)
+{
+    allocations++;
+
+    if (void *ptr = std::malloc(size ? size : 1))
+    {
+        return ptr;
+    }
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+static Operand reg(std::string_view name)
+{
+    const Register *r = find_register(name);
+    Operand op = {};
+
+    op.type = OPND_REG;
+    op.reg = r->num;
+    op.size = r->size;
+    op.reg_class = r->reg_class;
+    op.reg_flags = r->flags;
+    op.base = REG_NONE;
+    op.index = REG_NONE;
+    op.sym = SYM_NONE;
+
+    return op;
+}
+
+static Operand imm(int64_t value)
+{
+    Operand op = {};
+
+    op.type = OPND_IMM;
+    op.value = value;
+    op.base = REG_NONE;
+    op.index = REG_NONE;
+    op.sym = SYM_NONE;
+
+    return op;
+}
+
+static Operand mem(std::string_view base, int64_t disp, uint32_t sym = SYM_NONE)
+{
+    Operand op = {};
+
+    op.type = OPND_MEM;
+    op.base = base.empty() ? REG_NONE : base == "rip" ? REG_RIP : find_register(base)->num;
+    op.index = REG_NONE;
+    op.scale = 1;
+    op.value = disp;
+    op.sym = sym;
+
+    return op;
+}
+
+// Operands in Intel order
+static Instr instr(std::string_view mnemonic, std::vector<Operand> ops)
+{
+    Instr instr = {};
+
+    lookup_mnemonic(mnemonic, instr);
+    instr.num_ops = ops.size();
+
+    for (std::size_t i = 0; i < ops.size(); i++)
+    {
+        instr.ops[i] = ops[i];
+    }
+
+    return instr;
+}
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+    std::vector<Instr> mix = {
+        instr("movq", {reg("rax"), reg("rcx")}),
+        instr("addl", {reg("eax"), imm(1000)}),
+        instr("movq", {reg("rdx"), mem("rsp", 8)}),
+        instr("movl", {mem("rbp", -4), reg("r9d")}),
+        instr("leaq", {reg("rdi"), mem("rip", 0, 1)}),
+        instr("cmpq", {reg("r12"), imm(4)}),
+        instr("call", {mem("", 0, 2)}),
+        instr("pushq", {reg("rbx")}),
+        instr("ret", {}),
+    };
+
+    std::vector<Instr> instrs;
+
+    for (std::size_t i = 0; i < NUM_INSTRS; i++)
+    {
+        instrs.emplace_back(mix[i % mix.size()]);
+    }
+
+    std::vector<uint8_t> out(BATCH_SIZE * MAX_INSTR_SIZE);
+    std::vector<Enc_Record> records(BATCH_SIZE);
+    uint64_t total = 0;
+
+    // One call per instruction
+    std::size_t before = allocations;
+    auto start = std::chrono::steady_clock::now();
+
+    for (const Instr &instr : instrs)
+    {
+        uint8_t encoded[MAX_INSTR_SIZE];
+        std::size_t size;
+        Enc_Fixup fixups[MAX_FIXUPS];
+        std::size_t num_fixups;
+
+        if (!encode(instr, encoded, size, fixups, num_fixups))
+        {
+            std::cerr << "encode failed" << std::endl;
+            return 1;
+        }
+
+        total += size;
+    }
+
+    double single_ns = elapsed_ns(start);
+    std::size_t single_allocs = allocations - before;
+
+    // Batches written into one buffer
+    before = allocations;
+    start = std::chrono::steady_clock::now();
+
+    for (std::size_t i = 0; i < instrs.size(); i += BATCH_SIZE)
+    {
+        std::size_t count = std::min<std::size_t>(BATCH_SIZE, instrs.size() - i);
+
+        if (encode_batch(instrs.data() + i, count, out.data(), out.size(), records.data()) != count)
+        {
+            std::cerr << "encode_batch failed" << std::endl;
+            return 1;
+        }
+
+        total -= records[count - 1].offset + records[count - 1].size;
+    }
+
+    double batch_ns = elapsed_ns(start);
+    std::size_t batch_allocs = allocations - before;
+
+    std::cout << std::setw(8) << "api" << std::setw(12) << "instrs" << std::setw(12) << "ns/instr" << std::setw(14) << "allocations" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << std::setw(8) << "encode" << std::setw(12) << instrs.size() << std::setw(12) << single_ns / instrs.size() << std::setw(14) << single_allocs << std::endl;
+    std::cout << std::setw(8) << "batch" << std::setw(12) << instrs.size() << std::setw(12) << batch_ns / instrs.size() << std::setw(14) << batch_allocs << std::endl;
+
+    // Both runs produced the same number of bytes
+    return total == 0 ? 0 : 1;
+}
@@ -0,0 +1,215 @@
+// Synthetic source generator for the benchmark suite
+// Writes compiler-like AT&T assembly of about the requested size: functions
+// with prologues, arithmetic, memory operands, local branches, calls to
+// other functions and external symbols, RIP relative loads, and data,
+// read-only strings and common blocks that refer back to the code.
+// The output is the same for a given size and seed
+//
+// usage: gen_source.exe size[K|M|G] output.s [seed]
+
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <string>
+#include <cstdlib>
+#include <cstdint>
+
+#define NUM_EXTERNALS 1024 // Distinct undefined symbols called
+#define FLUSH_SIZE 0x100000
+
+static const char *REGS64[] = {"rax", "rcx", "rdx", "rbx", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"};
+static const char *REGS32[] = {"eax", "ecx", "edx", "ebx", "esi", "edi", "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d"};
+static const char *CONDITIONS[] = {"e", "ne", "l", "le", "g", "ge", "b", "be", "a", "ae", "s", "ns"};
+
+#define NUM_REGS (sizeof(REGS64) / sizeof(REGS64[0]))
+#define NUM_CONDITIONS (sizeof(CONDITIONS) / sizeof(CONDITIONS[0]))
+
+static uint64_t parse_size(const char *text)
+{
+    char *end;
+    uint64_t size = strtoull(text, &end, 10);
+
+    switch (*end)
+    {
+    case 'k':
+    case 'K':
+        return size << 10;
+    case 'm':
+    case 'M':
+        return size << 20;
+    case 'g':
+    case 'G':
+        return size << 30;
+    case '\0':
+        return size;
+    }
+
+    return 0;
+}
+
+struct Generator
+{
+    std::mt19937_64 rng;
+    std::string out;
+    uint64_t num_functions = 0;
+
+    uint32_t pick(uint32_t n)
+    {
+        return rng() % n;
+    }
+
+    const char *reg64()
+    {
+        return REGS64[pick(NUM_REGS)];
+    }
+
+    const char *reg32()
+    {
+        return REGS32[pick(NUM_REGS)];
+    }
+
+    // A function defined earlier, or this one
+    std::string callee(uint64_t f)
+    {
+        return "f" + std::to_string(f - (f ? pick(std::min<uint64_t>(f, 64)) : 0));
+    }
+
+    void instruction(uint64_t f, uint32_t num_blocks)
+    {
+        std::string fs = std::to_string(f);
+
+        switch (pick(16))
+        {
+        case 0:
+            out += "\tmovq\t%" + std::string(reg64()) + ", %" + reg64() + "\n";
+            break;
+        case 1:
+            out += "\tmovl\t$" + std::to_string(pick(100000)) + ", %" + reg32() + "\n";
+            break;
+        case 2:
+            out += "\taddq\t$" + std::to_string(pick(256)) + ", %" + reg64() + "\n";
+            break;
+        case 3:
+            out += "\tsubl\t%" + std::string(reg32()) + ", %" + reg32() + "\n";
+            break;
+        case 4:
+            out += "\tmovq\t" + std::to_string(8 * pick(32)) + "(%rsp), %" + reg64() + "\n";
+            break;
+        case 5:
+            out += "\tmovl\t%" + std::string(reg32()) + ", -" + std::to_string(4 * (1 + pick(16))) + "(%rbp)\n";
+            break;
+        case 6:
+            out += "\tleaq\t(%" + std::string(reg64()) + ",%" + reg64() + "," + std::to_string(1 << pick(4)) + "), %" + reg64() + "\n";
+            break;
+        case 7:
+            out += "\tcmpq\t$" + std::to_string(pick(64)) + ", %" + reg64() + "\n";
+            out += "\tj" + std::string(CONDITIONS[pick(NUM_CONDITIONS)]) + "\t.L" + fs + "_" + std::to_string(pick(num_blocks)) + "\n";
+            break;
+        case 8:
+            out += "\ttestl\t%" + std::string(reg32()) + ", %" + reg32() + "\n";
+            out += "\tjmp\t.L" + fs + "_" + std::to_string(pick(num_blocks)) + "\n";
+            break;
+        case 9:
+            out += "\tcall\t" + callee(f) + "\n";
+            break;
+        case 10:
+            out += "\tcall\text_" + std::to_string(pick(NUM_EXTERNALS)) + "\n";
+            break;
+        case 11:
+            out += "\tmovq\td" + std::to_string(f - pick(std::min<uint64_t>(f + 1, 64))) + "(%rip), %" + reg64() + "\n";
+            break;
+        case 12:
+            out += "\tleaq\t.LC" + fs + "(%rip), %" + reg64() + "\n";
+            break;
+        case 13:
+            out += "\timulq\t$" + std::to_string(3 + pick(60)) + ", %" + reg64() + ", %" + reg64() + "\n";
+            break;
+        case 14:
+            out += "\tshrq\t$" + std::to_string(1 + pick(63)) + ", %" + reg64() + "\n";
+            break;
+        case 15:
+            out += "\txorl\t%" + std::string(reg32()) + ", %" + reg32() + "\n";
+            break;
+        }
+    }
+
+    void function()
+    {
+        uint64_t f = num_functions++;
+        std::string fs = std::to_string(f);
+        uint32_t num_blocks = 2 + pick(8);
+
+        out += "\t.text\n\t.globl\tf" + fs + "\n\t.p2align 4\n";
+        out += "f" + fs + ":\n\tpushq\t%rbp\n\tmovq\t%rsp, %rbp\n\tsubq\t$" + std::to_string(16 * (1 + pick(8))) + ", %rsp\n";
+
+        for (uint32_t b = 0; b < num_blocks; b++)
+        {
+            uint32_t len = 2 + pick(10);
+
+            for (uint32_t i = 0; i < len; i++)
+            {
+                instruction(f, num_blocks);
+            }
+
+            out += ".L" + fs + "_" + std::to_string(b) + ":\n";
+        }
+
+        out += "\tleave\n\tret\n";
+
+        // Data for the function: a table pointing back at code and other data
+        out += "\t.data\n\t.globl\td" + fs + "\n\t.p2align 3\n";
+        out += "d" + fs + ":\n\t.quad\tf" + fs + "\n\t.quad\td" + std::to_string(f - pick(std::min<uint64_t>(f + 1, 64))) + "\n";
+        out += "\t.long\t" + std::to_string(pick(1 << 30)) + ", .L" + fs + "_1 - f" + fs + "\n";
+        out += "\t.short\t" + std::to_string(pick(1 << 16)) + "\n\t.byte\t1, 2, 3\n";
+
+        out += "\t.section .rodata\n.LC" + fs + ":\n\t.asciz\t\"function " + fs + " value %d\\n\"\n";
+
+        if (pick(8) == 0)
+        {
+            out += "\t.comm\tbuf" + fs + ", " + std::to_string(64 << pick(6)) + ", 16\n";
+        }
+    }
+};
+
+int main(int argc, char **argv)
+{
+    if (argc < 3 || parse_size(argv[1]) == 0)
+    {
+        std::cerr << "usage: gen_source size[K|M|G] output.s [seed]" << std::endl;
+        return 1;
+    }
+
+    uint64_t size = parse_size(argv[1]);
+    std::ofstream file(argv[2], std::ios::binary);
+
+    if (!file)
+    {
+        std::cerr << "error: cannot open " << argv[2] << std::endl;
+        return 1;
+    }
+
+    Generator gen;
+    uint64_t written = 0;
+
+    gen.rng.seed(argc > 3 ? strtoull(argv[3], nullptr, 10) : 1);
+    gen.out = "\t.file\t\"bench.c\"\n";
+
+    while (written + gen.out.size() < size)
+    {
+        gen.function();
+
+        if (gen.out.size() >= FLUSH_SIZE)
+        {
+            file.write(gen.out.data(), gen.out.size());
+            written += gen.out.size();
+            gen.out.clear();
+        }
+    }
+
+    file.write(gen.out.data(), gen.out.size());
+    written += gen.out.size();
+
+    std::cerr << argv[2] << ": " << written << " bytes, " << gen.num_functions << " functions" << std::endl;
+
+    return file ? 0 : 1;
+}
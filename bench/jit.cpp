@@ -0,0 +1,196 @@
+// JIT latency benchmark
+// Assembles a small module from text, and loads a few instructions encoded
+// with encode_batch, many times over, checking each time that the code runs
+// and binds its data, common symbol and host function correctly. Reports
+// the median and mean time from text or records to a callable function
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+#include <jit.h>
+#include <encoder.h>
+
+#define NUM_RUNS 10000
+
+static const char *SOURCE =
+    "\t.text\n"
+    "\t.globl\tapply\n"
+    "apply:\n"
+    "\tmovq\t%rdi, %rax\n"
+    "\timulq\tfactor(%rip), %rax\n"
+    "\tmovq\t%rax, %rdi\n"
+    "\tleaq\ttable(%rip), %rcx\n"
+    "\tmovq\t8(%rcx), %rsi\n"
+    "\tincq\tcounter(%rip)\n"
+    "\tjmp\thost_add\n"
+    "\t.globl\tself\n"
+    "self:\n"
+    "\tmovq\tself_ptr(%rip), %rax\n"
+    "\tret\n"
+    "\t.data\n"
+    "factor:\t.quad\t3\n"
+    "table:\t.quad\t0, 100\n"
+    "self_ptr:\t.quad\tself\n"
+    "\t.comm\tcounter, 8, 8\n";
+
+extern "C" int64_t host_add(int64_t a, int64_t b)
+{
+    return a + b;
+}
+
+static void *resolve(std::string_view name)
+{
+    return name == "host_add" ? (void *)(&host_add) : nullptr;
+}
+
+static Operand reg(std::string_view name)
+{
+    const Register *r = find_register(name);
+    Operand op = {};
+
+    op.type = OPND_REG;
+    op.reg = r->num;
+    op.size = r->size;
+    op.reg_class = r->reg_class;
+    op.reg_flags = r->flags;
+    op.base = REG_NONE;
+    op.index = REG_NONE;
+    op.sym = SYM_NONE;
+
+    return op;
+}
+
+static Operand imm(int64_t value)
+{
+    Operand op = {};
+
+    op.type = OPND_IMM;
+    op.value = value;
+    op.base = REG_NONE;
+    op.index = REG_NONE;
+    op.sym = SYM_NONE;
+
+    return op;
+}
+
+static Operand label(uint32_t sym)
+{
+    Operand op = {};
+
+    op.type = OPND_MEM;
+    op.base = REG_NONE;
+    op.index = REG_NONE;
+    op.scale = 1;
+    op.sym = sym;
+
+    return op;
+}
+
+// Operands in Intel order
+static Instr instr(std::string_view mnemonic, std::vector<Operand> ops)
+{
+    Instr instr = {};
+
+    lookup_mnemonic(mnemonic, instr);
+    instr.num_ops = ops.size();
+
+    for (std::size_t i = 0; i < ops.size(); i++)
+    {
+        instr.ops[i] = ops[i];
+    }
+
+    return instr;
+}
+
+static double elapsed_us(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void print_times(const char *api, std::vector<double> &times)
+{
+    double total = 0;
+
+    for (double time : times)
+    {
+        total += time;
+    }
+
+    std::sort(times.begin(), times.end());
+
+    std::cout << std::setw(10) << api << std::setw(10) << times.size() << std::setw(14) << times[times.size() / 2]
+              << std::setw(12) << total / times.size() << std::endl;
+}
+
+int main()
+{
+    std::vector<double> text_times;
+    std::vector<double> record_times;
+
+    // Text
+    for (int run = 0; run < NUM_RUNS; run++)
+    {
+        Jit_Module module;
+        auto start = std::chrono::steady_clock::now();
+
+        if (!jit_assemble(SOURCE, resolve, module))
+        {
+            return 1;
+        }
+
+        auto apply = (int64_t(*)(int64_t))(jit_lookup(module, "apply"));
+        text_times.emplace_back(elapsed_us(start));
+
+        auto self = (void *(*)())(jit_lookup(module, "self"));
+        int64_t *counter = (int64_t *)(jit_lookup(module, "counter"));
+
+        if (apply(5) != 115 || self() != (void *)(self) || *counter != 1)
+        {
+            std::cerr << "wrong result from assembled code" << std::endl;
+            return 1;
+        }
+    }
+
+    // Records, a tail call to the host with a constant second argument
+    std::vector<Instr> instrs = {
+        instr("movq", {reg("rsi"), imm(7)}),
+        instr("jmp", {label(0)}),
+    };
+    void *symbols[] = {(void *)(&host_add)};
+    uint8_t code[2 * MAX_INSTR_SIZE];
+    Enc_Record records[2];
+
+    for (int run = 0; run < NUM_RUNS; run++)
+    {
+        Jit_Module module;
+        auto start = std::chrono::steady_clock::now();
+
+        if (encode_batch(instrs.data(), instrs.size(), code, sizeof(code), records) != instrs.size() ||
+            !jit_load(code, records[1].offset + records[1].size, records, instrs.size(), symbols, module))
+        {
+            return 1;
+        }
+
+        auto add_seven = (int64_t(*)(int64_t))(module.base);
+        record_times.emplace_back(elapsed_us(start));
+
+        if (add_seven(5) != 12)
+        {
+            std::cerr << "wrong result from loaded code" << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << std::setw(10) << "api" << std::setw(10) << "runs" << std::setw(14) << "median us" << std::setw(12) << "mean us" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+
+    print_times("assemble", text_times);
+    print_times("load", record_times);
+
+    return 0;
+}
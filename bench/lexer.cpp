@@ -0,0 +1,124 @@
+// Lexer throughput benchmark
+// Lexes a file, or a built-in function repeated to 64 MB, with each block
+// kernel the CPU supports, checking that they all find the same tokens.
+// Reports the best of a few runs in MB/s and millions of tokens a second
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include <string>
+
+#include <lexer.h>
+
+#define NUM_RUNS 5
+#define REPEAT_SIZE ((std::size_t)(64) << 20)
+
+static const char *SOURCE =
+    "\t.text\n"
+    "\t.globl\tcopy_rows\n"
+    "copy_rows:\n"
+    "\tpushq\t%rbp\n"
+    "\tmovq\t%rsp, %rbp\n"
+    "\txorl\t%eax, %eax # row\n"
+    "1:\n"
+    "\tmovq\t(%rsi,%rax,8), %rcx\n"
+    "\tmovq\t%rcx, 16(%rdi,%rax,8)\n"
+    "\taddq\t$1, %rax\n"
+    "\tcmpq\t%rdx, %rax\n"
+    "\tjb\t1b\n"
+    "\tleaq\t.Lmessage(%rip), %rdi\n"
+    "\tcall\tputs@PLT\n"
+    "\tpopq\t%rbp\n"
+    "\tret\n"
+    "\t.section\t.rodata\n"
+    ".Lmessage:\n"
+    "\t.string\t\"rows copied\\n\"\n"
+    "\t.byte\t'a, 0x1f, -3\n";
+
+static const char *KERNEL_NAMES[] = {"scalar", "sse2", "avx2"};
+
+// Tokens found and the best time in seconds
+static std::size_t lex_all(std::string_view text, double &best)
+{
+    Lexer lexer;
+    std::vector<Token> tokens;
+    std::size_t count = 0;
+
+    best = 0;
+
+    for (int run = 0; run < NUM_RUNS; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        count = 0;
+        lexer.reset(text);
+
+        while (lexer.next_statement(tokens))
+        {
+            count += tokens.size();
+        }
+
+        double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        best = run == 0 ? time : std::min(best, time);
+    }
+
+    return count;
+}
+
+int main(int argc, char **argv)
+{
+    Source_File file;
+    std::string repeated;
+    std::string_view text;
+
+    if (argc > 1)
+    {
+        if (!file.open(argv[1]))
+        {
+            std::cerr << "cannot open " << argv[1] << std::endl;
+            return 1;
+        }
+
+        text = std::string_view(file.data, file.size);
+    }
+    else
+    {
+        while (repeated.size() < REPEAT_SIZE)
+        {
+            repeated += SOURCE;
+        }
+
+        text = repeated;
+    }
+
+    uint8_t best_kernel = lexer_kernel();
+    std::size_t expected = 0;
+
+    std::cout << std::setw(10) << "kernel" << std::setw(14) << "tokens" << std::setw(12) << "MB/s" << std::setw(12) << "Mtok/s" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+
+    for (uint8_t kernel = LEX_KERNEL_SCALAR; kernel <= best_kernel; kernel++)
+    {
+        double time;
+
+        set_lexer_kernel(kernel);
+
+        std::size_t count = lex_all(text, time);
+
+        std::cout << std::setw(10) << KERNEL_NAMES[kernel] << std::setw(14) << count << std::setw(12) << text.size() / time / 1e6 << std::setw(12)
+                  << count / time / 1e6 << std::endl;
+
+        if (kernel != LEX_KERNEL_SCALAR && count != expected)
+        {
+            std::cerr << KERNEL_NAMES[kernel] << " found " << count << " tokens, the scalar kernel " << expected << std::endl;
+            return 1;
+        }
+
+        expected = count;
+    }
+
+    return 0;
+}
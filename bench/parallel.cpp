@@ -0,0 +1,113 @@
+// Parallel assembly scaling benchmark
+// Generates a source file with many functions, assembles it with 1 to 64
+// threads and checks every object matches the single threaded one
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+#include <object.h>
+#include <parser.h>
+
+#define NUM_FUNCTIONS 20000
+#define RUNS 3
+
+static std::string generate_source(std::size_t num_functions)
+{
+    std::string source;
+
+    source += "\t.file \"bench.c\"\n";
+
+    for (std::size_t i = 0; i < num_functions; i++)
+    {
+        std::string f = "f" + std::to_string(i);
+        std::string prev = "f" + std::to_string(i ? i - 1 : 0);
+
+        source += "\t.text\n\t.globl " + f + "\n\t.def " + f + "; .scl 2; .type 32; .endef\n\t.p2align 4\n";
+        source += f + ":\n";
+        source += "\tpushq %rbp\n\tmovq %rsp, %rbp\n\tsubq $32, %rsp\n";
+        source += "\tmovl $" + std::to_string(i) + ", %eax\n";
+        source += "\taddq 16(%rsp), %rax\n\tleaq (%rdi,%rsi,8), %rdx\n";
+        source += "\tmovq .L" + f + "_data(%rip), %rcx\n";
+        source += "\ttestl %eax, %eax\n\tjne .L" + f + "_out\n";
+        source += "\tcall " + prev + "\n\tcall external_" + std::to_string(i % 64) + "\n";
+        source += "\timulq $12, %rax, %rax\n\tshrq $3, %rax\n\tmovsd .L" + f + "_data(%rip), %xmm0\n";
+        source += ".L" + f + "_out:\n\taddq $32, %rsp\n\tpopq %rbp\n\tret\n";
+        source += "\t.section .rdata,\"dr\"\n\t.p2align 3\n";
+        source += ".L" + f + "_data:\n\t.quad " + f + "\n\t.long .L" + f + "_out - " + f + "\n";
+        source += "\t.ascii \"function " + f + "\\n\\0\"\n";
+    }
+
+    return source;
+}
+
+// Gathers the regions of an object into one buffer for comparison
+static std::vector<uint8_t> flatten(const Out_File &out)
+{
+    std::vector<uint8_t> bytes(out.size, 0);
+
+    for (const Out_Region &region : out.regions)
+    {
+        memcpy(bytes.data() + region.offset, region.data, region.size);
+    }
+
+    return bytes;
+}
+
+int main()
+{
+    std::string source = generate_source(NUM_FUNCTIONS);
+    std::vector<uint8_t> reference;
+    double base_time = 0;
+
+    std::cout << "source: " << source.size() / 1024 << " KB, " << NUM_FUNCTIONS << " functions" << std::endl;
+    std::cout << std::setw(8) << "threads" << std::setw(12) << "ms" << std::setw(10) << "speedup" << std::setw(10) << "MB/s" << std::setw(12) << "identical" << std::endl;
+
+    for (std::size_t threads = 1; threads <= 64; threads *= 2)
+    {
+        Thread_Pool pool(threads);
+        double best = 0;
+        std::vector<uint8_t> bytes;
+
+        for (int run = 0; run < RUNS; run++)
+        {
+            Object obj;
+            init_object(obj);
+
+            auto start = std::chrono::steady_clock::now();
+
+            if (!assemble_source(source, "bench.s", obj, pool))
+            {
+                std::cerr << "assembly failed" << std::endl;
+                return 1;
+            }
+
+            finish_symbols(obj);
+
+            auto end = std::chrono::steady_clock::now();
+            double ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+            best = run == 0 ? ms : std::min(best, ms);
+
+            Out_File out = {};
+            layout_coff(obj.header, obj.sections, obj.sym_tab, obj.str_tab, out, "bench.s");
+            bytes = flatten(out);
+        }
+
+        if (threads == 1)
+        {
+            reference = bytes;
+            base_time = best;
+        }
+
+        std::cout << std::setw(8) << threads
+                  << std::setw(12) << std::fixed << std::setprecision(2) << best
+                  << std::setw(10) << std::setprecision(2) << base_time / best
+                  << std::setw(10) << std::setprecision(1) << source.size() / (best * 1000.0)
+                  << std::setw(12) << (bytes == reference ? "yes" : "NO") << std::endl;
+    }
+}
@@ -0,0 +1,231 @@
+// Branch relaxation benchmark
+// Sizes sections of 10k to 1M branches with relax and with a full relayout
+// per pass, and checks the layouts are valid and match. The cascade pattern makes
+// every branch grow one after the other, which takes one pass per branch
+// when the whole section is laid out again each time
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <relax.h>
+
+#define NAIVE_LIMIT 20000 // Largest cascade worth running the full relayout on
+
+static Relax_Var branch(uint64_t fixed, uint64_t target_fixed, uint32_t target_var, int64_t addend)
+{
+    Relax_Var var = {};
+
+    var.fixed = fixed;
+    var.kind = RVAR_BRANCH;
+    var.short_size = 2;
+    var.long_size = 6;
+    var.target_fixed = target_fixed;
+    var.target_var = target_var;
+    var.addend = addend;
+
+    return var;
+}
+
+// Compiler-like code: a few instructions between branches, targets within
+// about 40 branches either way and a function alignment now and then
+static std::vector<Relax_Var> random_section(std::size_t num_branches)
+{
+    std::mt19937 rng(1);
+    std::vector<Relax_Var> vars;
+    std::vector<uint64_t> fixed;
+    uint64_t pos = 0;
+
+    for (std::size_t i = 0; i < num_branches; i++)
+    {
+        pos += rng() % 24;
+
+        if (rng() % 64 == 0)
+        {
+            Relax_Var align = {};
+
+            align.fixed = pos;
+            align.kind = RVAR_ALIGN;
+            align.alignment = 16;
+            vars.emplace_back(align);
+        }
+
+        fixed.emplace_back(pos);
+        vars.emplace_back(branch(pos, 0, 0, 0));
+    }
+
+    // Each target is the position just before a branch
+    std::vector<uint32_t> branch_vars;
+
+    for (std::size_t i = 0; i < vars.size(); i++)
+    {
+        if (vars[i].kind == RVAR_BRANCH)
+        {
+            branch_vars.emplace_back(i);
+        }
+    }
+
+    for (std::size_t i = 0; i < num_branches; i++)
+    {
+        int64_t target = (int64_t)(i) + (int64_t)(rng() % 81) - 40;
+        target = std::max<int64_t>(0, std::min<int64_t>(target, num_branches - 1));
+
+        vars[branch_vars[i]].target_fixed = fixed[target];
+        vars[branch_vars[i]].target_var = branch_vars[target];
+    }
+
+    return vars;
+}
+
+// Every branch jumps back over the one before it and only fits while that
+// one is short. The first cannot be short, so all of them grow in turn
+static std::vector<Relax_Var> cascade_section(std::size_t num_branches)
+{
+    std::vector<Relax_Var> vars;
+
+    vars.emplace_back(branch(61, 0, 0, -1000));
+
+    for (std::size_t k = 1; k < num_branches; k++)
+    {
+        vars.emplace_back(branch((k + 1) * 61, (k - 1) * 61, k - 1, 0));
+    }
+
+    return vars;
+}
+
+// Lays out the whole section again on every pass until nothing grows
+static std::size_t naive_relax(std::vector<Relax_Var> &vars)
+{
+    std::vector<uint64_t> sizes(vars.size() + 1);
+    std::size_t passes = 0;
+    bool grown = true;
+
+    for (Relax_Var &var : vars)
+    {
+        var.size = var.kind == RVAR_ALIGN ? 0 : var.short_size;
+    }
+
+    while (grown)
+    {
+        grown = false;
+        passes++;
+
+        for (std::size_t i = 0; i < vars.size(); i++)
+        {
+            if (vars[i].kind == RVAR_ALIGN)
+            {
+                vars[i].size = align_padding(vars[i].fixed + sizes[i], vars[i].alignment, vars[i].max);
+            }
+
+            sizes[i + 1] = sizes[i] + vars[i].size;
+        }
+
+        for (std::size_t i = 0; i < vars.size(); i++)
+        {
+            Relax_Var &var = vars[i];
+
+            if (var.kind != RVAR_BRANCH || var.size == var.long_size)
+            {
+                continue;
+            }
+
+            int64_t address = var.fixed + sizes[i];
+            int64_t target = var.target_fixed + sizes[var.target_var] + var.addend;
+            int64_t disp = target - (address + var.size);
+
+            if (disp < -0x80 || disp > 0x7f)
+            {
+                var.size = var.long_size;
+                grown = true;
+            }
+        }
+    }
+
+    return passes;
+}
+
+// Every short branch reaches its target and all padding is right
+static bool valid(const std::vector<Relax_Var> &vars)
+{
+    std::vector<uint64_t> sizes(vars.size() + 1, 0);
+
+    for (std::size_t i = 0; i < vars.size(); i++)
+    {
+        if (vars[i].kind == RVAR_ALIGN && vars[i].size != align_padding(vars[i].fixed + sizes[i], vars[i].alignment, vars[i].max))
+        {
+            return false;
+        }
+
+        sizes[i + 1] = sizes[i] + vars[i].size;
+    }
+
+    for (std::size_t i = 0; i < vars.size(); i++)
+    {
+        const Relax_Var &var = vars[i];
+        int64_t disp = (int64_t)(var.target_fixed + sizes[var.target_var]) + var.addend - (int64_t)(var.fixed + sizes[i] + var.size);
+
+        if (var.kind == RVAR_BRANCH && var.size == var.short_size && (disp < -0x80 || disp > 0x7f))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+    std::size_t sizes[] = {10000, 100000, 1000000};
+
+    std::cout << std::setw(10) << "pattern" << std::setw(10) << "branches" << std::setw(10) << "short"
+              << std::setw(12) << "relax ms" << std::setw(14) << "checks/branch"
+              << std::setw(8) << "valid" << std::setw(12) << "naive ms" << std::setw(10) << "passes" << std::setw(8) << "same" << std::endl;
+
+    for (int pattern = 0; pattern < 2; pattern++)
+    {
+        for (std::size_t num_branches : sizes)
+        {
+            std::vector<Relax_Var> vars = pattern == 0 ? random_section(num_branches) : cascade_section(num_branches);
+            std::vector<Relax_Var> naive = vars;
+            Relax_Stats stats = {};
+
+            auto start = std::chrono::steady_clock::now();
+            relax(vars, stats);
+            double relax_ms = elapsed_ms(start);
+
+            std::cout << std::setw(10) << (pattern == 0 ? "random" : "cascade") << std::setw(10) << num_branches
+                      << std::setw(10) << stats.short_branches
+                      << std::setw(12) << std::fixed << std::setprecision(2) << relax_ms
+                      << std::setw(14) << std::setprecision(2) << (double)(stats.checks) / num_branches
+                      << std::setw(8) << (valid(vars) ? "yes" : "NO");
+
+            if (pattern == 1 && num_branches > NAIVE_LIMIT)
+            {
+                std::cout << std::setw(12) << "-" << std::setw(10) << "-" << std::setw(8) << "-" << std::endl;
+                continue;
+            }
+
+            start = std::chrono::steady_clock::now();
+            std::size_t passes = naive_relax(naive);
+            double naive_ms = elapsed_ms(start);
+
+            bool same = true;
+
+            for (std::size_t i = 0; i < vars.size(); i++)
+            {
+                same = same && vars[i].size == naive[i].size;
+            }
+
+            std::cout << std::setw(12) << naive_ms << std::setw(10) << passes << std::setw(8) << (same ? "yes" : "NO") << std::endl;
+        }
+    }
+}
@@ -0,0 +1,137 @@
+// Resident server latency benchmark
+// Starts the server on a thread and sends it the same small file many times
+// over one connection, and over a new connection per request, checking that
+// each object comes back. Reports the median and mean round trip, which is
+// what a build pays per file instead of starting the assembler
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <string>
+
+#include <server.h>
+
+#include <unistd.h>
+
+#define NUM_RUNS 5000
+
+static const char *SOURCE =
+    "\t.text\n"
+    "\t.globl\tsum\n"
+    "sum:\n"
+    "\txorl\t%eax, %eax\n"
+    "1:\n"
+    "\taddq\t(%rdi), %rax\n"
+    "\taddq\t$8, %rdi\n"
+    "\tdecq\t%rsi\n"
+    "\tjnz\t1b\n"
+    "\tret\n"
+    "\t.data\n"
+    "table:\t.quad\t1, 2, 3, 4\n";
+
+static double elapsed_us(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void print_times(const char *mode, std::vector<double> &times)
+{
+    double total = 0;
+
+    for (double time : times)
+    {
+        total += time;
+    }
+
+    std::sort(times.begin(), times.end());
+
+    std::cout << std::setw(12) << mode << std::setw(10) << times.size() << std::setw(14) << times[times.size() / 2]
+              << std::setw(12) << total / times.size() << std::endl;
+}
+
+static bool request(int fd, std::vector<double> &times)
+{
+    Server_Reply reply;
+    std::string messages;
+    std::vector<uint8_t> object;
+    auto start = std::chrono::steady_clock::now();
+
+    if (!call_server(fd, SERVE_ELF | SERVE_INLINE | SERVE_REPLY, "bench.s", "", SOURCE, reply, messages, object))
+    {
+        std::cerr << "lost the connection to the server" << std::endl;
+        return false;
+    }
+
+    times.emplace_back(elapsed_us(start));
+
+    if (!reply.ok || object.empty())
+    {
+        std::cerr << "no object from the server" << std::endl << messages;
+        return false;
+    }
+
+    return true;
+}
+
+int main()
+{
+    std::string path = "/tmp/assembler_bench_" + std::to_string(getpid()) + ".sock";
+    std::thread server(run_server, path, 4);
+    int fd = -1;
+
+    // The server has started once it accepts a connection
+    for (int i = 0; i < 1000 && fd < 0; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        fd = connect_server(path);
+    }
+
+    if (fd < 0)
+    {
+        return 1;
+    }
+
+    std::vector<double> kept_times;
+    std::vector<double> new_times;
+    bool ok = true;
+
+    for (int run = 0; run < NUM_RUNS && ok; run++)
+    {
+        ok = request(fd, kept_times);
+    }
+
+    for (int run = 0; run < NUM_RUNS && ok; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        int conn = connect_server(path);
+        std::vector<double> times;
+
+        ok = conn >= 0 && request(conn, times);
+        new_times.emplace_back(elapsed_us(start));
+        close_server(conn);
+    }
+
+    Server_Reply reply;
+    std::string messages;
+    std::vector<uint8_t> object;
+
+    call_server(fd, SERVE_STOP, "", "", "", reply, messages, object);
+    close_server(fd);
+    server.join();
+
+    if (!ok)
+    {
+        return 1;
+    }
+
+    std::cout << std::setw(12) << "connection" << std::setw(10) << "runs" << std::setw(14) << "median us" << std::setw(12) << "mean us" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+
+    print_times("kept", kept_times);
+    print_times("new", new_times);
+
+    return 0;
+}
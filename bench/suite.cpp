@@ -0,0 +1,305 @@
+// Throughput benchmark suite
+// Assembles each input and times the stages on their own: the front end and
+// encoder (splitting and parsing every chunk), the symbol and section tables
+// (merging the chunks, sizing branches, resolving labels and building the
+// symbol table) and the object writer (layout and writing the file). Each
+// stage reports instructions/s, input MB/s, output bytes/s and its peak RSS.
+// Inputs come from gen_source.exe, `make bench-suite` runs the usual sizes
+//
+// usage: suite_bench.exe [-j N] [--runs N] [--format=coff|elf] [--json] input.s...
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+#include <sys/resource.h>
+
+#include <object.h>
+#include <elf.h>
+#include <parser.h>
+#include <lexer.h>
+#include <unwind.h>
+
+#define NUM_STAGES 3
+
+static const char *STAGE_NAMES[NUM_STAGES] = {"encoder", "tables", "writer"};
+
+struct Stage_Result
+{
+    double seconds = 0;
+    uint64_t peak_rss_kb = 0;
+};
+
+struct Input_Result
+{
+    std::string file;
+    uint64_t input_bytes = 0;
+    uint64_t instructions = 0;
+    uint64_t output_bytes = 0;
+    Stage_Result stages[NUM_STAGES];
+    bool ok = true;
+};
+
+// Restarts the peak RSS count of the process so each stage gets its own.
+// Without /proc the peaks only ever grow
+static void reset_peak_rss()
+{
+    std::ofstream clear_refs("/proc/self/clear_refs");
+
+    if (clear_refs)
+    {
+        clear_refs << "5";
+    }
+}
+
+static uint64_t peak_rss_kb()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+        {
+            return strtoull(line.c_str() + 6, nullptr, 10);
+        }
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_maxrss;
+}
+
+static double elapsed_s(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// One full assembly of the input, timing each stage
+static bool run_once(const Source_File &source, const std::string &input, const std::string &output, bool elf, Thread_Pool &pool, Input_Result &result)
+{
+    std::string_view text(source.data, source.size);
+    Object obj;
+
+    obj.elf = elf;
+    init_object(obj);
+
+    // Front end and encoder
+    reset_peak_rss();
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<Chunk> chunks;
+    bool ok = split_source(text, input, obj, chunks);
+    std::vector<Unit> units(chunks.size());
+
+    pool.run(chunks.size(), [&](std::size_t i)
+             { parse_chunk(chunks[i], input, obj, units[i]); });
+
+    Stage_Result encoder = {elapsed_s(start), peak_rss_kb()};
+
+    result.instructions = 0;
+
+    for (const Unit &unit : units)
+    {
+        result.instructions += unit.num_instrs;
+    }
+
+    // Symbol and section tables
+    reset_peak_rss();
+    start = std::chrono::steady_clock::now();
+
+    ok = merge_units(units, input, obj) && ok;
+    ok = ok && build_unwind_tables(obj, input, elf);
+    finish_symbols(obj);
+
+    Stage_Result tables = {elapsed_s(start), peak_rss_kb()};
+
+    if (!ok)
+    {
+        return false;
+    }
+
+    // Object writer
+    reset_peak_rss();
+    start = std::chrono::steady_clock::now();
+
+    Out_File out = {};
+    ELF_File elf_file;
+
+    if (elf)
+    {
+        layout_elf(obj.sections, obj.sym_tab, obj.labels, elf_file, out);
+    }
+    else
+    {
+        ok = layout_coff(obj.header, obj.sections, obj.sym_tab, obj.str_tab, out, output);
+    }
+
+    ok = ok && write_out_file(output, out);
+
+    Stage_Result writer = {elapsed_s(start), peak_rss_kb()};
+
+    result.output_bytes = out.size;
+
+    // Best time and largest peak over the runs
+    Stage_Result *stages[NUM_STAGES] = {&encoder, &tables, &writer};
+
+    for (int i = 0; i < NUM_STAGES; i++)
+    {
+        Stage_Result &best = result.stages[i];
+
+        best.seconds = best.seconds == 0 ? stages[i]->seconds : std::min(best.seconds, stages[i]->seconds);
+        best.peak_rss_kb = std::max(best.peak_rss_kb, stages[i]->peak_rss_kb);
+    }
+
+    return ok;
+}
+
+static double per_second(double amount, double seconds)
+{
+    return seconds > 0 ? amount / seconds : 0;
+}
+
+static void print_table(const std::vector<Input_Result> &results)
+{
+    std::cout << std::setw(24) << "input" << std::setw(10) << "stage" << std::setw(10) << "seconds" << std::setw(14) << "Minstrs/s"
+              << std::setw(10) << "MB/s" << std::setw(14) << "out MB/s" << std::setw(14) << "peak RSS MB" << std::endl;
+    std::cout << std::fixed;
+
+    for (const Input_Result &result : results)
+    {
+        if (!result.ok)
+        {
+            std::cout << std::setw(24) << result.file << "  failed" << std::endl;
+            continue;
+        }
+
+        for (int i = 0; i < NUM_STAGES; i++)
+        {
+            const Stage_Result &stage = result.stages[i];
+
+            std::cout << std::setw(24) << (i == 0 ? result.file : "") << std::setw(10) << STAGE_NAMES[i]
+                      << std::setw(10) << std::setprecision(3) << stage.seconds
+                      << std::setw(14) << std::setprecision(2) << per_second(result.instructions, stage.seconds) / 1e6
+                      << std::setw(10) << per_second(result.input_bytes, stage.seconds) / (1 << 20)
+                      << std::setw(14) << per_second(result.output_bytes, stage.seconds) / (1 << 20)
+                      << std::setw(14) << std::setprecision(1) << stage.peak_rss_kb / 1024.0 << std::endl;
+        }
+    }
+}
+
+static void print_json(const std::vector<Input_Result> &results, std::size_t threads, bool elf)
+{
+    std::cout << std::setprecision(6) << std::fixed;
+    std::cout << "{\n  \"threads\": " << threads << ",\n  \"format\": \"" << (elf ? "elf" : "coff") << "\",\n  \"inputs\": [";
+
+    for (std::size_t r = 0; r < results.size(); r++)
+    {
+        const Input_Result &result = results[r];
+
+        std::cout << (r ? "," : "") << "\n    {\n      \"file\": \"" << result.file << "\",\n      \"ok\": " << (result.ok ? "true" : "false")
+                  << ",\n      \"input_bytes\": " << result.input_bytes << ",\n      \"instructions\": " << result.instructions
+                  << ",\n      \"output_bytes\": " << result.output_bytes << ",\n      \"stages\": {";
+
+        for (int i = 0; i < NUM_STAGES; i++)
+        {
+            const Stage_Result &stage = result.stages[i];
+
+            std::cout << (i ? "," : "") << "\n        \"" << STAGE_NAMES[i] << "\": {\"seconds\": " << stage.seconds
+                      << ", \"instructions_per_sec\": " << per_second(result.instructions, stage.seconds)
+                      << ", \"input_mb_per_sec\": " << per_second(result.input_bytes, stage.seconds) / (1 << 20)
+                      << ", \"output_bytes_per_sec\": " << per_second(result.output_bytes, stage.seconds)
+                      << ", \"peak_rss_kb\": " << stage.peak_rss_kb << "}";
+        }
+
+        std::cout << "\n      }\n    }";
+    }
+
+    std::cout << "\n  ]\n}" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> inputs;
+    std::size_t threads = 1;
+    int runs = 1;
+    bool elf = false;
+    bool json = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            threads = std::max(1ul, strtoul(argv[++i], nullptr, 10));
+        }
+        else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+        {
+            runs = std::max(1, atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--format=elf") == 0 || strcmp(argv[i], "--format=coff") == 0)
+        {
+            elf = strcmp(argv[i], "--format=elf") == 0;
+        }
+        else if (strcmp(argv[i], "--json") == 0)
+        {
+            json = true;
+        }
+        else if (argv[i][0] == '-')
+        {
+            std::cerr << "usage: suite_bench [-j N] [--runs N] [--format=coff|elf] [--json] input.s..." << std::endl;
+            return 1;
+        }
+        else
+        {
+            inputs.emplace_back(argv[i]);
+        }
+    }
+
+    Thread_Pool pool(threads);
+    std::vector<Input_Result> results;
+    bool ok = true;
+
+    for (const std::string &input : inputs)
+    {
+        Input_Result result;
+        Source_File source;
+        std::string output = input + (elf ? ".bench.o" : ".bench.obj");
+
+        result.file = input;
+
+        if (!source.open(input))
+        {
+            std::cerr << "error: cannot open " << input << std::endl;
+            return 1;
+        }
+
+        result.input_bytes = source.size;
+
+        for (int run = 0; run < runs && result.ok; run++)
+        {
+            result.ok = run_once(source, input, output, elf, pool, result);
+        }
+
+        std::remove(output.c_str());
+        ok = ok && result.ok;
+        results.emplace_back(result);
+    }
+
+    if (json)
+    {
+        print_json(results, threads, elf);
+    }
+    else
+    {
+        print_table(results);
+    }
+
+    return ok ? 0 : 1;
+}
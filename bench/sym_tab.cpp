@@ -0,0 +1,63 @@
+// Symbol table lookup microbenchmark
+// Builds tables of increasing size and measures the cost of Sym_Tab::find
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <coff.h>
+
+#define LOOKUPS 1000000
+
+int main()
+{
+    std::size_t sizes[] = {100, 1000, 10000, 100000, 1000000};
+
+    for (std::size_t num_sym : sizes)
+    {
+        Sym_Tab sym_tab = {};
+        Str_Tab str_tab = {};
+        std::vector<std::string> names = {};
+
+        sym_tab.str_tab = &str_tab;
+        names.reserve(num_sym);
+
+        for (std::size_t i = 0; i < num_sym; i++)
+        {
+            Sym_Hdr sym_hdr = {};
+
+            // Half short names, half long mangled names stored in the string table
+            std::string name = (i & 1) ? "_ZN4bench6symbolE" + std::to_string(i) : "s" + std::to_string(i);
+            names.emplace_back(name);
+
+            sym_tab.set_name(sym_hdr, name);
+
+            sym_hdr.storage_class = IMAGE_SYM_CLASS_EXTERNAL;
+            sym_tab.emplace_back(sym_hdr);
+        }
+
+        // Pseudo-random access pattern so the whole table is touched
+        uint64_t state = 0x9e3779b97f4a7c15;
+        std::size_t found = 0;
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (std::size_t i = 0; i < LOOKUPS; i++)
+        {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+
+            std::string_view key = names[state % num_sym];
+            found += sym_tab.find(key) != (std::size_t)(-1);
+        }
+
+        auto end = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(end - start).count() / LOOKUPS;
+
+        std::cout << std::setw(8) << num_sym << " symbols: " << std::fixed << std::setprecision(1) << ns << " ns/lookup (" << found << " found)" << std::endl;
+    }
+}
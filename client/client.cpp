@@ -0,0 +1,145 @@
+// Client of the resident assembler, started with assembler --serve
+// Sends one file to the server and prints the messages it sends back. The
+// input - reads the source from stdin and writes the object the server sends
+// back to the output
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+
+#include <server.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+static void print_usage()
+{
+    std::cerr << "usage: client [--socket=path] [--format=coff|elf] input.s [-o output]" << std::endl;
+    std::cerr << "       client [--socket=path] --stop" << std::endl;
+}
+
+// The server runs in its own directory, so paths are made absolute here
+static std::string absolute_path(const std::string &path)
+{
+#ifndef _WIN32
+    if (path.empty() || path[0] == '/')
+    {
+        return path;
+    }
+
+    char dir[SERVER_MAX_PATH];
+
+    if (getcwd(dir, sizeof(dir)) == nullptr)
+    {
+        return path;
+    }
+
+    return std::string(dir) + "/" + path;
+#else
+    return path;
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    const char *env = getenv("ASSEMBLER_SOCKET");
+    std::string socket = env && env[0] ? env : SERVER_DEFAULT_SOCKET;
+    std::string input;
+    std::string output;
+    uint32_t flags = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--socket=", 9) == 0)
+        {
+            socket = argv[i] + 9;
+        }
+        else if (strcmp(argv[i], "--format=elf") == 0)
+        {
+            flags |= SERVE_ELF;
+        }
+        else if (strcmp(argv[i], "--format=coff") == 0)
+        {
+            flags &= ~SERVE_ELF;
+        }
+        else if (strcmp(argv[i], "--stop") == 0)
+        {
+            flags |= SERVE_STOP;
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            output = argv[++i];
+        }
+        else if (input.empty() && (argv[i][0] != '-' || strcmp(argv[i], "-") == 0))
+        {
+            input = argv[i];
+        }
+        else
+        {
+            print_usage();
+            return 1;
+        }
+    }
+
+    if (input.empty() == !(flags & SERVE_STOP) || (input == "-" && output.empty()))
+    {
+        print_usage();
+        return 1;
+    }
+
+    std::string source;
+
+    if (input == "-")
+    {
+        std::ostringstream text;
+
+        text << std::cin.rdbuf();
+        source = text.str();
+        input = "<stdin>";
+        flags |= SERVE_INLINE | SERVE_REPLY;
+    }
+    else
+    {
+        input = absolute_path(input);
+        output = absolute_path(output);
+    }
+
+    int fd = connect_server(socket);
+
+    if (fd < 0)
+    {
+        return 1;
+    }
+
+    Server_Reply reply;
+    std::string messages;
+    std::vector<uint8_t> object;
+
+    if (!call_server(fd, flags, input, output, source, reply, messages, object))
+    {
+        std::cerr << "error: lost the connection to the assembler server" << std::endl;
+        close_server(fd);
+        return 1;
+    }
+
+    close_server(fd);
+    std::cerr << messages;
+
+    if (reply.ok && (flags & SERVE_REPLY))
+    {
+        std::ofstream fs(output, std::ios::binary);
+
+        if (!fs.write((const char *)(object.data()), object.size()))
+        {
+            std::cerr << "error: cannot write " << output << std::endl;
+            return 1;
+        }
+    }
+
+    return reply.ok ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+// Append-only byte storage for section contents. Bytes live in a chain of
+// chunks that are never moved or reallocated, so appending is O(1) amortised
+// and an offset handed out by append stays valid for patching later. Chunks
+// double from 256 bytes up to 64 KiB and then stay at 64 KiB, which keeps
+// small sections small and bounds the unused space at the end of a large one.
+// An arena given an Arena_Pool takes its chunks from the pool and gives them
+// back when it is cleared or destroyed, so a thread assembling one file after
+// another reuses the memory of the last file instead of allocating again.
+// The pool keeps a bounded number of chunks of each size and frees the rest,
+// so one very large file does not pin its memory to the thread for good
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+
+#define ARENA_FIRST_BITS 8  // log2 of the first chunk size
+#define ARENA_CHUNK_BITS 16 // log2 of the largest chunk size
+#define ARENA_POOL_CHUNKS 512 // Free chunks a pool keeps of each size, 32 MiB of the largest
+
+// Bytes held by the chunks that double in size
+#define ARENA_GROWING_BYTES (((uint64_t)(1) << (ARENA_CHUNK_BITS + 1)) - ((uint64_t)(1) << ARENA_FIRST_BITS))
+#define ARENA_GROWING_CHUNKS (ARENA_CHUNK_BITS - ARENA_FIRST_BITS + 1)
+
+// Free chunks by size, the chunks of 64 KiB sharing the last list
+struct Arena_Pool
+{
+    std::vector<std::unique_ptr<uint8_t[]>> free[ARENA_GROWING_CHUNKS];
+};
+
+struct Byte_Arena
+{
+    std::vector<std::unique_ptr<uint8_t[]>> chunks;
+    uint64_t length = 0;
+    Arena_Pool *pool = nullptr; // Must outlive the arena
+
+    Byte_Arena() = default;
+    Byte_Arena(Byte_Arena &&) = default;
+    Byte_Arena &operator=(Byte_Arena &&) = default;
+
+    ~Byte_Arena()
+    {
+        clear();
+    }
+
+    uint64_t size() const
+    {
+        return length;
+    }
+
+    bool empty() const
+    {
+        return length == 0;
+    }
+
+    // Each append returns the offset of its first byte
+    uint64_t append(const uint8_t *data, std::size_t size);
+
+    uint64_t append(std::size_t size, uint8_t val);
+
+    // Overwrites bytes already appended, the range may cross chunks
+    void write(uint64_t offset, const void *data, std::size_t size);
+
+    void read(uint64_t offset, void *data, std::size_t size) const;
+
+    uint8_t operator[](uint64_t offset) const;
+
+    void clear();
+
+    // Calls f(data, size) for every filled chunk in order, cut to the bytes
+    // from offset from up to offset to
+    template <typename F>
+    void for_each_chunk(F f, uint64_t from = 0, uint64_t to = UINT64_MAX) const
+    {
+        std::size_t chunk;
+        uint64_t within;
+
+        to = std::min(to, length);
+
+        if (from >= to)
+        {
+            return;
+        }
+
+        locate(from, chunk, within);
+
+        for (uint64_t left = to - from; left > 0; chunk++, within = 0)
+        {
+            uint64_t size = std::min<uint64_t>(left, chunk_size(chunk) - within);
+
+            f(chunks[chunk].get() + within, (std::size_t)(size));
+            left -= size;
+        }
+    }
+
+    // Adds chunk number chunks.size()
+    void add_chunk();
+
+    // Chunk holding a byte offset and the position within it
+    static void locate(uint64_t offset, std::size_t &chunk, uint64_t &within);
+
+    static uint64_t chunk_size(std::size_t chunk)
+    {
+        return (uint64_t)(1) << (chunk < ARENA_GROWING_CHUNKS ? ARENA_FIRST_BITS + chunk : ARENA_CHUNK_BITS);
+    }
+};
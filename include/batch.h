@@ -0,0 +1,59 @@
+#pragma once
+
+// Assembling whole files. A batch assembles many files in one process: each
+// file is a task on the thread pool and is assembled start to finish by the
+// thread that takes it, so the startup of the process and the tables built
+// at compile time (opcodes, registers, directives) are paid for once rather
+// than once per file. Each thread keeps an Arena_Pool, which the section
+// data of the next file it assembles takes its chunks from.
+//
+// A response file lists one job per line, the input followed by an optional
+// output. Blank lines and lines starting with # are skipped.
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <object.h>
+#include <elf.h>
+#include <writer.h>
+#include <thread_pool.h>
+#include <stats.h>
+
+struct Asm_Cache;
+
+struct File_Job
+{
+    std::string input;
+    std::string output; // Empty for the input's name with .obj or .o
+};
+
+struct Asm_Options
+{
+    bool elf = false;
+    bool align_branches = false; // See Object::align_branches
+    bool verify = false;         // Decodes every instruction again once assembled, see verify.h
+    Write_Mode write_mode = WRITE_PWRITEV;
+};
+
+std::string default_output(const std::string &input, bool elf);
+
+bool read_response_file(const std::string &path, std::vector<File_Job> &jobs);
+
+// Arena_Pool of the calling thread, kept for as long as the thread runs
+Arena_Pool &thread_arena_pool();
+
+// Assembles source into obj, which must be new, and lays the object out into
+// out. The regions of out point into obj and elf_file. name is the file name
+// used in messages
+bool assemble_text(std::string_view source, std::string_view name, const Asm_Options &options, Object &obj, Thread_Pool &pool, Asm_Cache *cache,
+                   ELF_File &elf_file, Out_File &out);
+
+// Assembles one file into obj, which must be new, and writes the object. The
+// chunks of the file are parsed on the threads of pool. With statistics
+// enabled in obj, its counters are filled in too
+bool assemble_file(const File_Job &job, const Asm_Options &options, Object &obj, Thread_Pool &pool, Asm_Cache *cache = nullptr);
+
+// Assembles every job, one file per task of pool. A file that fails does not
+// stop the others. The phases and counters of every file are added to stats
+bool assemble_batch(const std::vector<File_Job> &jobs, const Asm_Options &options, Thread_Pool &pool, Asm_Cache *cache, Stats &stats);
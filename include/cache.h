@@ -0,0 +1,68 @@
+#pragma once
+
+// On-disk cache of parsed chunks. A chunk is looked up by a 128-bit hash of
+// its text, the section it starts in, the assembler options and everything
+// the prescan left in the object that parsing reads (sections and constants).
+// An entry holds the Unit the chunk parses to: encoded bytes, alignment and
+// branch items, fixups, labels, unwind directives and, with --verify, the
+// instruction records, so a hit skips lexing and encoding and only the
+// merge, layout and write are done again.
+//
+// Each entry is one flat file named by its key, read through a memory
+// mapping. Names are stored as offsets into the chunk text and lines relative
+// to the chunk, both valid again for any chunk with the same text. Entries
+// are written to a temporary file and renamed into place, so concurrent
+// builds sharing a directory only ever see whole entries. A hit refreshes the
+// entry's modification time, and eviction removes the least recently used
+// entries once the directory is over its size cap. The size at the last scan
+// is kept in a file beside the entries, so a build only scans the directory
+// when what it stored takes that size over the cap.
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+#include <parser.h>
+
+#define CACHE_VERSION 11
+#define CACHE_DEFAULT_MAX_BYTES ((uint64_t)(1) << 30)
+
+struct Cache_Key
+{
+    uint64_t lo;
+    uint64_t hi;
+};
+
+struct Asm_Cache
+{
+    std::string dir;
+    std::string options;                  // Options that change what a chunk assembles to
+    uint64_t max_bytes = CACHE_DEFAULT_MAX_BYTES;
+    Cache_Key context = {};               // Set by cache_context for each source
+    std::atomic<uint64_t> hits = 0;
+    std::atomic<uint64_t> misses = 0;
+    std::atomic<uint64_t> stores = 0;
+    std::atomic<uint64_t> stored_bytes = 0; // Bytes of the entries stored by this run
+    uint64_t tracked_bytes = 0;             // Directory size at the last scan, read by open_cache
+    bool tracked = false;                   // False if no scan has recorded the size yet
+};
+
+// Creates the directory if needed. False if the cache cannot be used
+bool open_cache(Asm_Cache &cache, const std::string &dir);
+
+// Hashes what the prescan of a source left in obj, call after split_source
+void cache_context(Asm_Cache &cache, const Object &obj);
+
+Cache_Key chunk_key(const Asm_Cache &cache, const Chunk &chunk);
+
+// Fills unit from the entry for key if there is a valid one
+bool load_unit(Asm_Cache &cache, const Cache_Key &key, const Chunk &chunk, const Object &obj, Unit &unit);
+
+// Units with errors are not stored, so their messages are
+// printed again on the next build, nor are units holding text joined by
+// macros
+void store_unit(Asm_Cache &cache, const Cache_Key &key, const Chunk &chunk, const Unit &unit);
+
+// Removes the least recently used entries until the cache fits max_bytes,
+// scanning the directory only if the stored bytes may have taken it over
+void evict_cache(Asm_Cache &cache);
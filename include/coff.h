@@ -1,11 +1,19 @@
 // Based on https://learn.microsoft.com/en-us/windows/win32/debug/pe-format
 // All my own code - may not contain everything necessary for the COFF format
 
+#pragma once
+
 #include <vector>
 #include <string>
+#include <string_view>
 #include <algorithm>
 #include <cstring>
 #include <cstdint>
+#include <memory>
+
+#include <hash.h>
+#include <arena.h>
+#include <writer.h>
 
 #define IMAGE_FILE_MACHINE_UNKNOWN 0x0        // The content of this field is assumed to be applicable to any machine type
 #define IMAGE_FILE_MACHINE_ALPHA 0x184        // Alpha AXP, 32-bit address space
@@ -221,16 +229,15 @@ struct Name
         return *this;
     }
 
-    bool operator==(std::string str)
+    bool operator==(std::string_view str) const
     {
-        if (std::string(name) == str)
-        {
-            return true;
-        }
-        else
-        {
-            return false;
-        }
+        return view() == str;
+    }
+
+    // Short names are only null terminated when shorter than 8 characters
+    std::string_view view() const
+    {
+        return std::string_view(name, strnlen(name, 8));
     }
 };
 
@@ -263,7 +270,7 @@ struct Rel_Tab
         return relocations[idx];
     }
 
-    std::size_t size()
+    std::size_t size() const
     {
         return relocations.size();
     }
@@ -300,16 +307,123 @@ struct Sym_Hdr
 };
 #pragma pack(pop)
 
+#define NOP_BYTE 0x90   // Default fill of code sections
+#define NOP_MAX 11      // Longest multi-byte NOP used for padding
+#define NOP_JUMP_MIN 88 // Padding from this size on starts with a jump over the rest
+
+#define EXTENT_PATTERN_BYTES 0x10000 // A repeated value is written from a buffer of at most this many bytes
+
+// value rounded up to a multiple of alignment, a power of two
+inline uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+// Bytes of a section kept outside its arena: a run of a repeated value, or
+// the bytes of a mapped file, written out from where they are. A run of
+// zeros has no bytes at all and is left as a gap in the output
+struct Section_Extent
+{
+    uint64_t offset;      // In the section
+    uint64_t size;
+    uint64_t data_offset; // Arena bytes before the extent
+    const uint8_t *bytes; // File bytes, the value repeated pattern_size bytes long, or nullptr for zeros
+    uint32_t pattern_size;
+    std::unique_ptr<uint8_t[]> pattern;
+    int fd; // File the bytes are a mapping of, -1 if not mapped
+    uint64_t file_offset;
+
+    // Calls f(data, size) for the bytes in order, data nullptr for zeros
+    template <typename F>
+    void for_each_range(F f) const
+    {
+        if (!bytes || !pattern_size)
+        {
+            f(bytes, (std::size_t)(size));
+            return;
+        }
+
+        for (uint64_t done = 0; done < size; done += pattern_size)
+        {
+            f(bytes, (std::size_t)(std::min<uint64_t>(pattern_size, size - done)));
+        }
+    }
+};
+
 struct Section
 {
+    std::string name;
+    uint32_t str_id = NAME_NOT_FOUND; // String table entry for names longer than 8 characters
+    uint32_t sym = 0;                 // Symbol defining the section, which relocations to an offset in it name
     Sect_Hdr header;
-    std::vector<uint8_t> data;
+    Byte_Arena data;
+    std::vector<Section_Extent> extents; // In offset order, between the bytes of data
+    uint64_t extent_size = 0;
     Rel_Tab relocations = {};
+    Reloc reloc_count = {}; // Written first when the count overflows num_reloc, see layout_coff
+    uint64_t appends = 0;   // Calls to append, counted for --stats
+    uint32_t elf_type = 0;  // SHT_ type given by .section, 0 to pick one from the name
+    std::string group;      // Signature of the ELF section group the section is in, empty if none
+    bool comdat = false;    // The group is a COMDAT group, of which the linker keeps one copy
 
-    void append(uint8_t *to_add, std::size_t size);
+    bool is_bss() const
+    {
+        return header.flags & IMAGE_SCN_CNT_UNINITIALIZED_DATA;
+    }
+
+    // Bytes of a section that is not bss
+    uint64_t data_size() const
+    {
+        return data.size() + extent_size;
+    }
+
+    // Alignment the header asks for. The IMAGE_SCN_ALIGN_ field holds
+    // log2(alignment) + 1, and a section without it is byte aligned
+    uint64_t alignment() const
+    {
+        uint32_t bits = (header.flags >> 20) & 0xf;
+
+        return bits ? (uint64_t)(0x1) << (bits - 1) : 1;
+    }
+
+    // Offset of the next byte to be added
+    std::size_t loc() const
+    {
+        return is_bss() ? header.raw_size : data_size();
+    }
+
+    // Calls f(data, size) for the contents in order, data nullptr for zeros
+    template <typename F>
+    void for_each_range(F f) const
+    {
+        uint64_t done = 0;
+
+        for (const Section_Extent &extent : extents)
+        {
+            data.for_each_chunk(f, done, extent.data_offset);
+            extent.for_each_range(f);
+            done = extent.data_offset;
+        }
+
+        data.for_each_chunk(f, done);
+    }
+
+    // Places the contents at the end of out, zeros as a gap
+    uint64_t add_to(Out_File &out) const;
+
+    // Bytes already appended, by offset in the section. Writes only go to
+    // bytes in the arena, which is where every field that is patched lives
+    void read(uint64_t offset, void *to, std::size_t size) const;
+
+    void write(uint64_t offset, const void *from, std::size_t size);
+
+    void append(const uint8_t *to_add, std::size_t size);
 
     template <typename T>
-    void append_literal(T to_add);
+    void append_literal(T to_add)
+    {
+        append((uint8_t *)(&to_add), sizeof(T));
+    }
 
     void append(std::size_t size);
 
@@ -317,117 +431,262 @@ struct Section
 
     void reserve(std::size_t size);
 
+    // size bytes of value repeated, value being width bytes little-endian,
+    // kept as a count
+    void append_run(uint64_t size, uint64_t value, uint8_t width);
+
+    // Bytes of a file mapped from fd at file_offset, which stays mapped and
+    // open until the section has been written
+    void append_mapped(const uint8_t *bytes, uint64_t size, int fd, uint64_t file_offset);
+
+    // The fewest multi-byte NOPs that fill size bytes
+    void append_nops(std::size_t size);
+
+    // Pads to the section alignment
     void align();
+
+    // Raises the section alignment to alignment if it is lower
+    void raise_alignment(std::size_t alignment);
+
+    // Pads to alignment, raising the section alignment if it is lower. Code
+    // padded with NOP_BYTE gets multi-byte NOPs instead
+    void align(std::size_t alignment, uint8_t fill = 0);
 };
 
+// Stable reference to a section, valid for the lifetime of the Sect_Tab
+struct Sect_Handle
+{
+    uint32_t idx;
+
+    // COFF section numbers are 1-based
+    uint16_t number() const
+    {
+        return idx + 1;
+    }
+};
+
+// Sections are found by name and group, as sections of one name in different
+// groups are different sections
 struct Sect_Tab
 {
     std::vector<Section> sections;
+    std::vector<std::string> keys; // Name, then a null and the group for a section in a group
+    Name_Index index = {};
+    Arena_Pool *arena_pool = nullptr; // Where the data of sections added from now on takes its chunks
 
     Section &operator[](std::size_t idx)
     {
         return sections[idx];
     }
 
-    Section &operator[](std::string key)
+    Section &operator[](Sect_Handle handle)
     {
-        std::size_t idx = 0;
-
-        for (Section section : sections)
-        {
-            if (section.header.name == key)
-            {
-                break;
-            }
+        return sections[handle.idx];
+    }
 
-            idx++;
-        }
+    const Section &operator[](Sect_Handle handle) const
+    {
+        return sections[handle.idx];
+    }
 
-        return sections[idx];
+    Section &operator[](std::string_view key)
+    {
+        return sections[find(key)];
     }
 
-    std::size_t size()
+    std::size_t size() const
     {
         return sections.size();
     }
 
-    std::size_t find(std::string key)
+    static std::string key_of(std::string_view name, std::string_view group)
     {
-        std::size_t idx = 0;
+        return group.empty() ? std::string(name) : std::string(name) + '\0' + std::string(group);
+    }
 
-        for (Section section : sections)
-        {
-            if (section.header.name == key)
-            {
-                return idx;
-            }
+    std::size_t find(std::string_view name, std::string_view group = "") const
+    {
+        std::string key = key_of(name, group);
+        uint32_t idx = index.find(key, [this](uint32_t i)
+                                  { return std::string_view(keys[i]); });
 
-            idx++;
+        if (idx == NAME_NOT_FOUND)
+        {
+            return (std::size_t)(-1);
         }
 
-        return (std::size_t)(-1);
+        return idx;
+    }
+
+    Sect_Handle handle(std::string_view key) const
+    {
+        return Sect_Handle{(uint32_t)(find(key))};
+    }
+
+    Sect_Handle add(Section section)
+    {
+        Sect_Handle handle = {(uint32_t)(sections.size())};
+
+        section.data.pool = arena_pool;
+        keys.emplace_back(key_of(section.name, section.group));
+        sections.emplace_back(std::move(section));
+        index.insert(keys.back(), handle.idx, [this](uint32_t i)
+                     { return std::string_view(keys[i]); });
+
+        return handle;
+    }
+};
+
+struct Str_Tab_Stats
+{
+    uint64_t adds = 0;            // Calls to Str_Tab::add
+    uint64_t requested_bytes = 0; // Bytes (including terminators) that would be written without deduplication
+    uint64_t unique_bytes = 0;    // Bytes of distinct strings
+    uint64_t emitted_bytes = 0;   // Bytes of string data after suffix merging
+};
+
+// String table builder. Strings are interned when added and the table
+// contents are only produced by layout(), which also merges strings that
+// are suffixes of other strings into their storage
+struct Str_Tab
+{
+    std::vector<std::string_view> strings;
+    std::vector<uint32_t> offsets;
+    std::vector<uint8_t> data;
+    Name_Index index = {};
+    Str_Tab_Stats stats = {};
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    std::size_t block_used = 0;
+    std::size_t block_size = 0;
+
+    uint32_t add(std::string_view str);
+
+    std::string_view get(uint32_t id) const
+    {
+        return strings[id];
+    }
+
+    // Only valid after layout()
+    uint32_t offset(uint32_t id) const
+    {
+        return offsets[id];
     }
+
+    std::size_t size() const
+    {
+        return data.size();
+    }
+
+    void layout();
+
+private:
+    const char *store(std::string_view str);
 };
 
 struct Sym_Tab
 {
     std::vector<Sym_Hdr> symbols;
-    std::vector<uint8_t> *str_tab;
+    std::vector<uint32_t> str_ids;
+    Str_Tab *str_tab;
+    Name_Index index = {};
+    uint8_t pending_aux = 0;
 
     Sym_Hdr &operator[](std::size_t idx)
     {
         return symbols[idx];
     }
 
-    Sym_Hdr &operator[](std::string key)
+    Sym_Hdr &operator[](std::string_view key)
     {
-        std::size_t idx = 0;
+        return symbols[find(key)];
+    }
 
-        for (Sym_Hdr sym : symbols)
+    std::size_t size() const
+    {
+        return symbols.size();
+    }
+
+    // Names longer than 8 characters are interned in the string table, the
+    // offset is filled in by resolve_names() once the string table is laid out
+    void set_name(Sym_Hdr &sym, std::string_view str)
+    {
+        if (str.length() <= 8)
         {
-            if (sym.name == key)
-            {
-                break;
-            }
+            memset(sym.name.name, 0, 8);
+            memcpy(sym.name.name, str.data(), str.length());
+        }
+        else
+        {
+            memset(sym.name.name, 0, 4);
+            *(uint32_t *)(sym.name.name + 4) = str_tab->add(str);
+        }
+    }
 
-            idx++;
+    std::string_view name_of(std::size_t idx) const
+    {
+        if (str_ids[idx] != NAME_NOT_FOUND)
+        {
+            return str_tab->get(str_ids[idx]);
         }
 
-        return symbols[idx];
+        return symbols[idx].name.view();
     }
 
-    std::size_t size()
+    std::size_t find(std::string_view key) const
     {
-        return symbols.size();
+        uint32_t idx = index.find(key, [this](uint32_t i)
+                                  { return name_of(i); });
+
+        if (idx == NAME_NOT_FOUND)
+        {
+            return (std::size_t)(-1);
+        }
+
+        return idx;
     }
-    
-    std::size_t find(std::string key)
+
+    void emplace_back(Sym_Hdr sym)
     {
-        std::size_t idx = 0;
+        symbols.emplace_back(sym);
 
-        for (Sym_Hdr sym : symbols)
+        // Auxiliary records follow their symbol and are never looked up by name
+        if (pending_aux > 0)
         {
-            if (sym.name.name[0] == 0)
-            {
-                if (std::string((char *)(&(*str_tab)[*(uint32_t *)(sym.name.name + 4)])) == key)
-                {
-                    return idx;
-                }
-            }
-            else if (sym.name == key)
-            {
-                return idx;
-            }
+            str_ids.emplace_back(NAME_NOT_FOUND);
+            pending_aux--;
+            return;
+        }
+
+        pending_aux = sym.num_aux_sym;
 
-            idx++;
+        if (sym.name.name[0] == 0 && *(uint32_t *)(sym.name.name) == 0)
+        {
+            str_ids.emplace_back(*(uint32_t *)(sym.name.name + 4));
+        }
+        else
+        {
+            str_ids.emplace_back(NAME_NOT_FOUND);
         }
 
-        return (std::size_t)(-1);
+        std::string_view name = name_of(symbols.size() - 1);
+
+        if (!name.empty())
+        {
+            index.insert(name, symbols.size() - 1, [this](uint32_t i)
+                         { return name_of(i); });
+        }
     }
 
-    void emplace_back(Sym_Hdr sym)
+    void resolve_names()
     {
-        symbols.emplace_back(sym);
+        for (std::size_t i = 0; i < symbols.size(); i++)
+        {
+            if (str_ids[i] != NAME_NOT_FOUND)
+            {
+                *(uint32_t *)(symbols[i].name.name + 4) = str_tab->offset(str_ids[i]);
+            }
+        }
     }
 };
 
@@ -442,4 +701,10 @@ struct Aux_Form_5
     uint8_t selection;
     uint8_t reserve[3] = {};
 };
-#pragma pack(pop)
\ No newline at end of file
+#pragma pack(pop)
+
+// Computes every file offset of the object and fills out with the regions
+// to write, each pointing at the buffer that already holds its contents.
+// Returns false, with an error about file, if the object does not fit the
+// fields of the COFF format
+bool layout_coff(COFF_Hdr &header, Sect_Tab &sections, Sym_Tab &sym_tab, Str_Tab &str_tab, Out_File &out, std::string_view file);
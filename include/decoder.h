@@ -0,0 +1,60 @@
+#pragma once
+
+// x86-64 decoder for the instructions the encoder produces
+//
+// The decode tables are built at compile time from FORMS in opcodes.h. Each
+// opcode byte, in one table for one byte opcodes, one for opcodes after 0x0f
+// and one for opcodes after 0x0f 0x38, lists the forms that start with it in
+// table order, so decoding reads the prefixes, REX and opcode, and picks the
+// first form whose prefix, REX.W, ModR/M reg field and third opcode byte
+// match. Forms with a register in the opcode are listed under all eight bytes
+// they can start with. Lengths follow from the form and the ModR/M and SIB
+// bytes alone, which decode_length stops at; decode goes on to read the
+// operands.
+//
+// Only what the encoder emits is recognised: legacy prefixes in any order but
+// each kind at most once, and no VEX prefixes. A form with a mandatory prefix
+// is picked over one that would leave it as a repeat prefix, and any lock or
+// repeat prefix the form does not take goes in Instr::prefix, with a segment
+// override in Instr::segment. Anything else does not decode.
+
+#include <ostream>
+#include <cstdint>
+
+#include <encoder.h>
+
+#define DEC_FIELD_NONE 0xff
+
+// A decoded instruction. The operands are in Intel order and named the way an
+// instruction written with a size suffix would be: mnemonic is MNEMONIC_NONE,
+// base_mnemonic the mnemonic of the form and size its operand size
+struct Dec_Instr
+{
+    Instr instr;
+    uint16_t form;       // Index in FORMS, the first form with these bytes when several share them
+    uint8_t size;        // Length in bytes
+    uint8_t disp_offset; // ModR/M displacement, DEC_FIELD_NONE without one
+    uint8_t disp_size;
+    uint8_t imm_offset;  // Immediate or branch displacement, DEC_FIELD_NONE without one
+    uint8_t imm_size;
+};
+
+// Length of the instruction at code, which holds size bytes, or 0 if it is
+// not one of the forms. Operands are not read
+std::size_t decode_length(const uint8_t *code, std::size_t size);
+
+// Decodes the instruction at code, which holds size bytes, with its operands.
+// prefix is a repeat prefix the instruction is known to have been written
+// with, which is then not taken as the mandatory prefix of another form (rep
+// bsf rather than tzcnt). False if it is not one of the forms
+bool decode(const uint8_t *code, std::size_t size, Dec_Instr &dec, uint8_t prefix = 0);
+
+// Index in INSTRUCTIONS of the mnemonic of a form
+uint16_t form_mnemonic(uint16_t form);
+
+// Whether two forms are encoded alike, such as shl and sal or jb and jc
+bool same_encoding(const Opcode_Form &a, const Opcode_Form &b);
+
+// Writes the instruction in AT&T syntax. Branch targets are relative to the
+// start of the instruction
+void print_decoded(std::ostream &os, const Dec_Instr &dec);
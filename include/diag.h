@@ -0,0 +1,12 @@
+#pragma once
+
+// Errors and warnings are written to diag(), which is stderr unless the
+// calling thread has pointed it elsewhere, as the server does to send the
+// messages of a request back to its client
+
+#include <ostream>
+
+std::ostream &diag();
+
+// Sends the messages of the calling thread to os, nullptr for stderr again
+void set_diag(std::ostream *os);
@@ -0,0 +1,161 @@
+// Based on the System V ABI and its AMD64 supplement
+// Only what is needed for relocatable x86-64 objects
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include <coff.h>
+#include <writer.h>
+#include <object.h>
+
+#define EI_NIDENT 16
+#define ELFCLASS64 2  // 64-bit objects
+#define ELFDATA2LSB 1 // Little endian
+#define EV_CURRENT 1
+#define ELFOSABI_NONE 0
+#define ELFOSABI_GNU 3 // Uses GNU extensions, STT_GNU_IFUNC or STB_GNU_UNIQUE
+
+#define ET_REL 1        // Relocatable file
+#define EM_X86_64 62    // AMD x86-64
+
+#define SHN_UNDEF 0
+#define SHN_LORESERVE 0xff00 // Section indices from here up are reserved, larger ones are given another way
+#define SHN_ABS 0xfff1    // Absolute value, not affected by relocation
+#define SHN_COMMON 0xfff2 // Common block not yet allocated, the value is its alignment
+#define SHN_XINDEX 0xffff // The index is kept elsewhere: in .symtab_shndx for a symbol, in section 0 for e_shstrndx
+
+#define SHT_NULL 0
+#define SHT_PROGBITS 1 // Contents defined by the program
+#define SHT_SYMTAB 2
+#define SHT_STRTAB 3
+#define SHT_RELA 4     // Relocations with explicit addends
+#define SHT_NOTE 7
+#define SHT_NOBITS 8   // Occupies no space in the file (.bss)
+#define SHT_INIT_ARRAY 14    // Pointers to the constructors
+#define SHT_FINI_ARRAY 15    // Pointers to the destructors
+#define SHT_PREINIT_ARRAY 16 // Pointers to what runs before the constructors
+#define SHT_GROUP 17         // Section group, a flag word and the indices of the members
+#define SHT_SYMTAB_SHNDX 18  // Section indices of the symbols with SHN_XINDEX
+#define SHT_X86_64_UNWIND 0x70000001 // Unwind tables (.eh_frame)
+
+#define SHF_WRITE 0x1     // Writable at run time
+#define SHF_ALLOC 0x2     // Occupies memory at run time
+#define SHF_EXECINSTR 0x4 // Executable code
+#define SHF_INFO_LINK 0x40 // sh_info holds a section index
+#define SHF_GROUP 0x200    // Member of a section group
+#define SHF_TLS 0x400      // Thread local storage, a template for each thread's copy
+
+#define GRP_COMDAT 0x1 // The linker keeps one copy of the group's sections
+
+#define STB_LOCAL 0
+#define STB_GLOBAL 1
+#define STB_WEAK 2
+#define STB_GNU_UNIQUE 10 // One definition in the whole process, even with RTLD_LOCAL
+
+#define STV_DEFAULT 0
+#define STV_INTERNAL 1
+#define STV_HIDDEN 2    // Not visible outside the component that defines it
+#define STV_PROTECTED 3 // Visible but not preemptible
+
+#define STT_NOTYPE 0
+#define STT_OBJECT 1
+#define STT_FUNC 2
+#define STT_SECTION 3
+#define STT_FILE 4
+#define STT_TLS 6 // Offset in the thread local storage
+#define STT_GNU_IFUNC 10 // Function returning the address of the implementation to use
+
+#define R_X86_64_NONE 0
+#define R_X86_64_64 1    // S + A
+#define R_X86_64_PC32 2  // S + A - P
+#define R_X86_64_PLT32 4 // L + A - P, branch through the PLT when the target is in a shared object
+#define R_X86_64_32 10   // S + A, zero extended
+#define R_X86_64_GOTPCREL 9 // G + GOT + A - P
+#define R_X86_64_32S 11  // S + A, sign extended
+#define R_X86_64_DTPOFF64 17 // Offset in the module's TLS block
+#define R_X86_64_TPOFF64 18  // Offset from the thread pointer
+#define R_X86_64_TLSGD 19    // PC relative offset to the GOT entries of the symbol's TLS index
+#define R_X86_64_TLSLD 20    // The same for the module's TLS index
+#define R_X86_64_DTPOFF32 21
+#define R_X86_64_GOTTPOFF 22 // PC relative offset to the GOT entry holding the TPOFF64
+#define R_X86_64_TPOFF32 23
+#define R_X86_64_GOTPCRELX 41     // GOTPCREL the linker may relax to a direct reference
+#define R_X86_64_REX_GOTPCRELX 42 // The same for an instruction with a REX prefix
+
+// Relocation types from IMAGE_REL_ELF up carry an R_X86_64_ type in the low
+// byte, for the references only ELF objects have (@GOTPCREL and the TLS
+// models). Their field holds the ELF addend as it is, without the COFF
+// adjustment for the end of the field
+#define IMAGE_REL_ELF 0x8000
+
+struct Elf64_Ehdr
+{
+    uint8_t ident[EI_NIDENT];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint64_t entry;
+    uint64_t phoff;
+    uint64_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+};
+
+struct Elf64_Shdr
+{
+    uint32_t name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t addr;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t link;
+    uint32_t info;
+    uint64_t addralign;
+    uint64_t entsize;
+};
+
+struct Elf64_Sym
+{
+    uint32_t name;
+    uint8_t info; // Binding in the high 4 bits, type in the low 4
+    uint8_t other;
+    uint16_t shndx;
+    uint64_t value;
+    uint64_t size;
+};
+
+struct Elf64_Rela
+{
+    uint64_t offset;
+    uint64_t info; // Symbol index in the high 32 bits, type in the low 32
+    int64_t addend;
+};
+
+// Tables built for an ELF object. The regions of the Out_File point into
+// these and into the sections, so both must outlive the write
+struct ELF_File
+{
+    Elf64_Ehdr header = {};
+    std::vector<Elf64_Shdr> sect_hdrs;
+    std::vector<Elf64_Sym> symbols;
+    std::vector<std::vector<Elf64_Rela>> relocations; // One table per section
+    std::vector<std::vector<uint32_t>> groups;       // Contents of the SHT_GROUP sections
+    std::vector<uint32_t> symtab_shndx;              // Empty unless a symbol's section index is SHN_LORESERVE or more
+    Str_Tab strtab = {};
+    Str_Tab shstrtab = {};
+};
+
+// Lays out an ELF64 relocatable object from the same sections, symbols and
+// relocations the COFF writer uses. Symbols and relocation types are mapped
+// from their COFF form, and the addends kept in the relocated fields are
+// moved into the relocation entries, so the section data is changed. labels
+// give the symbols their visibility
+void layout_elf(Sect_Tab &sections, Sym_Tab &sym_tab, const std::vector<Label> &labels, ELF_File &elf, Out_File &out);
@@ -1,17 +1,143 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <ostream>
 #include <cstdint>
 
-#define REX_PRESENT 0x40 // Whether REX byte is present
-#define REX_W 0x8        // 1 = 64 Bit Operand Size
-#define REX_R 0x4        // Extension of the ModR/M reg field
-#define REX_X 0x2        // Extension of the SIB index field
-#define REX_B 0x1        // Extension of the ModR/M r/m field, SIB base field, or Opcode reg field
+#include <opcodes.h>
+
+#define OPND_NONE 0
+#define OPND_REG 1
+#define OPND_IMM 2
+#define OPND_MEM 3
+
+#define REG_NONE 0xff
+#define REG_RIP 0xfe
+#define SYM_NONE 0xffffffff
+#define MNEMONIC_NONE 0xffff
+
+#define MAX_INSTR_SIZE 15
+#define ENCODING_HASH_BYTES 16 // Read by hash_encoding, two words
+#define MAX_FIXUPS 2
+
+// Relocation modifiers written after a symbol, as in foo@GOTPCREL. The
+// encoder passes them on to the fixup of the field
+#define SYM_MOD_NONE 0
+#define SYM_MOD_GOTPCREL 1 // The symbol's GOT entry, PC relative
+#define SYM_MOD_TPOFF 2    // Offset from the thread pointer (local exec TLS)
+#define SYM_MOD_GOTTPOFF 3 // The GOT entry holding that offset, PC relative (initial exec TLS)
+#define SYM_MOD_DTPOFF 4   // Offset in the module's TLS block (local dynamic TLS)
+#define SYM_MOD_TLSGD 5    // The GOT entries __tls_get_addr takes, PC relative (general dynamic TLS)
+#define SYM_MOD_TLSLD 6    // The same for the module's TLS block (local dynamic TLS)
+
+struct Operand
+{
+    uint8_t type;
+    uint8_t reg;       // Register number for OPND_REG
+    uint8_t size;      // Register size in bytes
+    uint8_t reg_class;
+    uint8_t reg_flags;
+    uint8_t base;      // Memory base register, REG_NONE or REG_RIP
+    uint8_t index;     // Memory index register or REG_NONE
+    uint8_t scale;     // 1, 2, 4 or 8
+    bool indirect;     // Operand was written with a leading '*'
+    uint8_t modifier;  // SYM_MOD_ written after sym
+    int64_t value;     // Immediate value or displacement
+    uint32_t sym;      // Symbol the value is relative to, SYM_NONE for a plain number
+};
+
+// One decoded instruction, operands are in Intel order (destination first)
+struct Instr
+{
+    uint16_t mnemonic;      // Exact mnemonic, MNEMONIC_NONE if the name only exists with a size suffix
+    uint16_t base_mnemonic; // Mnemonic with the size suffix removed, or MNEMONIC_NONE
+    uint8_t size;           // Operand size given by the suffix of base_mnemonic
+    uint8_t num_ops;
+    uint8_t prefix;         // PREFIX_LOCK, PREFIX_REP or PREFIX_REPNZ written before the mnemonic, 0 = none
+    uint8_t segment;        // Segment override prefix of the memory operand, 0 = none
+    Operand ops[3];
+};
 
-struct Instruction
+#define FIX_PCREL 0x1  // Relative to the end of the instruction
+#define FIX_SIGNED 0x2 // Value is sign extended by the processor
+
+// A field inside an encoded instruction that depends on a symbol
+struct Enc_Fixup
 {
-    std::string name;
-    uint8_t prefix;
-    uint8_t REX;
-    uint32_t opcode;
+    uint8_t offset; // Offset of the field from the start of the instruction
+    uint8_t size;   // Size of the field in bytes
+    uint8_t flags;
+    uint8_t trail;  // Bytes between the end of the field and the end of the instruction
+    uint8_t modifier; // SYM_MOD_ of the operand
+    uint32_t sym;
+    int64_t addend;
 };
 
-void encode(uint8_t *&encoded, std::size_t &size);
\ No newline at end of file
+// Where one instruction of a batch was placed
+struct Enc_Record
+{
+    uint32_t offset; // Offset of the instruction in the output buffer
+    uint8_t size;
+    uint8_t num_fixups;
+    Enc_Fixup fixups[MAX_FIXUPS]; // Offsets are from the start of the instruction
+};
+
+// Rules that pick a shorter encoding than the first form of the table that
+// fits, counted for --size-stats
+#define SIZE_RULE_IMM8 0        // Sign extended imm8 (83 /digit ib) over imm16 or imm32
+#define SIZE_RULE_ACCUMULATOR 1 // Forms with al, ax, eax or rax implied (05 id) over ModR/M
+#define SIZE_RULE_MOV_REG 2     // Register in the opcode (B8+rd id) over ModR/M (C7 /0 id)
+#define SIZE_RULE_DISP8 3       // disp8 over disp32
+#define NUM_SIZE_RULES 4
+
+struct Enc_Size_Stats
+{
+    uint64_t instrs[NUM_SIZE_RULES]; // Instructions each rule made shorter
+    uint64_t bytes[NUM_SIZE_RULES];  // Bytes saved by each rule
+};
+
+// Resolves a mnemonic as written in the source, including AT&T size suffixes
+bool lookup_mnemonic(std::string_view name, Instr &instr);
+
+// Encodes instr into encoded, which must hold MAX_INSTR_SIZE bytes, using the
+// shortest form that takes its operands. A segment override goes first, then
+// an operand size prefix, then the lock or repeat prefix, the order GNU as
+// uses. Fields that refer to symbols are left zero and described in fixups
+// (MAX_FIXUPS entries). With size_stats, the bytes saved over the first form
+// that fits are added to it, and with form_idx the index in FORMS of the form
+// used is stored. Nothing is allocated and nothing is printed
+bool encode(const Instr &instr, uint8_t *encoded, std::size_t &size, Enc_Fixup *fixups, std::size_t &num_fixups, Enc_Size_Stats *size_stats = nullptr,
+            uint16_t *form_idx = nullptr);
+
+// Adds the counts of stats to total
+void add_size_stats(Enc_Size_Stats &total, const Enc_Size_Stats &stats);
+
+// Encodes instructions back to back into out, which holds capacity bytes, with
+// one record per instruction. Stops at the first instruction that cannot be
+// encoded or may not fit in what is left, and returns the number encoded
+std::size_t encode_batch(const Instr *instrs, std::size_t count, uint8_t *out, std::size_t capacity, Enc_Record *records);
+
+// Hash of the operands of instr, encoded with form, and of its prefixes, for
+// --verify to compare what was written with what decodes. Values that refer
+// to a symbol and branch displacements are left out, immediates count at the
+// operand size of form and only the operands form lists count
+uint32_t hash_operands(const Instr &instr, const Opcode_Form &form);
+
+// Hash of the size bytes of an encoded instruction, for --verify to compare
+// the bytes of a section with those the parser encoded. code holds
+// ENCODING_HASH_BYTES bytes, of which those past size are left out. The
+// caller zeroes fields that a symbol fills in first
+uint32_t hash_encoding(const uint8_t *code, std::size_t size);
+
+// Short form opcode (0xeb or 0x70 + condition) if instr is a jmp or jcc to a
+// label that can also take a rel32 form, otherwise 0
+uint8_t relaxable_branch(const Instr &instr);
+
+// Whether the rel32 at field, offset bytes into its section, is the
+// displacement of a call, jmp or jcc rather than a RIP-relative operand. Up
+// to two bytes before field are read
+bool is_branch_field(const uint8_t *field, uint64_t offset);
+
+// Debugging aid, writes the size and the bytes in hex
+void print_encoded(std::ostream &os, const uint8_t *encoded, std::size_t size);
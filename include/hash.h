@@ -0,0 +1,128 @@
+#pragma once
+
+// Open-addressing hash index used to map names to table indices without
+// allocating on lookup. The index only stores the hash and the table index,
+// the caller supplies a function that returns the name stored at an index.
+
+#include <vector>
+#include <string_view>
+#include <cstdint>
+
+#define NAME_NOT_FOUND 0xffffffff
+
+inline uint32_t hash_name(std::string_view str)
+{
+    // 32-bit FNV-1a
+    uint32_t hash = 0x811c9dc5;
+
+    for (char c : str)
+    {
+        hash ^= (uint8_t)(c);
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
+
+struct Name_Slot
+{
+    uint32_t hash;
+    uint32_t value; // Table index + 1, 0 = empty slot
+};
+
+struct Name_Index
+{
+    std::vector<Name_Slot> slots;
+    std::size_t count = 0;
+
+    template <typename Key_Of>
+    uint32_t find(std::string_view key, Key_Of key_of) const
+    {
+        if (slots.empty())
+        {
+            return NAME_NOT_FOUND;
+        }
+
+        uint32_t hash = hash_name(key);
+        std::size_t mask = slots.size() - 1;
+
+        for (std::size_t i = hash & mask;; i = (i + 1) & mask)
+        {
+            const Name_Slot &slot = slots[i];
+
+            if (slot.value == 0)
+            {
+                return NAME_NOT_FOUND;
+            }
+
+            if (slot.hash == hash && key_of(slot.value - 1) == key)
+            {
+                return slot.value - 1;
+            }
+        }
+    }
+
+    // Returns the index already stored under key, or value if it was inserted
+    template <typename Key_Of>
+    uint32_t insert(std::string_view key, uint32_t value, Key_Of key_of)
+    {
+        if ((count + 1) * 2 > slots.size())
+        {
+            grow();
+        }
+
+        uint32_t hash = hash_name(key);
+        std::size_t mask = slots.size() - 1;
+
+        for (std::size_t i = hash & mask;; i = (i + 1) & mask)
+        {
+            Name_Slot &slot = slots[i];
+
+            if (slot.value == 0)
+            {
+                slot.hash = hash;
+                slot.value = value + 1;
+                count++;
+
+                return value;
+            }
+
+            if (slot.hash == hash && key_of(slot.value - 1) == key)
+            {
+                return slot.value - 1;
+            }
+        }
+    }
+
+    void clear()
+    {
+        slots.clear();
+        count = 0;
+    }
+
+private:
+    void grow()
+    {
+        std::vector<Name_Slot> old = std::move(slots);
+
+        slots.assign(old.empty() ? 16 : old.size() * 2, Name_Slot{});
+        std::size_t mask = slots.size() - 1;
+
+        for (Name_Slot slot : old)
+        {
+            if (slot.value == 0)
+            {
+                continue;
+            }
+
+            std::size_t i = slot.hash & mask;
+
+            while (slots[i].value != 0)
+            {
+                i = (i + 1) & mask;
+            }
+
+            slots[i] = slot;
+        }
+    }
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+// In-process JIT. Source is assembled straight into executable memory: the
+// sections of the object are laid out in one mapping, code first, then
+// read-only data, then writable data, bss and common symbols, each group on
+// its own pages. Relocations are applied against the real addresses and
+// undefined symbols are bound through a resolver given by the caller. The
+// pages are written while they are only readable and writable and are then
+// made executable or read-only, so they are never writable and executable at
+// once. A call or jmp to an external symbol out of rel32 reach goes through a
+// stub holding its absolute address; any other reference out of reach is an
+// error.
+//
+// Instructions encoded with encode_batch can be loaded the same way, with the
+// symbols of their fixups given as addresses.
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+#include <hash.h>
+#include <encoder.h>
+
+struct Object;
+
+// Address of an external symbol, nullptr if there is none
+typedef std::function<void *(std::string_view name)> Jit_Resolver;
+
+struct Jit_Symbol
+{
+    uint32_t name;   // Offset in Jit_Module::names
+    uint32_t length;
+    void *address;
+};
+
+// Memory and labels of one assembled module, released by jit_free or when
+// the module is destroyed
+struct Jit_Module
+{
+    uint8_t *base = nullptr;
+    std::size_t size = 0;
+    std::string names;
+    std::vector<Jit_Symbol> symbols;
+    Name_Index symbol_index = {};
+
+    Jit_Module() = default;
+    ~Jit_Module();
+
+    Jit_Module(const Jit_Module &) = delete;
+    Jit_Module &operator=(const Jit_Module &) = delete;
+};
+
+// Assembles AT&T syntax source into module on the calling thread. Errors are
+// printed as for a file named "<jit>" and make the result false
+bool jit_assemble(std::string_view source, const Jit_Resolver &resolver, Jit_Module &module);
+
+// Loads an object filled by assemble_source into module. Every defined label
+// can be looked up afterwards, the object is left as it was apart from its
+// symbol table being finished
+bool jit_link(Object &obj, const Jit_Resolver &resolver, Jit_Module &module);
+
+// Loads size bytes of code encoded by encode_batch, patching the fixups of its
+// records. symbols[sym] is the address of each symbol the fixups refer to. The
+// code starts at module.base
+bool jit_load(const uint8_t *code, std::size_t size, const Enc_Record *records, std::size_t count, void *const *symbols, Jit_Module &module);
+
+// Address of a label defined by the module, nullptr if there is none
+void *jit_lookup(const Jit_Module &module, std::string_view name);
+
+void jit_free(Jit_Module &module);
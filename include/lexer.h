@@ -0,0 +1,82 @@
+#pragma once
+
+// Tokenizer for AT&T syntax assembly. The source file is mapped into memory
+// and every token is a view into it, so lexing does no heap allocation once
+// the token buffer has grown to the longest statement.
+//
+// Input is classified 64 bytes at a time into masks of identifier, blank and
+// special bytes, with AVX2 or SSE2 picked when the program starts, and runs
+// and punctuation are found from the masks without looking at each byte.
+// Strings, comments and the last block of the input go byte by byte.
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+#define TOK_EOL 0
+#define TOK_IDENT 1  // Symbol, mnemonic or directive name
+#define TOK_NUMBER 2 // Integer literal, sign not included
+#define TOK_STRING 3 // Quoted string, quotes included and escapes left as written
+#define TOK_CHAR 4   // Character literal such as 'a
+#define TOK_PUNCT 5  // Any other single character
+
+#define LEX_BLOCK 64
+
+#define LEX_KERNEL_SCALAR 0
+#define LEX_KERNEL_SSE2 1
+#define LEX_KERNEL_AVX2 2
+
+// Block classifier in use, the widest the CPU supports unless set
+uint8_t lexer_kernel();
+
+// False if the CPU does not support the kernel
+bool set_lexer_kernel(uint8_t kernel);
+
+struct Token
+{
+    uint8_t kind;
+    std::string_view text;
+};
+
+struct Source_File
+{
+    std::string path;
+    const char *data = nullptr;
+    std::size_t size = 0;
+    bool mapped = false;
+    int fd = -1; // Kept open while mapped, so the file can be copied without reading it
+    std::vector<char> buffer;
+
+    // A relative path is opened from the directory dir unless dir is empty
+    bool open(const std::string &path, std::string_view dir = {});
+    void close();
+
+    ~Source_File()
+    {
+        close();
+    }
+};
+
+struct Lexer
+{
+    const char *pos = nullptr;
+    const char *end = nullptr;
+    uint32_t line = 0;
+
+    // Identifier, blank, special and '$' masks of the LEX_BLOCK bytes from block
+    const char *block = nullptr;
+    uint64_t masks[4] = {};
+
+    void reset(std::string_view text)
+    {
+        pos = text.data();
+        end = text.data() + text.size();
+        line = 0;
+        block = nullptr;
+    }
+
+    // Reads the next statement (ended by a newline or ';') into tokens, which
+    // always ends with a TOK_EOL token. Returns false at the end of the input
+    bool next_statement(std::vector<Token> &tokens);
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+// Expansion of .macro, .rept, .irp and .irpc. A body is lexed once into a
+// template, the statements of the body as tokens with every parameter
+// reference marked, and an expansion walks the template putting the tokens
+// of the arguments in place of the references, so nothing is lexed again.
+// Expansions produce one statement at a time, which lets a .rept with a
+// large count stream into the encoder without the whole expansion existing
+// at once.
+//
+// Pieces written against each other, as in r\reg, \name\()_end or label\@,
+// are joined into one token. Joined text is interned in a Name_Pool, which
+// is kept with the object as labels may be named by it.
+
+#include <vector>
+#include <string_view>
+#include <memory>
+#include <cstdint>
+
+#include <hash.h>
+#include <lexer.h>
+
+#define MTOK_PARAM 0x80   // Reference to a parameter
+#define MTOK_COUNTER 0x81 // \@, the number of macros called before this one
+#define MTOK_STRING 0x82  // String holding parameter references, substituted as text
+
+#define MAX_EXPANSION_DEPTH 256
+
+struct Macro_Token
+{
+    uint8_t kind;    // TOK_* or MTOK_*
+    bool joined;     // Written against the previous piece with nothing between
+    uint16_t param;  // MTOK_PARAM
+    std::string_view text;
+};
+
+struct Macro_Param
+{
+    std::string_view name;
+    std::vector<Token> value; // Default
+    bool required = false;
+    bool vararg = false;      // Takes the rest of the arguments, commas included
+};
+
+// Statements of a body, each ended by a TOK_EOL token
+struct Macro_Body
+{
+    std::vector<Macro_Param> params;
+    std::vector<Macro_Token> tokens;
+    bool prescan = false; // Has statements the prescan must run, such as .set or .section
+};
+
+struct Macro
+{
+    std::string_view name;
+    Macro_Body body;
+};
+
+struct Macro_Arg
+{
+    uint32_t first; // Range in Expansion::arg_tokens
+    uint32_t count;
+};
+
+// A macro call or a .rept or .irp block being expanded
+struct Expansion
+{
+    const Macro_Body *body = nullptr;
+    std::unique_ptr<Macro_Body> owned; // Body of a .rept or .irp
+    std::vector<Token> arg_tokens;
+    std::vector<Macro_Arg> args;       // Every parameter for each iteration in turn
+    uint64_t count = 1;                // Iterations
+    uint64_t iteration = 0;
+    std::size_t pos = 0;               // Next token of the body
+    uint64_t counter = 0;              // Value of \@
+    bool macro = false;                // A call, which .exitm ends
+};
+
+// Interned names made while expanding. Views into the pool stay valid for
+// its lifetime, moving it included
+struct Name_Pool
+{
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char *next = nullptr; // Free space in the last block
+    std::size_t left = 0;
+    std::vector<std::string_view> names;
+    Name_Index index = {};
+
+    std::string_view add(std::string_view name);
+
+    bool empty() const
+    {
+        return names.empty();
+    }
+};
+
+// Adds one statement to a template. Parameters are matched by name against
+// body.params, which must be filled first
+void add_template_statement(Macro_Body &body, const std::vector<Token> &tokens);
+
+// Writes the next statement of the expansion into tokens, ended by a TOK_EOL
+// token. Returns false once every iteration is done
+bool next_expanded(Expansion &expansion, std::vector<Token> &tokens, Name_Pool &names);
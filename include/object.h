@@ -0,0 +1,163 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <cstdint>
+
+#include <coff.h>
+#include <encoder.h>
+#include <relax.h>
+#include <macro.h>
+#include <stats.h>
+
+#define LABEL_DEFINED 0x1
+#define LABEL_GLOBAL 0x2   // Named by .globl or given storage class 2 by .scl
+#define LABEL_ABSOLUTE 0x4 // Set by .set or .equ
+#define LABEL_COMMON 0x8   // Declared by .comm, loc holds the size
+#define LABEL_ALIAS 0x10   // Set by .set to another label plus value, defined once that label is placed
+
+struct Label
+{
+    std::string_view name; // Not copied, must outlive the object
+    Sect_Handle section;
+    uint32_t loc;
+    int64_t value;         // Value of a LABEL_ABSOLUTE label, offset from the target of a LABEL_ALIAS
+    uint32_t sym;          // Index in the symbol table
+    uint32_t alias;        // Label a LABEL_ALIAS is relative to
+    uint8_t flags;
+    uint8_t storage_class; // Set by .scl or .weak, 0 to pick one from the flags
+    uint8_t visibility;    // STV_ value set by .hidden, .protected or .internal
+    uint16_t type;         // Set by .type inside .def
+    uint8_t elf_info;      // Set by .type outside .def: STT_ type in the low 4 bits, STB_GNU_UNIQUE or 0 in the high 4
+    uint64_t size;         // Set by .size
+};
+
+#define INSTR_SYM_OPS 0x7 // Bit i set if operand i refers to a symbol
+#define INSTR_TARGET 0x8  // A branch or RIP relative operand refers to a label, given by an Instr_Target
+#define INSTR_REP 0x10    // Written with rep or repe before the mnemonic
+#define INSTR_REPNZ 0x20  // Written with repnz before the mnemonic
+
+// An instruction as the parser encoded it, kept for --verify. There is one
+// per instruction, so it is kept small
+struct Instr_Record
+{
+    uint32_t offset;   // In the section
+    uint32_t line;
+    uint32_t operands; // hash_operands of the operands as written
+    uint32_t encoding; // hash_encoding of the bytes encoded, with the fields referring to a symbol zeroed
+    uint16_t form;     // Index in FORMS, the rel32 form for a branch sized by relax
+    uint8_t size;      // 0 for a branch sized by relax
+    uint8_t flags;     // INSTR_ bits
+};
+
+// Label the PC relative field of a record with INSTR_TARGET has to reach
+struct Instr_Target
+{
+    uint32_t label;
+    int32_t addend; // Offset from label, which a 32-bit PC relative field holds
+};
+
+// Records of the instructions one chunk of the source put in one section
+struct Instr_Run
+{
+    uint32_t section;
+    std::vector<Instr_Record> records; // In offset order
+    std::vector<Instr_Target> targets; // One for each record with INSTR_TARGET, in the same order
+};
+
+#define FRAME_NONE 0xffffffff
+
+// Unwind directives. They are kept in source order with their offsets and
+// the unwind tables are built from them once the layout is final (unwind.h)
+#define FRAME_SEH_PROC 1        // .seh_proc, label is the function
+#define FRAME_SEH_ENDPROC 2
+#define FRAME_SEH_ENDPROLOGUE 3
+#define FRAME_SEH_PUSHREG 4     // reg
+#define FRAME_SEH_SETFRAME 5    // reg, value is the offset from rsp
+#define FRAME_SEH_STACKALLOC 6  // value is the size
+#define FRAME_SEH_SAVEREG 7     // reg, value is the offset from the frame
+#define FRAME_SEH_SAVEXMM 8     // reg, value is the offset from the frame
+#define FRAME_SEH_PUSHFRAME 9   // value is 1 if the machine frame has an error code
+#define FRAME_SEH_HANDLER 10    // label, value holds the UNW_FLAG_ handler flags
+#define FRAME_SEH_HANDLERDATA 11 // Space at offset in .xdata for the unwind information, value is its size
+#define FRAME_CFI_STARTPROC 12  // value is 1 for .cfi_startproc simple
+#define FRAME_CFI_ENDPROC 13
+#define FRAME_CFI_PERSONALITY 14 // reg is the pointer encoding, label the routine
+#define FRAME_CFI_LSDA 15        // reg is the pointer encoding, label the data
+#define FRAME_CFI_SIGNAL_FRAME 16
+#define FRAME_CFI_DEF_CFA 17       // reg, value is the offset. Registers are DWARF numbers
+#define FRAME_CFI_DEF_CFA_REGISTER 18 // reg
+#define FRAME_CFI_DEF_CFA_OFFSET 19 // value
+#define FRAME_CFI_ADJUST_CFA_OFFSET 20 // value is added to the offset
+#define FRAME_CFI_OFFSET 21        // reg, value is the offset from the CFA
+#define FRAME_CFI_REL_OFFSET 22    // reg, value is the offset from the CFA register
+#define FRAME_CFI_RESTORE 23       // reg
+#define FRAME_CFI_UNDEFINED 24     // reg
+#define FRAME_CFI_SAME_VALUE 25    // reg
+#define FRAME_CFI_REGISTER 26      // reg is saved in register value
+#define FRAME_CFI_REMEMBER_STATE 27
+#define FRAME_CFI_RESTORE_STATE 28
+#define FRAME_CFI_ESCAPE 29        // value is one byte of the instructions
+
+struct Frame_Op
+{
+    Sect_Handle section;
+    uint32_t offset;
+    uint32_t line;
+    uint8_t op;
+    uint8_t reg;
+    uint32_t label; // Index in labels, FRAME_NONE if the op has none
+    int64_t value;
+};
+
+// Everything built up while assembling one object file. The symbol table
+// points at the string table, so an Object must not be copied once initialised
+struct Object
+{
+    COFF_Hdr header = {};
+    Sect_Tab sections = {};
+    Sym_Tab sym_tab = {};
+    Str_Tab str_tab = {};
+    std::vector<Label> labels = {};
+    Name_Index label_index = {};
+    std::deque<Macro> macros = {};     // Defined by .macro, found by the prescan
+    Name_Index macro_index = {};
+    std::vector<Name_Pool> names = {}; // Text joined by macro expansion, which labels may be named by
+    std::vector<std::unique_ptr<Source_File>> binaries = {}; // Files mapped by .incbin, which sections point into
+    Sect_Handle text, data, bss;
+    Relax_Stats relax_stats = {};
+    Stats stats;
+    bool align_branches = false; // Keeps jumps and fused jcc pairs off 32-byte boundaries
+    bool verify = false;         // Records every instruction in instrs for verify_object
+    bool elf = false;            // The object is written as ELF, which allows weak symbols and ELF relocations
+    std::vector<Instr_Run> instrs = {};  // In source order, so each section's runs are in offset order
+    std::vector<Frame_Op> frames = {};   // In source order
+};
+
+std::size_t add_symbol(std::string_view symbol, Sym_Tab &sym_tab, Sect_Tab &sections, Str_Tab &str_tab, uint8_t storage_class, std::string_view str = "", uint32_t value = 0, uint8_t type = IMAGE_SYM_TYPE_NULL, uint8_t dtype = IMAGE_SYM_DTYPE_NULL);
+
+// group is the signature of the ELF section group the section is in, if any
+Sect_Handle add_section(Sect_Tab &sections, Sym_Tab &sym_tab, Str_Tab &str_tab, Sect_Hdr header, std::string_view name = "", std::string_view group = "");
+
+void relocate_symbol(std::string_view symbol, Sect_Handle section, Sect_Tab &sections, Sym_Tab &sym_tab, uint32_t virt_addr, uint16_t type);
+
+void relocate_symbol(uint32_t sym, Sect_Handle section, Sect_Tab &sections, uint32_t virt_addr, uint16_t type);
+
+// Writes the COFF header and creates .text, .data and .bss. Set Object::elf
+// first, as it decides their alignment
+void init_object(Object &obj);
+
+uint32_t find_label(const Object &obj, std::string_view name);
+
+// Finds a label or creates it as an undefined external
+uint32_t get_label(Object &obj, std::string_view name);
+
+// Returns false if the label was already defined
+bool define_label(Object &obj, uint32_t label, Sect_Handle section, uint32_t loc);
+
+const Macro *find_macro(const Object &obj, std::string_view name);
+
+// Gives every label symbol its final storage class and location
+void finish_symbols(Object &obj);
@@ -0,0 +1,846 @@
+#pragma once
+
+// x86-64 opcode forms, built entirely at compile time
+//
+// Every mnemonic has one or more forms. A form gives the operand kinds it
+// accepts (Intel operand order, destination first), how the operands are
+// encoded (/r, /digit, +r, immediate) and the prefix, REX.W and opcode bytes.
+// Forms of the same mnemonic are kept together, in the order they are tried.
+//
+// Immediate and relative operand sizes follow from the operand kinds:
+//     IMM8 = ib, IMM16 = iw, IMM32 = id, IMM64 = io, REL8 = cb, REL32 = cd
+
+#include <array>
+#include <string_view>
+#include <cstdint>
+
+#include <perfect_hash.h>
+
+#define REX_PRESENT 0x40 // Whether REX byte is present
+#define REX_W 0x8        // 1 = 64 Bit Operand Size
+#define REX_R 0x4        // Extension of the ModR/M reg field
+#define REX_X 0x2        // Extension of the SIB index field
+#define REX_B 0x1        // Extension of the ModR/M r/m field, SIB base field, or Opcode reg field
+
+// Operand kinds
+
+#define OPK_NONE 0
+#define OPK_R8 1      // General purpose register
+#define OPK_R16 2
+#define OPK_R32 3
+#define OPK_R64 4
+#define OPK_RM8 5     // General purpose register or memory
+#define OPK_RM16 6
+#define OPK_RM32 7
+#define OPK_RM64 8
+#define OPK_M 9       // Memory of any size (lea)
+#define OPK_IMM8 10
+#define OPK_IMM16 11
+#define OPK_IMM32 12
+#define OPK_IMM64 13
+#define OPK_REL8 14   // Branch displacement
+#define OPK_REL32 15
+#define OPK_AL 16     // Fixed accumulator register, not encoded
+#define OPK_AX 17
+#define OPK_EAX 18
+#define OPK_RAX 19
+#define OPK_CL 20     // Shift count register, not encoded
+#define OPK_ONE 21    // Immediate 1 for shifts, not encoded
+#define OPK_XMM 22    // SSE register
+#define OPK_XMM_M32 23 // SSE register or memory
+#define OPK_XMM_M64 24
+#define OPK_XMM_M128 25
+#define OPK_M16 26    // Memory only, sized by the mnemonic (movbe, movhps)
+#define OPK_M32 27
+#define OPK_M64 28
+
+// Operand encodings
+
+#define ENC_NONE 0 // Opcode only, any fixed operands are implied
+#define ENC_MR 1   // op0 in ModR/M r/m, op1 in ModR/M reg (/r)
+#define ENC_RM 2   // op0 in ModR/M reg, op1 in ModR/M r/m (/r)
+#define ENC_M 3    // op0 in ModR/M r/m, reg holds /digit
+#define ENC_MI 4   // op0 in ModR/M r/m with /digit, op1 immediate
+#define ENC_RMI 5  // op0 in ModR/M reg, op1 in r/m, op2 immediate
+#define ENC_O 6    // op0 added to the last opcode byte (+r)
+#define ENC_OI 7   // op0 added to the last opcode byte (+r), op1 immediate
+#define ENC_I 8    // Immediate only, other operands are implied
+#define ENC_D 9    // Relative branch displacement
+#define ENC_MRI 10 // op0 in ModR/M r/m, op1 in ModR/M reg, op2 immediate (shld, shrd)
+
+// Form flags
+
+#define FORM_DEF64 0x1  // Operand size defaults to 64 bits without REX.W (push, pop, near branches)
+#define FORM_DATA16 0x2 // An operand size prefix goes before the mandatory 0xf2 or 0xf3 prefix (popcntw, crc32w)
+
+struct Opcode_Form
+{
+    std::string_view mnemonic;
+    uint8_t enc;
+    uint8_t operands[3];
+    uint8_t prefix; // Mandatory or operand size prefix (0x66, 0xf2, 0xf3), 0 = none
+    uint8_t rex;    // REX_W or 0
+    int8_t digit;   // ModR/M reg opcode extension, -1 = /r or no ModR/M
+    uint8_t opcode_len;
+    uint8_t opcode[3];
+    uint8_t flags;
+};
+
+struct Instruction
+{
+    std::string_view name;
+    uint16_t first_form;
+    uint16_t num_forms;
+    bool one_size; // Every form has the same operand size, so memory needs no suffix (setcc)
+};
+
+// Operand size the suffix refers to, taken from the first general purpose operand
+constexpr uint8_t form_size(const Opcode_Form &form)
+{
+    for (uint8_t kind : form.operands)
+    {
+        switch (kind)
+        {
+        case OPK_R8:
+        case OPK_RM8:
+        case OPK_AL:
+            return 1;
+        case OPK_R16:
+        case OPK_RM16:
+        case OPK_AX:
+            return 2;
+        case OPK_R32:
+        case OPK_RM32:
+        case OPK_EAX:
+            return 4;
+        case OPK_R64:
+        case OPK_RM64:
+        case OPK_RAX:
+            return 8;
+        }
+    }
+
+    return 0;
+}
+
+// Bytes an immediate or branch displacement of this kind takes, 0 for other kinds
+constexpr uint8_t imm_size(uint8_t kind)
+{
+    switch (kind)
+    {
+    case OPK_IMM8:
+    case OPK_REL8:
+        return 1;
+    case OPK_IMM16:
+        return 2;
+    case OPK_IMM32:
+    case OPK_REL32:
+        return 4;
+    case OPK_IMM64:
+        return 8;
+    }
+
+    return 0;
+}
+
+// Form table helpers
+
+#define OP1(b0) 1, {b0}
+#define OP2(b0, b1) 2, {b0, b1}
+#define OP3(b0, b1, b2) 3, {b0, b1, b2}
+
+// add, or, adc, sbb, and, sub, xor, cmp
+#define ALU_FORMS(name, base, digit)                                                   \
+    {name, ENC_MR, {OPK_RM8, OPK_R8}, 0, 0, -1, OP1(base)},                            \
+    {name, ENC_MR, {OPK_RM16, OPK_R16}, 0x66, 0, -1, OP1(base + 1)},                   \
+    {name, ENC_MR, {OPK_RM32, OPK_R32}, 0, 0, -1, OP1(base + 1)},                      \
+    {name, ENC_MR, {OPK_RM64, OPK_R64}, 0, REX_W, -1, OP1(base + 1)},                  \
+    {name, ENC_RM, {OPK_R8, OPK_RM8}, 0, 0, -1, OP1(base + 2)},                        \
+    {name, ENC_RM, {OPK_R16, OPK_RM16}, 0x66, 0, -1, OP1(base + 3)},                   \
+    {name, ENC_RM, {OPK_R32, OPK_RM32}, 0, 0, -1, OP1(base + 3)},                      \
+    {name, ENC_RM, {OPK_R64, OPK_RM64}, 0, REX_W, -1, OP1(base + 3)},                  \
+    {name, ENC_MI, {OPK_RM8, OPK_IMM8}, 0, 0, digit, OP1(0x80)},                       \
+    {name, ENC_MI, {OPK_RM16, OPK_IMM16}, 0x66, 0, digit, OP1(0x81)},                  \
+    {name, ENC_MI, {OPK_RM32, OPK_IMM32}, 0, 0, digit, OP1(0x81)},                     \
+    {name, ENC_MI, {OPK_RM64, OPK_IMM32}, 0, REX_W, digit, OP1(0x81)},                 \
+    {name, ENC_MI, {OPK_RM16, OPK_IMM8}, 0x66, 0, digit, OP1(0x83)},                   \
+    {name, ENC_MI, {OPK_RM32, OPK_IMM8}, 0, 0, digit, OP1(0x83)},                      \
+    {name, ENC_MI, {OPK_RM64, OPK_IMM8}, 0, REX_W, digit, OP1(0x83)},                  \
+    {name, ENC_I, {OPK_AL, OPK_IMM8}, 0, 0, -1, OP1(base + 4)},                        \
+    {name, ENC_I, {OPK_AX, OPK_IMM16}, 0x66, 0, -1, OP1(base + 5)},                    \
+    {name, ENC_I, {OPK_EAX, OPK_IMM32}, 0, 0, -1, OP1(base + 5)},                      \
+    {name, ENC_I, {OPK_RAX, OPK_IMM32}, 0, REX_W, -1, OP1(base + 5)}
+
+// Single r/m operand with an opcode extension, byte form first
+#define UNARY_FORMS(name, op8, op, digit)                                              \
+    {name, ENC_M, {OPK_RM8}, 0, 0, digit, OP1(op8)},                                   \
+    {name, ENC_M, {OPK_RM16}, 0x66, 0, digit, OP1(op)},                                \
+    {name, ENC_M, {OPK_RM32}, 0, 0, digit, OP1(op)},                                   \
+    {name, ENC_M, {OPK_RM64}, 0, REX_W, digit, OP1(op)}
+
+// rol, ror, rcl, rcr, shl, sal, shr, sar
+#define SHIFT_FORMS(name, digit)                                                       \
+    {name, ENC_M, {OPK_RM8, OPK_ONE}, 0, 0, digit, OP1(0xd0)},                         \
+    {name, ENC_M, {OPK_RM16, OPK_ONE}, 0x66, 0, digit, OP1(0xd1)},                     \
+    {name, ENC_M, {OPK_RM32, OPK_ONE}, 0, 0, digit, OP1(0xd1)},                        \
+    {name, ENC_M, {OPK_RM64, OPK_ONE}, 0, REX_W, digit, OP1(0xd1)},                    \
+    {name, ENC_M, {OPK_RM8, OPK_CL}, 0, 0, digit, OP1(0xd2)},                          \
+    {name, ENC_M, {OPK_RM16, OPK_CL}, 0x66, 0, digit, OP1(0xd3)},                      \
+    {name, ENC_M, {OPK_RM32, OPK_CL}, 0, 0, digit, OP1(0xd3)},                         \
+    {name, ENC_M, {OPK_RM64, OPK_CL}, 0, REX_W, digit, OP1(0xd3)},                     \
+    {name, ENC_MI, {OPK_RM8, OPK_IMM8}, 0, 0, digit, OP1(0xc0)},                       \
+    {name, ENC_MI, {OPK_RM16, OPK_IMM8}, 0x66, 0, digit, OP1(0xc1)},                   \
+    {name, ENC_MI, {OPK_RM32, OPK_IMM8}, 0, 0, digit, OP1(0xc1)},                      \
+    {name, ENC_MI, {OPK_RM64, OPK_IMM8}, 0, REX_W, digit, OP1(0xc1)},                  \
+    UNARY_FORMS(name, 0xd0, 0xd1, digit)
+
+// Two byte opcode taking a 16/32/64-bit register and r/m operand
+#define REG_RM_FORMS(name, prefix, op)                                                 \
+    {name, ENC_RM, {OPK_R16, OPK_RM16}, prefix ? prefix : 0x66, 0, -1, OP2(0x0f, op),  \
+     prefix ? FORM_DATA16 : 0},                                                        \
+    {name, ENC_RM, {OPK_R32, OPK_RM32}, prefix, 0, -1, OP2(0x0f, op)},                 \
+    {name, ENC_RM, {OPK_R64, OPK_RM64}, prefix, REX_W, -1, OP2(0x0f, op)}
+
+// bt, bts, btr, btc
+#define BIT_TEST_FORMS(name, op, digit)                                                \
+    {name, ENC_MR, {OPK_RM16, OPK_R16}, 0x66, 0, -1, OP2(0x0f, op)},                   \
+    {name, ENC_MR, {OPK_RM32, OPK_R32}, 0, 0, -1, OP2(0x0f, op)},                      \
+    {name, ENC_MR, {OPK_RM64, OPK_R64}, 0, REX_W, -1, OP2(0x0f, op)},                  \
+    {name, ENC_MI, {OPK_RM16, OPK_IMM8}, 0x66, 0, digit, OP2(0x0f, 0xba)},             \
+    {name, ENC_MI, {OPK_RM32, OPK_IMM8}, 0, 0, digit, OP2(0x0f, 0xba)},                \
+    {name, ENC_MI, {OPK_RM64, OPK_IMM8}, 0, REX_W, digit, OP2(0x0f, 0xba)}
+
+// String operations, which take their operands from rsi, rdi and the accumulator
+#define STRING_FORMS(name, op8)                                                        \
+    {name "b", ENC_NONE, {}, 0, 0, -1, OP1(op8)},                                      \
+    {name "w", ENC_NONE, {}, 0x66, 0, -1, OP1(op8 + 1)},                               \
+    {name "l", ENC_NONE, {}, 0, 0, -1, OP1(op8 + 1)},                                  \
+    {name "q", ENC_NONE, {}, 0, REX_W, -1, OP1(op8 + 1)}
+
+// shld, shrd, the count in cl can be left out
+#define DOUBLE_SHIFT_FORMS(name, op)                                                   \
+    {name, ENC_MRI, {OPK_RM16, OPK_R16, OPK_IMM8}, 0x66, 0, -1, OP2(0x0f, op)},        \
+    {name, ENC_MRI, {OPK_RM32, OPK_R32, OPK_IMM8}, 0, 0, -1, OP2(0x0f, op)},           \
+    {name, ENC_MRI, {OPK_RM64, OPK_R64, OPK_IMM8}, 0, REX_W, -1, OP2(0x0f, op)},       \
+    {name, ENC_MR, {OPK_RM16, OPK_R16, OPK_CL}, 0x66, 0, -1, OP2(0x0f, op + 1)},       \
+    {name, ENC_MR, {OPK_RM32, OPK_R32, OPK_CL}, 0, 0, -1, OP2(0x0f, op + 1)},          \
+    {name, ENC_MR, {OPK_RM64, OPK_R64, OPK_CL}, 0, REX_W, -1, OP2(0x0f, op + 1)},      \
+    {name, ENC_MR, {OPK_RM16, OPK_R16}, 0x66, 0, -1, OP2(0x0f, op + 1)},               \
+    {name, ENC_MR, {OPK_RM32, OPK_R32}, 0, 0, -1, OP2(0x0f, op + 1)},                  \
+    {name, ENC_MR, {OPK_RM64, OPK_R64}, 0, REX_W, -1, OP2(0x0f, op + 1)}
+
+// Atomic read-modify-write, taken with a lock prefix
+#define XCHG_OP_FORMS(name, op8)                                                       \
+    {name, ENC_MR, {OPK_RM8, OPK_R8}, 0, 0, -1, OP2(0x0f, op8)},                       \
+    {name, ENC_MR, {OPK_RM16, OPK_R16}, 0x66, 0, -1, OP2(0x0f, op8 + 1)},              \
+    {name, ENC_MR, {OPK_RM32, OPK_R32}, 0, 0, -1, OP2(0x0f, op8 + 1)},                 \
+    {name, ENC_MR, {OPK_RM64, OPK_R64}, 0, REX_W, -1, OP2(0x0f, op8 + 1)}
+
+// jcc, setcc, cmovcc
+#define JCC_FORMS(cc, code)                                                            \
+    {"j" cc, ENC_D, {OPK_REL32}, 0, 0, -1, OP2(0x0f, 0x80 + code), FORM_DEF64},        \
+    {"j" cc, ENC_D, {OPK_REL8}, 0, 0, -1, OP1(0x70 + code), FORM_DEF64}
+
+#define SETCC_FORMS(cc, code) \
+    {"set" cc, ENC_M, {OPK_RM8}, 0, 0, 0, OP2(0x0f, 0x90 + code)}
+
+#define CMOVCC_FORMS(cc, code) \
+    REG_RM_FORMS("cmov" cc, 0, 0x40 + code)
+
+#define CC_LIST(FORMS)                                                                 \
+    FORMS("o", 0x0), FORMS("no", 0x1), FORMS("b", 0x2), FORMS("c", 0x2),               \
+    FORMS("nae", 0x2), FORMS("ae", 0x3), FORMS("nb", 0x3), FORMS("nc", 0x3),           \
+    FORMS("e", 0x4), FORMS("z", 0x4), FORMS("ne", 0x5), FORMS("nz", 0x5),              \
+    FORMS("be", 0x6), FORMS("na", 0x6), FORMS("a", 0x7), FORMS("nbe", 0x7),            \
+    FORMS("s", 0x8), FORMS("ns", 0x9), FORMS("p", 0xa), FORMS("pe", 0xa),              \
+    FORMS("np", 0xb), FORMS("po", 0xb), FORMS("l", 0xc), FORMS("nge", 0xc),            \
+    FORMS("ge", 0xd), FORMS("nl", 0xd), FORMS("le", 0xe), FORMS("ng", 0xe),            \
+    FORMS("g", 0xf), FORMS("nle", 0xf)
+
+// SSE load/store pair: load is RM with opcode ld, store is MR with opcode st
+#define SSE_MOV_FORMS(name, prefix, kind, ld, st)                                      \
+    {name, ENC_RM, {OPK_XMM, kind}, prefix, 0, -1, OP2(0x0f, ld)},                     \
+    {name, ENC_MR, {kind, OPK_XMM}, prefix, 0, -1, OP2(0x0f, st)}
+
+#define SSE_FORM(name, prefix, kind, op) \
+    {name, ENC_RM, {OPK_XMM, kind}, prefix, 0, -1, OP2(0x0f, op)}
+
+// Scalar and packed single/double arithmetic
+#define SSE_ARITH_FORMS(name, op)                                                      \
+    SSE_FORM(name "ss", 0xf3, OPK_XMM_M32, op),                                        \
+    SSE_FORM(name "sd", 0xf2, OPK_XMM_M64, op),                                        \
+    SSE_FORM(name "ps", 0, OPK_XMM_M128, op),                                          \
+    SSE_FORM(name "pd", 0x66, OPK_XMM_M128, op)
+
+#define SSE_LOGIC_FORMS(name, op)                                                      \
+    SSE_FORM(name "ps", 0, OPK_XMM_M128, op),                                          \
+    SSE_FORM(name "pd", 0x66, OPK_XMM_M128, op)
+
+#define SSE_INT_FORM(name, op) \
+    SSE_FORM(name, 0x66, OPK_XMM_M128, op)
+
+// Loads and stores of the high or low half of an xmm register, memory only
+#define SSE_HALF_FORMS(name, prefix, ld)                                               \
+    {name, ENC_RM, {OPK_XMM, OPK_M64}, prefix, 0, -1, OP2(0x0f, ld)},                  \
+    {name, ENC_MR, {OPK_M64, OPK_XMM}, prefix, 0, -1, OP2(0x0f, ld + 1)}
+
+// Packed shifts by the count in an xmm register or memory, or by an immediate
+#define SSE_SHIFT_FORMS(name, op, op_imm, digit)                                       \
+    SSE_INT_FORM(name, op),                                                            \
+    {name, ENC_MI, {OPK_XMM, OPK_IMM8}, 0x66, 0, digit, OP2(0x0f, op_imm)}
+
+// Integer to float conversions take a 32 or 64-bit source
+#define SSE_CVTSI_FORMS(name, prefix)                                                  \
+    {name, ENC_RM, {OPK_XMM, OPK_RM32}, prefix, 0, -1, OP2(0x0f, 0x2a)},               \
+    {name, ENC_RM, {OPK_XMM, OPK_RM64}, prefix, REX_W, -1, OP2(0x0f, 0x2a)}
+
+#define SSE_CVTTSI_FORMS(name, prefix, kind)                                           \
+    {name, ENC_RM, {OPK_R32, kind}, prefix, 0, -1, OP2(0x0f, 0x2c)},                   \
+    {name, ENC_RM, {OPK_R64, kind}, prefix, REX_W, -1, OP2(0x0f, 0x2c)}
+
+inline constexpr Opcode_Form FORMS[] = {
+    // Arithmetic and logic
+
+    ALU_FORMS("add", 0x00, 0),
+    ALU_FORMS("or", 0x08, 1),
+    ALU_FORMS("adc", 0x10, 2),
+    ALU_FORMS("sbb", 0x18, 3),
+    ALU_FORMS("and", 0x20, 4),
+    ALU_FORMS("sub", 0x28, 5),
+    ALU_FORMS("xor", 0x30, 6),
+    ALU_FORMS("cmp", 0x38, 7),
+
+    {"test", ENC_MR, {OPK_RM8, OPK_R8}, 0, 0, -1, OP1(0x84)},
+    {"test", ENC_MR, {OPK_RM16, OPK_R16}, 0x66, 0, -1, OP1(0x85)},
+    {"test", ENC_MR, {OPK_RM32, OPK_R32}, 0, 0, -1, OP1(0x85)},
+    {"test", ENC_MR, {OPK_RM64, OPK_R64}, 0, REX_W, -1, OP1(0x85)},
+    {"test", ENC_MI, {OPK_RM8, OPK_IMM8}, 0, 0, 0, OP1(0xf6)},
+    {"test", ENC_MI, {OPK_RM16, OPK_IMM16}, 0x66, 0, 0, OP1(0xf7)},
+    {"test", ENC_MI, {OPK_RM32, OPK_IMM32}, 0, 0, 0, OP1(0xf7)},
+    {"test", ENC_MI, {OPK_RM64, OPK_IMM32}, 0, REX_W, 0, OP1(0xf7)},
+    {"test", ENC_I, {OPK_AL, OPK_IMM8}, 0, 0, -1, OP1(0xa8)},
+    {"test", ENC_I, {OPK_AX, OPK_IMM16}, 0x66, 0, -1, OP1(0xa9)},
+    {"test", ENC_I, {OPK_EAX, OPK_IMM32}, 0, 0, -1, OP1(0xa9)},
+    {"test", ENC_I, {OPK_RAX, OPK_IMM32}, 0, REX_W, -1, OP1(0xa9)},
+
+    UNARY_FORMS("inc", 0xfe, 0xff, 0),
+    UNARY_FORMS("dec", 0xfe, 0xff, 1),
+    UNARY_FORMS("not", 0xf6, 0xf7, 2),
+    UNARY_FORMS("neg", 0xf6, 0xf7, 3),
+    UNARY_FORMS("mul", 0xf6, 0xf7, 4),
+    UNARY_FORMS("div", 0xf6, 0xf7, 6),
+    UNARY_FORMS("idiv", 0xf6, 0xf7, 7),
+
+    REG_RM_FORMS("imul", 0, 0xaf),
+    {"imul", ENC_RMI, {OPK_R16, OPK_RM16, OPK_IMM16}, 0x66, 0, -1, OP1(0x69)},
+    {"imul", ENC_RMI, {OPK_R32, OPK_RM32, OPK_IMM32}, 0, 0, -1, OP1(0x69)},
+    {"imul", ENC_RMI, {OPK_R64, OPK_RM64, OPK_IMM32}, 0, REX_W, -1, OP1(0x69)},
+    {"imul", ENC_RMI, {OPK_R16, OPK_RM16, OPK_IMM8}, 0x66, 0, -1, OP1(0x6b)},
+    {"imul", ENC_RMI, {OPK_R32, OPK_RM32, OPK_IMM8}, 0, 0, -1, OP1(0x6b)},
+    {"imul", ENC_RMI, {OPK_R64, OPK_RM64, OPK_IMM8}, 0, REX_W, -1, OP1(0x6b)},
+    UNARY_FORMS("imul", 0xf6, 0xf7, 5),
+
+    SHIFT_FORMS("rol", 0),
+    SHIFT_FORMS("ror", 1),
+    SHIFT_FORMS("rcl", 2),
+    SHIFT_FORMS("rcr", 3),
+    SHIFT_FORMS("shl", 4),
+    SHIFT_FORMS("sal", 4),
+    SHIFT_FORMS("shr", 5),
+    SHIFT_FORMS("sar", 7),
+
+    REG_RM_FORMS("bsf", 0, 0xbc),
+    REG_RM_FORMS("bsr", 0, 0xbd),
+    REG_RM_FORMS("popcnt", 0xf3, 0xb8),
+    REG_RM_FORMS("lzcnt", 0xf3, 0xbd),
+    REG_RM_FORMS("tzcnt", 0xf3, 0xbc),
+
+    BIT_TEST_FORMS("bt", 0xa3, 4),
+    BIT_TEST_FORMS("bts", 0xab, 5),
+    BIT_TEST_FORMS("btr", 0xb3, 6),
+    BIT_TEST_FORMS("btc", 0xbb, 7),
+
+    {"bswap", ENC_O, {OPK_R32}, 0, 0, -1, OP2(0x0f, 0xc8)},
+    {"bswap", ENC_O, {OPK_R64}, 0, REX_W, -1, OP2(0x0f, 0xc8)},
+
+    DOUBLE_SHIFT_FORMS("shld", 0xa4),
+    DOUBLE_SHIFT_FORMS("shrd", 0xac),
+
+    {"crc32b", ENC_RM, {OPK_R32, OPK_RM8}, 0xf2, 0, -1, OP3(0x0f, 0x38, 0xf0)},
+    {"crc32b", ENC_RM, {OPK_R64, OPK_RM8}, 0xf2, REX_W, -1, OP3(0x0f, 0x38, 0xf0)},
+    {"crc32w", ENC_RM, {OPK_R32, OPK_RM16}, 0xf2, 0, -1, OP3(0x0f, 0x38, 0xf1), FORM_DATA16},
+    {"crc32l", ENC_RM, {OPK_R32, OPK_RM32}, 0xf2, 0, -1, OP3(0x0f, 0x38, 0xf1)},
+    {"crc32q", ENC_RM, {OPK_R64, OPK_RM64}, 0xf2, REX_W, -1, OP3(0x0f, 0x38, 0xf1)},
+
+    // Data movement
+
+    {"mov", ENC_MR, {OPK_RM8, OPK_R8}, 0, 0, -1, OP1(0x88)},
+    {"mov", ENC_MR, {OPK_RM16, OPK_R16}, 0x66, 0, -1, OP1(0x89)},
+    {"mov", ENC_MR, {OPK_RM32, OPK_R32}, 0, 0, -1, OP1(0x89)},
+    {"mov", ENC_MR, {OPK_RM64, OPK_R64}, 0, REX_W, -1, OP1(0x89)},
+    {"mov", ENC_RM, {OPK_R8, OPK_RM8}, 0, 0, -1, OP1(0x8a)},
+    {"mov", ENC_RM, {OPK_R16, OPK_RM16}, 0x66, 0, -1, OP1(0x8b)},
+    {"mov", ENC_RM, {OPK_R32, OPK_RM32}, 0, 0, -1, OP1(0x8b)},
+    {"mov", ENC_RM, {OPK_R64, OPK_RM64}, 0, REX_W, -1, OP1(0x8b)},
+    {"mov", ENC_MI, {OPK_RM8, OPK_IMM8}, 0, 0, 0, OP1(0xc6)},
+    {"mov", ENC_MI, {OPK_RM16, OPK_IMM16}, 0x66, 0, 0, OP1(0xc7)},
+    {"mov", ENC_MI, {OPK_RM32, OPK_IMM32}, 0, 0, 0, OP1(0xc7)},
+    {"mov", ENC_MI, {OPK_RM64, OPK_IMM32}, 0, REX_W, 0, OP1(0xc7)},
+    {"mov", ENC_OI, {OPK_R8, OPK_IMM8}, 0, 0, -1, OP1(0xb0)},
+    {"mov", ENC_OI, {OPK_R16, OPK_IMM16}, 0x66, 0, -1, OP1(0xb8)},
+    {"mov", ENC_OI, {OPK_R32, OPK_IMM32}, 0, 0, -1, OP1(0xb8)},
+    {"mov", ENC_OI, {OPK_R64, OPK_IMM64}, 0, REX_W, -1, OP1(0xb8)},
+
+    {"movabs", ENC_OI, {OPK_R64, OPK_IMM64}, 0, REX_W, -1, OP1(0xb8)},
+
+    {"movzb", ENC_RM, {OPK_R16, OPK_RM8}, 0x66, 0, -1, OP2(0x0f, 0xb6)},
+    {"movzb", ENC_RM, {OPK_R32, OPK_RM8}, 0, 0, -1, OP2(0x0f, 0xb6)},
+    {"movzb", ENC_RM, {OPK_R64, OPK_RM8}, 0, REX_W, -1, OP2(0x0f, 0xb6)},
+    {"movzw", ENC_RM, {OPK_R32, OPK_RM16}, 0, 0, -1, OP2(0x0f, 0xb7)},
+    {"movzw", ENC_RM, {OPK_R64, OPK_RM16}, 0, REX_W, -1, OP2(0x0f, 0xb7)},
+    {"movsb", ENC_RM, {OPK_R16, OPK_RM8}, 0x66, 0, -1, OP2(0x0f, 0xbe)},
+    {"movsb", ENC_RM, {OPK_R32, OPK_RM8}, 0, 0, -1, OP2(0x0f, 0xbe)},
+    {"movsb", ENC_RM, {OPK_R64, OPK_RM8}, 0, REX_W, -1, OP2(0x0f, 0xbe)},
+    {"movsb", ENC_NONE, {}, 0, 0, -1, OP1(0xa4)},
+    {"movsw", ENC_RM, {OPK_R32, OPK_RM16}, 0, 0, -1, OP2(0x0f, 0xbf)},
+    {"movsw", ENC_RM, {OPK_R64, OPK_RM16}, 0, REX_W, -1, OP2(0x0f, 0xbf)},
+    {"movsw", ENC_NONE, {}, 0x66, 0, -1, OP1(0xa5)},
+    {"movsl", ENC_RM, {OPK_R64, OPK_RM32}, 0, REX_W, -1, OP1(0x63)},
+    {"movsl", ENC_NONE, {}, 0, 0, -1, OP1(0xa5)},
+    {"movsq", ENC_NONE, {}, 0, REX_W, -1, OP1(0xa5)},
+
+    STRING_FORMS("stos", 0xaa),
+    STRING_FORMS("lods", 0xac),
+    STRING_FORMS("scas", 0xae),
+    STRING_FORMS("cmps", 0xa6),
+
+    {"movbe", ENC_RM, {OPK_R16, OPK_M16}, 0x66, 0, -1, OP3(0x0f, 0x38, 0xf0)},
+    {"movbe", ENC_RM, {OPK_R32, OPK_M32}, 0, 0, -1, OP3(0x0f, 0x38, 0xf0)},
+    {"movbe", ENC_RM, {OPK_R64, OPK_M64}, 0, REX_W, -1, OP3(0x0f, 0x38, 0xf0)},
+    {"movbe", ENC_MR, {OPK_M16, OPK_R16}, 0x66, 0, -1, OP3(0x0f, 0x38, 0xf1)},
+    {"movbe", ENC_MR, {OPK_M32, OPK_R32}, 0, 0, -1, OP3(0x0f, 0x38, 0xf1)},
+    {"movbe", ENC_MR, {OPK_M64, OPK_R64}, 0, REX_W, -1, OP3(0x0f, 0x38, 0xf1)},
+
+    {"lea", ENC_RM, {OPK_R16, OPK_M}, 0x66, 0, -1, OP1(0x8d)},
+    {"lea", ENC_RM, {OPK_R32, OPK_M}, 0, 0, -1, OP1(0x8d)},
+    {"lea", ENC_RM, {OPK_R64, OPK_M}, 0, REX_W, -1, OP1(0x8d)},
+
+    {"xchg", ENC_MR, {OPK_RM8, OPK_R8}, 0, 0, -1, OP1(0x86)},
+    {"xchg", ENC_MR, {OPK_RM16, OPK_R16}, 0x66, 0, -1, OP1(0x87)},
+    {"xchg", ENC_MR, {OPK_RM32, OPK_R32}, 0, 0, -1, OP1(0x87)},
+    {"xchg", ENC_MR, {OPK_RM64, OPK_R64}, 0, REX_W, -1, OP1(0x87)},
+
+    XCHG_OP_FORMS("cmpxchg", 0xb0),
+    XCHG_OP_FORMS("xadd", 0xc0),
+
+    {"push", ENC_O, {OPK_R64}, 0, 0, -1, OP1(0x50), FORM_DEF64},
+    {"push", ENC_O, {OPK_R16}, 0x66, 0, -1, OP1(0x50)},
+    {"push", ENC_M, {OPK_RM64}, 0, 0, 6, OP1(0xff), FORM_DEF64},
+    {"push", ENC_I, {OPK_IMM32}, 0, 0, -1, OP1(0x68), FORM_DEF64},
+    {"push", ENC_I, {OPK_IMM8}, 0, 0, -1, OP1(0x6a), FORM_DEF64},
+
+    {"pop", ENC_O, {OPK_R64}, 0, 0, -1, OP1(0x58), FORM_DEF64},
+    {"pop", ENC_O, {OPK_R16}, 0x66, 0, -1, OP1(0x58)},
+    {"pop", ENC_M, {OPK_RM64}, 0, 0, 0, OP1(0x8f), FORM_DEF64},
+
+    CC_LIST(CMOVCC_FORMS),
+    CC_LIST(SETCC_FORMS),
+
+    {"cbtw", ENC_NONE, {}, 0x66, 0, -1, OP1(0x98)},
+    {"cwtl", ENC_NONE, {}, 0, 0, -1, OP1(0x98)},
+    {"cltq", ENC_NONE, {}, 0, REX_W, -1, OP1(0x98)},
+    {"cwtd", ENC_NONE, {}, 0x66, 0, -1, OP1(0x99)},
+    {"cltd", ENC_NONE, {}, 0, 0, -1, OP1(0x99)},
+    {"cqto", ENC_NONE, {}, 0, REX_W, -1, OP1(0x99)},
+
+    // Control flow
+
+    {"call", ENC_D, {OPK_REL32}, 0, 0, -1, OP1(0xe8), FORM_DEF64},
+    {"call", ENC_M, {OPK_RM64}, 0, 0, 2, OP1(0xff), FORM_DEF64},
+
+    {"jmp", ENC_D, {OPK_REL32}, 0, 0, -1, OP1(0xe9), FORM_DEF64},
+    {"jmp", ENC_D, {OPK_REL8}, 0, 0, -1, OP1(0xeb), FORM_DEF64},
+    {"jmp", ENC_M, {OPK_RM64}, 0, 0, 4, OP1(0xff), FORM_DEF64},
+
+    CC_LIST(JCC_FORMS),
+
+    {"ret", ENC_NONE, {}, 0, 0, -1, OP1(0xc3)},
+    {"ret", ENC_I, {OPK_IMM16}, 0, 0, -1, OP1(0xc2)},
+
+    {"leave", ENC_NONE, {}, 0, 0, -1, OP1(0xc9)},
+
+    // Miscellaneous
+
+    {"nop", ENC_NONE, {}, 0, 0, -1, OP1(0x90)},
+    {"nop", ENC_M, {OPK_RM16}, 0x66, 0, 0, OP2(0x0f, 0x1f)},
+    {"nop", ENC_M, {OPK_RM32}, 0, 0, 0, OP2(0x0f, 0x1f)},
+
+    {"hlt", ENC_NONE, {}, 0, 0, -1, OP1(0xf4)},
+    {"int3", ENC_NONE, {}, 0, 0, -1, OP1(0xcc)},
+    {"int", ENC_I, {OPK_IMM8}, 0, 0, -1, OP1(0xcd)},
+    {"ud2", ENC_NONE, {}, 0, 0, -1, OP2(0x0f, 0x0b)},
+    {"syscall", ENC_NONE, {}, 0, 0, -1, OP2(0x0f, 0x05)},
+    {"cpuid", ENC_NONE, {}, 0, 0, -1, OP2(0x0f, 0xa2)},
+    {"rdtsc", ENC_NONE, {}, 0, 0, -1, OP2(0x0f, 0x31)},
+    {"pause", ENC_NONE, {}, 0xf3, 0, -1, OP1(0x90)},
+    {"mfence", ENC_NONE, {}, 0, 0, -1, OP3(0x0f, 0xae, 0xf0)},
+    {"lfence", ENC_NONE, {}, 0, 0, -1, OP3(0x0f, 0xae, 0xe8)},
+    {"sfence", ENC_NONE, {}, 0, 0, -1, OP3(0x0f, 0xae, 0xf8)},
+    {"endbr64", ENC_NONE, {}, 0xf3, 0, -1, OP3(0x0f, 0x1e, 0xfa)},
+    {"prefetchnta", ENC_M, {OPK_M}, 0, 0, 0, OP2(0x0f, 0x18)},
+    {"prefetcht0", ENC_M, {OPK_M}, 0, 0, 1, OP2(0x0f, 0x18)},
+    {"prefetcht1", ENC_M, {OPK_M}, 0, 0, 2, OP2(0x0f, 0x18)},
+    {"prefetcht2", ENC_M, {OPK_M}, 0, 0, 3, OP2(0x0f, 0x18)},
+    {"prefetchw", ENC_M, {OPK_M}, 0, 0, 1, OP2(0x0f, 0x0d)},
+
+    // SSE
+
+    SSE_MOV_FORMS("movss", 0xf3, OPK_XMM_M32, 0x10, 0x11),
+    SSE_MOV_FORMS("movsd", 0xf2, OPK_XMM_M64, 0x10, 0x11),
+    SSE_MOV_FORMS("movaps", 0, OPK_XMM_M128, 0x28, 0x29),
+    SSE_MOV_FORMS("movups", 0, OPK_XMM_M128, 0x10, 0x11),
+    SSE_MOV_FORMS("movapd", 0x66, OPK_XMM_M128, 0x28, 0x29),
+    SSE_MOV_FORMS("movupd", 0x66, OPK_XMM_M128, 0x10, 0x11),
+    SSE_MOV_FORMS("movdqa", 0x66, OPK_XMM_M128, 0x6f, 0x7f),
+    SSE_MOV_FORMS("movdqu", 0xf3, OPK_XMM_M128, 0x6f, 0x7f),
+
+    {"movd", ENC_RM, {OPK_XMM, OPK_RM32}, 0x66, 0, -1, OP2(0x0f, 0x6e)},
+    {"movd", ENC_MR, {OPK_RM32, OPK_XMM}, 0x66, 0, -1, OP2(0x0f, 0x7e)},
+
+    // Memory goes through the forms without REX.W, as GNU as encodes it
+    {"movq", ENC_RM, {OPK_XMM, OPK_XMM_M64}, 0xf3, 0, -1, OP2(0x0f, 0x7e)},
+    {"movq", ENC_MR, {OPK_XMM_M64, OPK_XMM}, 0x66, 0, -1, OP2(0x0f, 0xd6)},
+    {"movq", ENC_RM, {OPK_XMM, OPK_RM64}, 0x66, REX_W, -1, OP2(0x0f, 0x6e)},
+    {"movq", ENC_MR, {OPK_RM64, OPK_XMM}, 0x66, REX_W, -1, OP2(0x0f, 0x7e)},
+
+    SSE_HALF_FORMS("movlps", 0, 0x12),
+    SSE_HALF_FORMS("movhps", 0, 0x16),
+    SSE_HALF_FORMS("movlpd", 0x66, 0x12),
+    SSE_HALF_FORMS("movhpd", 0x66, 0x16),
+    SSE_FORM("movhlps", 0, OPK_XMM, 0x12),
+    SSE_FORM("movlhps", 0, OPK_XMM, 0x16),
+
+    SSE_ARITH_FORMS("add", 0x58),
+    SSE_ARITH_FORMS("mul", 0x59),
+    SSE_ARITH_FORMS("sub", 0x5c),
+    SSE_ARITH_FORMS("min", 0x5d),
+    SSE_ARITH_FORMS("div", 0x5e),
+    SSE_ARITH_FORMS("max", 0x5f),
+    SSE_ARITH_FORMS("sqrt", 0x51),
+
+    SSE_LOGIC_FORMS("and", 0x54),
+    SSE_LOGIC_FORMS("andn", 0x55),
+    SSE_LOGIC_FORMS("or", 0x56),
+    SSE_LOGIC_FORMS("xor", 0x57),
+    SSE_LOGIC_FORMS("unpckl", 0x14),
+    SSE_LOGIC_FORMS("unpckh", 0x15),
+
+    SSE_FORM("ucomiss", 0, OPK_XMM_M32, 0x2e),
+    SSE_FORM("ucomisd", 0x66, OPK_XMM_M64, 0x2e),
+    SSE_FORM("comiss", 0, OPK_XMM_M32, 0x2f),
+    SSE_FORM("comisd", 0x66, OPK_XMM_M64, 0x2f),
+
+    SSE_CVTSI_FORMS("cvtsi2ss", 0xf3),
+    SSE_CVTSI_FORMS("cvtsi2sd", 0xf2),
+    SSE_CVTTSI_FORMS("cvttss2si", 0xf3, OPK_XMM_M32),
+    SSE_CVTTSI_FORMS("cvttsd2si", 0xf2, OPK_XMM_M64),
+    SSE_FORM("cvtss2sd", 0xf3, OPK_XMM_M32, 0x5a),
+    SSE_FORM("cvtsd2ss", 0xf2, OPK_XMM_M64, 0x5a),
+
+    SSE_INT_FORM("pxor", 0xef),
+    SSE_INT_FORM("por", 0xeb),
+    SSE_INT_FORM("pand", 0xdb),
+    SSE_INT_FORM("pandn", 0xdf),
+    SSE_INT_FORM("paddb", 0xfc),
+    SSE_INT_FORM("paddw", 0xfd),
+    SSE_INT_FORM("paddd", 0xfe),
+    SSE_INT_FORM("paddq", 0xd4),
+    SSE_INT_FORM("psubb", 0xf8),
+    SSE_INT_FORM("psubw", 0xf9),
+    SSE_INT_FORM("psubd", 0xfa),
+    SSE_INT_FORM("psubq", 0xfb),
+    SSE_INT_FORM("pcmpeqb", 0x74),
+    SSE_INT_FORM("pcmpeqw", 0x75),
+    SSE_INT_FORM("pcmpeqd", 0x76),
+    SSE_INT_FORM("pcmpgtb", 0x64),
+    SSE_INT_FORM("pcmpgtw", 0x65),
+    SSE_INT_FORM("pcmpgtd", 0x66),
+    SSE_INT_FORM("paddsb", 0xec),
+    SSE_INT_FORM("paddsw", 0xed),
+    SSE_INT_FORM("paddusb", 0xdc),
+    SSE_INT_FORM("paddusw", 0xdd),
+    SSE_INT_FORM("psubsb", 0xe8),
+    SSE_INT_FORM("psubsw", 0xe9),
+    SSE_INT_FORM("psubusb", 0xd8),
+    SSE_INT_FORM("psubusw", 0xd9),
+    SSE_INT_FORM("pmullw", 0xd5),
+    SSE_INT_FORM("pmulhw", 0xe5),
+    SSE_INT_FORM("pmulhuw", 0xe4),
+    SSE_INT_FORM("pmuludq", 0xf4),
+    SSE_INT_FORM("pmaddwd", 0xf5),
+    SSE_INT_FORM("pminub", 0xda),
+    SSE_INT_FORM("pmaxub", 0xde),
+    SSE_INT_FORM("pminsw", 0xea),
+    SSE_INT_FORM("pmaxsw", 0xee),
+    SSE_INT_FORM("pavgb", 0xe0),
+    SSE_INT_FORM("pavgw", 0xe3),
+    SSE_INT_FORM("psadbw", 0xf6),
+    SSE_INT_FORM("packsswb", 0x63),
+    SSE_INT_FORM("packuswb", 0x67),
+    SSE_INT_FORM("packssdw", 0x6b),
+    SSE_INT_FORM("punpcklbw", 0x60),
+    SSE_INT_FORM("punpcklwd", 0x61),
+    SSE_INT_FORM("punpckldq", 0x62),
+    SSE_INT_FORM("punpcklqdq", 0x6c),
+    SSE_INT_FORM("punpckhbw", 0x68),
+    SSE_INT_FORM("punpckhwd", 0x69),
+    SSE_INT_FORM("punpckhdq", 0x6a),
+    SSE_INT_FORM("punpckhqdq", 0x6d),
+
+    {"pmovmskb", ENC_RM, {OPK_R32, OPK_XMM}, 0x66, 0, -1, OP2(0x0f, 0xd7)},
+
+    SSE_SHIFT_FORMS("psrlw", 0xd1, 0x71, 2),
+    SSE_SHIFT_FORMS("psrld", 0xd2, 0x72, 2),
+    SSE_SHIFT_FORMS("psrlq", 0xd3, 0x73, 2),
+    SSE_SHIFT_FORMS("psraw", 0xe1, 0x71, 4),
+    SSE_SHIFT_FORMS("psrad", 0xe2, 0x72, 4),
+    SSE_SHIFT_FORMS("psllw", 0xf1, 0x71, 6),
+    SSE_SHIFT_FORMS("pslld", 0xf2, 0x72, 6),
+    SSE_SHIFT_FORMS("psllq", 0xf3, 0x73, 6),
+    {"psrldq", ENC_MI, {OPK_XMM, OPK_IMM8}, 0x66, 0, 3, OP2(0x0f, 0x73)},
+    {"pslldq", ENC_MI, {OPK_XMM, OPK_IMM8}, 0x66, 0, 7, OP2(0x0f, 0x73)},
+
+    {"shufps", ENC_RMI, {OPK_XMM, OPK_XMM_M128, OPK_IMM8}, 0, 0, -1, OP2(0x0f, 0xc6)},
+    {"shufpd", ENC_RMI, {OPK_XMM, OPK_XMM_M128, OPK_IMM8}, 0x66, 0, -1, OP2(0x0f, 0xc6)},
+    {"pshufd", ENC_RMI, {OPK_XMM, OPK_XMM_M128, OPK_IMM8}, 0x66, 0, -1, OP2(0x0f, 0x70)},
+    {"pshuflw", ENC_RMI, {OPK_XMM, OPK_XMM_M128, OPK_IMM8}, 0xf2, 0, -1, OP2(0x0f, 0x70)},
+    {"pshufhw", ENC_RMI, {OPK_XMM, OPK_XMM_M128, OPK_IMM8}, 0xf3, 0, -1, OP2(0x0f, 0x70)},
+};
+
+inline constexpr std::size_t NUM_FORMS = sizeof(FORMS) / sizeof(FORMS[0]);
+
+// Mnemonic table, one entry per run of forms with the same mnemonic
+
+constexpr std::size_t count_mnemonics()
+{
+    std::size_t count = 0;
+
+    for (std::size_t i = 0; i < NUM_FORMS; i++)
+    {
+        if (i == 0 || FORMS[i].mnemonic != FORMS[i - 1].mnemonic)
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+inline constexpr std::size_t NUM_MNEMONICS = count_mnemonics();
+
+constexpr std::array<Instruction, NUM_MNEMONICS> build_instructions()
+{
+    std::array<Instruction, NUM_MNEMONICS> instructions = {};
+    std::size_t count = 0;
+
+    for (std::size_t i = 0; i < NUM_FORMS; i++)
+    {
+        if (i == 0 || FORMS[i].mnemonic != FORMS[i - 1].mnemonic)
+        {
+            instructions[count++] = Instruction{FORMS[i].mnemonic, (uint16_t)(i), 0, form_size(FORMS[i]) != 0};
+        }
+
+        Instruction &instruction = instructions[count - 1];
+
+        instruction.num_forms++;
+        instruction.one_size = instruction.one_size && form_size(FORMS[i]) == form_size(FORMS[instruction.first_form]);
+    }
+
+    return instructions;
+}
+
+inline constexpr std::array<Instruction, NUM_MNEMONICS> INSTRUCTIONS = build_instructions();
+
+constexpr bool mnemonics_unique()
+{
+    for (std::size_t i = 0; i < NUM_MNEMONICS; i++)
+    {
+        if (INSTRUCTIONS[i].name.length() > PACKED_NAME_MAX)
+        {
+            return false;
+        }
+
+        for (std::size_t j = 0; j < i; j++)
+        {
+            if (INSTRUCTIONS[i].name == INSTRUCTIONS[j].name)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static_assert(mnemonics_unique(), "forms of a mnemonic must be contiguous");
+
+constexpr std::array<Packed_Name, NUM_MNEMONICS> mnemonic_keys()
+{
+    std::array<Packed_Name, NUM_MNEMONICS> keys = {};
+
+    for (std::size_t i = 0; i < NUM_MNEMONICS; i++)
+    {
+        keys[i] = pack_name(INSTRUCTIONS[i].name);
+    }
+
+    return keys;
+}
+
+inline constexpr Perfect_Hash<NUM_MNEMONICS> MNEMONIC_HASH = build_perfect_hash(mnemonic_keys());
+
+static_assert(MNEMONIC_HASH.ok, "no perfect hash found for the mnemonic table");
+
+// Registers
+
+#define RC_GP 0
+#define RC_XMM 1
+#define RC_RIP 2
+#define RC_SEG 3 // Segment register, only written as an override in front of a memory operand
+
+#define REG_NEED_REX 0x1 // spl, bpl, sil, dil are only reachable with a REX prefix
+#define REG_NO_REX 0x2   // ah, ch, dh, bh cannot be encoded with a REX prefix
+
+struct Register
+{
+    std::string_view name;
+    uint8_t num;  // Register number including the REX extension bit
+    uint8_t size; // Size in bytes
+    uint8_t reg_class;
+    uint8_t flags;
+};
+
+#define GP_REGS(q, d, w, b, num) \
+    {q, num, 8, RC_GP, 0}, {d, num, 4, RC_GP, 0}, {w, num, 2, RC_GP, 0}, {b, num, 1, RC_GP, 0}
+
+inline constexpr Register REGISTERS[] = {
+    GP_REGS("rax", "eax", "ax", "al", 0),
+    GP_REGS("rcx", "ecx", "cx", "cl", 1),
+    GP_REGS("rdx", "edx", "dx", "dl", 2),
+    GP_REGS("rbx", "ebx", "bx", "bl", 3),
+    {"rsp", 4, 8, RC_GP, 0}, {"esp", 4, 4, RC_GP, 0}, {"sp", 4, 2, RC_GP, 0}, {"spl", 4, 1, RC_GP, REG_NEED_REX},
+    {"rbp", 5, 8, RC_GP, 0}, {"ebp", 5, 4, RC_GP, 0}, {"bp", 5, 2, RC_GP, 0}, {"bpl", 5, 1, RC_GP, REG_NEED_REX},
+    {"rsi", 6, 8, RC_GP, 0}, {"esi", 6, 4, RC_GP, 0}, {"si", 6, 2, RC_GP, 0}, {"sil", 6, 1, RC_GP, REG_NEED_REX},
+    {"rdi", 7, 8, RC_GP, 0}, {"edi", 7, 4, RC_GP, 0}, {"di", 7, 2, RC_GP, 0}, {"dil", 7, 1, RC_GP, REG_NEED_REX},
+    {"ah", 4, 1, RC_GP, REG_NO_REX},
+    {"ch", 5, 1, RC_GP, REG_NO_REX},
+    {"dh", 6, 1, RC_GP, REG_NO_REX},
+    {"bh", 7, 1, RC_GP, REG_NO_REX},
+    GP_REGS("r8", "r8d", "r8w", "r8b", 8),
+    GP_REGS("r9", "r9d", "r9w", "r9b", 9),
+    GP_REGS("r10", "r10d", "r10w", "r10b", 10),
+    GP_REGS("r11", "r11d", "r11w", "r11b", 11),
+    GP_REGS("r12", "r12d", "r12w", "r12b", 12),
+    GP_REGS("r13", "r13d", "r13w", "r13b", 13),
+    GP_REGS("r14", "r14d", "r14w", "r14b", 14),
+    GP_REGS("r15", "r15d", "r15w", "r15b", 15),
+    {"xmm0", 0, 16, RC_XMM, 0}, {"xmm1", 1, 16, RC_XMM, 0}, {"xmm2", 2, 16, RC_XMM, 0}, {"xmm3", 3, 16, RC_XMM, 0},
+    {"xmm4", 4, 16, RC_XMM, 0}, {"xmm5", 5, 16, RC_XMM, 0}, {"xmm6", 6, 16, RC_XMM, 0}, {"xmm7", 7, 16, RC_XMM, 0},
+    {"xmm8", 8, 16, RC_XMM, 0}, {"xmm9", 9, 16, RC_XMM, 0}, {"xmm10", 10, 16, RC_XMM, 0}, {"xmm11", 11, 16, RC_XMM, 0},
+    {"xmm12", 12, 16, RC_XMM, 0}, {"xmm13", 13, 16, RC_XMM, 0}, {"xmm14", 14, 16, RC_XMM, 0}, {"xmm15", 15, 16, RC_XMM, 0},
+    {"rip", 0, 8, RC_RIP, 0},
+    {"es", 0, 2, RC_SEG, 0}, {"cs", 1, 2, RC_SEG, 0}, {"ss", 2, 2, RC_SEG, 0},
+    {"ds", 3, 2, RC_SEG, 0}, {"fs", 4, 2, RC_SEG, 0}, {"gs", 5, 2, RC_SEG, 0},
+};
+
+// Override prefix of each segment register, by number
+inline constexpr uint8_t SEGMENT_PREFIXES[] = {0x26, 0x2e, 0x36, 0x3e, 0x64, 0x65};
+
+inline constexpr std::size_t NUM_REGISTERS = sizeof(REGISTERS) / sizeof(REGISTERS[0]);
+
+constexpr std::array<Packed_Name, NUM_REGISTERS> register_keys()
+{
+    std::array<Packed_Name, NUM_REGISTERS> keys = {};
+
+    for (std::size_t i = 0; i < NUM_REGISTERS; i++)
+    {
+        keys[i] = pack_name(REGISTERS[i].name);
+    }
+
+    return keys;
+}
+
+inline constexpr Perfect_Hash<NUM_REGISTERS> REGISTER_HASH = build_perfect_hash(register_keys());
+
+static_assert(REGISTER_HASH.ok, "no perfect hash found for the register table");
+
+// Prefixes written as a word in front of a mnemonic
+
+#define PREFIX_LOCK 0xf0
+#define PREFIX_REPNZ 0xf2
+#define PREFIX_REP 0xf3
+
+struct Prefix
+{
+    std::string_view name;
+    uint8_t byte;
+    bool segment; // A segment override, which goes in Instr::segment rather than Instr::prefix
+    bool raw;     // A byte written in front of the instruction as it is, as GCC pads TLS calls
+};
+
+inline constexpr Prefix PREFIXES[] = {
+    {"lock", PREFIX_LOCK, false},
+    {"rep", PREFIX_REP, false},
+    {"repe", PREFIX_REP, false},
+    {"repz", PREFIX_REP, false},
+    {"repne", PREFIX_REPNZ, false},
+    {"repnz", PREFIX_REPNZ, false},
+    {"data16", 0x66, false, true},
+    {"rex64", 0x48, false, true},
+    {"es", 0x26, true},
+    {"cs", 0x2e, true},
+    {"ss", 0x36, true},
+    {"ds", 0x3e, true},
+    {"fs", 0x64, true},
+    {"gs", 0x65, true},
+};
+
+inline constexpr std::size_t NUM_PREFIXES = sizeof(PREFIXES) / sizeof(PREFIXES[0]);
+
+constexpr std::array<Packed_Name, NUM_PREFIXES> prefix_keys()
+{
+    std::array<Packed_Name, NUM_PREFIXES> keys = {};
+
+    for (std::size_t i = 0; i < NUM_PREFIXES; i++)
+    {
+        keys[i] = pack_name(PREFIXES[i].name);
+    }
+
+    return keys;
+}
+
+inline constexpr Perfect_Hash<NUM_PREFIXES> PREFIX_HASH = build_perfect_hash(prefix_keys());
+
+static_assert(PREFIX_HASH.ok, "no perfect hash found for the prefix table");
+
+// Lookups, these never compare strings
+
+constexpr const Instruction *find_instruction(std::string_view name)
+{
+    uint32_t idx = MNEMONIC_HASH.find(name);
+
+    return idx == PERFECT_HASH_NOT_FOUND ? nullptr : &INSTRUCTIONS[idx];
+}
+
+constexpr const Register *find_register(std::string_view name)
+{
+    uint32_t idx = REGISTER_HASH.find(name);
+
+    return idx == PERFECT_HASH_NOT_FOUND ? nullptr : &REGISTERS[idx];
+}
+
+constexpr const Prefix *find_prefix(std::string_view name)
+{
+    uint32_t idx = PREFIX_HASH.find(name);
+
+    return idx == PERFECT_HASH_NOT_FOUND ? nullptr : &PREFIXES[idx];
+}
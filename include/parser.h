@@ -0,0 +1,185 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include <object.h>
+#include <lexer.h>
+#include <relax.h>
+#include <thread_pool.h>
+
+// The source is split into chunks at function and section boundaries. A
+// sequential prescan creates sections and constants while splitting, then
+// every chunk is parsed into its own Unit in parallel. Units only refer to
+// their own labels, and positions are kept relative to the items whose size
+// depends on the final layout (alignment padding and branches to labels).
+// Once every chunk is parsed the items of each section are sized by relax and
+// the units are merged into the object in source order. Chunking does not
+// depend on the number of threads, which makes the output the same for any
+// thread count.
+
+#define CHUNK_SIZE 0x40000      // Target chunk size in bytes of source
+#define CHUNK_ANCHOR_BYTES 64   // Source hashed at a boundary to pick where chunks end
+#define CHUNK_ANCHOR_MASK 0x3ff // About one boundary in 1024 ends a chunk
+#define UNIT_NONE 0xffffffff
+
+struct Chunk
+{
+    std::string_view text;
+    uint32_t first_line;
+    Sect_Handle section; // Section in use at the start of the chunk
+};
+
+// Byte offset in a unit section together with the number of variable sized
+// items before it, the sizes of which are only known when merging
+struct Unit_Pos
+{
+    uint32_t offset;
+    uint32_t vars;
+};
+
+#define UVAR_GUARD_NEXT 0x1 // RVAR_BOUNDARY: the branch right after the guarded bytes is guarded too
+#define UVAR_BINARY 0x2     // RVAR_FILL: bytes of a file .incbin mapped rather than a repeated value
+
+// Alignment padding, padding before a jump, a jmp/jcc to a label that takes
+// the short form when the target is in reach, or a long run of one value or
+// of file bytes that is never copied into the unit
+struct Unit_Var
+{
+    uint32_t offset;
+    uint8_t kind;   // RVAR_ALIGN, RVAR_BRANCH, RVAR_BOUNDARY or RVAR_FILL
+    uint8_t fill;   // RVAR_ALIGN
+    uint8_t opcode; // RVAR_BRANCH: short form opcode, 0xeb or 0x70 + condition
+    uint8_t guard;  // RVAR_BOUNDARY: bytes after the item kept off the boundary
+    uint8_t flags;
+    uint8_t width;  // RVAR_FILL: bytes in the repeated value
+    uint32_t alignment;
+    uint32_t max;   // Largest padding allowed, 0 for no limit
+    uint32_t label; // RVAR_BRANCH target, RVAR_FILL with UVAR_BINARY: index in Unit::binaries
+    uint32_t size;  // RVAR_FILL
+    int64_t addend; // RVAR_FILL: the repeated value, or with UVAR_BINARY the offset in the file
+};
+
+#define UFIX_RELOC 0 // Relocation against a label, the addend is already in the data
+#define UFIX_DIFF 1  // Difference of two labels, written once every label is placed
+#define UFIX_DONE 2  // Difference patched in place while parsing, dropped when the chunk ends
+
+// How a UFIX_DIFF is written. A LEB128 difference is padded to the size of
+// the field, which is reserved before the labels are placed
+#define DIFF_FIXED 0
+#define DIFF_ULEB128 1
+#define DIFF_SLEB128 2
+#define LEB128_DIFF_SIZE 4 // Bytes of a .uleb128 or .sleb128 of a label difference
+
+struct Unit_Fixup
+{
+    Unit_Pos pos;
+    uint8_t kind;
+    uint8_t size;
+    uint16_t type; // Relocation type for UFIX_RELOC, DIFF_ value for UFIX_DIFF
+    uint32_t label;
+    uint32_t sub_label; // Label subtracted for UFIX_DIFF
+    int64_t addend;
+    uint32_t line;
+};
+
+// An unwind directive, placed where it appeared in the code
+struct Unit_Frame
+{
+    Unit_Pos pos;
+    uint32_t section; // Index into Unit::sections
+    uint32_t line;
+    uint8_t op;       // FRAME_*
+    uint8_t reg;
+    uint32_t label;   // Unit label, UNIT_NONE if the op has none
+    int64_t value;
+};
+
+// What one chunk adds to one section
+struct Unit_Section
+{
+    Sect_Handle section;
+    std::vector<uint8_t> data;
+    uint32_t size = 0; // Including reserved bss space
+    std::vector<Unit_Var> vars;
+    std::vector<Unit_Fixup> fixups;
+    std::vector<Instr_Record> instrs; // Recorded with Object::verify. Offsets are in the unit section until merged
+    std::vector<uint32_t> instr_vars; // Unit_Pos::vars of each of instrs
+    std::vector<Instr_Target> targets; // Of unit labels until merged, then moved with instrs into an Instr_Run
+    uint64_t fixed_base = 0; // Position in the section's item stream, assigned when merging
+    uint32_t var_base = 0;
+};
+
+#define ULABEL_LOCAL 0x80    // Named by .local, so a later .comm allocates it like .lcomm
+#define ULABEL_NUMERIC 0x40  // One definition of a numeric label such as 1:, named by its number
+#define ULABEL_BACKWARD 0x20 // Numeric label referred to as Nb before any N: in the chunk
+
+// A numeric label is a separate Unit_Label for each definition, kept out of
+// the label index. References resolve to the last definition (Nb) or to an
+// entry the next definition takes over (Nf). A reference that reaches past
+// the chunk is left undefined and resolved when the units are merged
+struct Unit_Label
+{
+    std::string_view name;
+    uint32_t section; // Index into Unit::sections
+    Unit_Pos pos;
+    uint32_t line;    // Where it was defined, for duplicate definitions found when merging, or
+                      // first referred to for a numeric label the chunk does not define
+    int64_t value;    // Value for LABEL_ABSOLUTE, size for LABEL_COMMON, offset for LABEL_ALIAS
+    uint8_t flags;
+    uint8_t storage_class;
+    uint16_t type;
+    uint32_t alias;   // Unit label a LABEL_ALIAS is relative to
+    uint8_t visibility; // STV_ value
+    uint8_t elf_info; // As in Label
+    uint32_t global;  // Object label, assigned when merging
+};
+
+// A .size, end - start + value, or just value if end is UNIT_NONE. The
+// labels are only placed when merging
+struct Unit_Size
+{
+    uint32_t label;
+    uint32_t end;
+    uint32_t start;
+    uint32_t line;
+    int64_t value;
+};
+
+struct Unit
+{
+    std::vector<Unit_Section> sections;
+    std::vector<uint32_t> section_map; // Object section index to unit section, UNIT_NONE if unused
+    std::vector<Unit_Label> labels;
+    Name_Index label_index = {};
+    std::vector<std::string_view> files; // Names given by .file
+    std::vector<Unit_Frame> frames;      // Unwind directives in source order
+    std::vector<Unit_Size> sizes;        // In source order
+    Name_Pool names = {};                // Text joined by macro expansion
+    uint64_t num_instrs = 0;
+    Enc_Size_Stats size_stats = {}; // Bytes the choice of encodings saved
+    std::vector<std::unique_ptr<Source_File>> binaries; // Files mapped by .incbin
+    std::string messages; // Errors of the chunk, printed by merge_units in chunk order
+    bool ok = true;
+};
+
+// Splits source into chunks of about chunk_size bytes, creating sections and
+// constants in obj on the way
+bool split_source(std::string_view source, std::string_view file, Object &obj, std::vector<Chunk> &chunks, std::size_t chunk_size = CHUNK_SIZE);
+
+// Parses one chunk. obj is only read, so chunks can be parsed concurrently
+void parse_chunk(const Chunk &chunk, std::string_view file, const Object &obj, Unit &unit);
+
+// Merges parsed units into obj in source order, sizing branches and alignment
+// and resolving label differences. The units are released as they are merged
+bool merge_units(std::vector<Unit> &units, std::string_view file, Object &obj);
+
+struct Asm_Cache;
+
+// Assembles AT&T syntax source into obj using the threads of pool. Labels keep
+// views into source, so it must stay mapped until the object has been written.
+// Errors are printed with the file name and line and make the result false.
+// With a cache, chunks assembled before are loaded instead of parsed
+bool assemble_source(std::string_view source, std::string_view file, Object &obj, Thread_Pool &pool, Asm_Cache *cache = nullptr);
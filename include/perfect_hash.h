@@ -0,0 +1,200 @@
+#pragma once
+
+// Compile-time perfect hashing for short fixed key sets (mnemonics, register
+// names). Keys of up to 16 characters are packed into two 64-bit words so a
+// lookup is one hash, one table probe and two integer compares.
+//
+// The table is built with hash and displace: keys are grouped into buckets by
+// a first hash, then each bucket, largest first, is given the smallest seed
+// that moves all of its keys into free slots of the final table.
+
+#include <array>
+#include <string_view>
+#include <cstdint>
+
+#define PACKED_NAME_MAX 16
+#define PERFECT_HASH_NOT_FOUND 0xffffffff
+
+struct Packed_Name
+{
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+
+    constexpr bool operator==(const Packed_Name &other) const
+    {
+        return lo == other.lo && hi == other.hi;
+    }
+};
+
+// Names longer than PACKED_NAME_MAX have the characters past it folded into
+// the high word, with its top bit set so they never match a shorter name.
+// Two long names may pack the same, so a table with long keys compares the
+// name it finds
+constexpr Packed_Name pack_name(std::string_view str)
+{
+    Packed_Name packed = {};
+
+    for (std::size_t i = 0; i < str.length() && i < PACKED_NAME_MAX; i++)
+    {
+        uint64_t c = (uint8_t)(str[i]);
+
+        if (i < 8)
+        {
+            packed.lo |= c << (i * 8);
+        }
+        else
+        {
+            packed.hi |= c << ((i - 8) * 8);
+        }
+    }
+
+    for (std::size_t i = PACKED_NAME_MAX; i < str.length(); i++)
+    {
+        packed.hi = (packed.hi ^ (uint8_t)(str[i])) * 0x100000001b3;
+    }
+
+    if (str.length() > PACKED_NAME_MAX)
+    {
+        packed.hi |= (uint64_t)(1) << 63;
+    }
+
+    return packed;
+}
+
+constexpr uint64_t mix_name(Packed_Name key, uint64_t seed)
+{
+    uint64_t hash = (key.lo ^ (seed * 0x9e3779b97f4a7c15)) * 0xbf58476d1ce4e5b9;
+    hash ^= hash >> 31;
+    hash += key.hi * 0x94d049bb133111eb;
+    hash ^= hash >> 29;
+    hash *= 0xc2b2ae3d27d4eb4f;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+template <std::size_t N>
+struct Perfect_Hash
+{
+    static constexpr std::size_t SLOTS = N * 2;
+    static constexpr std::size_t BUCKETS = N / 2 + 1;
+
+    std::array<uint16_t, BUCKETS> seeds = {};
+    std::array<uint16_t, SLOTS> values = {}; // Key index + 1, 0 = empty slot
+    std::array<Packed_Name, SLOTS> keys = {};
+    bool ok = false;
+
+    constexpr uint32_t find(Packed_Name key) const
+    {
+        std::size_t bucket = mix_name(key, 0) % BUCKETS;
+        std::size_t slot = mix_name(key, seeds[bucket] + 1) % SLOTS;
+
+        if (values[slot] != 0 && keys[slot] == key)
+        {
+            return values[slot] - 1;
+        }
+
+        return PERFECT_HASH_NOT_FOUND;
+    }
+
+    constexpr uint32_t find(std::string_view name) const
+    {
+        return find(pack_name(name));
+    }
+};
+
+template <std::size_t N>
+constexpr Perfect_Hash<N> build_perfect_hash(const std::array<Packed_Name, N> &keys)
+{
+    using Hash = Perfect_Hash<N>;
+
+    Hash hash = {};
+    std::array<uint16_t, Hash::BUCKETS> bucket_size = {};
+    std::array<uint16_t, N> bucket_of = {};
+    std::size_t max_size = 0;
+
+    for (std::size_t i = 0; i < N; i++)
+    {
+        bucket_of[i] = mix_name(keys[i], 0) % Hash::BUCKETS;
+        bucket_size[bucket_of[i]]++;
+
+        if (bucket_size[bucket_of[i]] > max_size)
+        {
+            max_size = bucket_size[bucket_of[i]];
+        }
+    }
+
+    for (std::size_t size = max_size; size > 0; size--)
+    {
+        for (std::size_t bucket = 0; bucket < Hash::BUCKETS; bucket++)
+        {
+            if (bucket_size[bucket] != size)
+            {
+                continue;
+            }
+
+            bool placed = false;
+
+            for (uint32_t seed = 0; seed < 0xffff && !placed; seed++)
+            {
+                std::array<std::size_t, N> slots = {};
+                std::size_t count = 0;
+                bool fits = true;
+
+                for (std::size_t i = 0; i < N && fits; i++)
+                {
+                    if (bucket_of[i] != bucket)
+                    {
+                        continue;
+                    }
+
+                    std::size_t slot = mix_name(keys[i], seed + 1) % Hash::SLOTS;
+
+                    if (hash.values[slot] != 0)
+                    {
+                        fits = false;
+                    }
+
+                    for (std::size_t j = 0; j < count && fits; j++)
+                    {
+                        if (slots[j] == slot)
+                        {
+                            fits = false;
+                        }
+                    }
+
+                    slots[count++] = slot;
+                }
+
+                if (!fits)
+                {
+                    continue;
+                }
+
+                count = 0;
+
+                for (std::size_t i = 0; i < N; i++)
+                {
+                    if (bucket_of[i] == bucket)
+                    {
+                        hash.values[slots[count]] = i + 1;
+                        hash.keys[slots[count]] = keys[i];
+                        count++;
+                    }
+                }
+
+                hash.seeds[bucket] = seed;
+                placed = true;
+            }
+
+            if (!placed)
+            {
+                return hash;
+            }
+        }
+    }
+
+    hash.ok = true;
+
+    return hash;
+}
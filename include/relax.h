@@ -0,0 +1,64 @@
+#pragma once
+
+// Sizing of the variable length items of a section (alignment padding,
+// padding that keeps jumps off a boundary, and branches that have a short and
+// a long form).
+//
+// A section is described as a stream of fixed bytes with items between them.
+// Every branch starts in its short form and only branches whose displacement
+// does not fit are grown. Plain passes over the section run while many
+// branches grow at once. After that addresses are kept in a Fenwick tree over
+// the item sizes, and when an item changes size only the short branches that
+// can span it are checked again: a short branch covers at most 128 bytes, so
+// those are the few branches within that distance of the change. The work is
+// therefore close to linear in the number of branches even when every growth
+// causes another, instead of a full relayout of the section per growth.
+
+#include <vector>
+#include <cstdint>
+
+#define RVAR_ALIGN 0
+#define RVAR_BRANCH 1
+#define RVAR_BOUNDARY 2 // Padding that keeps the instructions after it from crossing or ending on a boundary
+#define RVAR_FILL 3     // Bytes of a known size kept out of the fixed bytes, such as a long .space
+
+#define RELAX_NONE 0xffffffff
+
+struct Relax_Var
+{
+    uint64_t fixed; // Fixed bytes before the item
+    uint8_t kind;
+    uint32_t size;  // Current size, final once relax has returned. Set beforehand for RVAR_FILL
+
+    // RVAR_ALIGN, and RVAR_BOUNDARY with the boundary in alignment
+    uint32_t alignment;
+    uint32_t max; // Largest padding allowed, 0 for no limit
+
+    // RVAR_BOUNDARY, the guarded bytes are fixed ones and the branch item
+    // right after when guard_next is set
+    uint8_t guard;
+    bool guard_next;
+
+    // RVAR_BRANCH, a branch that cannot be relaxed has short_size equal to long_size
+    uint8_t short_size;
+    uint8_t long_size;
+    uint64_t target_fixed; // Target position: fixed bytes and items before it
+    uint32_t target_var;
+    int64_t addend;
+};
+
+struct Relax_Stats
+{
+    uint64_t branches = 0;       // Branches that could use either form
+    uint64_t short_branches = 0; // Branches left in the short form
+    uint64_t checks = 0;         // Displacement checks performed
+};
+
+uint32_t align_padding(uint64_t address, uint32_t alignment, uint32_t max);
+
+// Padding that moves length bytes at address to the next boundary if they
+// would otherwise cross or end on it
+uint32_t boundary_padding(uint64_t address, uint32_t boundary, uint32_t length);
+
+// Sizes every item. Branches only ever grow, so this always terminates
+void relax(std::vector<Relax_Var> &vars, Relax_Stats &stats);
@@ -0,0 +1,67 @@
+#pragma once
+
+// Resident assembler. The server listens on a Unix domain socket and serves
+// each connection on one of a fixed set of threads, which assemble the
+// requests they are given start to finish, so the section memory of one
+// request is reused by the next and no process or thread is started per file.
+//
+// A connection carries any number of requests, each answered in turn. A
+// request is a Server_Request followed by the input name, the output path
+// and, for SERVE_INLINE, the source text. Paths are used as given, so
+// clients send absolute ones. The reply is a Server_Reply followed by the
+// messages printed while assembling and, for SERVE_REPLY, the object.
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+#define SERVER_DEFAULT_SOCKET "/tmp/assembler.sock"
+#define SERVER_REQUEST_MAGIC "ASMQ"
+#define SERVER_REPLY_MAGIC "ASMR"
+#define SERVER_MAX_PATH 4096
+#define SERVER_MAX_SOURCE ((uint64_t)(1) << 32)
+
+#define SERVE_ELF 0x1    // ELF rather than COFF
+#define SERVE_INLINE 0x2 // The source follows the request, the input only names it in messages
+#define SERVE_REPLY 0x4  // The object is sent back instead of written to the output
+#define SERVE_STOP 0x8   // Stops the server, nothing is assembled
+
+struct Server_Request
+{
+    char magic[4];
+    uint32_t flags;
+    uint32_t input_length;
+    uint32_t output_length; // 0 for the input's name with .obj or .o
+    uint64_t source_length; // SERVE_INLINE
+};
+
+struct Server_Reply
+{
+    char magic[4];
+    uint32_t ok;
+    uint32_t message_length;
+    uint32_t reserved;
+    uint64_t object_length;
+};
+
+// Serves requests on path with num_threads threads until a stop request.
+// False if the socket cannot be set up
+bool run_server(const std::string &path, std::size_t num_threads);
+
+// Client side
+
+// Connected socket, -1 with a message printed if there is no server at path
+int connect_server(const std::string &path);
+
+// Sends one request and reads its reply. False if the connection failed,
+// otherwise reply.ok tells whether the request succeeded
+bool call_server(int fd, uint32_t flags, std::string_view input, std::string_view output, std::string_view source, Server_Reply &reply,
+                 std::string &messages, std::vector<uint8_t> &object);
+
+void close_server(int fd);
+
+// Whole buffers over a socket, false once the connection is closed
+bool send_all(int fd, const void *data, std::size_t size);
+
+bool recv_all(int fd, void *data, std::size_t size);
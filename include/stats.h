@@ -0,0 +1,99 @@
+#pragma once
+
+// Phase timing and counters behind --stats and --trace. A phase is timed by
+// a scoped Phase_Timer, which only reads the clock when statistics were asked
+// for, and is kept as an event for the Chrome trace. Counters are totals
+// collected from the tables once assembly is done, apart from the section
+// append count and the relocations resolved while merging, which are kept as
+// they happen.
+//
+// Building with -DASSEMBLER_STATS=0 turns PHASE and STAT_INC into nothing.
+
+#include <chrono>
+#include <vector>
+#include <string>
+#include <ostream>
+#include <mutex>
+#include <cstdint>
+
+#include <encoder.h>
+
+#ifndef ASSEMBLER_STATS
+#define ASSEMBLER_STATS 1
+#endif
+
+struct Trace_Event
+{
+    const char *name; // Static string
+    uint32_t tid;     // Threads are numbered in the order they first record a phase
+    uint64_t start;   // Microseconds since Stats::origin
+    uint64_t duration;
+};
+
+struct Stats
+{
+    bool enabled = false;
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    std::mutex mutex; // Phases run on pool threads add events concurrently
+    std::vector<Trace_Event> events;
+
+    uint64_t input_bytes = 0;
+    uint64_t output_bytes = 0;
+    uint64_t chunks = 0;
+    uint64_t instructions = 0;
+    uint64_t labels = 0;
+    uint64_t symbols = 0;
+    uint64_t relocations = 0;
+    uint64_t resolved_relocations = 0; // PC-relative references to the same section written as displacements
+    uint64_t str_tab_bytes = 0;
+    uint64_t str_tab_requested = 0; // String bytes added, before deduplication and suffix merging
+    uint64_t str_tab_emitted = 0;   // String bytes written once both were done
+    uint64_t section_appends = 0;
+    uint64_t section_chunks = 0; // Arena chunks allocated for section data
+    uint64_t branches = 0;
+    uint64_t short_branches = 0;
+    uint64_t cache_hits = 0;
+    uint64_t cache_misses = 0;
+    Enc_Size_Stats sizes = {}; // Kept even without statistics, for --size-stats
+};
+
+// Small number for the calling thread, stable for its lifetime
+uint32_t stats_thread_id();
+
+struct Phase_Timer
+{
+    Stats &stats;
+    const char *name;
+    std::chrono::steady_clock::time_point start;
+
+    Phase_Timer(Stats &stats, const char *name);
+    ~Phase_Timer();
+
+    Phase_Timer(const Phase_Timer &) = delete;
+    Phase_Timer &operator=(const Phase_Timer &) = delete;
+};
+
+// Adds the phases and counters of stats to total, with the phases moved to
+// the clock of total. Several threads may add to one total
+void add_stats(Stats &total, const Stats &stats);
+
+// Summary of the phases and counters, phases that ran on several threads are
+// summed
+void print_stats(const Stats &stats, std::ostream &os);
+
+// Instructions and bytes each shortest encoding rule saved
+void print_size_stats(const Stats &stats, std::ostream &os);
+
+// Chrome trace event format, load with chrome://tracing or Perfetto
+bool write_trace(const Stats &stats, const std::string &path);
+
+#define STATS_JOIN2(a, b) a##b
+#define STATS_JOIN(a, b) STATS_JOIN2(a, b)
+
+#if ASSEMBLER_STATS
+#define PHASE(stats, name) Phase_Timer STATS_JOIN(phase_timer_, __LINE__)(stats, name)
+#define STAT_INC(counter) ((counter)++)
+#else
+#define PHASE(stats, name) ((void)0)
+#define STAT_INC(counter) ((void)0)
+#endif
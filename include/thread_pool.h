@@ -0,0 +1,54 @@
+#pragma once
+
+// Work stealing thread pool. Each worker owns a queue of task indices and
+// takes from its back; a worker that runs dry steals from the front of the
+// other queues. The calling thread is worker 0, so a pool of one thread runs
+// everything inline.
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <cstdint>
+
+struct Work_Queue
+{
+    std::mutex mutex;
+    std::deque<std::size_t> tasks;
+};
+
+struct Thread_Pool
+{
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<Work_Queue>> queues;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(std::size_t)> *task = nullptr;
+    uint64_t generation = 0;
+    std::atomic<std::size_t> remaining = 0;
+    bool stopping = false;
+
+    explicit Thread_Pool(std::size_t num_threads = 1);
+    ~Thread_Pool();
+
+    Thread_Pool(const Thread_Pool &) = delete;
+    Thread_Pool &operator=(const Thread_Pool &) = delete;
+
+    std::size_t size() const
+    {
+        return queues.size();
+    }
+
+    // Calls task(i) for every i below count and returns once all have finished
+    void run(std::size_t count, const std::function<void(std::size_t)> &task);
+
+private:
+    void worker(std::size_t id);
+    void drain(std::size_t id);
+    bool next_task(std::size_t id, std::size_t &task_idx);
+};
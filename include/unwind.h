@@ -0,0 +1,97 @@
+#pragma once
+
+// Unwind tables built from the unwind directives of the source
+//
+// The parser keeps every .seh_* directive as a Frame_Op at its place in the
+// code and merging gives each its final offset, so the tables are built once
+// the layout is known. For COFF output every .seh_proc gets an UNWIND_INFO in
+// .xdata and a RUNTIME_FUNCTION in .pdata, both referring to the code with
+// image relative relocations. An UNWIND_INFO whose function has handler data
+// goes in the space .seh_handlerdata reserved in front of that data, the
+// others are appended to .xdata.
+//
+// Every .cfi_startproc gets an FDE in .eh_frame, for both formats, in the
+// layout GNU as writes. An FDE shares a CIE that has the same personality and
+// encodings and whose instructions start those of the FDE. A new CIE takes the
+// instructions before the first that follows code.
+
+#include <string_view>
+
+#include <object.h>
+
+// Unwind operations of the x64 exception handling ABI
+#define UWOP_PUSH_NONVOL 0
+#define UWOP_ALLOC_LARGE 1
+#define UWOP_ALLOC_SMALL 2
+#define UWOP_SET_FPREG 3
+#define UWOP_SAVE_NONVOL 4
+#define UWOP_SAVE_NONVOL_FAR 5
+#define UWOP_SAVE_XMM128 8
+#define UWOP_SAVE_XMM128_FAR 9
+#define UWOP_PUSH_MACHFRAME 10
+
+#define UNW_VERSION 1
+#define UNW_FLAG_EHANDLER 0x1 // The handler is called to look for an exception handler
+#define UNW_FLAG_UHANDLER 0x2 // The handler is called while unwinding
+
+#define UNW_MAX_SLOTS 255      // Unwind code slots an UNWIND_INFO can hold
+#define UNW_MAX_PROLOGUE 255   // Bytes of prologue an unwind code offset reaches
+#define UNW_MAX_FRAME_OFFSET 240 // Largest offset of the frame register from rsp
+
+// DWARF call frame instructions
+#define DW_CFA_ADVANCE_LOC 0x40 // Low 6 bits are the delta
+#define DW_CFA_OFFSET 0x80      // Low 6 bits are the register
+#define DW_CFA_RESTORE 0xc0     // Low 6 bits are the register
+#define DW_CFA_NOP 0x00
+#define DW_CFA_ADVANCE_LOC1 0x02
+#define DW_CFA_ADVANCE_LOC2 0x03
+#define DW_CFA_ADVANCE_LOC4 0x04
+#define DW_CFA_OFFSET_EXTENDED 0x05
+#define DW_CFA_RESTORE_EXTENDED 0x06
+#define DW_CFA_UNDEFINED 0x07
+#define DW_CFA_SAME_VALUE 0x08
+#define DW_CFA_REGISTER 0x09
+#define DW_CFA_REMEMBER_STATE 0x0a
+#define DW_CFA_RESTORE_STATE 0x0b
+#define DW_CFA_DEF_CFA 0x0c
+#define DW_CFA_DEF_CFA_REGISTER 0x0d
+#define DW_CFA_DEF_CFA_OFFSET 0x0e
+#define DW_CFA_OFFSET_EXTENDED_SF 0x11
+#define DW_CFA_DEF_CFA_SF 0x12
+#define DW_CFA_DEF_CFA_OFFSET_SF 0x13
+
+// Pointer encodings of the personality, LSDA and FDE addresses
+#define DW_EH_PE_ABSPTR 0x00
+#define DW_EH_PE_UDATA4 0x03
+#define DW_EH_PE_UDATA8 0x04
+#define DW_EH_PE_SDATA4 0x0b
+#define DW_EH_PE_SDATA8 0x0c
+#define DW_EH_PE_FORMAT 0x0f    // The bits above give the size
+#define DW_EH_PE_PCREL 0x10
+#define DW_EH_PE_INDIRECT 0x80  // The address holds a pointer to the value
+#define DW_EH_PE_OMIT 0xff
+
+#define DWARF_RSP 7
+#define DWARF_RETURN_REG 16    // The return address column
+#define DWARF_XMM0 17          // xmm1 to xmm15 follow
+#define DWARF_MAX_REG 255
+#define DWARF_DATA_ALIGN 8     // Save offsets are factored by -8
+#define EH_FRAME_ALIGN 4       // CIEs and FDEs are padded to this, the last FDE to 8
+
+// Unwind code slots an operation takes
+uint32_t seh_slots(uint8_t op, int64_t value);
+
+// Bytes of the UNWIND_INFO for a prologue of slots slots
+uint32_t seh_info_size(uint32_t slots, bool handler);
+
+// Bytes of a pointer in encoding, 0 for one that is not supported
+uint32_t dwarf_pointer_size(uint8_t encoding);
+
+// Finds or creates an unwind table section, read only data aligned to 4
+// bytes unless alignment gives other IMAGE_SCN_ALIGN_ bits
+Sect_Handle unwind_section(Object &obj, std::string_view name, uint32_t alignment = IMAGE_SCN_ALIGN_4BYTES);
+
+// Builds the unwind tables of obj for the output format. False with a
+// message for the line of any directive that has no encoding, or for SEH
+// directives in an ELF object
+bool build_unwind_tables(Object &obj, std::string_view file, bool elf);
@@ -0,0 +1,36 @@
+#pragma once
+
+// Round trip check of assembled code, run by --verify
+//
+// With Object::verify set the parser records every instruction with the form
+// it was encoded with, a hash of its operands as written and the label its
+// branch or RIP relative operand refers to, and a hash of the bytes it was
+// encoded to. Merging gives each record its offset in the section and moves
+// the records of each chunk into an Instr_Run. verify_object then decodes
+// every recorded instruction from the section bytes and checks that
+//   - it decodes, to the length that was recorded
+//   - the form decoded is encoded like the one recorded (a branch sized by
+//     relax may take either its rel32 or its rel8 form)
+//   - the decoded operands hash like the written ones, and relocations are
+//     only on operands that referred to a symbol
+//   - a branch or RIP relative field reaches its label, by the distance or
+//     through a relocation against the label's symbol
+//   - the bytes hash like the ones encoded, fields referring to a symbol
+//     zeroed, or else encoding the decoded operands again gives the same
+//     bytes, with a fixup exactly where the section has a relocation
+//     (branches aside, whose displacement is checked against the label)
+// Fields under a relocation only count as referring to a symbol, their value
+// being up to the linker. Runs are checked in blocks on the threads of
+// the pool, and the messages are printed from the calling thread in source
+// order.
+
+#include <string_view>
+
+#include <object.h>
+#include <thread_pool.h>
+
+#define VERIFY_BLOCK 0x4000 // Instructions checked by one task
+
+// Prints a message with the line of every instruction that does not round
+// trip and returns false if there was one. Call once the units are merged
+bool verify_object(const Object &obj, std::string_view file, Thread_Pool &pool);
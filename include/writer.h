@@ -0,0 +1,87 @@
+#pragma once
+
+// Output file model. The object writers lay out every region of the file
+// up front, the regions are then written straight from the buffers that own
+// them without first being gathered into a single copy of the file
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include <arena.h>
+
+struct Out_Region
+{
+    const void *data;
+    std::size_t size;
+    uint64_t offset;
+    int fd = -1; // A file data is a mapping of, copied from the file by the kernel where it can be
+    uint64_t file_offset = 0;
+};
+
+struct Out_File
+{
+    std::vector<Out_Region> regions;
+    uint64_t size = 0;
+
+    // Places a region at the current end of the file and returns its offset
+    uint64_t add(const void *data, std::size_t size)
+    {
+        uint64_t offset = this->size;
+
+        if (size > 0)
+        {
+            regions.emplace_back(Out_Region{data, size, offset});
+        }
+
+        this->size += size;
+
+        return offset;
+    }
+
+    // Bytes of a mapped file, so a large file is not read in through the mapping
+    uint64_t add_file(const void *data, std::size_t size, int fd, uint64_t file_offset)
+    {
+        uint64_t offset = this->size;
+
+        if (size > 0)
+        {
+            regions.emplace_back(Out_Region{data, size, offset, fd, file_offset});
+        }
+
+        this->size += size;
+
+        return offset;
+    }
+
+    // One region per chunk, the chunks are written where they are
+    uint64_t add(const Byte_Arena &arena)
+    {
+        uint64_t offset = this->size;
+
+        arena.for_each_chunk([&](const uint8_t *data, std::size_t size)
+                             { add(data, size); });
+
+        return offset;
+    }
+
+    // Zero filled gap, nothing is written for it
+    uint64_t skip(std::size_t size)
+    {
+        uint64_t offset = this->size;
+        this->size += size;
+
+        return offset;
+    }
+};
+
+enum Write_Mode
+{
+    WRITE_PWRITEV, // Gather regions with pwritev
+    WRITE_MMAP     // Copy regions into a mapping of the output file
+};
+
+bool write_out_file(const std::string &path, const Out_File &out, Write_Mode mode = WRITE_PWRITEV);
+
+// Copies the file into bytes after what is there already, gaps zero filled
+void gather_out_file(const Out_File &out, std::vector<uint8_t> &bytes);
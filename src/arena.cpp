@@ -0,0 +1,166 @@
+#include <cstring>
+
+#include <arena.h>
+
+void Byte_Arena::locate(uint64_t offset, std::size_t &chunk, uint64_t &within)
+{
+    if (offset < ARENA_GROWING_BYTES)
+    {
+        // Chunk k starts at 2^(FIRST + k) - 2^FIRST
+        uint64_t shifted = offset + ((uint64_t)(1) << ARENA_FIRST_BITS);
+        uint32_t bits = 63 - __builtin_clzll(shifted);
+
+        chunk = bits - ARENA_FIRST_BITS;
+        within = shifted - ((uint64_t)(1) << bits);
+        return;
+    }
+
+    offset -= ARENA_GROWING_BYTES;
+    chunk = ARENA_GROWING_CHUNKS + (offset >> ARENA_CHUNK_BITS);
+    within = offset & (((uint64_t)(1) << ARENA_CHUNK_BITS) - 1);
+}
+
+void Byte_Arena::add_chunk()
+{
+    std::size_t size_class = std::min<std::size_t>(chunks.size(), ARENA_GROWING_CHUNKS - 1);
+
+    if (pool && !pool->free[size_class].empty())
+    {
+        chunks.emplace_back(std::move(pool->free[size_class].back()));
+        pool->free[size_class].pop_back();
+        return;
+    }
+
+    chunks.emplace_back(new uint8_t[chunk_size(chunks.size())]);
+}
+
+uint64_t Byte_Arena::append(const uint8_t *data, std::size_t size)
+{
+    uint64_t offset = length;
+
+    while (size > 0)
+    {
+        std::size_t chunk;
+        uint64_t within;
+
+        locate(length, chunk, within);
+
+        if (chunk == chunks.size())
+        {
+            add_chunk();
+        }
+
+        std::size_t count = std::min<uint64_t>(size, chunk_size(chunk) - within);
+
+        if (data)
+        {
+            memcpy(chunks[chunk].get() + within, data, count);
+            data += count;
+        }
+        else
+        {
+            memset(chunks[chunk].get() + within, 0, count);
+        }
+
+        length += count;
+        size -= count;
+    }
+
+    return offset;
+}
+
+uint64_t Byte_Arena::append(std::size_t size, uint8_t val)
+{
+    uint64_t offset = length;
+
+    while (size > 0)
+    {
+        std::size_t chunk;
+        uint64_t within;
+
+        locate(length, chunk, within);
+
+        if (chunk == chunks.size())
+        {
+            add_chunk();
+        }
+
+        std::size_t count = std::min<uint64_t>(size, chunk_size(chunk) - within);
+
+        memset(chunks[chunk].get() + within, val, count);
+        length += count;
+        size -= count;
+    }
+
+    return offset;
+}
+
+void Byte_Arena::write(uint64_t offset, const void *data, std::size_t size)
+{
+    const uint8_t *src = (const uint8_t *)(data);
+
+    while (size > 0)
+    {
+        std::size_t chunk;
+        uint64_t within;
+
+        locate(offset, chunk, within);
+
+        std::size_t count = std::min<uint64_t>(size, chunk_size(chunk) - within);
+
+        memcpy(chunks[chunk].get() + within, src, count);
+        src += count;
+        offset += count;
+        size -= count;
+    }
+}
+
+void Byte_Arena::read(uint64_t offset, void *data, std::size_t size) const
+{
+    uint8_t *dst = (uint8_t *)(data);
+
+    while (size > 0)
+    {
+        std::size_t chunk;
+        uint64_t within;
+
+        locate(offset, chunk, within);
+
+        std::size_t count = std::min<uint64_t>(size, chunk_size(chunk) - within);
+
+        memcpy(dst, chunks[chunk].get() + within, count);
+        dst += count;
+        offset += count;
+        size -= count;
+    }
+}
+
+uint8_t Byte_Arena::operator[](uint64_t offset) const
+{
+    std::size_t chunk;
+    uint64_t within;
+
+    locate(offset, chunk, within);
+
+    return chunks[chunk][within];
+}
+
+void Byte_Arena::clear()
+{
+    if (pool)
+    {
+        // Chunks past the cap are freed with the chain below
+        for (std::size_t i = 0; i < chunks.size(); i++)
+        {
+            std::vector<std::unique_ptr<uint8_t[]>> &free = pool->free[std::min<std::size_t>(i, ARENA_GROWING_CHUNKS - 1)];
+
+            if (free.size() < ARENA_POOL_CHUNKS)
+            {
+                free.emplace_back(std::move(chunks[i]));
+            }
+        }
+    }
+
+    chunks.clear();
+    length = 0;
+}
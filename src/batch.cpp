@@ -0,0 +1,218 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <atomic>
+
+#include <batch.h>
+#include <elf.h>
+#include <parser.h>
+#include <lexer.h>
+#include <cache.h>
+#include <verify.h>
+#include <unwind.h>
+#include <diag.h>
+
+// Chunks freed by the last file the thread assembled
+static thread_local Arena_Pool thread_arenas;
+
+Arena_Pool &thread_arena_pool()
+{
+    return thread_arenas;
+}
+
+std::string default_output(const std::string &input, bool elf)
+{
+    std::size_t dot = input.find_last_of('.');
+    std::size_t sep = input.find_last_of("/\\");
+
+    return input.substr(0, dot != std::string::npos && (sep == std::string::npos || dot > sep) ? dot : input.length()) + (elf ? ".o" : ".obj");
+}
+
+bool read_response_file(const std::string &path, std::vector<File_Job> &jobs)
+{
+    std::ifstream fs(path);
+
+    if (!fs)
+    {
+        diag() << "error: cannot open " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+
+    while (std::getline(fs, line))
+    {
+        std::istringstream words(line);
+        File_Job job;
+
+        if (!(words >> job.input) || job.input[0] == '#')
+        {
+            continue;
+        }
+
+        words >> job.output;
+        jobs.emplace_back(job);
+    }
+
+    return true;
+}
+
+// Counters that are read off the finished tables
+static void collect_stats(Object &obj, const ELF_File &elf_file, bool elf, const Out_File &out, const Asm_Cache *cache)
+{
+    Stats &stats = obj.stats;
+
+    stats.output_bytes = out.size;
+    stats.labels = obj.labels.size();
+    stats.symbols = elf ? elf_file.symbols.size() : obj.sym_tab.size();
+    stats.str_tab_bytes = elf ? elf_file.strtab.size() : obj.str_tab.size();
+    stats.str_tab_requested = elf ? elf_file.strtab.stats.requested_bytes : obj.str_tab.stats.requested_bytes;
+    stats.str_tab_emitted = elf ? elf_file.strtab.stats.emitted_bytes : obj.str_tab.stats.emitted_bytes;
+    stats.branches = obj.relax_stats.branches;
+    stats.short_branches = obj.relax_stats.short_branches;
+    stats.cache_hits = cache ? cache->hits.load() : 0;
+    stats.cache_misses = cache ? cache->misses.load() : 0;
+
+    for (std::size_t i = 0; i < obj.sections.size(); i++)
+    {
+        const Section &section = obj.sections[i];
+
+        stats.relocations += section.relocations.size();
+        stats.section_appends += section.appends;
+        stats.section_chunks += section.data.chunks.size();
+    }
+}
+
+bool assemble_text(std::string_view source, std::string_view name, const Asm_Options &options, Object &obj, Thread_Pool &pool, Asm_Cache *cache,
+                   ELF_File &elf_file, Out_File &out)
+{
+    obj.stats.input_bytes = source.size();
+
+    obj.align_branches = options.align_branches;
+    obj.verify = options.verify;
+    obj.elf = options.elf;
+    init_object(obj);
+
+    if (!assemble_source(source, name, obj, pool, cache))
+    {
+        return false;
+    }
+
+    {
+        PHASE(obj.stats, "unwind");
+
+        if (!build_unwind_tables(obj, name, options.elf))
+        {
+            return false;
+        }
+    }
+
+    if (options.verify)
+    {
+        PHASE(obj.stats, "verify");
+
+        if (!verify_object(obj, name, pool))
+        {
+            return false;
+        }
+    }
+
+    {
+        PHASE(obj.stats, "symbols");
+        finish_symbols(obj);
+    }
+
+    {
+        PHASE(obj.stats, "layout");
+
+        if (options.elf)
+        {
+            layout_elf(obj.sections, obj.sym_tab, obj.labels, elf_file, out);
+        }
+        else if (!layout_coff(obj.header, obj.sections, obj.sym_tab, obj.str_tab, out, name))
+        {
+            return false;
+        }
+    }
+
+    if (obj.stats.enabled)
+    {
+        collect_stats(obj, elf_file, options.elf, out, cache);
+    }
+
+    return true;
+}
+
+bool assemble_file(const File_Job &job, const Asm_Options &options, Object &obj, Thread_Pool &pool, Asm_Cache *cache)
+{
+    // The source stays mapped until the object is written, labels refer into it
+    Source_File source;
+
+    {
+        PHASE(obj.stats, "read");
+
+        if (!source.open(job.input))
+        {
+            diag() << "error: cannot open " << job.input << std::endl;
+            return false;
+        }
+    }
+
+    // Each region is written from its own buffer
+    Out_File out = {};
+    ELF_File elf_file;
+
+    if (!assemble_text(std::string_view(source.data, source.size), job.input, options, obj, pool, cache, elf_file, out))
+    {
+        return false;
+    }
+
+    PHASE(obj.stats, "write");
+
+    return write_out_file(job.output.empty() ? default_output(job.input, options.elf) : job.output, out, options.write_mode);
+}
+
+bool assemble_batch(const std::vector<File_Job> &jobs, const Asm_Options &options, Thread_Pool &pool, Asm_Cache *cache, Stats &stats)
+{
+    std::atomic<bool> ok = true;
+
+    pool.run(jobs.size(), [&](std::size_t i)
+             {
+                 // The pool is busy with other files, so the chunks of this one are parsed inline
+                 Thread_Pool inline_pool(1);
+                 Object obj;
+
+                 obj.sections.arena_pool = &thread_arena_pool();
+                 obj.stats.enabled = stats.enabled;
+
+                 // The cache context is set per source, so each file has its own view of the directory
+                 Asm_Cache file_cache;
+
+                 if (cache)
+                 {
+                     file_cache.dir = cache->dir;
+                     file_cache.options = cache->options;
+                 }
+
+                 {
+                     PHASE(obj.stats, "file");
+
+                     if (!assemble_file(jobs[i], options, obj, inline_pool, cache ? &file_cache : nullptr))
+                     {
+                         ok = false;
+                     }
+                 }
+
+                 if (cache)
+                 {
+                     cache->hits += file_cache.hits;
+                     cache->misses += file_cache.misses;
+                     cache->stores += file_cache.stores;
+                     cache->stored_bytes += file_cache.stored_bytes;
+                 }
+
+                 add_stats(stats, obj.stats);
+             });
+
+    return ok;
+}
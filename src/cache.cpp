@@ -0,0 +1,740 @@
+#include <cache.h>
+#include <lexer.h>
+#include <diag.h>
+
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <cstring>
+#include <cstdio>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#define CACHE_MAGIC "ASMCACHE"
+#define CACHE_SUFFIX ".unit"
+#define CACHE_SIZE_FILE "size" // Decimal size of the entries at the last scan
+#define CACHE_STALE_TMP_SECONDS 3600 // Temporary files older than this were left by a build that died
+
+// Layout of an entry, every array starts on an 8-byte boundary:
+//   Cache_Header
+//   Cache_Section[num_sections]
+//   for each section: data, Unit_Var[num_vars], Unit_Fixup[num_fixups], Instr_Record[num_records], uint32_t[num_records] (instr_vars),
+//     Instr_Target[num_targets]
+//   Cache_Label[num_labels]
+//   Cache_Ref[num_files]
+//   Unit_Frame[num_frames]
+//   Unit_Size[num_sizes]
+
+struct Cache_Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t struct_sizes; // Catches entries written by a build with other struct layouts
+    Cache_Key key;
+    uint64_t size;         // Whole entry
+    uint64_t num_instrs;
+    Enc_Size_Stats size_stats;
+    uint32_t num_sections;
+    uint32_t num_labels;
+    uint32_t num_files;
+    uint32_t num_frames;
+    uint32_t num_sizes;
+    uint32_t reserved;
+};
+
+struct Cache_Section
+{
+    uint32_t section;
+    uint32_t size;
+    uint32_t data_size;
+    uint32_t num_vars;
+    uint32_t num_fixups;
+    uint32_t num_records; // Instructions recorded for --verify, which has entries of its own
+    uint32_t num_targets;
+    uint32_t reserved;
+};
+
+// Offset and length of a name in the chunk text
+struct Cache_Ref
+{
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct Cache_Label
+{
+    Cache_Ref name;
+    uint32_t section;
+    Unit_Pos pos;
+    uint32_t line; // Relative to the first line of the chunk
+    int64_t value;
+    uint8_t flags;
+    uint8_t storage_class;
+    uint16_t type;
+    uint32_t alias;
+    uint8_t visibility;
+    uint8_t elf_info;
+    uint8_t reserved[6];
+};
+
+static uint32_t struct_sizes()
+{
+    return (uint32_t)(sizeof(Unit_Var)) | (uint32_t)(sizeof(Unit_Fixup)) << 8 | (uint32_t)(sizeof(Cache_Label)) << 16 | (uint32_t)(sizeof(Cache_Section)) << 24;
+}
+
+// Hashing
+
+static uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t fmix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+
+    return x;
+}
+
+// Two 64-bit lanes in the style of MurmurHash3. Not meant to resist crafted
+// collisions, the inputs are the user's own sources
+static void hash_bytes(Cache_Key &key, const void *data, std::size_t size)
+{
+    const uint8_t *p = (const uint8_t *)(data);
+    uint64_t a = key.lo;
+    uint64_t b = key.hi;
+
+    for (; size >= 16; p += 16, size -= 16)
+    {
+        uint64_t w0, w1;
+        memcpy(&w0, p, 8);
+        memcpy(&w1, p + 8, 8);
+
+        a ^= rotl(w0 * 0x87c37b91114253d5ull, 31) * 0x4cf5ad432745937full;
+        a = rotl(a, 27) + b;
+        a = a * 5 + 0x52dce729;
+        b ^= rotl(w1 * 0x4cf5ad432745937full, 33) * 0x87c37b91114253d5ull;
+        b = rotl(b, 31) + a;
+        b = b * 5 + 0x38495ab5;
+    }
+
+    uint8_t tail[16] = {};
+    memcpy(tail, p, size);
+
+    uint64_t w0, w1;
+    memcpy(&w0, tail, 8);
+    memcpy(&w1, tail + 8, 8);
+
+    a ^= fmix(w0 ^ size);
+    b ^= fmix(w1 + a);
+    key.lo = fmix(a + b);
+    key.hi = fmix(b + key.lo);
+}
+
+template <typename T>
+static void hash_value(Cache_Key &key, const T &value)
+{
+    hash_bytes(key, &value, sizeof(T));
+}
+
+static void hash_string(Cache_Key &key, std::string_view str)
+{
+    hash_value(key, (uint64_t)(str.length()));
+    hash_bytes(key, str.data(), str.length());
+}
+
+void cache_context(Asm_Cache &cache, const Object &obj)
+{
+    Cache_Key key = {CACHE_VERSION, struct_sizes()};
+
+    hash_string(key, cache.options);
+
+    for (std::size_t i = 0; i < obj.sections.size(); i++)
+    {
+        const Section &section = obj.sections.sections[i];
+
+        hash_string(key, section.name);
+        hash_value(key, section.header.flags);
+    }
+
+    for (const Label &label : obj.labels)
+    {
+        if (label.flags & LABEL_ABSOLUTE)
+        {
+            hash_string(key, label.name);
+            hash_value(key, label.value);
+        }
+    }
+
+    for (const Macro &macro : obj.macros)
+    {
+        hash_string(key, macro.name);
+
+        for (const Macro_Param &param : macro.body.params)
+        {
+            hash_string(key, param.name);
+            hash_value(key, (uint8_t)(param.required | (param.vararg << 1)));
+
+            for (const Token &tok : param.value)
+            {
+                hash_value(key, tok.kind);
+                hash_string(key, tok.text);
+            }
+        }
+
+        for (const Macro_Token &tok : macro.body.tokens)
+        {
+            hash_value(key, (uint32_t)(tok.kind | (tok.joined << 8) | (tok.param << 16)));
+            hash_string(key, tok.text);
+        }
+    }
+
+    cache.context = key;
+}
+
+Cache_Key chunk_key(const Asm_Cache &cache, const Chunk &chunk)
+{
+    Cache_Key key = cache.context;
+
+    hash_value(key, chunk.section.idx);
+    hash_bytes(key, chunk.text.data(), chunk.text.size());
+
+    return key;
+}
+
+static std::string entry_path(const Asm_Cache &cache, const Cache_Key &key)
+{
+    char name[40];
+    snprintf(name, sizeof(name), "%016llx%016llx", (unsigned long long)(key.hi), (unsigned long long)(key.lo));
+
+    return cache.dir + "/" + name + CACHE_SUFFIX;
+}
+
+// Entries
+
+static void put(std::vector<uint8_t> &buffer, const void *data, std::size_t size)
+{
+    const uint8_t *bytes = (const uint8_t *)(data);
+
+    buffer.insert(buffer.end(), bytes, bytes + size);
+    buffer.resize((buffer.size() + 7) & ~(std::size_t)(7), 0);
+}
+
+// Reads the arrays of an entry, failing on anything that runs past its end
+struct Entry_Reader
+{
+    const uint8_t *pos;
+    const uint8_t *end;
+
+    template <typename T>
+    bool get(T *dest, std::size_t count)
+    {
+        std::size_t size = sizeof(T) * count;
+        std::size_t padded = (size + 7) & ~(std::size_t)(7);
+
+        if ((std::size_t)(end - pos) < padded)
+        {
+            return false;
+        }
+
+        if (size > 0)
+        {
+            memcpy((void *)(dest), pos, size);
+        }
+
+        pos += padded;
+
+        return true;
+    }
+};
+
+static bool to_ref(const Chunk &chunk, std::string_view name, Cache_Ref &ref)
+{
+    if (name.data() < chunk.text.data() || name.data() + name.length() > chunk.text.data() + chunk.text.size())
+    {
+        return false;
+    }
+
+    ref.offset = name.data() - chunk.text.data();
+    ref.length = name.length();
+
+    return true;
+}
+
+static bool from_ref(const Chunk &chunk, const Cache_Ref &ref, std::string_view &name)
+{
+    if ((uint64_t)(ref.offset) + ref.length > chunk.text.size())
+    {
+        return false;
+    }
+
+    name = chunk.text.substr(ref.offset, ref.length);
+
+    return true;
+}
+
+#ifndef _WIN32
+
+bool open_cache(Asm_Cache &cache, const std::string &dir)
+{
+    cache.dir = dir;
+
+    // Create each missing directory along the path
+    for (std::size_t i = 1; i <= dir.length(); i++)
+    {
+        if (i == dir.length() || dir[i] == '/')
+        {
+            mkdir(dir.substr(0, i).c_str(), 0777);
+        }
+    }
+
+    struct stat st;
+
+    if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) || access(dir.c_str(), R_OK | W_OK | X_OK) != 0)
+    {
+        diag() << "error: cannot use cache directory " << dir << std::endl;
+        return false;
+    }
+
+    // A missing or unreadable size leaves the cache untracked, so the first eviction scans
+    if (FILE *file = fopen((dir + "/" + CACHE_SIZE_FILE).c_str(), "r"))
+    {
+        unsigned long long size;
+
+        if (fscanf(file, "%llu", &size) == 1)
+        {
+            cache.tracked_bytes = size;
+            cache.tracked = true;
+        }
+
+        fclose(file);
+    }
+
+    return true;
+}
+
+bool load_unit(Asm_Cache &cache, const Cache_Key &key, const Chunk &chunk, const Object &obj, Unit &unit)
+{
+    std::string path = entry_path(cache, key);
+    Source_File entry;
+    Cache_Header header;
+
+    if (!entry.open(path) || entry.size < sizeof(Cache_Header))
+    {
+        cache.misses++;
+        return false;
+    }
+
+    Entry_Reader reader = {(const uint8_t *)(entry.data), (const uint8_t *)(entry.data) + entry.size};
+
+    reader.get(&header, 1);
+
+    if (memcmp(header.magic, CACHE_MAGIC, 8) != 0 || header.version != CACHE_VERSION || header.struct_sizes != struct_sizes() ||
+        header.key.lo != key.lo || header.key.hi != key.hi || header.size != entry.size)
+    {
+        cache.misses++;
+        return false;
+    }
+
+    std::vector<Cache_Section> sections(header.num_sections);
+    bool ok = reader.get(sections.data(), sections.size());
+
+    unit = {};
+    unit.section_map.assign(obj.sections.size(), UNIT_NONE);
+    unit.sections.resize(header.num_sections);
+
+    for (std::size_t i = 0; ok && i < sections.size(); i++)
+    {
+        const Cache_Section &cs = sections[i];
+        Unit_Section &us = unit.sections[i];
+
+        if (cs.section >= obj.sections.size())
+        {
+            ok = false;
+            break;
+        }
+
+        us.section = Sect_Handle{cs.section};
+        us.size = cs.size;
+        us.data.resize(cs.data_size);
+        us.vars.resize(cs.num_vars);
+        us.fixups.resize(cs.num_fixups);
+        us.instrs.resize(cs.num_records);
+        us.instr_vars.resize(cs.num_records);
+        us.targets.resize(cs.num_targets);
+        unit.section_map[cs.section] = i;
+
+        ok = reader.get(us.data.data(), us.data.size()) && reader.get(us.vars.data(), us.vars.size()) &&
+             reader.get(us.fixups.data(), us.fixups.size()) && reader.get(us.instrs.data(), us.instrs.size()) &&
+             reader.get(us.instr_vars.data(), us.instr_vars.size()) && reader.get(us.targets.data(), us.targets.size());
+
+        for (Unit_Fixup &fixup : us.fixups)
+        {
+            fixup.line += chunk.first_line;
+        }
+
+        for (Instr_Record &instr : us.instrs)
+        {
+            instr.line += chunk.first_line;
+        }
+    }
+
+    std::vector<Cache_Label> labels(header.num_labels);
+    std::vector<Cache_Ref> files(header.num_files);
+
+    unit.frames.resize(header.num_frames);
+    unit.sizes.resize(header.num_sizes);
+
+    ok = ok && reader.get(labels.data(), labels.size()) && reader.get(files.data(), files.size()) &&
+         reader.get(unit.frames.data(), unit.frames.size()) && reader.get(unit.sizes.data(), unit.sizes.size());
+
+    unit.labels.resize(labels.size());
+
+    for (std::size_t i = 0; ok && i < labels.size(); i++)
+    {
+        const Cache_Label &cl = labels[i];
+        Unit_Label &label = unit.labels[i];
+
+        ok = from_ref(chunk, cl.name, label.name) && (cl.section == UNIT_NONE || cl.section < unit.sections.size()) &&
+             (!(cl.flags & LABEL_ALIAS) || cl.alias < labels.size());
+
+        label.section = cl.section;
+        label.pos = cl.pos;
+        label.line = cl.line + chunk.first_line;
+        label.value = cl.value;
+        label.flags = cl.flags;
+        label.storage_class = cl.storage_class;
+        label.type = cl.type;
+        label.alias = cl.alias;
+        label.visibility = cl.visibility;
+        label.elf_info = cl.elf_info;
+        label.global = UNIT_NONE;
+    }
+
+    unit.files.resize(files.size());
+
+    for (std::size_t i = 0; ok && i < files.size(); i++)
+    {
+        ok = from_ref(chunk, files[i], unit.files[i]);
+    }
+
+    for (Unit_Frame &frame : unit.frames)
+    {
+        ok = ok && frame.section < unit.sections.size() && (frame.label == UNIT_NONE || frame.label < unit.labels.size());
+        frame.line += chunk.first_line;
+    }
+
+    for (Unit_Size &size : unit.sizes)
+    {
+        ok = ok && size.label < unit.labels.size() && (size.end == UNIT_NONE || (size.end < unit.labels.size() && size.start < unit.labels.size()));
+        size.line += chunk.first_line;
+    }
+
+    for (const Unit_Section &us : unit.sections)
+    {
+        std::size_t targets = 0;
+
+        for (std::size_t i = 0; i < us.instrs.size(); i++)
+        {
+            ok = ok && us.instrs[i].form < NUM_FORMS && us.instr_vars[i] <= us.vars.size();
+            targets += (us.instrs[i].flags & INSTR_TARGET) != 0;
+        }
+
+        for (const Instr_Target &target : us.targets)
+        {
+            ok = ok && target.label < unit.labels.size();
+        }
+
+        ok = ok && targets == us.targets.size();
+    }
+
+    unit.num_instrs = header.num_instrs;
+    unit.size_stats = header.size_stats;
+
+    if (!ok)
+    {
+        unit = {};
+        cache.misses++;
+        return false;
+    }
+
+    // Refresh the entry for LRU eviction
+    utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+    cache.hits++;
+
+    return true;
+}
+
+void store_unit(Asm_Cache &cache, const Cache_Key &key, const Chunk &chunk, const Unit &unit)
+{
+    // Text joined by macros, such as the value of \@, and files read by .incbin
+    // depend on more than the chunk
+    if (!unit.ok || !unit.names.empty() || !unit.binaries.empty())
+    {
+        return;
+    }
+
+    std::vector<uint8_t> buffer(sizeof(Cache_Header), 0);
+    Cache_Header header = {};
+
+    for (const Unit_Section &us : unit.sections)
+    {
+        Cache_Section cs = {us.section.idx, us.size, (uint32_t)(us.data.size()), (uint32_t)(us.vars.size()), (uint32_t)(us.fixups.size()),
+                            (uint32_t)(us.instrs.size()), (uint32_t)(us.targets.size())};
+        put(buffer, &cs, sizeof(cs));
+    }
+
+    for (const Unit_Section &us : unit.sections)
+    {
+        std::vector<Unit_Fixup> fixups = us.fixups;
+        std::vector<Instr_Record> instrs = us.instrs;
+
+        for (Unit_Fixup &fixup : fixups)
+        {
+            fixup.line -= chunk.first_line;
+        }
+
+        for (Instr_Record &instr : instrs)
+        {
+            instr.line -= chunk.first_line;
+        }
+
+        put(buffer, us.data.data(), us.data.size());
+        put(buffer, us.vars.data(), us.vars.size() * sizeof(Unit_Var));
+        put(buffer, fixups.data(), fixups.size() * sizeof(Unit_Fixup));
+        put(buffer, instrs.data(), instrs.size() * sizeof(Instr_Record));
+        put(buffer, us.instr_vars.data(), us.instr_vars.size() * sizeof(uint32_t));
+        put(buffer, us.targets.data(), us.targets.size() * sizeof(Instr_Target));
+    }
+
+    for (const Unit_Label &label : unit.labels)
+    {
+        Cache_Label cl = {};
+
+        if (!to_ref(chunk, label.name, cl.name))
+        {
+            return;
+        }
+
+        cl.section = label.section;
+        cl.pos = label.pos;
+        cl.line = label.line - chunk.first_line;
+        cl.value = label.value;
+        cl.flags = label.flags;
+        cl.storage_class = label.storage_class;
+        cl.type = label.type;
+        cl.alias = label.alias;
+        cl.visibility = label.visibility;
+        cl.elf_info = label.elf_info;
+
+        put(buffer, &cl, sizeof(cl));
+    }
+
+    for (std::string_view file : unit.files)
+    {
+        Cache_Ref ref;
+
+        if (!to_ref(chunk, file, ref))
+        {
+            return;
+        }
+
+        put(buffer, &ref, sizeof(ref));
+    }
+
+    for (Unit_Frame frame : unit.frames)
+    {
+        frame.line -= chunk.first_line;
+        put(buffer, &frame, sizeof(frame));
+    }
+
+    for (Unit_Size size : unit.sizes)
+    {
+        size.line -= chunk.first_line;
+        put(buffer, &size, sizeof(size));
+    }
+
+    memcpy(header.magic, CACHE_MAGIC, 8);
+    header.version = CACHE_VERSION;
+    header.struct_sizes = struct_sizes();
+    header.key = key;
+    header.size = buffer.size();
+    header.num_instrs = unit.num_instrs;
+    header.size_stats = unit.size_stats;
+    header.num_sections = unit.sections.size();
+    header.num_labels = unit.labels.size();
+    header.num_files = unit.files.size();
+    header.num_frames = unit.frames.size();
+    header.num_sizes = unit.sizes.size();
+    memcpy(buffer.data(), &header, sizeof(header));
+
+    // Written under a name no other writer uses, then moved into place whole
+    std::string path = entry_path(cache, key);
+    std::string tmp = path + ".tmp" + std::to_string(getpid()) + "_" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+    if (fd < 0)
+    {
+        return;
+    }
+
+    std::size_t written = 0;
+
+    while (written < buffer.size())
+    {
+        ssize_t n = ::write(fd, buffer.data() + written, buffer.size() - written);
+
+        if (n <= 0)
+        {
+            break;
+        }
+
+        written += n;
+    }
+
+    ::close(fd);
+
+    if (written != buffer.size() || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        unlink(tmp.c_str());
+        return;
+    }
+
+    cache.stores++;
+    cache.stored_bytes += buffer.size();
+}
+
+// Written under a temporary name like an entry, so a reader sees one size or the other
+static void write_tracked_size(const Asm_Cache &cache, uint64_t size)
+{
+    std::string path = cache.dir + "/" + CACHE_SIZE_FILE;
+    std::string tmp = path + ".tmp" + std::to_string(getpid());
+
+    if (FILE *file = fopen(tmp.c_str(), "w"))
+    {
+        bool ok = fprintf(file, "%llu\n", (unsigned long long)(size)) > 0;
+
+        if (fclose(file) == 0 && ok && rename(tmp.c_str(), path.c_str()) == 0)
+        {
+            return;
+        }
+
+        unlink(tmp.c_str());
+    }
+}
+
+void evict_cache(Asm_Cache &cache)
+{
+    struct Entry
+    {
+        std::string path;
+        struct timespec mtime;
+        uint64_t size;
+    };
+
+    // Replacing an entry counts its size twice, which only makes the next scan come sooner
+    uint64_t stored = cache.stored_bytes.exchange(0);
+
+    if (cache.tracked && cache.tracked_bytes + stored <= cache.max_bytes)
+    {
+        if (stored != 0)
+        {
+            cache.tracked_bytes += stored;
+            write_tracked_size(cache, cache.tracked_bytes);
+        }
+
+        return;
+    }
+
+    DIR *dir = opendir(cache.dir.c_str());
+
+    if (!dir)
+    {
+        return;
+    }
+
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    time_t now = time(nullptr);
+
+    while (struct dirent *ent = readdir(dir))
+    {
+        std::string_view name = ent->d_name;
+        std::string path = cache.dir + "/" + ent->d_name;
+        struct stat st;
+
+        if (name.find(CACHE_SUFFIX) == std::string_view::npos || stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            continue;
+        }
+
+        if (name.find(".tmp") != std::string_view::npos)
+        {
+            if (now - st.st_mtime > CACHE_STALE_TMP_SECONDS)
+            {
+                unlink(path.c_str());
+            }
+
+            continue;
+        }
+
+        entries.emplace_back(Entry{path, st.st_mtim, (uint64_t)(st.st_size)});
+        total += st.st_size;
+    }
+
+    closedir(dir);
+
+    if (total > cache.max_bytes)
+    {
+        std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b)
+              { return a.mtime.tv_sec != b.mtime.tv_sec ? a.mtime.tv_sec < b.mtime.tv_sec : a.mtime.tv_nsec < b.mtime.tv_nsec; });
+
+        // Another build may remove the same entries, which is harmless
+        for (const Entry &entry : entries)
+        {
+            if (total <= cache.max_bytes)
+            {
+                break;
+            }
+
+            unlink(entry.path.c_str());
+            total -= entry.size;
+        }
+    }
+
+    cache.tracked_bytes = total;
+    cache.tracked = true;
+    write_tracked_size(cache, total);
+}
+
+#else
+
+bool open_cache(Asm_Cache &cache, const std::string &dir)
+{
+    diag() << "error: the assembly cache is not supported on this platform" << std::endl;
+    return false;
+}
+
+bool load_unit(Asm_Cache &cache, const Cache_Key &key, const Chunk &chunk, const Object &obj, Unit &unit)
+{
+    return false;
+}
+
+void store_unit(Asm_Cache &cache, const Cache_Key &key, const Chunk &chunk, const Unit &unit)
+{
+}
+
+void evict_cache(Asm_Cache &cache)
+{
+}
+
+#endif
@@ -1,108 +1,515 @@
 #include <coff.h>
+#include <stats.h>
+#include <diag.h>
 
-void Section::append(uint8_t *to_add, std::size_t size)
+#define STR_BLOCK_SIZE 0x10000
+
+void Section::append(const uint8_t *to_add, std::size_t size)
+{
+    data.append(to_add, size);
+    STAT_INC(appends);
+    header.raw_size += size;
+}
+
+void Section::append(std::size_t size)
+{
+    data.append(size, 0);
+    STAT_INC(appends);
+    header.raw_size += size;
+}
+
+void Section::append(std::size_t size, uint8_t val)
+{
+    data.append(size, val);
+    STAT_INC(appends);
+    header.raw_size += size;
+}
+
+// Recommended NOP of each length up to NOP_MAX, longer padding repeats the
+// longest. Lengths past 11 bytes need more than three prefixes, which some
+// decoders take extra cycles over, so like GNU as these stop at 11
+static const uint8_t NOPS[NOP_MAX + 1][NOP_MAX] = {
+    {},
+    {0x90},
+    {0x66, 0x90},
+    {0x0f, 0x1f, 0x00},
+    {0x0f, 0x1f, 0x40, 0x00},
+    {0x0f, 0x1f, 0x44, 0x00, 0x00},
+    {0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00},
+    {0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00},
+    {0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+    {0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+    {0x66, 0x2e, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+    {0x66, 0x66, 0x2e, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00},
+};
+
+void Section::append_nops(std::size_t size)
 {
-    if (size > 0 && to_add)
+    // Running through a long stretch of NOPs costs more than jumping over it
+    if (size >= NOP_JUMP_MIN)
     {
-        data.insert(data.end(), to_add, to_add + size);
+        uint8_t jump[5] = {0xeb, (uint8_t)(size - 2)};
+        uint8_t len = 2;
+
+        if (size - 2 > 0x7f)
+        {
+            uint32_t disp = size - 5;
+
+            jump[0] = 0xe9;
+            jump[1] = disp;
+            jump[2] = disp >> 8;
+            jump[3] = disp >> 16;
+            jump[4] = disp >> 24;
+            len = 5;
+        }
+
+        append(jump, len);
+        size -= len;
     }
 
-    if (data.size() >= header.raw_size)
+    for (; size > NOP_MAX; size -= NOP_MAX)
     {
-        header.raw_size += size;
+        append(NOPS[NOP_MAX], NOP_MAX);
     }
+
+    append(NOPS[size], size);
+}
+
+void Section::reserve(std::size_t size)
+{
+    header.raw_size += size;
 }
 
-template <typename T>
-void Section::append_literal(T to_add)
+void Section::append_run(uint64_t size, uint64_t value, uint8_t width)
 {
-    data.insert(data.end(), (uint8_t *)(&to_add), (uint8_t *)(&to_add) + sizeof(T));
+    Section_Extent extent = {loc(), size, data.size(), nullptr, 0, nullptr, -1, 0};
 
-    if (data.size() >= header.raw_size)
+    if (value != 0)
     {
-        header.raw_size += sizeof(T);
+        // As many whole copies of the value as fit in the buffer, or in the run if it is shorter
+        uint64_t copies = std::max<uint64_t>(std::min<uint64_t>(size, EXTENT_PATTERN_BYTES) / width, 1);
+
+        extent.pattern_size = copies * width;
+        extent.pattern.reset(new uint8_t[extent.pattern_size]);
+
+        for (uint32_t i = 0; i < extent.pattern_size; i++)
+        {
+            extent.pattern[i] = value >> (i % width * 8);
+        }
+
+        extent.bytes = extent.pattern.get();
     }
+
+    extents.emplace_back(std::move(extent));
+    extent_size += size;
+    STAT_INC(appends);
+    header.raw_size += size;
 }
 
-template void Section::append_literal<uint8_t>(uint8_t);
-template void Section::append_literal<uint16_t>(uint16_t);
-template void Section::append_literal<uint32_t>(uint32_t);
-template void Section::append_literal<uint64_t>(uint64_t);
-template void Section::append_literal<unsigned long>(unsigned long);
+void Section::append_mapped(const uint8_t *bytes, uint64_t size, int fd, uint64_t file_offset)
+{
+    extents.emplace_back(Section_Extent{loc(), size, data.size(), bytes, 0, nullptr, fd, file_offset});
+    extent_size += size;
+    STAT_INC(appends);
+    header.raw_size += size;
+}
 
-template void Section::append_literal<int8_t>(int8_t);
-template void Section::append_literal<int16_t>(int16_t);
-template void Section::append_literal<int32_t>(int32_t);
-template void Section::append_literal<int64_t>(int64_t);
-template void Section::append_literal<long>(long);
+uint64_t Section::add_to(Out_File &out) const
+{
+    uint64_t offset = out.size;
+    uint64_t done = 0;
 
-template void Section::append_literal<uint8_t *>(uint8_t *);
-template void Section::append_literal<uint16_t *>(uint16_t *);
-template void Section::append_literal<uint32_t *>(uint32_t *);
-template void Section::append_literal<uint64_t *>(uint64_t *);
-template void Section::append_literal<unsigned long *>(unsigned long *);
+    auto add_range = [&](const uint8_t *bytes, std::size_t size)
+    {
+        if (bytes)
+        {
+            out.add(bytes, size);
+        }
+        else
+        {
+            out.skip(size);
+        }
+    };
 
-template void Section::append_literal<int8_t *>(int8_t *);
-template void Section::append_literal<int16_t *>(int16_t *);
-template void Section::append_literal<int32_t *>(int32_t *);
-template void Section::append_literal<int64_t *>(int64_t *);
-template void Section::append_literal<long *>(long *);
+    for (const Section_Extent &extent : extents)
+    {
+        data.for_each_chunk(add_range, done, extent.data_offset);
+        done = extent.data_offset;
 
-template void Section::append_literal<void *>(void *);
+        if (extent.fd >= 0)
+        {
+            out.add_file(extent.bytes, extent.size, extent.fd, extent.file_offset);
+        }
+        else
+        {
+            extent.for_each_range(add_range);
+        }
+    }
 
-void Section::append(std::size_t size)
+    data.for_each_chunk(add_range, done);
+
+    return offset;
+}
+
+// The extent at or before offset, nullptr if offset comes before them all
+static const Section_Extent *extent_before(const std::vector<Section_Extent> &extents, uint64_t offset)
+{
+    auto after = std::upper_bound(extents.begin(), extents.end(), offset, [](uint64_t offset, const Section_Extent &extent)
+                                  { return offset < extent.offset; });
+
+    return after == extents.begin() ? nullptr : &*(after - 1);
+}
+
+void Section::read(uint64_t offset, void *to, std::size_t size) const
 {
-    if (size > 0)
+    uint8_t *dst = (uint8_t *)(to);
+
+    if (extents.empty())
     {
-        data.resize(data.size() + size, 0);
+        data.read(offset, dst, size);
+        return;
     }
 
-    if (data.size() >= header.raw_size)
+    while (size > 0)
     {
-        header.raw_size += size;
+        const Section_Extent *extent = extent_before(extents, offset);
+        std::size_t count;
+
+        if (extent && offset < extent->offset + extent->size)
+        {
+            uint64_t within = offset - extent->offset;
+
+            count = std::min<uint64_t>(size, extent->size - within);
+
+            for (std::size_t i = 0; i < count; i++)
+            {
+                dst[i] = !extent->bytes ? 0 : extent->pattern_size ? extent->bytes[(within + i) % extent->pattern_size] : extent->bytes[within + i];
+            }
+        }
+        else
+        {
+            // Arena bytes run up to the next extent
+            uint64_t start = extent ? extent->offset + extent->size : 0;
+            uint64_t data_offset = (extent ? extent->data_offset : 0) + offset - start;
+            uint64_t next = extent ? (extent + 1 < extents.data() + extents.size() ? extent[1].offset : UINT64_MAX) : extents[0].offset;
+
+            count = std::min<uint64_t>(size, next - offset);
+            data.read(data_offset, dst, count);
+        }
+
+        dst += count;
+        offset += count;
+        size -= count;
     }
 }
 
-void Section::append(std::size_t size, uint8_t val)
+void Section::write(uint64_t offset, const void *from, std::size_t size)
 {
-    if (size > 0)
+    const Section_Extent *extent = extent_before(extents, offset);
+
+    if (extent)
     {
-        data.resize(data.size() + size, val);
+        offset = extent->data_offset + offset - (extent->offset + extent->size);
     }
 
-    if (data.size() >= header.raw_size)
+    data.write(offset, from, size);
+}
+
+void Section::align()
+{
+    if (header.flags & IMAGE_SCN_CNT_CODE)
+    {
+        align(alignment(), NOP_BYTE);
+    }
+    else
     {
-        header.raw_size += size;
+        align(alignment());
     }
 }
 
-void Section::reserve(std::size_t size)
+void Section::raise_alignment(std::size_t alignment)
 {
-    header.raw_size += size;
+    // The alignment field holds log2(alignment) + 1, up to 8192 bytes
+    uint32_t bits = 1;
+
+    while ((std::size_t)(0x1) << (bits - 1) < alignment && bits < 14)
+    {
+        bits++;
+    }
+
+    if (bits > ((header.flags >> 20) & 0xf))
+    {
+        header.flags = (header.flags & ~0x00f00000) | (bits << 20);
+    }
 }
 
-void Section::align()
+void Section::align(std::size_t alignment, uint8_t fill)
 {
-    uint16_t alignment;
-
-    alignment = (header.flags >> 20) & 0xf;
-    alignment = 0x1 << (alignment - 1);
+    if (alignment <= 1)
+    {
+        return;
+    }
 
-    uint16_t padding;
+    raise_alignment(alignment);
 
-    padding = data.size() % alignment;
+    std::size_t padding = loc() % alignment;
 
     if (padding > 0)
     {
         padding = alignment - padding;
 
-        if ((header.flags >> 5) & 0x1)
+        if (is_bss())
+        {
+            reserve(padding);
+        }
+        else if (fill == NOP_BYTE && (header.flags & IMAGE_SCN_CNT_CODE))
         {
-            append(padding, 0x90);
+            append_nops(padding);
         }
         else
         {
-            append(padding);
+            append(padding, fill);
         }
     }
-}
\ No newline at end of file
+}
+
+const char *Str_Tab::store(std::string_view str)
+{
+    if (block_used + str.length() > block_size)
+    {
+        block_size = std::max<std::size_t>(STR_BLOCK_SIZE, str.length());
+        block_used = 0;
+        blocks.emplace_back(new char[block_size]);
+    }
+
+    char *copy = blocks.back().get() + block_used;
+    memcpy(copy, str.data(), str.length());
+    block_used += str.length();
+
+    return copy;
+}
+
+// Compares strings from their last character, longer strings first on a tie
+static bool reverse_greater(std::string_view a, std::string_view b)
+{
+    auto it_a = a.rbegin();
+    auto it_b = b.rbegin();
+
+    for (; it_a != a.rend() && it_b != b.rend(); it_a++, it_b++)
+    {
+        if (*it_a != *it_b)
+        {
+            return (uint8_t)(*it_a) > (uint8_t)(*it_b);
+        }
+    }
+
+    return a.length() > b.length();
+}
+
+uint32_t Str_Tab::add(std::string_view str)
+{
+    stats.adds++;
+    stats.requested_bytes += str.length() + 1;
+
+    uint32_t id = index.insert(str, strings.size(), [this](uint32_t i)
+                               { return strings[i]; });
+
+    if (id == strings.size())
+    {
+        strings.emplace_back(store(str), str.length());
+        stats.unique_bytes += str.length() + 1;
+    }
+
+    return id;
+}
+
+void Str_Tab::layout()
+{
+    std::size_t count = strings.size();
+    std::vector<uint32_t> order(count);
+    std::vector<uint32_t> parent(count);
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+        order[i] = i;
+        parent[i] = i;
+    }
+
+    // Sorting by reversed string in descending order places every string
+    // directly after the strings it is a suffix of
+    std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b)
+              { return reverse_greater(strings[a], strings[b]); });
+
+    std::size_t prev = (std::size_t)(-1);
+
+    for (uint32_t id : order)
+    {
+        if (prev != (std::size_t)(-1))
+        {
+            std::string_view str_prev = strings[prev];
+            std::string_view str = strings[id];
+
+            if (str_prev.length() >= str.length() && str_prev.substr(str_prev.length() - str.length()) == str)
+            {
+                parent[id] = prev;
+                continue;
+            }
+        }
+
+        prev = id;
+    }
+
+    // Strings that were not merged are written in the order they were added
+    offsets.assign(count, 0);
+    data.assign(4, 0);
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+        if (parent[i] == i)
+        {
+            offsets[i] = data.size();
+            data.insert(data.end(), strings[i].begin(), strings[i].end());
+            data.emplace_back(0);
+        }
+    }
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+        if (parent[i] != i)
+        {
+            offsets[i] = offsets[parent[i]] + strings[parent[i]].length() - strings[i].length();
+        }
+    }
+
+    *(uint32_t *)(data.data()) = data.size();
+    stats.emitted_bytes = data.size() - 4;
+}
+
+// Reports a value that does not fit its field of the COFF format
+static bool coff_error(std::string_view file, const char *msg)
+{
+    diag() << file << ": error: " << msg << std::endl;
+
+    return false;
+}
+
+bool layout_coff(COFF_Hdr &header, Sect_Tab &sections, Sym_Tab &sym_tab, Str_Tab &str_tab, Out_File &out, std::string_view file)
+{
+    // Symbols hold section numbers as signed 16-bit values
+    if (sections.size() > INT16_MAX)
+    {
+        return coff_error(file, "too many sections for COFF");
+    }
+
+    // Section definitions carry the section length and relocation count
+
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        Aux_Form_5 aux = {};
+
+        if (sections[i].data_size() > UINT32_MAX)
+        {
+            return coff_error(file, "section too large for COFF");
+        }
+
+        aux.length = sections[i].header.raw_size;
+        aux.num_rel = std::min<std::size_t>(sections[i].relocations.size(), 0xffff);
+
+        memcpy(&(sym_tab[sym_tab.find(sections[i].name) + 1]), &aux, sizeof(Sym_Hdr));
+    }
+
+    str_tab.layout();
+    sym_tab.resolve_names();
+
+    // Long section names are written as "/" followed by the decimal string table offset
+
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        if (sections[i].str_id != NAME_NOT_FOUND)
+        {
+            sections[i].header.name = "/" + std::to_string(str_tab.offset(sections[i].str_id));
+        }
+    }
+
+    // Compute all file offsets
+
+    header.num_sections = sections.size();
+    header.num_sym = sym_tab.size();
+
+    uint64_t section_data = sizeof(COFF_Hdr) + sizeof(Sect_Hdr) * sections.size();
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        if (sections[i].data_size() > 0)
+        {
+            sections[i].align();
+            sections[i].header.data = section_data;
+            section_data += sections[i].header.raw_size;
+        }
+    }
+
+    // A count that does not fit num_reloc is written in the virtual address
+    // of an extra first relocation, counting itself, and num_reloc is 0xffff
+
+    uint64_t rel_tab_loc = section_data;
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        std::size_t num_reloc = sections[i].relocations.size();
+
+        if (num_reloc >= 0xffff)
+        {
+            if (num_reloc >= UINT32_MAX)
+            {
+                return coff_error(file, "too many relocations for COFF");
+            }
+
+            sections[i].header.flags |= IMAGE_SCN_LNK_NRELOC_OVFL;
+            sections[i].reloc_count = {};
+            sections[i].reloc_count.virt_addr = num_reloc + 1;
+            num_reloc++;
+        }
+
+        if (num_reloc > 0)
+        {
+            sections[i].header.reloc = rel_tab_loc;
+            sections[i].header.num_reloc = std::min<std::size_t>(num_reloc, 0xffff);
+            rel_tab_loc += num_reloc * sizeof(Reloc);
+        }
+    }
+
+    // Every offset up to the symbol table is in a 32-bit field
+    if (rel_tab_loc > UINT32_MAX)
+    {
+        return coff_error(file, "object too large for COFF");
+    }
+
+    header.sym_tab = rel_tab_loc;
+
+    // Regions in file order
+
+    out.add(&header, sizeof(COFF_Hdr));
+
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        out.add(&(sections[i].header), sizeof(Sect_Hdr));
+    }
+
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        sections[i].add_to(out);
+    }
+
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        if (sections[i].header.flags & IMAGE_SCN_LNK_NRELOC_OVFL)
+        {
+            out.add(&(sections[i].reloc_count), sizeof(Reloc));
+        }
+
+        out.add(sections[i].relocations.relocations.data(), sections[i].relocations.size() * sizeof(Reloc));
+    }
+
+    out.add(sym_tab.symbols.data(), sym_tab.size() * sizeof(Sym_Hdr));
+    out.add(str_tab.data.data(), str_tab.size());
+
+    return true;
+}
@@ -0,0 +1,750 @@
+#include <decoder.h>
+
+#include <array>
+
+// Decode tables
+
+#define DEC_MAP_SIZE 256 // Opcode bytes of one map, the 0x0f and 0x0f 0x38 maps follow the one byte map
+#define DEC_MODRM 0x1    // The forms of the byte take a ModR/M byte, or a third opcode byte in its place
+
+#define DEC_MOD_ANY 0
+#define DEC_MOD_MEMORY 1   // The r/m operand must be memory (lea, movbe)
+#define DEC_MOD_REGISTER 2 // The r/m operand must be a register (movhlps)
+
+struct Decode_Slot
+{
+    uint16_t first; // First entry in Decode_Table::forms
+    uint8_t count;
+    uint8_t flags;
+};
+
+// A form listed under a slot with what its bytes must hold, so picking one
+// does not read FORMS
+struct Decode_Entry
+{
+    uint16_t form;
+    uint8_t prefix;
+    uint8_t rex_w;    // REX_W or 0
+    uint8_t mask;  // Bits of the ModR/M byte that must equal value, for a /digit or a third opcode byte
+    uint8_t value;
+    uint8_t mod;   // DEC_MOD_ANY, DEC_MOD_MEMORY or DEC_MOD_REGISTER
+    bool data16;   // An operand size prefix goes with the mandatory one (FORM_DATA16)
+};
+
+// 0x0f 0x38 opcodes, whose third byte picks the slot rather than standing
+// for the ModR/M byte
+constexpr bool form_map_38(const Opcode_Form &form)
+{
+    return form.opcode_len == 3 && form.opcode[1] == 0x38;
+}
+
+constexpr bool form_has_modrm(const Opcode_Form &form)
+{
+    switch (form.enc)
+    {
+    case ENC_MR:
+    case ENC_RM:
+    case ENC_M:
+    case ENC_MI:
+    case ENC_RMI:
+    case ENC_MRI:
+        return true;
+    }
+
+    return form.opcode_len == 3;
+}
+
+// What the mod field of the ModR/M byte may hold, from the kind of the r/m operand
+constexpr uint8_t form_mod(const Opcode_Form &form)
+{
+    uint8_t kind = form.enc == ENC_RM || form.enc == ENC_RMI ? form.operands[1] : form.operands[0];
+
+    switch (kind)
+    {
+    case OPK_M:
+    case OPK_M16:
+    case OPK_M32:
+    case OPK_M64:
+        return DEC_MOD_MEMORY;
+    case OPK_R8:
+    case OPK_R16:
+    case OPK_R32:
+    case OPK_R64:
+    case OPK_XMM:
+        return form_has_modrm(form) ? DEC_MOD_REGISTER : DEC_MOD_ANY;
+    }
+
+    return DEC_MOD_ANY;
+}
+
+// Opcode bytes a form starts with, eight for a register added to the opcode
+constexpr std::size_t form_slots(const Opcode_Form &form)
+{
+    return form.enc == ENC_O || form.enc == ENC_OI ? 8 : 1;
+}
+
+// Slot of the byte after any 0x0f or 0x0f 0x38, another third opcode byte is
+// matched separately
+constexpr std::size_t form_slot(const Opcode_Form &form, std::size_t reg)
+{
+    if (form_map_38(form))
+    {
+        return 2 * DEC_MAP_SIZE + form.opcode[2];
+    }
+
+    return form.opcode_len == 1 ? form.opcode[0] + reg : DEC_MAP_SIZE + form.opcode[1] + reg;
+}
+
+constexpr std::size_t count_decode_forms()
+{
+    std::size_t count = 0;
+
+    for (std::size_t i = 0; i < NUM_FORMS; i++)
+    {
+        count += form_slots(FORMS[i]);
+    }
+
+    return count;
+}
+
+inline constexpr std::size_t NUM_DECODE_FORMS = count_decode_forms();
+
+struct Decode_Table
+{
+    std::array<Decode_Slot, 3 * DEC_MAP_SIZE> slots;
+    std::array<Decode_Entry, NUM_DECODE_FORMS> forms; // By slot, in table order within one
+    std::array<uint8_t, NUM_FORMS> imm_sizes;         // Immediate bytes of each form
+    std::array<uint16_t, NUM_FORMS> mnemonics;        // Index in INSTRUCTIONS of each form
+    bool ok;                                          // The forms of a slot agree on ModR/M and two byte opcodes start with 0x0f
+};
+
+constexpr Decode_Table build_decode_table()
+{
+    Decode_Table table = {};
+    std::array<uint16_t, 3 * DEC_MAP_SIZE> filled = {};
+
+    table.ok = true;
+
+    for (std::size_t i = 0; i < NUM_FORMS; i++)
+    {
+        const Opcode_Form &form = FORMS[i];
+        uint8_t flags = form_has_modrm(form) ? DEC_MODRM : 0;
+
+        if (form.opcode_len > 1 && form.opcode[0] != 0x0f)
+        {
+            table.ok = false;
+        }
+
+        for (std::size_t reg = 0; reg < form_slots(form); reg++)
+        {
+            Decode_Slot &slot = table.slots[form_slot(form, reg)];
+
+            if (slot.count > 0 && slot.flags != flags)
+            {
+                table.ok = false;
+            }
+
+            slot.count++;
+            slot.flags = flags;
+        }
+
+        for (uint8_t kind : form.operands)
+        {
+            table.imm_sizes[i] += imm_size(kind);
+        }
+    }
+
+    for (std::size_t i = 1; i < table.slots.size(); i++)
+    {
+        table.slots[i].first = table.slots[i - 1].first + table.slots[i - 1].count;
+    }
+
+    for (std::size_t i = 0; i < NUM_FORMS; i++)
+    {
+        const Opcode_Form &form = FORMS[i];
+        Decode_Entry entry = {(uint16_t)(i), form.prefix, (uint8_t)(form.rex & REX_W), 0, 0, form_mod(form),
+                              (form.flags & FORM_DATA16) != 0};
+
+        if (form.opcode_len == 3 && !form_map_38(form))
+        {
+            entry.mask = 0xff;
+            entry.value = form.opcode[2];
+        }
+        else if (form.digit >= 0)
+        {
+            entry.mask = 0x38;
+            entry.value = form.digit << 3;
+        }
+
+        for (std::size_t reg = 0; reg < form_slots(form); reg++)
+        {
+            std::size_t slot = form_slot(form, reg);
+
+            table.forms[table.slots[slot].first + filled[slot]++] = entry;
+        }
+    }
+
+    for (std::size_t m = 0; m < NUM_MNEMONICS; m++)
+    {
+        for (std::size_t i = 0; i < INSTRUCTIONS[m].num_forms; i++)
+        {
+            table.mnemonics[INSTRUCTIONS[m].first_form + i] = m;
+        }
+    }
+
+    return table;
+}
+
+inline constexpr Decode_Table DECODE = build_decode_table();
+
+static_assert(DECODE.ok, "every form of an opcode byte must agree on ModR/M");
+
+// Fields
+
+// Where the parts of an instruction are, read off its first bytes
+struct Dec_Fields
+{
+    uint16_t form;
+    uint8_t rex;
+    uint8_t opcode; // Last opcode byte, which holds the register of ENC_O and ENC_OI
+    uint8_t modrm;
+    uint8_t sib;
+    uint8_t disp_offset;
+    uint8_t disp_size;
+    uint8_t imm_offset;
+    uint8_t imm_size;
+    uint8_t prefix;  // Lock or repeat prefix the form does not take
+    uint8_t segment; // Segment override prefix
+};
+
+// Prefixes in front of an instruction, which may come in any order
+struct Dec_Prefixes
+{
+    bool operand_size; // 0x66
+    uint8_t rep;       // 0xf2 or 0xf3
+    uint8_t mandatory; // rep unless the caller knows it was written as a repeat prefix
+    uint8_t lock;
+    uint8_t segment;
+};
+
+// How well an entry takes the prefixes, -1 if it does not fit. A form whose
+// mandatory prefix is there beats one that leaves it as a legacy prefix, so
+// f3 0f bc is tzcnt rather than rep bsf
+static inline int entry_rank(const Decode_Entry &entry, const Dec_Prefixes &prefixes, uint8_t rex_w, uint8_t modrm)
+{
+    uint8_t mod = modrm >> 6;
+
+    if (entry.rex_w != rex_w || (modrm & entry.mask) != entry.value)
+    {
+        return -1;
+    }
+
+    if ((entry.mod == DEC_MOD_MEMORY && mod == 3) || (entry.mod == DEC_MOD_REGISTER && mod != 3))
+    {
+        return -1;
+    }
+
+    if (entry.prefix == 0)
+    {
+        return 0;
+    }
+
+    if (entry.prefix == 0x66)
+    {
+        return prefixes.operand_size ? 1 : -1;
+    }
+
+    return entry.prefix == prefixes.mandatory && entry.data16 == prefixes.operand_size ? 2 : -1;
+}
+
+// Length of the instruction, 0 if it is not one of the forms. legacy is a
+// repeat prefix not to take as a mandatory one
+static inline std::size_t decode_fields(const uint8_t *code, std::size_t size, Dec_Fields &f, uint8_t legacy)
+{
+    const uint8_t *p = code;
+    const uint8_t *end = code + size;
+    Dec_Prefixes prefixes = {};
+    std::size_t map = 0;
+
+    f.rex = 0;
+    f.modrm = 0;
+    f.sib = 0;
+
+    // Each kind of prefix at most once, as the encoder writes them
+    for (; p < end; p++)
+    {
+        uint8_t byte = *p;
+
+        if (byte == 0x66 && !prefixes.operand_size)
+        {
+            prefixes.operand_size = true;
+        }
+        else if ((byte == PREFIX_REP || byte == PREFIX_REPNZ) && !prefixes.rep)
+        {
+            prefixes.rep = byte;
+        }
+        else if (byte == PREFIX_LOCK && !prefixes.lock)
+        {
+            prefixes.lock = byte;
+        }
+        else if ((byte == 0x26 || byte == 0x2e || byte == 0x36 || byte == 0x3e || byte == 0x64 || byte == 0x65) && !prefixes.segment)
+        {
+            prefixes.segment = byte;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    prefixes.mandatory = prefixes.rep == legacy ? 0 : prefixes.rep;
+
+    if (p < end && (*p & 0xf0) == REX_PRESENT)
+    {
+        f.rex = *p++;
+    }
+
+    if (p < end && *p == 0x0f)
+    {
+        map = DEC_MAP_SIZE;
+        p++;
+
+        if (p < end && *p == 0x38)
+        {
+            map = 2 * DEC_MAP_SIZE;
+            p++;
+        }
+    }
+
+    if (p >= end)
+    {
+        return 0;
+    }
+
+    f.opcode = *p++;
+
+    const Decode_Slot &slot = DECODE.slots[map + f.opcode];
+
+    if (slot.flags & DEC_MODRM)
+    {
+        if (p >= end)
+        {
+            return 0;
+        }
+
+        f.modrm = *p++;
+    }
+
+    // The first entry of the best rank, which without prefixes is the first that fits
+    const Decode_Entry *first = DECODE.forms.data() + slot.first;
+    const Decode_Entry *entry = nullptr;
+    int top = prefixes.mandatory ? 2 : prefixes.operand_size ? 1 : 0;
+    int best = -1;
+
+    for (const Decode_Entry *e = first; e < first + slot.count && best < top; e++)
+    {
+        int rank = entry_rank(*e, prefixes, f.rex & REX_W, f.modrm);
+
+        if (rank > best)
+        {
+            entry = e;
+            best = rank;
+        }
+    }
+
+    if (!entry)
+    {
+        return 0;
+    }
+
+    // What the form does not take is a lock or repeat prefix, one at most,
+    // and never an operand size prefix
+    f.prefix = prefixes.mandatory && entry->prefix == prefixes.mandatory ? 0 : prefixes.rep;
+
+    if ((prefixes.operand_size && entry->prefix != 0x66 && !entry->data16) || (f.prefix && prefixes.lock))
+    {
+        return 0;
+    }
+
+    f.prefix = f.prefix ? f.prefix : prefixes.lock;
+    f.segment = prefixes.segment;
+    f.form = entry->form;
+    f.disp_size = 0;
+
+    // A third opcode byte stands where the ModR/M byte would
+    if ((slot.flags & DEC_MODRM) && entry->mask != 0xff && (f.modrm >> 6) != 3)
+    {
+        uint8_t mod = f.modrm >> 6;
+        uint8_t rm = f.modrm & 0x7;
+
+        if (rm == 4)
+        {
+            if (p >= end)
+            {
+                return 0;
+            }
+
+            f.sib = *p++;
+        }
+
+        if (mod == 1)
+        {
+            f.disp_size = 1;
+        }
+        else if (mod == 2 || (mod == 0 && (rm == 5 || (rm == 4 && (f.sib & 0x7) == 5))))
+        {
+            f.disp_size = 4;
+        }
+    }
+
+    f.disp_offset = p - code;
+    f.imm_offset = f.disp_offset + f.disp_size;
+    f.imm_size = DECODE.imm_sizes[f.form];
+
+    if ((std::size_t)(f.imm_offset + f.imm_size) > size)
+    {
+        return 0;
+    }
+
+    return f.imm_offset + f.imm_size;
+}
+
+std::size_t decode_length(const uint8_t *code, std::size_t size)
+{
+    Dec_Fields f;
+
+    return decode_fields(code, size, f, 0);
+}
+
+// Operands
+
+static int64_t read_signed(const uint8_t *field, uint8_t size)
+{
+    uint64_t value = 0;
+
+    for (uint8_t i = 0; i < size; i++)
+    {
+        value |= (uint64_t)(field[i]) << (i * 8);
+    }
+
+    // Sign extends from the top bit of the field
+    return size > 0 && size < 8 ? (int64_t)(value << (64 - size * 8)) >> (64 - size * 8) : (int64_t)(value);
+}
+
+static Operand register_operand(uint8_t num, uint8_t size, uint8_t reg_class, uint8_t rex)
+{
+    Operand op = {};
+
+    op.type = OPND_REG;
+    op.reg = num;
+    op.size = size;
+    op.reg_class = reg_class;
+    op.base = REG_NONE;
+    op.index = REG_NONE;
+    op.sym = SYM_NONE;
+
+    // Byte registers 4 to 7 are spl to dil with a REX prefix, ah to bh without
+    if (reg_class == RC_GP && size == 1 && num >= 4 && num < 8)
+    {
+        op.reg_flags = rex ? REG_NEED_REX : REG_NO_REX;
+    }
+
+    return op;
+}
+
+static Operand immediate_operand(int64_t value)
+{
+    Operand op = {};
+
+    op.type = OPND_IMM;
+    op.base = REG_NONE;
+    op.index = REG_NONE;
+    op.value = value;
+    op.sym = SYM_NONE;
+
+    return op;
+}
+
+// Register operand of kind numbered num
+static Operand kind_register(uint8_t kind, uint8_t num, uint8_t rex)
+{
+    switch (kind)
+    {
+    case OPK_R8:
+    case OPK_RM8:
+        return register_operand(num, 1, RC_GP, rex);
+    case OPK_R16:
+    case OPK_RM16:
+        return register_operand(num, 2, RC_GP, rex);
+    case OPK_R32:
+    case OPK_RM32:
+        return register_operand(num, 4, RC_GP, rex);
+    case OPK_R64:
+    case OPK_RM64:
+        return register_operand(num, 8, RC_GP, rex);
+    }
+
+    return register_operand(num, 16, RC_XMM, rex);
+}
+
+static Operand rm_operand(uint8_t kind, const Dec_Fields &f, const uint8_t *code)
+{
+    uint8_t mod = f.modrm >> 6;
+    uint8_t rm = f.modrm & 0x7;
+
+    if (mod == 3)
+    {
+        return kind_register(kind, rm | (f.rex & REX_B ? 8 : 0), f.rex);
+    }
+
+    Operand op = {};
+
+    op.type = OPND_MEM;
+    op.base = rm | (f.rex & REX_B ? 8 : 0);
+    op.index = REG_NONE;
+    op.scale = 1;
+    op.sym = SYM_NONE;
+    op.value = read_signed(code + f.disp_offset, f.disp_size);
+
+    if (rm == 4)
+    {
+        uint8_t index = ((f.sib >> 3) & 0x7) | (f.rex & REX_X ? 8 : 0);
+
+        op.base = (f.sib & 0x7) | (f.rex & REX_B ? 8 : 0);
+        op.index = index == 4 ? REG_NONE : index;
+        op.scale = 1 << (f.sib >> 6);
+
+        if (mod == 0 && (f.sib & 0x7) == 5)
+        {
+            op.base = REG_NONE;
+        }
+    }
+    else if (mod == 0 && rm == 5)
+    {
+        op.base = REG_RIP;
+    }
+
+    return op;
+}
+
+bool decode(const uint8_t *code, std::size_t size, Dec_Instr &dec, uint8_t prefix)
+{
+    Dec_Fields f;
+
+    dec.size = decode_fields(code, size, f, prefix);
+
+    if (dec.size == 0)
+    {
+        return false;
+    }
+
+    const Opcode_Form &form = FORMS[f.form];
+    Instr &instr = dec.instr;
+
+    dec.form = f.form;
+    dec.disp_offset = f.disp_size ? f.disp_offset : DEC_FIELD_NONE;
+    dec.disp_size = f.disp_size;
+    dec.imm_offset = f.imm_size ? f.imm_offset : DEC_FIELD_NONE;
+    dec.imm_size = f.imm_size;
+
+    instr.mnemonic = MNEMONIC_NONE;
+    instr.base_mnemonic = DECODE.mnemonics[f.form];
+    instr.size = form_size(form);
+    instr.num_ops = 0;
+    instr.prefix = f.prefix;
+    instr.segment = f.segment;
+
+    // Branch targets through r/m are written with '*'
+    bool indirect = (form.flags & FORM_DEF64) && form.enc == ENC_M && form.opcode[0] == 0xff && form.digit != 6;
+
+    for (uint8_t i = 0; i < 3 && form.operands[i] != OPK_NONE; i++)
+    {
+        uint8_t kind = form.operands[i];
+        Operand &op = instr.ops[instr.num_ops++];
+
+        switch (kind)
+        {
+        case OPK_IMM8:
+        case OPK_IMM16:
+        case OPK_IMM32:
+        case OPK_IMM64:
+            op = immediate_operand(read_signed(code + f.imm_offset, f.imm_size));
+            continue;
+        case OPK_REL8:
+        case OPK_REL32:
+            op = immediate_operand(read_signed(code + f.imm_offset, f.imm_size));
+            op.type = OPND_MEM;
+            op.scale = 1;
+            continue;
+        case OPK_AL:
+        case OPK_AX:
+        case OPK_EAX:
+        case OPK_RAX:
+            op = register_operand(0, 1 << (kind - OPK_AL), RC_GP, f.rex);
+            continue;
+        case OPK_CL:
+            op = register_operand(1, 1, RC_GP, f.rex);
+            continue;
+        case OPK_ONE:
+            op = immediate_operand(1);
+            continue;
+        }
+
+        // The register or r/m operand goes where the encoding puts it
+        switch (form.enc)
+        {
+        case ENC_O:
+        case ENC_OI:
+            op = kind_register(kind, (f.opcode & 0x7) | (f.rex & REX_B ? 8 : 0), f.rex);
+            break;
+        case ENC_MR:
+        case ENC_RM:
+        case ENC_RMI:
+        case ENC_MRI:
+            if ((i == 0) == (form.enc == ENC_MR || form.enc == ENC_MRI))
+            {
+                op = rm_operand(kind, f, code);
+            }
+            else
+            {
+                op = kind_register(kind, ((f.modrm >> 3) & 0x7) | (f.rex & REX_R ? 8 : 0), f.rex);
+            }
+
+            break;
+        default:
+            op = rm_operand(kind, f, code);
+            op.indirect = indirect;
+            break;
+        }
+    }
+
+    return true;
+}
+
+uint16_t form_mnemonic(uint16_t form)
+{
+    return DECODE.mnemonics[form];
+}
+
+bool same_encoding(const Opcode_Form &a, const Opcode_Form &b)
+{
+    return a.enc == b.enc && a.prefix == b.prefix && a.rex == b.rex && a.digit == b.digit && a.opcode_len == b.opcode_len &&
+           a.opcode[0] == b.opcode[0] && a.opcode[1] == b.opcode[1] && a.opcode[2] == b.opcode[2];
+}
+
+// Printing
+
+static void print_register(std::ostream &os, const Operand &op)
+{
+    for (const Register &reg : REGISTERS)
+    {
+        // spl to dil and ah to bh share numbers
+        if (reg.num == op.reg && reg.size == op.size && reg.reg_class == op.reg_class && (reg.flags & REG_NO_REX) == (op.reg_flags & REG_NO_REX))
+        {
+            os << "%" << reg.name;
+            return;
+        }
+    }
+
+    os << "%?";
+}
+
+static void print_operand(std::ostream &os, const Dec_Instr &dec, const Operand &op, bool branch)
+{
+    if (op.indirect)
+    {
+        os << "*";
+    }
+
+    if (op.type == OPND_REG)
+    {
+        print_register(os, op);
+        return;
+    }
+
+    if (op.type == OPND_IMM)
+    {
+        os << "$" << op.value;
+        return;
+    }
+
+    if (branch)
+    {
+        os << ".+" << dec.size + op.value;
+        return;
+    }
+
+    for (const Register &reg : REGISTERS)
+    {
+        if (reg.reg_class == RC_SEG && SEGMENT_PREFIXES[reg.num] == dec.instr.segment)
+        {
+            os << "%" << reg.name << ":";
+        }
+    }
+
+    if (op.value != 0 || op.base == REG_NONE)
+    {
+        os << op.value;
+    }
+
+    if (op.base == REG_NONE && op.index == REG_NONE)
+    {
+        return;
+    }
+
+    os << "(";
+
+    if (op.base == REG_RIP)
+    {
+        os << "%rip";
+    }
+    else if (op.base != REG_NONE)
+    {
+        print_register(os, register_operand(op.base, 8, RC_GP, 0));
+    }
+
+    if (op.index != REG_NONE)
+    {
+        os << ",";
+        print_register(os, register_operand(op.index, 8, RC_GP, 0));
+        os << "," << (uint32_t)(op.scale);
+    }
+
+    os << ")";
+}
+
+void print_decoded(std::ostream &os, const Dec_Instr &dec)
+{
+    const Opcode_Form &form = FORMS[dec.form];
+    const Instr &instr = dec.instr;
+    bool memory = false;
+
+    for (uint8_t i = 0; i < instr.num_ops; i++)
+    {
+        memory |= instr.ops[i].type == OPND_MEM;
+    }
+
+    for (const Prefix &prefix : PREFIXES)
+    {
+        if (!prefix.segment && prefix.byte == instr.prefix)
+        {
+            os << prefix.name << " ";
+            break;
+        }
+    }
+
+    os << form.mnemonic;
+
+    // A memory operand takes its size from the suffix
+    if (memory && form.enc != ENC_D && instr.size)
+    {
+        os << (instr.size == 1 ? "b" : instr.size == 2 ? "w" : instr.size == 4 ? "l" : "q");
+    }
+
+    // AT&T order is source first
+    for (uint8_t i = instr.num_ops; i-- > 0;)
+    {
+        os << (i + 1 == instr.num_ops ? " " : ", ");
+        print_operand(os, dec, instr.ops[i], form.enc == ENC_D);
+    }
+}
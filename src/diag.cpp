@@ -0,0 +1,15 @@
+#include <iostream>
+
+#include <diag.h>
+
+static thread_local std::ostream *thread_diag = nullptr;
+
+std::ostream &diag()
+{
+    return thread_diag ? *thread_diag : std::cerr;
+}
+
+void set_diag(std::ostream *os)
+{
+    thread_diag = os;
+}
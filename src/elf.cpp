@@ -0,0 +1,672 @@
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include <elf.h>
+#include <encoder.h>
+
+#define ELF_SYM_NONE 0xffffffff
+
+// Where a COFF symbol ended up in the ELF symbol table. Local labels in a
+// section are referred to through the section symbol plus their offset,
+// except by the GOT and TLS relocations, which need the label's own symbol
+struct ELF_Sym_Ref
+{
+    uint32_t idx = ELF_SYM_NONE;
+    int64_t offset = 0;
+    uint32_t own = ELF_SYM_NONE; // The label's symbol, if it is kept
+};
+
+static bool has_prefix(std::string_view name, std::string_view prefix)
+{
+    return name.substr(0, prefix.length()) == prefix;
+}
+
+// Thread local sections are only told apart by their names
+static bool is_tls_section(const Section &section)
+{
+    return has_prefix(section.name, ".tdata") || has_prefix(section.name, ".tbss");
+}
+
+// The type .section gave, or the one GNU as gives a section of that name
+static uint32_t section_type(const Section &section)
+{
+    if (section.elf_type != SHT_NULL)
+    {
+        return section.elf_type;
+    }
+
+    if (section.is_bss())
+    {
+        return SHT_NOBITS;
+    }
+
+    if (has_prefix(section.name, ".init_array"))
+    {
+        return SHT_INIT_ARRAY;
+    }
+
+    if (has_prefix(section.name, ".fini_array"))
+    {
+        return SHT_FINI_ARRAY;
+    }
+
+    if (has_prefix(section.name, ".preinit_array"))
+    {
+        return SHT_PREINIT_ARRAY;
+    }
+
+    if (has_prefix(section.name, ".note"))
+    {
+        return SHT_NOTE;
+    }
+
+    return SHT_PROGBITS;
+}
+
+static uint64_t section_flags(const Section &section)
+{
+    uint32_t flags = section.header.flags;
+    uint64_t elf_flags = 0;
+
+    if ((flags & IMAGE_SCN_MEM_READ) && !(flags & IMAGE_SCN_LNK_REMOVE))
+    {
+        elf_flags |= SHF_ALLOC;
+    }
+
+    if (flags & IMAGE_SCN_MEM_WRITE)
+    {
+        elf_flags |= SHF_WRITE;
+    }
+
+    if (flags & IMAGE_SCN_MEM_EXECUTE)
+    {
+        elf_flags |= SHF_EXECINSTR;
+    }
+
+    if (is_tls_section(section))
+    {
+        elf_flags |= SHF_TLS;
+    }
+
+    return elf_flags;
+}
+
+// Reads the opcode bytes before a rel32 to tell a branch from other fields
+static bool is_branch_field(const Section &section, uint32_t offset)
+{
+    uint8_t before[2] = {};
+    uint32_t count = std::min<uint32_t>(offset, 2);
+
+    section.read(offset - count, before + 2 - count, count);
+
+    return is_branch_field(before + 2, offset);
+}
+
+// Relocation types that make their symbol thread local
+static bool is_tls_reloc(uint32_t type)
+{
+    return type == R_X86_64_TPOFF32 || type == R_X86_64_TPOFF64 || type == R_X86_64_GOTTPOFF || type == R_X86_64_DTPOFF32 || type == R_X86_64_DTPOFF64 ||
+           type == R_X86_64_TLSGD || type == R_X86_64_TLSLD;
+}
+
+// Bytes of the field an ELF relocation type patches
+static uint32_t reloc_size(uint32_t type)
+{
+    return type == R_X86_64_64 || type == R_X86_64_TPOFF64 || type == R_X86_64_DTPOFF64 ? 8 : 4;
+}
+
+static Elf64_Sym make_sym(uint8_t bind, uint8_t type, uint16_t shndx, uint64_t value, uint64_t size = 0)
+{
+    Elf64_Sym sym = {};
+
+    sym.info = (bind << 4) | type;
+    sym.shndx = shndx;
+    sym.value = value;
+    sym.size = size;
+
+    return sym;
+}
+
+void layout_elf(Sect_Tab &sections, Sym_Tab &sym_tab, const std::vector<Label> &labels, ELF_File &elf, Out_File &out)
+{
+    std::vector<uint32_t> sym_names;
+    std::vector<ELF_Sym_Ref> refs(sym_tab.size());
+    std::vector<uint32_t> section_syms(sections.size());
+    std::vector<uint8_t> visibility(sym_tab.size(), STV_DEFAULT);
+    std::vector<uint8_t> info(sym_tab.size(), 0);
+    std::vector<uint64_t> sizes(sym_tab.size(), 0);
+    std::vector<uint32_t> sect(sym_tab.size(), 0); // Section index + 1 of a label defined in one, which COFF symbols only hold 16 bits of
+    std::vector<bool> tls(sym_tab.size(), false);
+    uint32_t first_global = 0;
+    bool gnu = false; // Has indirect functions or unique symbols
+    bool got = false; // Has GOT or TLS relocations
+
+    // Section groups in the order of their first member. Their headers come
+    // first, as a group has to come before its members
+    std::vector<std::string_view> groups;
+    std::vector<uint32_t> group_of(sections.size(), ELF_SYM_NONE);
+    std::vector<bool> comdat(sections.size(), false);
+    std::vector<uint32_t> signatures;
+    Name_Index group_index = {};
+
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        if (sections[i].group.empty())
+        {
+            continue;
+        }
+
+        group_of[i] = group_index.insert(sections[i].group, groups.size(), [&groups](uint32_t g)
+                                         { return groups[g]; });
+
+        if (group_of[i] == groups.size())
+        {
+            groups.emplace_back(sections[i].group);
+        }
+    }
+
+    // Header index of the first section
+    uint32_t first = 1 + groups.size();
+
+    elf.groups.assign(groups.size(), std::vector<uint32_t>(1, 0));
+    signatures.assign(groups.size(), ELF_SYM_NONE);
+
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        if (group_of[i] != ELF_SYM_NONE && sections[i].comdat)
+        {
+            elf.groups[group_of[i]][0] = GRP_COMDAT;
+        }
+    }
+
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        comdat[i] = group_of[i] != ELF_SYM_NONE && elf.groups[group_of[i]][0] == GRP_COMDAT;
+    }
+
+    for (const Label &label : labels)
+    {
+        visibility[label.sym] = label.visibility;
+        info[label.sym] = label.elf_info;
+        sizes[label.sym] = label.size;
+
+        if (label.flags & LABEL_DEFINED)
+        {
+            sect[label.sym] = label.section.idx + 1;
+        }
+    }
+
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        for (std::size_t r = 0; r < sections[i].relocations.size(); r++)
+        {
+            const Reloc &reloc = sections[i].relocations[r];
+
+            if ((reloc.type & IMAGE_REL_ELF) && is_tls_reloc(reloc.type & 0xff))
+            {
+                tls[reloc.sym_tab_idx] = true;
+            }
+
+            got = got || (reloc.type & IMAGE_REL_ELF);
+        }
+    }
+
+    // section is the header index of the section the symbol is defined in. From
+    // SHN_LORESERVE up the index is kept in .symtab_shndx and st_shndx is SHN_XINDEX
+    auto add_sym = [&](Elf64_Sym sym, std::string_view name, uint32_t section = SHN_UNDEF)
+    {
+        if (section >= SHN_LORESERVE)
+        {
+            sym.shndx = SHN_XINDEX;
+            elf.symtab_shndx.resize(elf.symbols.size() + 1, 0);
+            elf.symtab_shndx.back() = section;
+        }
+        else if (section != SHN_UNDEF)
+        {
+            sym.shndx = section;
+        }
+
+        elf.symbols.emplace_back(sym);
+        sym_names.emplace_back(name.empty() ? NAME_NOT_FOUND : elf.strtab.add(name));
+
+        return (uint32_t)(elf.symbols.size() - 1);
+    };
+
+    // Symbols: the null symbol, files and sections, local labels, then every
+    // global after the last local as the ELF symbol table requires
+
+    add_sym(Elf64_Sym{}, "");
+
+    for (std::size_t i = 0; i < sym_tab.size(); i += 1 + sym_tab[i].num_aux_sym)
+    {
+        const Sym_Hdr &sym = sym_tab[i];
+
+        if (sym.storage_class == IMAGE_SYM_CLASS_FILE)
+        {
+            // The file name is held in the auxiliary records
+            const char *name = (const char *)(&sym_tab[i + 1]);
+
+            add_sym(make_sym(STB_LOCAL, STT_FILE, SHN_ABS, 0), std::string_view(name, strnlen(name, sym.num_aux_sym * sizeof(Sym_Hdr))));
+        }
+    }
+
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        section_syms[i] = add_sym(make_sym(STB_LOCAL, STT_SECTION, SHN_UNDEF, 0), "", first + i);
+        refs[sections[i].sym] = ELF_Sym_Ref{section_syms[i], 0};
+    }
+
+    // A group is named by the symbol of its signature. Without a label of that
+    // name GNU as adds a local symbol in the group section, and so does this
+    for (std::size_t g = 0; g < groups.size(); g++)
+    {
+        std::size_t sym = sym_tab.find(groups[g]);
+
+        if (sym == (std::size_t)(-1) || sym_tab[sym].num_aux_sym > 0 || groups[g].substr(0, 2) == ".L")
+        {
+            signatures[g] = add_sym(make_sym(STB_LOCAL, STT_NOTYPE, SHN_UNDEF, 0), groups[g], 1 + g);
+        }
+    }
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (std::size_t i = 0; i < sym_tab.size(); i += 1 + sym_tab[i].num_aux_sym)
+        {
+            const Sym_Hdr &sym = sym_tab[i];
+            uint32_t sect_num = sect[i];
+            bool weak = sym.storage_class == IMAGE_SYM_CLASS_WEAK_EXTERNAL;
+            bool global = sym.storage_class == IMAGE_SYM_CLASS_EXTERNAL || weak;
+            bool unique = global && !weak && (info[i] >> 4) == STB_GNU_UNIQUE;
+            uint8_t bind = unique ? STB_GNU_UNIQUE : weak ? STB_WEAK : global ? STB_GLOBAL : STB_LOCAL;
+
+            // Section definitions have an auxiliary record, labels do not
+            if (sym.storage_class == IMAGE_SYM_CLASS_FILE || sym.num_aux_sym > 0 || global != (pass == 1))
+            {
+                continue;
+            }
+
+            std::string_view name = sym_tab.name_of(i);
+            uint8_t type = (sym.type >> 4) == IMAGE_SYM_DTYPE_FUNCTION ? STT_FUNC : STT_NOTYPE;
+
+            if (info[i] & 0xf)
+            {
+                type = info[i] & 0xf;
+            }
+
+            if (tls[i] || (sect_num > 0 && is_tls_section(sections[sect_num - 1])))
+            {
+                type = STT_TLS;
+            }
+
+            if (!global && sect_num > 0)
+            {
+                refs[i] = ELF_Sym_Ref{section_syms[sect_num - 1], sym.value};
+
+                // Assembler local labels are not kept in ELF objects
+                if (name.substr(0, 2) == ".L")
+                {
+                    continue;
+                }
+            }
+
+            Elf64_Sym elf_sym;
+            uint32_t section = SHN_UNDEF;
+
+            if (sect_num > 0)
+            {
+                elf_sym = make_sym(bind, type, SHN_UNDEF, sym.value, sizes[i]);
+                section = first + sect_num - 1;
+                gnu = gnu || unique || type == STT_GNU_IFUNC;
+            }
+            else if ((int16_t)(sym.sect_num) == IMAGE_SYM_ABSOLUTE)
+            {
+                elf_sym = make_sym(bind, type, SHN_ABS, sym.value, sizes[i]);
+            }
+            else if (sym.value > 0)
+            {
+                // Common symbols are aligned to the largest power of two up to 16 that fits in their size
+                uint64_t alignment = 1;
+
+                while (alignment < 16 && alignment * 2 <= sym.value)
+                {
+                    alignment *= 2;
+                }
+
+                elf_sym = make_sym(STB_GLOBAL, STT_OBJECT, SHN_COMMON, alignment, sym.value);
+            }
+            else
+            {
+                elf_sym = make_sym(weak ? STB_WEAK : STB_GLOBAL, type, SHN_UNDEF, 0);
+            }
+
+            elf_sym.other = visibility[i];
+
+            uint32_t idx = add_sym(elf_sym, name, section);
+
+            refs[i].own = idx;
+
+            if (refs[i].idx == ELF_SYM_NONE)
+            {
+                refs[i].idx = idx;
+            }
+        }
+
+        if (pass == 0)
+        {
+            first_global = elf.symbols.size();
+        }
+    }
+
+    // GNU as names the GOT in any object with GOT or TLS relocations
+    if (got && sym_tab.find("_GLOBAL_OFFSET_TABLE_") == (std::size_t)(-1))
+    {
+        add_sym(make_sym(STB_GLOBAL, STT_NOTYPE, SHN_UNDEF, 0), "_GLOBAL_OFFSET_TABLE_");
+    }
+
+    // Relocations. COFF keeps the addend in the relocated field, relative to
+    // the end of the field for PC relative types, ELF keeps it in the entry
+
+    elf.relocations.assign(sections.size(), {});
+
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        Section &section = sections[i];
+
+        for (std::size_t r = 0; r < section.relocations.size(); r++)
+        {
+            const Reloc &reloc = section.relocations[r];
+            const uint64_t zero = 0;
+            ELF_Sym_Ref ref = refs[reloc.sym_tab_idx];
+            uint32_t target = sect[reloc.sym_tab_idx];
+
+            // A label in a COMDAT section keeps its own symbol when another
+            // section refers to it, as the group may be dropped (GNU as does
+            // the same). Assembler local labels have none
+            if (ref.own != ELF_SYM_NONE && target > 0 && target - 1 != i && comdat[target - 1])
+            {
+                ref = ELF_Sym_Ref{ref.own, 0, ref.own};
+            }
+            Elf64_Rela rela = {};
+            uint32_t type = R_X86_64_NONE;
+            int64_t addend = 0;
+
+            if (reloc.type & IMAGE_REL_ELF)
+            {
+                type = reloc.type & 0xff;
+
+                if (ref.own != ELF_SYM_NONE)
+                {
+                    ref = ELF_Sym_Ref{ref.own, 0, ref.own};
+                }
+
+                if (reloc_size(type) == 8)
+                {
+                    section.read(reloc.virt_addr, &addend, 8);
+                }
+                else
+                {
+                    int32_t value;
+                    section.read(reloc.virt_addr, &value, 4);
+                    addend = value;
+                }
+
+                section.write(reloc.virt_addr, &zero, reloc_size(type));
+            }
+            else if (reloc.type >= IMAGE_REL_AMD64_REL32 && reloc.type <= IMAGE_REL_AMD64_REL32_5)
+            {
+                int32_t value;
+                section.read(reloc.virt_addr, &value, 4);
+                section.write(reloc.virt_addr, &zero, 4);
+
+                // Only code holds branches, data that looks like one is not. As with
+                // GNU as, a branch to a local label needs no PLT
+                bool local = sym_tab[reloc.sym_tab_idx].storage_class == IMAGE_SYM_CLASS_STATIC;
+                bool branch = reloc.type == IMAGE_REL_AMD64_REL32 && !local && (section_flags(section) & SHF_EXECINSTR) && is_branch_field(section, reloc.virt_addr);
+
+                addend = (int64_t)(value) - 4 - (reloc.type - IMAGE_REL_AMD64_REL32);
+                type = branch ? R_X86_64_PLT32 : R_X86_64_PC32;
+            }
+            else if (reloc.type == IMAGE_REL_AMD64_ADDR64)
+            {
+                section.read(reloc.virt_addr, &addend, 8);
+                section.write(reloc.virt_addr, &zero, 8);
+
+                type = R_X86_64_64;
+            }
+            else if (reloc.type == IMAGE_REL_AMD64_ADDR32)
+            {
+                int32_t value;
+                section.read(reloc.virt_addr, &value, 4);
+                section.write(reloc.virt_addr, &zero, 4);
+
+                addend = value;
+                type = R_X86_64_32;
+            }
+
+            rela.offset = reloc.virt_addr;
+            rela.info = ((uint64_t)(ref.idx) << 32) | type;
+            rela.addend = addend + ref.offset;
+
+            elf.relocations[i].emplace_back(rela);
+        }
+    }
+
+    // Section headers: null, the sections, their relocation tables, then the
+    // symbol and string tables
+
+    std::vector<uint32_t> rela_idx(sections.size(), 0);
+    std::size_t num_headers = first + sections.size();
+    std::vector<uint32_t> sect_names(1, NAME_NOT_FOUND);
+
+    for (std::size_t g = 0; g < groups.size(); g++)
+    {
+        sect_names.emplace_back(elf.shstrtab.add(".group"));
+    }
+
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        sect_names.emplace_back(elf.shstrtab.add(sections[i].name));
+    }
+
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        if (!elf.relocations[i].empty())
+        {
+            rela_idx[i] = num_headers++;
+            sect_names.emplace_back(elf.shstrtab.add(".rela" + sections[i].name));
+        }
+    }
+
+    // Each member is listed with its relocations
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        if (group_of[i] == ELF_SYM_NONE)
+        {
+            continue;
+        }
+
+        elf.groups[group_of[i]].emplace_back(first + i);
+
+        if (rela_idx[i])
+        {
+            elf.groups[group_of[i]].emplace_back(rela_idx[i]);
+        }
+    }
+
+    uint32_t symtab_idx = num_headers++;
+    uint32_t shndx_idx = elf.symtab_shndx.empty() ? 0 : num_headers++;
+    uint32_t strtab_idx = num_headers++;
+    uint32_t shstrtab_idx = num_headers++;
+
+    sect_names.emplace_back(elf.shstrtab.add(".symtab"));
+
+    if (shndx_idx)
+    {
+        sect_names.emplace_back(elf.shstrtab.add(".symtab_shndx"));
+    }
+    sect_names.emplace_back(elf.shstrtab.add(".strtab"));
+    sect_names.emplace_back(elf.shstrtab.add(".shstrtab"));
+
+    // Both string tables start with an empty string where the COFF layout
+    // keeps the table size
+    elf.strtab.layout();
+    elf.shstrtab.layout();
+    memset(elf.strtab.data.data(), 0, 4);
+    memset(elf.shstrtab.data.data(), 0, 4);
+
+    for (std::size_t i = 0; i < elf.symbols.size(); i++)
+    {
+        elf.symbols[i].name = sym_names[i] == NAME_NOT_FOUND ? 0 : elf.strtab.offset(sym_names[i]);
+    }
+
+    elf.sect_hdrs.assign(num_headers, Elf64_Shdr{});
+
+    for (std::size_t i = 1; i < num_headers; i++)
+    {
+        elf.sect_hdrs[i].name = elf.shstrtab.offset(sect_names[i]);
+    }
+
+    // File layout, each offset is fixed as its region is added
+
+    out.add(&elf.header, sizeof(Elf64_Ehdr));
+
+    for (std::size_t g = 0; g < groups.size(); g++)
+    {
+        Elf64_Shdr &hdr = elf.sect_hdrs[1 + g];
+        std::size_t sym = sym_tab.find(groups[g]);
+
+        hdr.type = SHT_GROUP;
+        hdr.link = symtab_idx;
+        hdr.info = signatures[g] != ELF_SYM_NONE ? signatures[g] : refs[sym].own;
+        hdr.addralign = 4;
+        hdr.entsize = 4;
+        hdr.size = elf.groups[g].size() * 4;
+        hdr.offset = out.add(elf.groups[g].data(), hdr.size);
+    }
+
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        const Section &section = sections[i];
+        Elf64_Shdr &hdr = elf.sect_hdrs[first + i];
+
+        hdr.type = section_type(section);
+        hdr.flags = section_flags(section) | (group_of[i] != ELF_SYM_NONE ? SHF_GROUP : 0);
+        hdr.addralign = section.alignment();
+        hdr.size = section.loc();
+
+        // The arrays of pointers the loader runs through
+        if (hdr.type == SHT_INIT_ARRAY || hdr.type == SHT_FINI_ARRAY || hdr.type == SHT_PREINIT_ARRAY)
+        {
+            hdr.entsize = 8;
+        }
+
+        out.skip(align_up(out.size, hdr.addralign) - out.size);
+        hdr.offset = out.size;
+
+        if (!section.is_bss())
+        {
+            section.add_to(out);
+        }
+    }
+
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        if (rela_idx[i] == 0)
+        {
+            continue;
+        }
+
+        Elf64_Shdr &hdr = elf.sect_hdrs[rela_idx[i]];
+
+        hdr.type = SHT_RELA;
+        hdr.flags = SHF_INFO_LINK | (group_of[i] != ELF_SYM_NONE ? SHF_GROUP : 0);
+        hdr.link = symtab_idx;
+        hdr.info = first + i;
+        hdr.addralign = 8;
+        hdr.entsize = sizeof(Elf64_Rela);
+        hdr.size = elf.relocations[i].size() * sizeof(Elf64_Rela);
+
+        out.skip(align_up(out.size, 8) - out.size);
+        hdr.offset = out.add(elf.relocations[i].data(), hdr.size);
+    }
+
+    Elf64_Shdr &symtab = elf.sect_hdrs[symtab_idx];
+
+    symtab.type = SHT_SYMTAB;
+    symtab.link = strtab_idx;
+    symtab.info = first_global;
+    symtab.addralign = 8;
+    symtab.entsize = sizeof(Elf64_Sym);
+    symtab.size = elf.symbols.size() * sizeof(Elf64_Sym);
+
+    out.skip(align_up(out.size, 8) - out.size);
+    symtab.offset = out.add(elf.symbols.data(), symtab.size);
+
+    if (shndx_idx)
+    {
+        Elf64_Shdr &shndx = elf.sect_hdrs[shndx_idx];
+
+        elf.symtab_shndx.resize(elf.symbols.size(), 0);
+
+        shndx.type = SHT_SYMTAB_SHNDX;
+        shndx.link = symtab_idx;
+        shndx.addralign = 4;
+        shndx.entsize = 4;
+        shndx.size = elf.symtab_shndx.size() * 4;
+        shndx.offset = out.add(elf.symtab_shndx.data(), shndx.size);
+    }
+
+    Elf64_Shdr &strtab = elf.sect_hdrs[strtab_idx];
+
+    strtab.type = SHT_STRTAB;
+    strtab.addralign = 1;
+    strtab.size = elf.strtab.size();
+    strtab.offset = out.add(elf.strtab.data.data(), strtab.size);
+
+    Elf64_Shdr &shstrtab = elf.sect_hdrs[shstrtab_idx];
+
+    shstrtab.type = SHT_STRTAB;
+    shstrtab.addralign = 1;
+    shstrtab.size = elf.shstrtab.size();
+    shstrtab.offset = out.add(elf.shstrtab.data.data(), shstrtab.size);
+
+    out.skip(align_up(out.size, 8) - out.size);
+
+    // ELF header
+
+    Elf64_Ehdr &header = elf.header;
+    const uint8_t ident[] = {0x7f, 'E', 'L', 'F', ELFCLASS64, ELFDATA2LSB, EV_CURRENT, (uint8_t)(gnu ? ELFOSABI_GNU : ELFOSABI_NONE)};
+
+    memset(header.ident, 0, EI_NIDENT);
+    memcpy(header.ident, ident, sizeof(ident));
+
+    header.type = ET_REL;
+    header.machine = EM_X86_64;
+    header.version = EV_CURRENT;
+    header.ehsize = sizeof(Elf64_Ehdr);
+    header.shentsize = sizeof(Elf64_Shdr);
+
+    // Counts that do not fit the header are kept in section 0
+    if (num_headers >= SHN_LORESERVE)
+    {
+        header.shnum = 0;
+        elf.sect_hdrs[0].size = num_headers;
+    }
+    else
+    {
+        header.shnum = num_headers;
+    }
+
+    if (shstrtab_idx >= SHN_LORESERVE)
+    {
+        header.shstrndx = SHN_XINDEX;
+        elf.sect_hdrs[0].link = shstrtab_idx;
+    }
+    else
+    {
+        header.shstrndx = shstrtab_idx;
+    }
+
+    header.shoff = out.add(elf.sect_hdrs.data(), num_headers * sizeof(Elf64_Shdr));
+}
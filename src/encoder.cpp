@@ -1,7 +1,7 @@
 #include <encoder.h>
 
-#include <iostream>
 #include <iomanip>
+#include <cstring>
 
 /*
 
@@ -182,21 +182,846 @@ This results in the following instruction:
 
 */
 
-void print_encoded(uint8_t *encoded, std::size_t size)
+void print_encoded(std::ostream &os, const uint8_t *encoded, std::size_t size)
 {
-    std::cout << size << ": ";
+    os << std::dec << size << ": ";
 
     for (std::size_t i = 0; i < size; i++)
     {
-        std::cout << std::hex << std::setfill('0') << std::setw(2) << (uint32_t)(encoded[i]) << " ";
+        os << std::hex << std::setfill('0') << std::setw(2) << (uint32_t)(encoded[i]) << " ";
     }
 
-    std::cout << std::endl;
+    os << std::dec << std::endl;
 }
 
-void encode(uint8_t *&encoded, std::size_t &size)
+bool lookup_mnemonic(std::string_view name, Instr &instr)
 {
-    encoded = new uint8_t[16]{};
+    const Instruction *exact = find_instruction(name);
+    const Instruction *base = nullptr;
 
-    print_encoded(encoded, size);
-}
\ No newline at end of file
+    instr.size = 0;
+
+    if (name.length() > 1)
+    {
+        switch (name.back())
+        {
+        case 'b':
+            instr.size = 1;
+            break;
+        case 'w':
+            instr.size = 2;
+            break;
+        case 'l':
+            instr.size = 4;
+            break;
+        case 'q':
+            instr.size = 8;
+            break;
+        }
+
+        if (instr.size)
+        {
+            base = find_instruction(name.substr(0, name.length() - 1));
+        }
+    }
+
+    instr.mnemonic = exact ? exact - INSTRUCTIONS.data() : MNEMONIC_NONE;
+    instr.base_mnemonic = base ? base - INSTRUCTIONS.data() : MNEMONIC_NONE;
+
+    return exact || base;
+}
+
+static bool is_gp(const Operand &op, uint8_t size)
+{
+    return op.type == OPND_REG && op.reg_class == RC_GP && op.size == size;
+}
+
+static bool imm_fits(const Opcode_Form &form, uint8_t kind, const Operand &op)
+{
+    int64_t value = op.value;
+    uint8_t size = form_size(form);
+    bool sign_extended = size == 8 || (form.flags & FORM_DEF64);
+
+    // Symbol values are only known at link time, they need a full width field
+    if (op.sym != SYM_NONE)
+    {
+        return kind == OPK_IMM32 || kind == OPK_IMM64;
+    }
+
+    // The processor only sees the low bits of a 16 or 32-bit operation, so 0xffffffff is -1 there
+    if (!sign_extended && (size == 2 || size == 4) && kind == OPK_IMM8 && value >= 0)
+    {
+        int64_t top = (int64_t)(1) << (size * 8);
+
+        if (value < top && value >= top - 0x80)
+        {
+            return true;
+        }
+    }
+
+    switch (kind)
+    {
+    case OPK_IMM8:
+        return value >= -0x80 && value <= (sign_extended || size > 1 ? 0x7f : 0xff);
+    case OPK_IMM16:
+        return value >= -0x8000 && value <= 0xffff;
+    case OPK_IMM32:
+        return value >= INT32_MIN && value <= (sign_extended ? INT32_MAX : UINT32_MAX);
+    case OPK_IMM64:
+        return true;
+    }
+
+    return false;
+}
+
+static bool operand_matches(const Opcode_Form &form, uint8_t kind, const Operand &op, bool mem_sized)
+{
+    bool mem = op.type == OPND_MEM;
+    bool direct = mem && op.base == REG_NONE && op.index == REG_NONE && !op.indirect;
+
+    // '*' marks the target of an indirect branch and is only valid there
+    if (op.indirect && !(form.flags & FORM_DEF64))
+    {
+        return false;
+    }
+
+    switch (kind)
+    {
+    case OPK_R8:
+        return is_gp(op, 1);
+    case OPK_R16:
+        return is_gp(op, 2);
+    case OPK_R32:
+        return is_gp(op, 4);
+    case OPK_R64:
+        return is_gp(op, 8);
+    case OPK_RM8:
+        return is_gp(op, 1) || (mem && mem_sized);
+    case OPK_RM16:
+        return is_gp(op, 2) || (mem && mem_sized);
+    case OPK_RM32:
+        return is_gp(op, 4) || (mem && mem_sized);
+    case OPK_RM64:
+        // Branch targets through r/m must be written with '*'
+        if (form.flags & FORM_DEF64 && form.enc == ENC_M && form.opcode[0] == 0xff && form.digit != 6)
+        {
+            return op.indirect && (is_gp(op, 8) || mem);
+        }
+
+        return is_gp(op, 8) || (mem && mem_sized);
+    case OPK_M:
+    case OPK_M16:
+    case OPK_M32:
+    case OPK_M64:
+        return mem;
+    case OPK_IMM8:
+    case OPK_IMM16:
+    case OPK_IMM32:
+    case OPK_IMM64:
+        return op.type == OPND_IMM && imm_fits(form, kind, op);
+    case OPK_REL8:
+        return direct && (op.sym != SYM_NONE || (op.value >= -0x80 && op.value <= 0x7f));
+    case OPK_REL32:
+        return direct;
+    case OPK_AL:
+        return is_gp(op, 1) && op.reg == 0;
+    case OPK_AX:
+        return is_gp(op, 2) && op.reg == 0;
+    case OPK_EAX:
+        return is_gp(op, 4) && op.reg == 0;
+    case OPK_RAX:
+        return is_gp(op, 8) && op.reg == 0;
+    case OPK_CL:
+        return is_gp(op, 1) && op.reg == 1;
+    case OPK_ONE:
+        return op.type == OPND_IMM && op.sym == SYM_NONE && op.value == 1;
+    case OPK_XMM:
+        return op.type == OPND_REG && op.reg_class == RC_XMM;
+    case OPK_XMM_M32:
+    case OPK_XMM_M64:
+    case OPK_XMM_M128:
+        return (op.type == OPND_REG && op.reg_class == RC_XMM) || mem;
+    }
+
+    return false;
+}
+
+static bool form_matches(const Opcode_Form &form, const Instr &instr, uint8_t size, bool one_size)
+{
+    uint8_t num_ops = 0;
+
+    while (num_ops < 3 && form.operands[num_ops] != OPK_NONE)
+    {
+        num_ops++;
+    }
+
+    if (num_ops != instr.num_ops)
+    {
+        return false;
+    }
+
+    uint8_t fsize = form_size(form);
+
+    if (size && fsize && size != fsize)
+    {
+        return false;
+    }
+
+    // Without a suffix the size of a memory operand has to come from the
+    // mnemonic or a register, an xmm register sizing it through the mnemonic
+    // (movd)
+    bool mem_sized = size != 0 || one_size || (form.flags & FORM_DEF64);
+
+    for (uint8_t i = 0; i < num_ops; i++)
+    {
+        if (instr.ops[i].type == OPND_REG && (instr.ops[i].reg_class == RC_GP || instr.ops[i].reg_class == RC_XMM))
+        {
+            mem_sized = true;
+        }
+    }
+
+    for (uint8_t i = 0; i < num_ops; i++)
+    {
+        if (!operand_matches(form, form.operands[i], instr.ops[i], mem_sized))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void put_value(uint8_t *&p, int64_t value, uint8_t size)
+{
+    for (uint8_t i = 0; i < size; i++)
+    {
+        *p++ = (uint8_t)(value >> (i * 8));
+    }
+}
+
+// Bytes of a form apart from REX.RXB, ModR/M, SIB and displacement, which
+// are the same for every form that takes the same operands
+static uint8_t form_cost(const Opcode_Form &form)
+{
+    uint8_t cost = form.opcode_len + (form.prefix != 0) + ((form.flags & FORM_DATA16) != 0) + (form.rex != 0);
+
+    switch (form.enc)
+    {
+    case ENC_MR:
+    case ENC_RM:
+    case ENC_M:
+    case ENC_MI:
+    case ENC_RMI:
+    case ENC_MRI:
+        cost++;
+        break;
+    }
+
+    for (uint8_t kind : form.operands)
+    {
+        cost += imm_size(kind);
+    }
+
+    return cost;
+}
+
+static bool encode_form(const Opcode_Form &form, const Instr &instr, uint8_t *encoded, std::size_t &size, Enc_Fixup *fixups, std::size_t &num_fixups,
+                        Enc_Size_Stats *size_stats)
+{
+    const Operand *reg_op = nullptr;
+    const Operand *rm_op = nullptr;
+    const Operand *opcode_op = nullptr;
+    const Operand *imm_op = nullptr;
+    uint8_t imm_kind = OPK_NONE;
+
+    switch (form.enc)
+    {
+    case ENC_MR:
+        rm_op = &instr.ops[0];
+        reg_op = &instr.ops[1];
+        break;
+    case ENC_RM:
+        reg_op = &instr.ops[0];
+        rm_op = &instr.ops[1];
+        break;
+    case ENC_M:
+        rm_op = &instr.ops[0];
+        break;
+    case ENC_MI:
+        rm_op = &instr.ops[0];
+        imm_op = &instr.ops[1];
+        imm_kind = form.operands[1];
+        break;
+    case ENC_RMI:
+        reg_op = &instr.ops[0];
+        rm_op = &instr.ops[1];
+        imm_op = &instr.ops[2];
+        imm_kind = form.operands[2];
+        break;
+    case ENC_MRI:
+        rm_op = &instr.ops[0];
+        reg_op = &instr.ops[1];
+        imm_op = &instr.ops[2];
+        imm_kind = form.operands[2];
+        break;
+    case ENC_O:
+        opcode_op = &instr.ops[0];
+        break;
+    case ENC_OI:
+        opcode_op = &instr.ops[0];
+        imm_op = &instr.ops[1];
+        imm_kind = form.operands[1];
+        break;
+    case ENC_I:
+    case ENC_D:
+        imm_op = &instr.ops[instr.num_ops - 1];
+        imm_kind = form.operands[instr.num_ops - 1];
+        break;
+    }
+
+    // REX prefix
+
+    uint8_t rex = form.rex;
+    bool need_rex = false;
+    bool no_rex = false;
+
+    for (uint8_t i = 0; i < instr.num_ops; i++)
+    {
+        const Operand &op = instr.ops[i];
+
+        if (op.type == OPND_REG && op.reg_class == RC_GP && op.size == 1)
+        {
+            need_rex |= (op.reg_flags & REG_NEED_REX) != 0;
+            no_rex |= (op.reg_flags & REG_NO_REX) != 0;
+        }
+    }
+
+    if (reg_op && reg_op->reg >= 8)
+    {
+        rex |= REX_R;
+    }
+
+    if (opcode_op && opcode_op->reg >= 8)
+    {
+        rex |= REX_B;
+    }
+
+    if (rm_op && rm_op->type == OPND_REG && rm_op->reg >= 8)
+    {
+        rex |= REX_B;
+    }
+
+    if (rm_op && rm_op->type == OPND_MEM)
+    {
+        if (rm_op->base != REG_NONE && rm_op->base != REG_RIP && rm_op->base >= 8)
+        {
+            rex |= REX_B;
+        }
+
+        if (rm_op->index != REG_NONE && rm_op->index >= 8)
+        {
+            rex |= REX_X;
+        }
+    }
+
+    if ((rex || need_rex) && no_rex)
+    {
+        return false;
+    }
+
+    uint8_t *p = encoded;
+
+    if (instr.segment || instr.prefix)
+    {
+        // A repeat prefix would stand for another mandatory one
+        if (instr.prefix != PREFIX_LOCK && (form.prefix == PREFIX_REP || form.prefix == PREFIX_REPNZ))
+        {
+            return false;
+        }
+
+        // Prefixes, REX and the longest ModR/M, SIB and displacement must
+        // still fit in the buffer
+        if (form_cost(form) + (instr.segment != 0) + (instr.prefix != 0) + 6 > MAX_INSTR_SIZE)
+        {
+            return false;
+        }
+
+        if (instr.segment)
+        {
+            *p++ = instr.segment;
+        }
+
+        if (form.prefix == 0x66 || (form.flags & FORM_DATA16))
+        {
+            *p++ = 0x66;
+        }
+
+        if (instr.prefix)
+        {
+            *p++ = instr.prefix;
+        }
+
+        if (form.prefix && form.prefix != 0x66)
+        {
+            *p++ = form.prefix;
+        }
+    }
+    else if (form.prefix)
+    {
+        if (form.flags & FORM_DATA16)
+        {
+            *p++ = 0x66;
+        }
+
+        *p++ = form.prefix;
+    }
+
+    if (rex || need_rex)
+    {
+        *p++ = REX_PRESENT | rex;
+    }
+
+    // Opcode
+
+    for (uint8_t i = 0; i < form.opcode_len; i++)
+    {
+        *p++ = form.opcode[i];
+    }
+
+    if (opcode_op)
+    {
+        p[-1] += opcode_op->reg & 0x7;
+    }
+
+    // ModR/M, SIB and displacement
+
+    Enc_Fixup *disp_fixup = nullptr;
+    num_fixups = 0;
+
+    if (rm_op)
+    {
+        uint8_t reg = reg_op ? reg_op->reg & 0x7 : form.digit & 0x7;
+
+        if (rm_op->type == OPND_REG)
+        {
+            *p++ = 0xc0 | (reg << 3) | (rm_op->reg & 0x7);
+        }
+        else if (rm_op->base == REG_RIP)
+        {
+            if (rm_op->index != REG_NONE)
+            {
+                return false;
+            }
+
+            *p++ = 0x05 | (reg << 3);
+            disp_fixup = &fixups[num_fixups];
+        }
+        else
+        {
+            uint8_t base = rm_op->base;
+            uint8_t index = rm_op->index;
+            uint8_t scale = 0;
+
+            switch (rm_op->scale)
+            {
+            case 0:
+            case 1:
+                scale = 0;
+                break;
+            case 2:
+                scale = 1;
+                break;
+            case 4:
+                scale = 2;
+                break;
+            case 8:
+                scale = 3;
+                break;
+            default:
+                return false;
+            }
+
+            // rsp cannot be an index, its encoding means "no index"
+            if (index == 4)
+            {
+                return false;
+            }
+
+            bool has_disp = rm_op->value != 0 || rm_op->sym != SYM_NONE;
+
+            if (base == REG_NONE)
+            {
+                // Absolute disp32 goes through a SIB byte with no base, plain mod 00 rm 101 is rip relative
+                *p++ = 0x04 | (reg << 3);
+                *p++ = (scale << 6) | ((index == REG_NONE ? 4 : index & 0x7) << 3) | 0x5;
+                disp_fixup = &fixups[num_fixups];
+            }
+            else
+            {
+                // rbp and r13 as a base always need a displacement, a plain one that fits takes a byte
+                uint8_t mod = 0x80;
+
+                if (!has_disp && (base & 0x7) != 5)
+                {
+                    mod = 0x00;
+                }
+                else if (rm_op->sym == SYM_NONE && rm_op->value >= -0x80 && rm_op->value <= 0x7f)
+                {
+                    mod = 0x40;
+                }
+
+                if (index == REG_NONE && (base & 0x7) != 4)
+                {
+                    *p++ = mod | (reg << 3) | (base & 0x7);
+                }
+                else
+                {
+                    *p++ = mod | (reg << 3) | 0x4;
+                    *p++ = (scale << 6) | ((index == REG_NONE ? 4 : index & 0x7) << 3) | (base & 0x7);
+                }
+
+                if (mod == 0x80)
+                {
+                    disp_fixup = &fixups[num_fixups];
+                }
+                else if (mod == 0x40)
+                {
+                    *p++ = (uint8_t)(rm_op->value);
+
+                    if (size_stats)
+                    {
+                        size_stats->instrs[SIZE_RULE_DISP8]++;
+                        size_stats->bytes[SIZE_RULE_DISP8] += 3;
+                    }
+                }
+            }
+        }
+
+        if (disp_fixup)
+        {
+            disp_fixup->offset = p - encoded;
+            disp_fixup->size = 4;
+            disp_fixup->flags = rm_op->base == REG_RIP ? FIX_PCREL : FIX_SIGNED;
+            disp_fixup->trail = 0;
+            disp_fixup->modifier = rm_op->modifier;
+            disp_fixup->sym = rm_op->sym;
+            disp_fixup->addend = rm_op->value;
+
+            put_value(p, rm_op->sym == SYM_NONE ? rm_op->value : 0, 4);
+
+            // A plain displacement needs no fixup
+            if (rm_op->sym == SYM_NONE)
+            {
+                disp_fixup = nullptr;
+            }
+            else
+            {
+                num_fixups++;
+            }
+        }
+    }
+
+    // Immediate or branch displacement
+
+    if (imm_op && imm_kind != OPK_CL && imm_kind != OPK_ONE && imm_kind < OPK_AL)
+    {
+        uint8_t size = imm_size(imm_kind);
+
+        if (imm_op->sym != SYM_NONE)
+        {
+            Enc_Fixup &fixup = fixups[num_fixups++];
+
+            fixup.offset = p - encoded;
+            fixup.size = size;
+            fixup.flags = form.enc == ENC_D ? FIX_PCREL : (size == 4 && (form_size(form) == 8 || (form.flags & FORM_DEF64)) ? FIX_SIGNED : 0);
+            fixup.trail = 0;
+            fixup.modifier = imm_op->modifier;
+            fixup.sym = imm_op->sym;
+            fixup.addend = imm_op->value;
+
+            put_value(p, 0, size);
+        }
+        else
+        {
+            put_value(p, imm_op->value, size);
+        }
+
+        if (disp_fixup)
+        {
+            disp_fixup->trail = size;
+        }
+    }
+
+    size = p - encoded;
+
+    return true;
+}
+
+static bool has_imm8(const Opcode_Form &form)
+{
+    for (uint8_t kind : form.operands)
+    {
+        if (kind == OPK_IMM8)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Counts what choosing best over first, the form the table lists first, saved
+static void count_choice(const Opcode_Form &first, const Opcode_Form &best, Enc_Size_Stats *size_stats)
+{
+    uint8_t rule = SIZE_RULE_ACCUMULATOR;
+
+    if (!size_stats || &first == &best)
+    {
+        return;
+    }
+
+    if (has_imm8(best) && !has_imm8(first))
+    {
+        rule = SIZE_RULE_IMM8;
+    }
+    else if (best.enc == ENC_OI)
+    {
+        rule = SIZE_RULE_MOV_REG;
+    }
+
+    size_stats->instrs[rule]++;
+    size_stats->bytes[rule] += form_cost(first) - form_cost(best);
+}
+
+bool encode(const Instr &instr, uint8_t *encoded, std::size_t &size, Enc_Fixup *fixups, std::size_t &num_fixups, Enc_Size_Stats *size_stats,
+            uint16_t *form_idx)
+{
+    // The mnemonic as written is tried first, then the mnemonic without its
+    // size suffix. Of the forms that take the operands the shortest is used,
+    // the earliest in the table on a tie
+
+    uint16_t mnemonics[2] = {instr.mnemonic, instr.base_mnemonic};
+    uint8_t sizes[2] = {0, instr.size};
+    bool has_imm = false;
+    const Opcode_Form *first = nullptr;
+    const Opcode_Form *best = nullptr;
+    uint8_t best_cost = 0;
+
+    // Forms of one mnemonic only differ in length by how they take an immediate
+    for (uint8_t i = 0; i < instr.num_ops; i++)
+    {
+        has_imm |= instr.ops[i].type == OPND_IMM;
+    }
+
+    for (uint8_t m = 0; m < 2 && !best; m++)
+    {
+        if (mnemonics[m] == MNEMONIC_NONE)
+        {
+            continue;
+        }
+
+        const Instruction &instruction = INSTRUCTIONS[mnemonics[m]];
+
+        for (uint16_t i = 0; i < instruction.num_forms; i++)
+        {
+            const Opcode_Form &form = FORMS[instruction.first_form + i];
+
+            if (!form_matches(form, instr, sizes[m], instruction.one_size))
+            {
+                continue;
+            }
+
+            // Without an immediate the first form is as short as any, and
+            // branch displacements are sized by relaxation rather than here
+            if (!has_imm || form.enc == ENC_D)
+            {
+                if (!first)
+                {
+                    if (form_idx)
+                    {
+                        *form_idx = &form - FORMS;
+                    }
+
+                    return encode_form(form, instr, encoded, size, fixups, num_fixups, size_stats);
+                }
+
+                continue;
+            }
+
+            uint8_t cost = form_cost(form);
+
+            if (!best || cost < best_cost)
+            {
+                best = &form;
+                best_cost = cost;
+            }
+
+            first = first ? first : &form;
+        }
+    }
+
+    if (best)
+    {
+        count_choice(*first, *best, size_stats);
+
+        if (form_idx)
+        {
+            *form_idx = best - FORMS;
+        }
+
+        return encode_form(*best, instr, encoded, size, fixups, num_fixups, size_stats);
+    }
+
+    size = 0;
+    num_fixups = 0;
+
+    return false;
+}
+
+void add_size_stats(Enc_Size_Stats &total, const Enc_Size_Stats &stats)
+{
+    for (std::size_t i = 0; i < NUM_SIZE_RULES; i++)
+    {
+        total.instrs[i] += stats.instrs[i];
+        total.bytes[i] += stats.bytes[i];
+    }
+}
+
+std::size_t encode_batch(const Instr *instrs, std::size_t count, uint8_t *out, std::size_t capacity, Enc_Record *records)
+{
+    std::size_t offset = 0;
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+        if (capacity - offset < MAX_INSTR_SIZE)
+        {
+            return i;
+        }
+
+        Enc_Record &record = records[i];
+        std::size_t size;
+        std::size_t num_fixups;
+
+        if (!encode(instrs[i], out + offset, size, record.fixups, num_fixups))
+        {
+            return i;
+        }
+
+        record.offset = offset;
+        record.size = size;
+        record.num_fixups = num_fixups;
+        offset += size;
+    }
+
+    return count;
+}
+
+// The rel32 of call, jmp and jcc directly follows the opcode, where any
+// other PC relative field follows a ModR/M byte, which can never be one of
+// these opcodes when it selects RIP relative addressing
+bool is_branch_field(const uint8_t *field, uint64_t offset)
+{
+    if (offset >= 1 && (field[-1] == 0xe8 || field[-1] == 0xe9))
+    {
+        return true;
+    }
+
+    return offset >= 2 && field[-2] == 0x0f && (field[-1] & 0xf0) == 0x80;
+}
+
+uint8_t relaxable_branch(const Instr &instr)
+{
+    const Operand &op = instr.ops[0];
+
+    // Prefixed branches keep the form they were written with
+    if (instr.num_ops != 1 || op.type != OPND_MEM || op.sym == SYM_NONE || op.base != REG_NONE || op.index != REG_NONE || op.indirect ||
+        instr.prefix || instr.segment)
+    {
+        return 0;
+    }
+
+    uint16_t mnemonics[2] = {instr.mnemonic, instr.base_mnemonic};
+
+    for (uint16_t mnemonic : mnemonics)
+    {
+        if (mnemonic == MNEMONIC_NONE)
+        {
+            continue;
+        }
+
+        const Instruction &instruction = INSTRUCTIONS[mnemonic];
+
+        for (uint16_t i = 0; i < instruction.num_forms; i++)
+        {
+            const Opcode_Form &form = FORMS[instruction.first_form + i];
+
+            if (form.operands[0] == OPK_REL8 && (form.opcode[0] == 0xeb || (form.opcode[0] & 0xf0) == 0x70))
+            {
+                return form.opcode[0];
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Mixes value into hash, a multiply and a shift for the whole word
+static uint64_t hash_value(uint64_t hash, uint64_t value)
+{
+    hash = (hash ^ value) * 0x9e3779b97f4a7c15;
+
+    return hash ^ (hash >> 29);
+}
+
+uint32_t hash_operands(const Instr &instr, const Opcode_Form &form)
+{
+    uint64_t hash = hash_value(0, instr.prefix | instr.segment << 8);
+    uint8_t size = form_size(form);
+
+    // Operands past those of the form are implied, as the %cl of shld
+    // written with two operands is to the form that lists it
+    for (uint8_t i = 0; i < instr.num_ops && i < 3 && form.operands[i] != OPK_NONE; i++)
+    {
+        const Operand &op = instr.ops[i];
+        uint8_t kind = form.operands[i];
+
+        hash = hash_value(hash, op.type);
+
+        if (op.type == OPND_REG)
+        {
+            hash = hash_value(hash, op.reg | op.reg_class << 8);
+        }
+        else if (op.type == OPND_IMM && op.sym == SYM_NONE)
+        {
+            uint8_t bytes = size ? size : imm_size(kind);
+
+            hash = hash_value(hash, bytes < 8 ? op.value & ((1ull << (bytes * 8)) - 1) : op.value);
+        }
+        else if (op.type == OPND_MEM)
+        {
+            hash = hash_value(hash, op.base | op.index << 8 | (op.index != REG_NONE ? op.scale : 0) << 16);
+
+            if (op.sym == SYM_NONE && imm_size(kind) == 0)
+            {
+                hash = hash_value(hash, (uint32_t)(op.value));
+            }
+        }
+    }
+
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+uint32_t hash_encoding(const uint8_t *code, std::size_t size)
+{
+    uint64_t words[2];
+
+    memcpy(words, code, ENCODING_HASH_BYTES);
+
+    // Bytes past the instruction are masked off the words
+    words[0] &= size >= 8 ? ~0ull : (1ull << (size * 8)) - 1;
+    words[1] &= size <= 8 ? 0 : (1ull << ((size - 8) * 8)) - 1;
+
+    uint64_t hash = hash_value(hash_value(size, words[0]), words[1]);
+
+    return (uint32_t)(hash ^ (hash >> 32));
+}
@@ -0,0 +1,620 @@
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <jit.h>
+#include <object.h>
+#include <parser.h>
+#include <diag.h>
+
+#define JIT_FILE "<jit>"
+#define JIT_NONE 0xffffffffffffffff
+
+#define JIT_CODE 0
+#define JIT_RODATA 1
+#define JIT_DATA 2
+#define JIT_GROUPS 3
+
+#define JIT_STUB_SIZE 16              // jmp *0(%rip) followed by the target address
+#define JIT_NEAR_DISTANCE 0x10000000  // How far below the first external symbol a module is placed
+#define JIT_HINT_ALIGNMENT 0x10000
+
+// Pages
+
+#ifdef _WIN32
+
+static std::size_t page_size()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+
+    return info.dwPageSize;
+}
+
+static uint8_t *map_pages(uint64_t hint, std::size_t size)
+{
+    void *pages = hint ? VirtualAlloc((void *)(hint), size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE) : nullptr;
+
+    if (!pages)
+    {
+        pages = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    }
+
+    return (uint8_t *)(pages);
+}
+
+static bool protect_pages(uint8_t *pages, std::size_t size, int group)
+{
+    DWORD protection = group == JIT_CODE ? PAGE_EXECUTE_READ : group == JIT_RODATA ? PAGE_READONLY : PAGE_READWRITE;
+    DWORD old;
+
+    if (!VirtualProtect(pages, size, protection, &old))
+    {
+        return false;
+    }
+
+    return group != JIT_CODE || FlushInstructionCache(GetCurrentProcess(), pages, size);
+}
+
+static void unmap_pages(uint8_t *pages, std::size_t)
+{
+    VirtualFree(pages, 0, MEM_RELEASE);
+}
+
+#else
+
+static std::size_t page_size()
+{
+    return sysconf(_SC_PAGESIZE);
+}
+
+// The hint is only a hint, the pages go elsewhere if it is taken
+static uint8_t *map_pages(uint64_t hint, std::size_t size)
+{
+    void *pages = mmap((void *)(hint), size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    return pages == MAP_FAILED ? nullptr : (uint8_t *)(pages);
+}
+
+static bool protect_pages(uint8_t *pages, std::size_t size, int group)
+{
+    int protection = group == JIT_CODE ? PROT_READ | PROT_EXEC : group == JIT_RODATA ? PROT_READ : PROT_READ | PROT_WRITE;
+
+    if (mprotect(pages, size, protection) != 0)
+    {
+        return false;
+    }
+
+    if (group == JIT_CODE)
+    {
+        __builtin___clear_cache((char *)(pages), (char *)(pages + size));
+    }
+
+    return true;
+}
+
+static void unmap_pages(uint8_t *pages, std::size_t size)
+{
+    munmap(pages, size);
+}
+
+#endif
+
+// Somewhere below address that leaves room for the module, so rel32 fields
+// reach it when the pages there are free
+static uint64_t near_hint(uint64_t address)
+{
+    return address > JIT_NEAR_DISTANCE ? (address - JIT_NEAR_DISTANCE) & ~(uint64_t)(JIT_HINT_ALIGNMENT - 1) : 0;
+}
+
+// Which pages a section is loaded into, -1 for sections that are not loaded
+static int section_group(const Section &section)
+{
+    uint32_t flags = section.header.flags;
+
+    if (!(flags & IMAGE_SCN_MEM_READ) || (flags & IMAGE_SCN_LNK_REMOVE))
+    {
+        return -1;
+    }
+
+    if (flags & IMAGE_SCN_MEM_EXECUTE)
+    {
+        return JIT_CODE;
+    }
+
+    return flags & IMAGE_SCN_MEM_WRITE ? JIT_DATA : JIT_RODATA;
+}
+
+// Sends a branch through stub, which is filled the first time it is used
+static bool use_stub(uint8_t *stub, uint64_t target)
+{
+    static const uint8_t JMP_RIP[6] = {0xff, 0x25, 0x00, 0x00, 0x00, 0x00};
+
+    if (stub[0] == 0xff)
+    {
+        uint64_t filled;
+        memcpy(&filled, stub + sizeof(JMP_RIP), 8);
+
+        return filled == target;
+    }
+
+    memcpy(stub, JMP_RIP, sizeof(JMP_RIP));
+    memcpy(stub + sizeof(JMP_RIP), &target, 8);
+
+    return true;
+}
+
+// Adds target to a relocated field that holds its addend, as in a COFF object.
+// Returns what is wrong, or nullptr
+static const char *relocate(const Jit_Module &module, uint8_t *field, uint16_t type, uint64_t target, bool branch, uint8_t *stub)
+{
+    if (type >= IMAGE_REL_AMD64_REL32 && type <= IMAGE_REL_AMD64_REL32_5)
+    {
+        int32_t value;
+        memcpy(&value, field, 4);
+
+        uint64_t end = (uint64_t)(field) + 4 + (type - IMAGE_REL_AMD64_REL32);
+        int64_t distance = target + value - end;
+
+        if (distance != (int32_t)(distance) && branch && stub)
+        {
+            if (!use_stub(stub, target + value))
+            {
+                return "branches to one symbol with different addends";
+            }
+
+            distance = (uint64_t)(stub) - end;
+        }
+
+        if (distance != (int32_t)(distance))
+        {
+            return "out of reach of a 32 bit displacement";
+        }
+
+        value = distance;
+        memcpy(field, &value, 4);
+    }
+    else if (type == IMAGE_REL_AMD64_ADDR64)
+    {
+        uint64_t value;
+        memcpy(&value, field, 8);
+
+        value += target;
+        memcpy(field, &value, 8);
+    }
+    else if (type == IMAGE_REL_AMD64_ADDR32 || type == IMAGE_REL_AMD64_ADDR32NB)
+    {
+        int32_t value;
+        memcpy(&value, field, 4);
+
+        // The field may be sign extended, so only the low 2 GB are in reach
+        uint64_t address = target + value - (type == IMAGE_REL_AMD64_ADDR32NB ? (uint64_t)(module.base) : 0);
+
+        if (address > INT32_MAX)
+        {
+            return "address does not fit in 32 bits";
+        }
+
+        uint32_t address32 = address;
+        memcpy(field, &address32, 4);
+    }
+    else
+    {
+        return "relocation type not supported";
+    }
+
+    return nullptr;
+}
+
+// Makes each group of pages executable, read-only or writable. group_starts
+// holds JIT_GROUPS + 1 offsets
+static bool protect_module(Jit_Module &module, const uint64_t *group_starts)
+{
+    for (int group = 0; group < JIT_GROUPS; group++)
+    {
+        uint64_t size = group_starts[group + 1] - group_starts[group];
+
+        if (size > 0 && !protect_pages(module.base + group_starts[group], size, group))
+        {
+            diag() << "error: cannot change the protection of JIT pages" << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void add_symbol(Jit_Module &module, std::string_view name, void *address)
+{
+    Jit_Symbol symbol = {(uint32_t)(module.names.size()), (uint32_t)(name.length()), address};
+
+    module.names.append(name);
+    module.symbols.emplace_back(symbol);
+
+    module.symbol_index.insert(name, module.symbols.size() - 1, [&](uint32_t idx)
+                               { return std::string_view(module.names.data() + module.symbols[idx].name, module.symbols[idx].length); });
+}
+
+bool jit_assemble(std::string_view source, const Jit_Resolver &resolver, Jit_Module &module)
+{
+    Object obj;
+    std::vector<Chunk> chunks;
+
+    init_object(obj);
+
+    // Sources given to the JIT are small, so their chunks are parsed here
+    // rather than on a pool
+    bool ok = split_source(source, JIT_FILE, obj, chunks);
+    std::vector<Unit> units(chunks.size());
+
+    for (std::size_t i = 0; i < chunks.size(); i++)
+    {
+        parse_chunk(chunks[i], JIT_FILE, obj, units[i]);
+    }
+
+    ok = merge_units(units, JIT_FILE, obj) && ok;
+
+    return ok && jit_link(obj, resolver, module);
+}
+
+bool jit_link(Object &obj, const Jit_Resolver &resolver, Jit_Module &module)
+{
+    Sect_Tab &sections = obj.sections;
+    Sym_Tab &sym_tab = obj.sym_tab;
+    std::vector<uint8_t> resolved(sym_tab.size(), 0);
+    std::vector<void *> externals(sym_tab.size(), nullptr);
+    std::vector<uint64_t> stubs(sym_tab.size(), JIT_NONE);
+    uint64_t num_stubs = 0;
+    uint64_t hint = 0;
+    bool ok = true;
+
+    jit_free(module);
+    finish_symbols(obj);
+
+    // Externals are bound first so the module can be placed near them. Calls
+    // and jumps to them get a stub in case they are out of reach
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        Section &section = sections[i];
+        int group = section_group(section);
+
+        for (std::size_t r = 0; group >= 0 && r < section.relocations.size(); r++)
+        {
+            const Reloc &reloc = section.relocations[r];
+            uint32_t idx = reloc.sym_tab_idx;
+            const Sym_Hdr &sym = sym_tab[idx];
+
+            // Common symbols are allocated in the module
+            if (sym.sect_num != IMAGE_SYM_UNDEFINED || sym.value > 0)
+            {
+                continue;
+            }
+
+            if (!resolved[idx])
+            {
+                std::string_view name = sym_tab.name_of(idx);
+
+                resolved[idx] = 1;
+                externals[idx] = resolver ? resolver(name) : nullptr;
+
+                if (!externals[idx])
+                {
+                    diag() << "error: undefined symbol " << name << std::endl;
+                    ok = false;
+                }
+                else if (hint == 0)
+                {
+                    hint = near_hint((uint64_t)(externals[idx]));
+                }
+            }
+
+            if (group == JIT_CODE && reloc.type == IMAGE_REL_AMD64_REL32 && stubs[idx] == JIT_NONE)
+            {
+                stubs[idx] = num_stubs++;
+            }
+        }
+    }
+
+    if (!ok)
+    {
+        return false;
+    }
+
+    // Layout, each group starts on a new page
+    std::vector<uint64_t> offsets(sections.size(), JIT_NONE);
+    std::vector<uint64_t> commons(sym_tab.size(), JIT_NONE);
+    uint64_t group_starts[JIT_GROUPS + 1];
+    uint64_t stub_offset = 0;
+    uint64_t page = page_size();
+    uint64_t size = 0;
+
+    for (int group = 0; group < JIT_GROUPS; group++)
+    {
+        size = align_up(size, page);
+        group_starts[group] = size;
+
+        for (std::size_t i = 0; i < sections.size(); i++)
+        {
+            if (section_group(sections[i]) == group)
+            {
+                size = align_up(size, sections[i].alignment());
+                offsets[i] = size;
+                size += sections[i].loc();
+            }
+        }
+
+        if (group == JIT_CODE)
+        {
+            size = align_up(size, JIT_STUB_SIZE);
+            stub_offset = size;
+            size += num_stubs * JIT_STUB_SIZE;
+        }
+        else if (group == JIT_DATA)
+        {
+            for (std::size_t i = 0; i < sym_tab.size(); i += 1 + sym_tab[i].num_aux_sym)
+            {
+                const Sym_Hdr &sym = sym_tab[i];
+
+                if (sym.sect_num != IMAGE_SYM_UNDEFINED || sym.value == 0 || sym.storage_class != IMAGE_SYM_CLASS_EXTERNAL)
+                {
+                    continue;
+                }
+
+                // Aligned as the ELF writer declares them
+                uint64_t alignment = 1;
+
+                while (alignment < 16 && alignment * 2 <= sym.value)
+                {
+                    alignment *= 2;
+                }
+
+                size = align_up(size, alignment);
+                commons[i] = size;
+                size += sym.value;
+            }
+        }
+    }
+
+    size = std::max(align_up(size, page), page);
+    group_starts[JIT_GROUPS] = size;
+
+    module.base = map_pages(hint, size);
+
+    if (!module.base)
+    {
+        diag() << "error: cannot allocate " << size << " bytes for JIT code" << std::endl;
+        return false;
+    }
+
+    module.size = size;
+
+    // The pages start zeroed, which leaves bss, commons and unused stubs as they should be
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        if (offsets[i] == JIT_NONE || sections[i].is_bss())
+        {
+            continue;
+        }
+
+        uint8_t *dest = module.base + offsets[i];
+
+        sections[i].for_each_range([&](const uint8_t *data, std::size_t length)
+                                   {
+                                       if (data)
+                                       {
+                                           memcpy(dest, data, length);
+                                       }
+
+                                       dest += length; });
+    }
+
+    auto address_of = [&](uint32_t idx, uint64_t &address)
+    {
+        const Sym_Hdr &sym = sym_tab[idx];
+        int16_t sect_num = sym.sect_num;
+
+        if (sect_num > 0)
+        {
+            address = (uint64_t)(module.base) + offsets[sect_num - 1] + sym.value;
+            return offsets[sect_num - 1] != JIT_NONE;
+        }
+
+        if (sect_num == IMAGE_SYM_ABSOLUTE)
+        {
+            address = sym.value;
+        }
+        else
+        {
+            address = commons[idx] != JIT_NONE ? (uint64_t)(module.base) + commons[idx] : (uint64_t)(externals[idx]);
+        }
+
+        return true;
+    };
+
+    for (std::size_t i = 0; i < sections.size(); i++)
+    {
+        Section &section = sections[i];
+
+        if (offsets[i] == JIT_NONE)
+        {
+            continue;
+        }
+
+        for (std::size_t r = 0; r < section.relocations.size(); r++)
+        {
+            const Reloc &reloc = section.relocations[r];
+            uint32_t idx = reloc.sym_tab_idx;
+            uint8_t *field = module.base + offsets[i] + reloc.virt_addr;
+            uint8_t *stub = stubs[idx] != JIT_NONE ? module.base + stub_offset + stubs[idx] * JIT_STUB_SIZE : nullptr;
+            uint64_t target;
+            const char *problem = "refers to a section that is not loaded";
+
+            if (address_of(idx, target))
+            {
+                problem = relocate(module, field, reloc.type, target, is_branch_field(field, reloc.virt_addr), stub);
+            }
+
+            if (problem)
+            {
+                diag() << "error: " << section.name << "+0x" << std::hex << reloc.virt_addr << std::dec << ": "
+                          << sym_tab.name_of(idx) << ": " << problem << std::endl;
+                ok = false;
+            }
+        }
+    }
+
+    // Every label placed in the module can be looked up
+    for (const Label &label : obj.labels)
+    {
+        if (label.flags & LABEL_DEFINED)
+        {
+            uint64_t offset = offsets[label.section.number() - 1];
+
+            if (offset != JIT_NONE)
+            {
+                add_symbol(module, label.name, module.base + offset + label.loc);
+            }
+        }
+        else if (commons[label.sym] != JIT_NONE)
+        {
+            add_symbol(module, label.name, module.base + commons[label.sym]);
+        }
+    }
+
+    if (!ok || !protect_module(module, group_starts))
+    {
+        jit_free(module);
+        return false;
+    }
+
+    return true;
+}
+
+bool jit_load(const uint8_t *code, std::size_t size, const Enc_Record *records, std::size_t count, void *const *symbols, Jit_Module &module)
+{
+    uint64_t num_stubs = 0;
+    uint64_t hint = 0;
+
+    jit_free(module);
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+        for (std::size_t f = 0; f < records[i].num_fixups; f++)
+        {
+            const Enc_Fixup &fixup = records[i].fixups[f];
+
+            num_stubs += (fixup.flags & FIX_PCREL) ? 1 : 0;
+
+            if (hint == 0 && symbols[fixup.sym])
+            {
+                hint = near_hint((uint64_t)(symbols[fixup.sym]));
+            }
+        }
+    }
+
+    uint64_t page = page_size();
+    uint64_t stub_offset = align_up(size, JIT_STUB_SIZE);
+    uint64_t group_starts[JIT_GROUPS + 1];
+
+    group_starts[JIT_CODE] = 0;
+    group_starts[JIT_RODATA] = group_starts[JIT_DATA] = group_starts[JIT_GROUPS] = std::max(align_up(stub_offset + num_stubs * JIT_STUB_SIZE, page), page);
+
+    module.base = map_pages(hint, group_starts[JIT_GROUPS]);
+
+    if (!module.base)
+    {
+        diag() << "error: cannot allocate " << group_starts[JIT_GROUPS] << " bytes for JIT code" << std::endl;
+        return false;
+    }
+
+    module.size = group_starts[JIT_GROUPS];
+    memcpy(module.base, code, size);
+
+    uint8_t *stub = module.base + stub_offset;
+    bool ok = true;
+
+    for (std::size_t i = 0; i < count; i++)
+    {
+        const Enc_Record &record = records[i];
+
+        for (std::size_t f = 0; f < record.num_fixups; f++)
+        {
+            const Enc_Fixup &fixup = record.fixups[f];
+            uint64_t offset = record.offset + fixup.offset;
+            uint8_t *field = module.base + offset;
+            const char *problem = nullptr;
+            uint16_t type = IMAGE_REL_AMD64_ABSOLUTE;
+
+            // The same types the parser gives these fixups
+            if (fixup.flags & FIX_PCREL)
+            {
+                type = fixup.size == 4 && fixup.trail <= 5 ? IMAGE_REL_AMD64_REL32 + fixup.trail : type;
+            }
+            else if (fixup.size == 8 || fixup.size == 4)
+            {
+                type = fixup.size == 8 ? IMAGE_REL_AMD64_ADDR64 : IMAGE_REL_AMD64_ADDR32;
+            }
+
+            if (type == IMAGE_REL_AMD64_ABSOLUTE)
+            {
+                problem = "relocation does not fit";
+            }
+            else if (!symbols[fixup.sym])
+            {
+                problem = "undefined symbol";
+            }
+            else
+            {
+                memcpy(field, &fixup.addend, fixup.size);
+                problem = relocate(module, field, type, (uint64_t)(symbols[fixup.sym]), is_branch_field(field, offset), stub);
+                stub += (fixup.flags & FIX_PCREL) ? JIT_STUB_SIZE : 0;
+            }
+
+            if (problem)
+            {
+                diag() << "error: instruction " << i << ", symbol " << fixup.sym << ": " << problem << std::endl;
+                ok = false;
+            }
+        }
+    }
+
+    if (!ok || !protect_module(module, group_starts))
+    {
+        jit_free(module);
+        return false;
+    }
+
+    return true;
+}
+
+void *jit_lookup(const Jit_Module &module, std::string_view name)
+{
+    uint32_t idx = module.symbol_index.find(name, [&](uint32_t i)
+                                            { return std::string_view(module.names.data() + module.symbols[i].name, module.symbols[i].length); });
+
+    return idx == NAME_NOT_FOUND ? nullptr : module.symbols[idx].address;
+}
+
+void jit_free(Jit_Module &module)
+{
+    if (module.base)
+    {
+        unmap_pages(module.base, module.size);
+    }
+
+    module.base = nullptr;
+    module.size = 0;
+    module.names.clear();
+    module.symbols.clear();
+    module.symbol_index.clear();
+}
+
+Jit_Module::~Jit_Module()
+{
+    jit_free(*this);
+}
@@ -0,0 +1,554 @@
+#include <lexer.h>
+
+#include <iostream>
+#include <fstream>
+#include <array>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LEX_X86 1
+#include <immintrin.h>
+#else
+#define LEX_X86 0
+#endif
+
+bool Source_File::open(const std::string &path, std::string_view dir)
+{
+    close();
+
+    bool relative = !dir.empty() && !path.empty() && path[0] != '/';
+
+    this->path = relative ? std::string(dir) + "/" + path : path;
+
+#ifndef _WIN32
+    if (relative)
+    {
+        int dir_fd = ::open(std::string(dir).c_str(), O_RDONLY | O_DIRECTORY);
+
+        if (dir_fd < 0)
+        {
+            return false;
+        }
+
+        fd = openat(dir_fd, path.c_str(), O_RDONLY);
+        ::close(dir_fd);
+    }
+    else
+    {
+        fd = ::open(path.c_str(), O_RDONLY);
+    }
+
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    size = st.st_size;
+
+    if (size > 0)
+    {
+        void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (map != MAP_FAILED)
+        {
+            madvise(map, size, MADV_SEQUENTIAL);
+
+            data = (const char *)(map);
+            mapped = true;
+        }
+    }
+
+    if (mapped || size == 0)
+    {
+        return true;
+    }
+
+    ::close(fd);
+    fd = -1;
+#endif
+
+    // Fall back to reading the whole file
+    std::ifstream fs(this->path, std::ios::in | std::ios::binary);
+
+    if (!fs)
+    {
+        return false;
+    }
+
+    fs.seekg(0, std::ios::end);
+    buffer.resize(fs.tellg());
+    fs.seekg(0, std::ios::beg);
+    fs.read(buffer.data(), buffer.size());
+
+    data = buffer.data();
+    size = buffer.size();
+
+    return true;
+}
+
+void Source_File::close()
+{
+#ifndef _WIN32
+    if (mapped)
+    {
+        munmap((void *)(data), size);
+    }
+
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+#endif
+
+    data = nullptr;
+    size = 0;
+    mapped = false;
+    buffer.clear();
+}
+
+static bool is_ident_start(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '.';
+}
+
+static bool is_ident_char(char c)
+{
+    return is_ident_start(c) || (c >= '0' && c <= '9') || c == '$';
+}
+
+// Block classification
+
+// Bytes the block kernels mark
+#define LEX_IDENT 0x1   // Letters, digits, '_', '.' and '$'
+#define LEX_SPACE 0x2   // Blanks other than the newline
+#define LEX_SPECIAL 0x4 // Newline, ';', '#', '/', '"' and '\'', which the scalar code handles
+#define LEX_DOLLAR 0x8
+
+struct Lex_Masks
+{
+    uint64_t ident;
+    uint64_t space;
+    uint64_t special;
+    uint64_t dollar;
+};
+
+static const std::array<uint8_t, 256> LEX_CLASSES = []
+{
+    std::array<uint8_t, 256> classes = {};
+
+    for (int c = 0; c < 256; c++)
+    {
+        classes[c] |= is_ident_char((char)(c)) ? LEX_IDENT : 0;
+        classes[c] |= c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v' ? LEX_SPACE : 0;
+        classes[c] |= c == '\n' || c == ';' || c == '#' || c == '/' || c == '"' || c == '\'' ? LEX_SPECIAL : 0;
+        classes[c] |= c == '$' ? LEX_DOLLAR : 0;
+    }
+
+    return classes;
+}();
+
+// Kind of the token a byte starts, outside strings and character literals
+static const std::array<uint8_t, 256> TOKEN_KINDS = []
+{
+    std::array<uint8_t, 256> kinds = {};
+
+    for (int c = 0; c < 256; c++)
+    {
+        kinds[c] = is_ident_start((char)(c)) ? TOK_IDENT : c >= '0' && c <= '9' ? TOK_NUMBER : TOK_PUNCT;
+    }
+
+    return kinds;
+}();
+
+static Lex_Masks classify_scalar(const char *p)
+{
+    Lex_Masks masks = {};
+
+    for (uint32_t i = 0; i < LEX_BLOCK; i++)
+    {
+        uint8_t cls = LEX_CLASSES[(uint8_t)(p[i])];
+
+        masks.ident |= (uint64_t)(cls & LEX_IDENT) << i;
+        masks.space |= (uint64_t)((cls & LEX_SPACE) >> 1) << i;
+        masks.special |= (uint64_t)((cls & LEX_SPECIAL) >> 2) << i;
+        masks.dollar |= (uint64_t)((cls & LEX_DOLLAR) >> 3) << i;
+    }
+
+    return masks;
+}
+
+#if LEX_X86
+
+// x <= n for unsigned bytes
+static __m128i below_sse2(__m128i x, char n)
+{
+    return _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(n)), x);
+}
+
+static Lex_Masks classify_sse2(const char *p)
+{
+    Lex_Masks masks = {};
+
+    for (uint32_t i = 0; i < LEX_BLOCK; i += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i newline = _mm_cmpeq_epi8(x, _mm_set1_epi8('\n'));
+
+        __m128i alpha = below_sse2(_mm_sub_epi8(_mm_or_si128(x, _mm_set1_epi8(0x20)), _mm_set1_epi8('a')), 'z' - 'a');
+        __m128i digit = below_sse2(_mm_sub_epi8(x, _mm_set1_epi8('0')), 9);
+        __m128i ident = _mm_or_si128(_mm_or_si128(alpha, digit), _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('_')), _mm_cmpeq_epi8(x, _mm_set1_epi8('.'))));
+        __m128i dollar = _mm_cmpeq_epi8(x, _mm_set1_epi8('$'));
+        ident = _mm_or_si128(ident, dollar);
+
+        // '\t' to '\r' apart from the newline, and ' '
+        __m128i space = _mm_andnot_si128(newline, below_sse2(_mm_sub_epi8(x, _mm_set1_epi8('\t')), '\r' - '\t'));
+        space = _mm_or_si128(space, _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')));
+
+        __m128i special = _mm_or_si128(newline, _mm_cmpeq_epi8(x, _mm_set1_epi8(';')));
+        special = _mm_or_si128(special, _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('#')), _mm_cmpeq_epi8(x, _mm_set1_epi8('/'))));
+        special = _mm_or_si128(special, _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('"')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\''))));
+
+        masks.ident |= (uint64_t)((uint16_t)(_mm_movemask_epi8(ident))) << i;
+        masks.space |= (uint64_t)((uint16_t)(_mm_movemask_epi8(space))) << i;
+        masks.special |= (uint64_t)((uint16_t)(_mm_movemask_epi8(special))) << i;
+        masks.dollar |= (uint64_t)((uint16_t)(_mm_movemask_epi8(dollar))) << i;
+    }
+
+    return masks;
+}
+
+__attribute__((target("avx2"))) static __m256i below_avx2(__m256i x, char n)
+{
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(n)), x);
+}
+
+__attribute__((target("avx2"))) static Lex_Masks classify_avx2(const char *p)
+{
+    Lex_Masks masks = {};
+
+    for (uint32_t i = 0; i < LEX_BLOCK; i += 32)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i newline = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n'));
+
+        __m256i alpha = below_avx2(_mm256_sub_epi8(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a')), 'z' - 'a');
+        __m256i digit = below_avx2(_mm256_sub_epi8(x, _mm256_set1_epi8('0')), 9);
+        __m256i ident = _mm256_or_si256(_mm256_or_si256(alpha, digit), _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('.'))));
+        __m256i dollar = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('$'));
+        ident = _mm256_or_si256(ident, dollar);
+
+        __m256i space = _mm256_andnot_si256(newline, below_avx2(_mm256_sub_epi8(x, _mm256_set1_epi8('\t')), '\r' - '\t'));
+        space = _mm256_or_si256(space, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')));
+
+        __m256i special = _mm256_or_si256(newline, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(';')));
+        special = _mm256_or_si256(special, _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('#')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('/'))));
+        special = _mm256_or_si256(special, _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\''))));
+
+        masks.ident |= (uint64_t)((uint32_t)(_mm256_movemask_epi8(ident))) << i;
+        masks.space |= (uint64_t)((uint32_t)(_mm256_movemask_epi8(space))) << i;
+        masks.special |= (uint64_t)((uint32_t)(_mm256_movemask_epi8(special))) << i;
+        masks.dollar |= (uint64_t)((uint32_t)(_mm256_movemask_epi8(dollar))) << i;
+    }
+
+    return masks;
+}
+
+#endif
+
+typedef Lex_Masks (*Lex_Classifier)(const char *);
+
+static uint8_t best_kernel()
+{
+#if LEX_X86
+    __builtin_cpu_init();
+
+    return __builtin_cpu_supports("avx2") ? LEX_KERNEL_AVX2 : LEX_KERNEL_SSE2;
+#else
+    return LEX_KERNEL_SCALAR;
+#endif
+}
+
+static Lex_Classifier kernel_classifier(uint8_t kernel)
+{
+#if LEX_X86
+    if (kernel == LEX_KERNEL_AVX2)
+    {
+        return classify_avx2;
+    }
+
+    if (kernel == LEX_KERNEL_SSE2)
+    {
+        return classify_sse2;
+    }
+#endif
+
+    return classify_scalar;
+}
+
+// Set before main, so threads lexing at once only read it
+static uint8_t kernel = best_kernel();
+static Lex_Classifier classify_block = kernel_classifier(kernel);
+
+uint8_t lexer_kernel()
+{
+    return kernel;
+}
+
+bool set_lexer_kernel(uint8_t to_use)
+{
+    if (to_use > best_kernel())
+    {
+        return false;
+    }
+
+    kernel = to_use;
+    classify_block = kernel_classifier(kernel);
+
+    return true;
+}
+
+// Tokenizing
+
+// Reads one token, or skips blanks or a comment, at pos. Returns true at the
+// end of the statement
+static bool scalar_step(Lexer &lexer, std::vector<Token> &tokens)
+{
+    const char *&pos = lexer.pos;
+    const char *end = lexer.end;
+    char c = *pos;
+
+    if (c == '\n')
+    {
+        pos++;
+        lexer.line++;
+        return true;
+    }
+
+    if (c == ';')
+    {
+        pos++;
+        return true;
+    }
+
+    if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v')
+    {
+        pos++;
+        return false;
+    }
+
+    // Comments run to the end of the line
+    if (c == '#' || (c == '/' && pos + 1 < end && pos[1] == '/'))
+    {
+        const char *eol = (const char *)(memchr(pos, '\n', end - pos));
+
+        pos = eol ? eol : end;
+        return false;
+    }
+
+    const char *start = pos;
+
+    if (is_ident_start(c))
+    {
+        while (pos < end && is_ident_char(*pos))
+        {
+            pos++;
+        }
+
+        tokens.emplace_back(Token{TOK_IDENT, std::string_view(start, pos - start)});
+    }
+    else if (c >= '0' && c <= '9')
+    {
+        // Numeric label references such as 1f and 1b are kept as one token
+        while (pos < end && (is_ident_char(*pos)))
+        {
+            pos++;
+        }
+
+        tokens.emplace_back(Token{TOK_NUMBER, std::string_view(start, pos - start)});
+    }
+    else if (c == '"')
+    {
+        pos++;
+
+        while (pos < end && *pos != '"' && *pos != '\n')
+        {
+            pos += (*pos == '\\' && pos + 1 < end) ? 2 : 1;
+        }
+
+        if (pos < end && *pos == '"')
+        {
+            pos++;
+        }
+
+        tokens.emplace_back(Token{TOK_STRING, std::string_view(start, pos - start)});
+    }
+    else if (c == '\'')
+    {
+        pos++;
+
+        if (pos < end && *pos == '\\' && pos + 1 < end)
+        {
+            pos++;
+        }
+
+        if (pos < end && *pos != '\n')
+        {
+            pos++;
+        }
+
+        // The closing quote is optional in GAS
+        if (pos < end && *pos == '\'')
+        {
+            pos++;
+        }
+
+        tokens.emplace_back(Token{TOK_CHAR, std::string_view(start, pos - start)});
+    }
+    else
+    {
+        pos++;
+        tokens.emplace_back(Token{TOK_PUNCT, std::string_view(start, 1)});
+    }
+
+    return false;
+}
+
+// Reads the identifiers, numbers and punctuation from pos up to the next
+// special byte or the end of the block, and leaves pos there. Token starts
+// are the first bytes of identifier runs and every punctuation byte; an
+// identifier that may go on past the block is left for the next block.
+// Returns true if pos is at a special byte
+static bool lex_block(Lexer &lexer, std::vector<Token> &tokens)
+{
+    uint32_t offset = lexer.pos - lexer.block;
+    uint32_t left = LEX_BLOCK - offset;
+    uint64_t ident = lexer.masks[0] >> offset;
+    uint64_t space = lexer.masks[1] >> offset;
+    uint64_t special = lexer.masks[2] >> offset;
+    uint64_t dollar = lexer.masks[3] >> offset;
+    uint32_t stop = special ? __builtin_ctzll(special) : left;
+    uint64_t before = stop == 64 ? ~(uint64_t)(0) : ((uint64_t)(1) << stop) - 1;
+    bool at_special = stop < left;
+
+    // '$' only continues an identifier, at the start of a run it is punctuation
+    while (uint64_t lone = dollar & ident & ~(ident << 1))
+    {
+        ident &= ~lone;
+    }
+
+    uint64_t punct = ~ident & ~space & before;
+    uint64_t starts = ((ident & ~(ident << 1)) | punct) & before;
+    const char *pos = lexer.pos;
+
+    // A run up to the end of the block may go on in the next one
+    if (stop == left && (ident >> (left - 1)) & 1 && starts)
+    {
+        stop = 63 - __builtin_clzll(starts);
+        starts &= ~((uint64_t)(1) << stop);
+    }
+
+    std::size_t first = tokens.size();
+
+    tokens.resize(first + __builtin_popcountll(starts));
+
+    for (Token *out = tokens.data() + first; starts; out++)
+    {
+        uint32_t i = __builtin_ctzll(starts);
+        uint32_t length = __builtin_ctzll(~(ident >> i));
+
+        // Punctuation is a single byte where the identifier mask is clear
+        out->kind = TOKEN_KINDS[(uint8_t)(pos[i])];
+        out->text = std::string_view(pos + i, length + (length == 0));
+        starts &= starts - 1;
+    }
+
+    lexer.pos = pos + stop;
+
+    return at_special;
+}
+
+bool Lexer::next_statement(std::vector<Token> &tokens)
+{
+    tokens.clear();
+
+    if (pos >= end)
+    {
+        return false;
+    }
+
+    while (pos < end)
+    {
+        // Whole blocks while they fit, then byte by byte
+        if (!block || pos >= block + LEX_BLOCK)
+        {
+            if (end - pos < LEX_BLOCK)
+            {
+                if (scalar_step(*this, tokens))
+                {
+                    break;
+                }
+
+                continue;
+            }
+
+            Lex_Masks found = classify_block(pos);
+
+            block = pos;
+            masks[0] = found.ident;
+            masks[1] = found.space;
+            masks[2] = found.special;
+            masks[3] = found.dollar;
+        }
+
+        const char *from = pos;
+
+        if (lex_block(*this, tokens))
+        {
+            // Most statements end at a newline
+            if (*pos == '\n')
+            {
+                pos++;
+                line++;
+                break;
+            }
+
+            if (scalar_step(*this, tokens))
+            {
+                break;
+            }
+        }
+        else if (pos == from)
+        {
+            // An identifier from the start of the block to its end
+            if (pos == block)
+            {
+                scalar_step(*this, tokens);
+            }
+            else
+            {
+                block = nullptr;
+            }
+        }
+    }
+
+    tokens.emplace_back(Token{TOK_EOL, std::string_view(pos, 0)});
+
+    return true;
+}
@@ -0,0 +1,295 @@
+#include <string>
+#include <algorithm>
+#include <cstring>
+
+#include <macro.h>
+
+#define NAME_POOL_BLOCK 0x1000
+
+std::string_view Name_Pool::add(std::string_view name)
+{
+    auto key_of = [this](uint32_t i)
+    { return names[i]; };
+
+    uint32_t idx = index.find(name, key_of);
+
+    if (idx != NAME_NOT_FOUND)
+    {
+        return names[idx];
+    }
+
+    if (name.length() > left)
+    {
+        left = std::max<std::size_t>(NAME_POOL_BLOCK, name.length());
+        blocks.emplace_back(new char[left]);
+        next = blocks.back().get();
+    }
+
+    memcpy(next, name.data(), name.length());
+
+    std::string_view interned(next, name.length());
+
+    next += name.length();
+    left -= name.length();
+
+    names.emplace_back(interned);
+    index.insert(interned, names.size() - 1, key_of);
+
+    return interned;
+}
+
+// Templates
+
+static bool adjacent(const Token &a, const Token &b)
+{
+    return a.text.data() + a.text.length() == b.text.data();
+}
+
+static bool is_word(uint8_t kind)
+{
+    return kind == TOK_IDENT || kind == TOK_NUMBER;
+}
+
+static bool is_name_char(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '.' || c == '$';
+}
+
+static int find_param(const Macro_Body &body, std::string_view name)
+{
+    for (std::size_t i = 0; i < body.params.size(); i++)
+    {
+        if (body.params[i].name == name)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Length of the reference at text[i], a backslash followed by a parameter
+// name or @, or 0 if there is none
+static std::size_t reference_length(const Macro_Body &body, std::string_view text, std::size_t i, int &param)
+{
+    param = -1;
+
+    if (i + 1 >= text.length() || text[i] != '\\')
+    {
+        return 0;
+    }
+
+    if (text[i + 1] == '@')
+    {
+        return 2;
+    }
+
+    std::size_t end = i + 1;
+
+    while (end < text.length() && is_name_char(text[end]))
+    {
+        end++;
+    }
+
+    param = find_param(body, text.substr(i + 1, end - i - 1));
+
+    return param >= 0 ? end - i : 0;
+}
+
+void add_template_statement(Macro_Body &body, const std::vector<Token> &tokens)
+{
+    bool join_next = false; // After \(), which only separates a reference from what follows
+
+    for (std::size_t i = 0; i < tokens.size(); i++)
+    {
+        const Token &tok = tokens[i];
+        Macro_Token mt = {tok.kind, join_next || (i > 0 && adjacent(tokens[i - 1], tok)), 0, tok.text};
+
+        join_next = false;
+
+        if (tok.kind == TOK_PUNCT && tok.text[0] == '\\' && i + 1 < tokens.size() && adjacent(tok, tokens[i + 1]))
+        {
+            const Token &next = tokens[i + 1];
+            int param = next.kind == TOK_IDENT ? find_param(body, next.text) : -1;
+
+            if (param >= 0)
+            {
+                mt.kind = MTOK_PARAM;
+                mt.param = param;
+                mt.text = next.text;
+                body.tokens.emplace_back(mt);
+                i++;
+                continue;
+            }
+
+            if (next.kind == TOK_PUNCT && next.text[0] == '@')
+            {
+                mt.kind = MTOK_COUNTER;
+                body.tokens.emplace_back(mt);
+                i++;
+                continue;
+            }
+
+            if (next.kind == TOK_PUNCT && next.text[0] == '(' && i + 2 < tokens.size() && tokens[i + 2].kind == TOK_PUNCT && tokens[i + 2].text[0] == ')')
+            {
+                join_next = true;
+                i += 2;
+                continue;
+            }
+        }
+
+        if (tok.kind == TOK_STRING)
+        {
+            for (std::size_t c = 0; c < tok.text.length(); c++)
+            {
+                int param;
+
+                if (reference_length(body, tok.text, c, param) > 0)
+                {
+                    mt.kind = MTOK_STRING;
+                    break;
+                }
+
+                // Escaped backslashes are not references
+                c += tok.text[c] == '\\' ? 1 : 0;
+            }
+        }
+
+        body.tokens.emplace_back(mt);
+    }
+}
+
+// Expansion
+
+static Macro_Arg arg_of(const Expansion &expansion, uint16_t param)
+{
+    return expansion.args[expansion.iteration * expansion.body->params.size() + param];
+}
+
+// The argument as it was written, blanks between tokens kept as one space
+static void append_arg(std::string &out, const Expansion &expansion, Macro_Arg arg)
+{
+    for (uint32_t i = 0; i < arg.count; i++)
+    {
+        const Token &tok = expansion.arg_tokens[arg.first + i];
+
+        if (i > 0 && !adjacent(expansion.arg_tokens[arg.first + i - 1], tok))
+        {
+            out += ' ';
+        }
+
+        out += tok.text;
+    }
+}
+
+static std::string_view substitute_string(const Expansion &expansion, std::string_view text, Name_Pool &names)
+{
+    const Macro_Body &body = *expansion.body;
+    std::string out;
+
+    for (std::size_t i = 0; i < text.length();)
+    {
+        int param;
+        std::size_t length = reference_length(body, text, i, param);
+
+        if (length == 0)
+        {
+            std::size_t escape = text[i] == '\\' && i + 1 < text.length() ? 2 : 1;
+
+            out.append(text.substr(i, escape));
+            i += escape;
+        }
+        else
+        {
+            if (param >= 0)
+            {
+                append_arg(out, expansion, arg_of(expansion, param));
+            }
+            else
+            {
+                out += std::to_string(expansion.counter);
+            }
+
+            i += length;
+        }
+    }
+
+    return names.add(out);
+}
+
+bool next_expanded(Expansion &expansion, std::vector<Token> &tokens, Name_Pool &names)
+{
+    const std::vector<Macro_Token> &body = expansion.body->tokens;
+
+    if (body.empty() || expansion.iteration >= expansion.count)
+    {
+        return false;
+    }
+
+    std::string joined;
+    bool pending = false; // The last token is joined text not yet interned
+
+    tokens.clear();
+
+    // Words written against each other become one token
+    auto put = [&](const Token &tok, bool join)
+    {
+        if (join && !tokens.empty() && is_word(tokens.back().kind) && is_word(tok.kind))
+        {
+            if (!pending)
+            {
+                joined.assign(tokens.back().text);
+                pending = true;
+            }
+
+            joined.append(tok.text);
+            return;
+        }
+
+        if (pending)
+        {
+            tokens.back().text = names.add(joined);
+            pending = false;
+        }
+
+        tokens.emplace_back(tok);
+    };
+
+    while (true)
+    {
+        const Macro_Token &mt = body[expansion.pos++];
+
+        switch (mt.kind)
+        {
+        case MTOK_PARAM:
+        {
+            Macro_Arg arg = arg_of(expansion, mt.param);
+
+            for (uint32_t i = 0; i < arg.count; i++)
+            {
+                put(expansion.arg_tokens[arg.first + i], i == 0 && mt.joined);
+            }
+            break;
+        }
+        case MTOK_COUNTER:
+            put(Token{TOK_NUMBER, names.add(std::to_string(expansion.counter))}, mt.joined);
+            break;
+        case MTOK_STRING:
+            put(Token{TOK_STRING, substitute_string(expansion, mt.text, names)}, mt.joined);
+            break;
+        case TOK_EOL:
+            put(Token{TOK_EOL, mt.text}, false);
+
+            if (expansion.pos == body.size())
+            {
+                expansion.pos = 0;
+                expansion.iteration++;
+            }
+
+            return true;
+        default:
+            put(Token{mt.kind, mt.text}, mt.joined);
+            break;
+        }
+    }
+}
@@ -0,0 +1,232 @@
+#include <cstring>
+#include <algorithm>
+
+#include <object.h>
+
+std::size_t add_symbol(std::string_view symbol, Sym_Tab &sym_tab, Sect_Tab &sections, Str_Tab &str_tab, uint8_t storage_class, std::string_view str, uint32_t value, uint8_t type, uint8_t dtype)
+{
+    Sym_Hdr sym_hdr = {};
+    std::size_t idx = sym_tab.size();
+
+    sym_tab.set_name(sym_hdr, symbol);
+
+    if (storage_class == IMAGE_SYM_CLASS_FILE)
+    {
+        // The file name fills as many auxiliary records as it needs
+        uint8_t num_aux = (str.length() + sizeof(Sym_Hdr) - 1) / sizeof(Sym_Hdr);
+
+        sym_hdr.value = 0;
+        sym_hdr.sect_num = -2;
+        sym_hdr.type = 0;
+        sym_hdr.storage_class = storage_class;
+        sym_hdr.num_aux_sym = num_aux > 0 ? num_aux : 1;
+
+        sym_tab.emplace_back(sym_hdr);
+
+        for (std::size_t i = 0; i < sym_hdr.num_aux_sym; i++)
+        {
+            Sym_Hdr aux = {};
+            std::size_t offset = i * sizeof(Sym_Hdr);
+
+            if (offset < str.length())
+            {
+                memcpy(&aux, str.data() + offset, std::min(sizeof(Sym_Hdr), str.length() - offset));
+            }
+
+            sym_tab.emplace_back(aux);
+        }
+    }
+    else if (storage_class == IMAGE_SYM_CLASS_STATIC)
+    {
+        sym_hdr.value = 0;
+        sym_hdr.sect_num = sections.find(symbol) + 1;
+        sym_hdr.type = 0;
+        sym_hdr.storage_class = storage_class;
+        sym_hdr.num_aux_sym = 1;
+
+        sym_tab.emplace_back(sym_hdr);
+
+        sym_hdr = {};
+        sym_tab.emplace_back(sym_hdr);
+    }
+    else
+    {
+        uint16_t sect_num = 0;
+
+        if (str != ".extern")
+        {
+            sect_num = sections.find(str) + 1;
+        }
+
+        sym_hdr.value = value;
+        sym_hdr.sect_num = sect_num;
+        sym_hdr.type = (dtype << 8) | type;
+        sym_hdr.storage_class = storage_class;
+        sym_hdr.num_aux_sym = 0;
+
+        sym_tab.emplace_back(sym_hdr);
+    }
+
+    return idx;
+}
+
+Sect_Handle add_section(Sect_Tab &sections, Sym_Tab &sym_tab, Str_Tab &str_tab, Sect_Hdr header, std::string_view name, std::string_view group)
+{
+    Section section = {};
+
+    header.raw_size = 0;
+
+    section.name = name.empty() ? std::string(header.name.view()) : std::string(name);
+    section.header = header;
+    section.data = {};
+    section.group = group;
+
+    // Names that do not fit the header are resolved to a string table offset by layout_coff
+    if (section.name.length() > 8)
+    {
+        section.str_id = str_tab.add(section.name);
+    }
+    else
+    {
+        section.header.name = section.name;
+    }
+
+    Sect_Handle handle = sections.add(std::move(section));
+
+    sections[handle].sym = add_symbol(sections[handle].name, sym_tab, sections, str_tab, IMAGE_SYM_CLASS_STATIC);
+
+    // Found by name, the symbol would point at the first section of that name
+    sym_tab[sections[handle].sym].sect_num = handle.number();
+
+    return handle;
+}
+
+void relocate_symbol(std::string_view symbol, Sect_Handle section, Sect_Tab &sections, Sym_Tab &sym_tab, uint32_t virt_addr, uint16_t type)
+{
+    relocate_symbol(sym_tab.find(symbol), section, sections, virt_addr, type);
+}
+
+void relocate_symbol(uint32_t sym, Sect_Handle section, Sect_Tab &sections, uint32_t virt_addr, uint16_t type)
+{
+    Reloc reloc = {};
+
+    reloc.virt_addr = virt_addr;
+    reloc.sym_tab_idx = sym;
+    reloc.type = type;
+
+    sections[section].relocations.emplace_back(reloc);
+}
+
+void init_object(Object &obj)
+{
+    Sect_Hdr section_header = {};
+
+    // COFF sections are 16-byte aligned, ELF ones only as far as .align asks
+    uint32_t alignment = obj.elf ? IMAGE_SCN_ALIGN_1BYTES : IMAGE_SCN_ALIGN_16BYTES;
+
+    obj.sym_tab.str_tab = &obj.str_tab;
+
+    // COFF Header
+
+    obj.header.machine = IMAGE_FILE_MACHINE_AMD64;
+    obj.header.time_date = 0x00;
+    obj.header.opt_size = 0x00;
+    obj.header.flags = IMAGE_FILE_LINE_NUMS_STRIPPED;
+
+    // Default sections
+
+    section_header.name = ".text";
+    section_header.flags = IMAGE_SCN_CNT_CODE | alignment | IMAGE_SCN_MEM_EXECUTE | IMAGE_SCN_MEM_READ;
+    obj.text = add_section(obj.sections, obj.sym_tab, obj.str_tab, section_header);
+
+    section_header.name = ".data";
+    section_header.flags = IMAGE_SCN_CNT_INITIALIZED_DATA | alignment | IMAGE_SCN_MEM_READ | IMAGE_SCN_MEM_WRITE;
+    obj.data = add_section(obj.sections, obj.sym_tab, obj.str_tab, section_header);
+
+    section_header.name = ".bss";
+    section_header.flags = IMAGE_SCN_CNT_UNINITIALIZED_DATA | alignment | IMAGE_SCN_MEM_READ | IMAGE_SCN_MEM_WRITE;
+    obj.bss = add_section(obj.sections, obj.sym_tab, obj.str_tab, section_header);
+}
+
+uint32_t find_label(const Object &obj, std::string_view name)
+{
+    return obj.label_index.find(name, [&obj](uint32_t i)
+                                { return obj.labels[i].name; });
+}
+
+const Macro *find_macro(const Object &obj, std::string_view name)
+{
+    uint32_t idx = obj.macro_index.find(name, [&obj](uint32_t i)
+                                        { return obj.macros[i].name; });
+
+    return idx == NAME_NOT_FOUND ? nullptr : &obj.macros[idx];
+}
+
+uint32_t get_label(Object &obj, std::string_view name)
+{
+    uint32_t idx = obj.label_index.insert(name, obj.labels.size(), [&obj](uint32_t i)
+                                          { return obj.labels[i].name; });
+
+    if (idx == obj.labels.size())
+    {
+        Label label = {};
+
+        label.name = name;
+        label.sym = add_symbol(name, obj.sym_tab, obj.sections, obj.str_tab, IMAGE_SYM_CLASS_EXTERNAL, ".extern");
+
+        obj.labels.emplace_back(label);
+    }
+
+    return idx;
+}
+
+bool define_label(Object &obj, uint32_t label, Sect_Handle section, uint32_t loc)
+{
+    Label &l = obj.labels[label];
+
+    if (l.flags & (LABEL_DEFINED | LABEL_ABSOLUTE | LABEL_COMMON | LABEL_ALIAS))
+    {
+        return false;
+    }
+
+    l.flags |= LABEL_DEFINED;
+    l.section = section;
+    l.loc = loc;
+
+    return true;
+}
+
+void finish_symbols(Object &obj)
+{
+    for (const Label &label : obj.labels)
+    {
+        Sym_Hdr &sym = obj.sym_tab[label.sym];
+
+        if (label.flags & LABEL_DEFINED)
+        {
+            sym.sect_num = label.section.number();
+            sym.value = label.loc;
+            sym.storage_class = label.flags & LABEL_GLOBAL ? IMAGE_SYM_CLASS_EXTERNAL : IMAGE_SYM_CLASS_STATIC;
+        }
+        else if (label.flags & LABEL_ABSOLUTE)
+        {
+            sym.sect_num = IMAGE_SYM_ABSOLUTE;
+            sym.value = label.value;
+            sym.storage_class = label.flags & LABEL_GLOBAL ? IMAGE_SYM_CLASS_EXTERNAL : IMAGE_SYM_CLASS_STATIC;
+        }
+        else
+        {
+            // Undefined and common symbols are external, a common symbol's value is its size
+            sym.sect_num = IMAGE_SYM_UNDEFINED;
+            sym.value = label.flags & LABEL_COMMON ? label.loc : 0;
+            sym.storage_class = IMAGE_SYM_CLASS_EXTERNAL;
+        }
+
+        if (label.storage_class)
+        {
+            sym.storage_class = label.storage_class;
+        }
+
+        sym.type = label.type;
+    }
+}
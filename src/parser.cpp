@@ -0,0 +1,4856 @@
+#include <iostream>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <string>
+#include <cstring>
+#include <cctype>
+#include <cstdint>
+
+#include <parser.h>
+#include <lexer.h>
+#include <cache.h>
+#include <diag.h>
+#include <perfect_hash.h>
+#include <unwind.h>
+#include <elf.h>
+
+// Directives
+
+#define DIR_IGNORED 0
+#define DIR_FILE 1
+#define DIR_TEXT 2
+#define DIR_DATA 3
+#define DIR_BSS 4
+#define DIR_SECTION 5
+#define DIR_GLOBL 6
+#define DIR_EXTERN 7
+#define DIR_COMM 8
+#define DIR_LCOMM 9
+#define DIR_SET 10
+#define DIR_ALIGN 11  // Alignment in bytes
+#define DIR_P2ALIGN 12 // Alignment as a power of two
+#define DIR_BYTE 13
+#define DIR_WORD 14
+#define DIR_LONG 15
+#define DIR_QUAD 16
+#define DIR_ASCII 17
+#define DIR_ASCIZ 18
+#define DIR_SPACE 19
+#define DIR_FILL 20
+#define DIR_DEF 21
+#define DIR_SCL 22
+#define DIR_TYPE 23
+#define DIR_ENDEF 24
+#define DIR_LOCAL 25
+#define DIR_MACRO 26
+#define DIR_ENDM 27
+#define DIR_EXITM 28
+#define DIR_REPT 29
+#define DIR_IRP 30
+#define DIR_IRPC 31
+#define DIR_ENDR 32
+#define DIR_INCBIN 33
+#define DIR_SEH_PROC 34 // The .seh_ directives, in the order of their FRAME_SEH_ ops
+#define DIR_SEH_ENDPROC 35
+#define DIR_SEH_ENDPROLOGUE 36
+#define DIR_SEH_PUSHREG 37
+#define DIR_SEH_SETFRAME 38
+#define DIR_SEH_STACKALLOC 39
+#define DIR_SEH_SAVEREG 40
+#define DIR_SEH_SAVEXMM 41
+#define DIR_SEH_PUSHFRAME 42
+#define DIR_SEH_HANDLER 43
+#define DIR_SEH_HANDLERDATA 44
+#define DIR_WEAK 45
+#define DIR_INTERNAL 46 // Visibility, in the order of the STV_ values
+#define DIR_HIDDEN 47
+#define DIR_PROTECTED 48
+#define DIR_ULEB128 49
+#define DIR_SLEB128 50
+#define DIR_CFI_SECTIONS 51
+#define DIR_CFI_STARTPROC 52 // The .cfi_ directives kept as frames, in the order of their FRAME_CFI_ ops
+#define DIR_CFI_ENDPROC 53
+#define DIR_CFI_PERSONALITY 54
+#define DIR_CFI_LSDA 55
+#define DIR_CFI_SIGNAL_FRAME 56
+#define DIR_CFI_DEF_CFA 57
+#define DIR_CFI_DEF_CFA_REGISTER 58
+#define DIR_CFI_DEF_CFA_OFFSET 59
+#define DIR_CFI_ADJUST_CFA_OFFSET 60
+#define DIR_CFI_OFFSET 61
+#define DIR_CFI_REL_OFFSET 62
+#define DIR_CFI_RESTORE 63
+#define DIR_CFI_UNDEFINED 64
+#define DIR_CFI_SAME_VALUE 65
+#define DIR_CFI_REGISTER 66
+#define DIR_CFI_REMEMBER_STATE 67
+#define DIR_CFI_RESTORE_STATE 68
+#define DIR_CFI_ESCAPE 69
+#define DIR_SIZE 70
+
+// .space, .fill and .incbin of this many bytes become an item of the unit
+// that the section keeps as a count or a view of the file, not as bytes
+#define FILL_ITEM_MIN 0x1000
+
+struct Directive
+{
+    std::string_view name;
+    uint8_t id;
+};
+
+inline constexpr Directive DIRECTIVES[] = {
+    {".file", DIR_FILE},
+    {".text", DIR_TEXT},
+    {".data", DIR_DATA},
+    {".bss", DIR_BSS},
+    {".section", DIR_SECTION},
+    {".globl", DIR_GLOBL},
+    {".global", DIR_GLOBL},
+    {".extern", DIR_EXTERN},
+    {".comm", DIR_COMM},
+    {".lcomm", DIR_LCOMM},
+    {".set", DIR_SET},
+    {".equ", DIR_SET},
+    {".align", DIR_ALIGN},
+    {".balign", DIR_ALIGN},
+    {".p2align", DIR_P2ALIGN},
+    {".byte", DIR_BYTE},
+    {".word", DIR_WORD},
+    {".short", DIR_WORD},
+    {".value", DIR_WORD},
+    {".long", DIR_LONG},
+    {".int", DIR_LONG},
+    {".quad", DIR_QUAD},
+    {".ascii", DIR_ASCII},
+    {".asciz", DIR_ASCIZ},
+    {".string", DIR_ASCIZ},
+    {".space", DIR_SPACE},
+    {".skip", DIR_SPACE},
+    {".zero", DIR_SPACE},
+    {".fill", DIR_FILL},
+    {".incbin", DIR_INCBIN},
+    {".def", DIR_DEF},
+    {".scl", DIR_SCL},
+    {".type", DIR_TYPE},
+    {".size", DIR_SIZE},
+    {".endef", DIR_ENDEF},
+    {".local", DIR_LOCAL},
+    {".macro", DIR_MACRO},
+    {".endm", DIR_ENDM},
+    {".exitm", DIR_EXITM},
+    {".rept", DIR_REPT},
+    {".irp", DIR_IRP},
+    {".irpc", DIR_IRPC},
+    {".endr", DIR_ENDR},
+    {".seh_proc", DIR_SEH_PROC},
+    {".seh_endproc", DIR_SEH_ENDPROC},
+    {".seh_endprologue", DIR_SEH_ENDPROLOGUE},
+    {".seh_pushreg", DIR_SEH_PUSHREG},
+    {".seh_setframe", DIR_SEH_SETFRAME},
+    {".seh_stackalloc", DIR_SEH_STACKALLOC},
+    {".seh_savereg", DIR_SEH_SAVEREG},
+    {".seh_savexmm", DIR_SEH_SAVEXMM},
+    {".seh_pushframe", DIR_SEH_PUSHFRAME},
+    {".seh_handler", DIR_SEH_HANDLER},
+    {".seh_handlerdata", DIR_SEH_HANDLERDATA},
+    {".weak", DIR_WEAK},
+    {".internal", DIR_INTERNAL},
+    {".hidden", DIR_HIDDEN},
+    {".protected", DIR_PROTECTED},
+    {".uleb128", DIR_ULEB128},
+    {".sleb128", DIR_SLEB128},
+    {".cfi_sections", DIR_CFI_SECTIONS},
+    {".cfi_startproc", DIR_CFI_STARTPROC},
+    {".cfi_endproc", DIR_CFI_ENDPROC},
+    {".cfi_personality", DIR_CFI_PERSONALITY},
+    {".cfi_lsda", DIR_CFI_LSDA},
+    {".cfi_signal_frame", DIR_CFI_SIGNAL_FRAME},
+    {".cfi_def_cfa", DIR_CFI_DEF_CFA},
+    {".cfi_def_cfa_register", DIR_CFI_DEF_CFA_REGISTER},
+    {".cfi_def_cfa_offset", DIR_CFI_DEF_CFA_OFFSET},
+    {".cfi_adjust_cfa_offset", DIR_CFI_ADJUST_CFA_OFFSET},
+    {".cfi_offset", DIR_CFI_OFFSET},
+    {".cfi_rel_offset", DIR_CFI_REL_OFFSET},
+    {".cfi_restore", DIR_CFI_RESTORE},
+    {".cfi_undefined", DIR_CFI_UNDEFINED},
+    {".cfi_same_value", DIR_CFI_SAME_VALUE},
+    {".cfi_register", DIR_CFI_REGISTER},
+    {".cfi_remember_state", DIR_CFI_REMEMBER_STATE},
+    {".cfi_restore_state", DIR_CFI_RESTORE_STATE},
+    {".cfi_escape", DIR_CFI_ESCAPE},
+
+    // Debug and toolchain information that has no effect on the object
+    {".ident", DIR_IGNORED},
+    {".loc", DIR_IGNORED},
+    {".att_syntax", DIR_IGNORED},
+    {".addrsig", DIR_IGNORED},
+    {".addrsig_sym", DIR_IGNORED},
+    {".linkonce", DIR_IGNORED},
+    {".seh_startepilogue", DIR_IGNORED}, // Epilogues are not described by version 1 unwind information
+    {".seh_endepilogue", DIR_IGNORED},
+};
+
+inline constexpr std::size_t NUM_DIRECTIVES = sizeof(DIRECTIVES) / sizeof(DIRECTIVES[0]);
+
+constexpr std::array<Packed_Name, NUM_DIRECTIVES> directive_keys()
+{
+    std::array<Packed_Name, NUM_DIRECTIVES> keys = {};
+
+    for (std::size_t i = 0; i < NUM_DIRECTIVES; i++)
+    {
+        keys[i] = pack_name(DIRECTIVES[i].name);
+    }
+
+    return keys;
+}
+
+inline constexpr Perfect_Hash<NUM_DIRECTIVES> DIRECTIVE_HASH = build_perfect_hash(directive_keys());
+
+static_assert(DIRECTIVE_HASH.ok, "no perfect hash found for the directive table");
+
+// Some directives are longer than a packed name, so a long name is compared
+static uint32_t find_directive(std::string_view name)
+{
+    uint32_t idx = DIRECTIVE_HASH.find(name);
+
+    if (idx != PERFECT_HASH_NOT_FOUND && name.length() > PACKED_NAME_MAX && DIRECTIVES[idx].name != name)
+    {
+        return PERFECT_HASH_NOT_FOUND;
+    }
+
+    return idx;
+}
+
+// Parser state
+
+struct Expr
+{
+    int64_t value;
+    uint32_t label;     // Unit label the value is relative to, UNIT_NONE for a constant
+    uint32_t sub_label; // Unit label subtracted from the value, UNIT_NONE if there is none
+    uint8_t modifier;   // SYM_MOD_ written after label
+};
+
+struct Sym_Modifier
+{
+    std::string_view name;
+    uint8_t modifier;
+};
+
+// Modifiers GCC writes after a symbol. Calls through the PLT already get a
+// PLT32 relocation in ELF objects, so @PLT changes nothing
+inline constexpr Sym_Modifier SYM_MODIFIERS[] = {
+    {"PLT", SYM_MOD_NONE},
+    {"GOTPCREL", SYM_MOD_GOTPCREL},
+    {"tpoff", SYM_MOD_TPOFF},
+    {"gottpoff", SYM_MOD_GOTTPOFF},
+    {"dtpoff", SYM_MOD_DTPOFF},
+    {"tlsgd", SYM_MOD_TLSGD},
+    {"tlsld", SYM_MOD_TLSLD},
+};
+
+// A .macro, .rept or .irp body being read. Blocks opened inside it are read
+// as part of it
+struct Block
+{
+    uint8_t kind = 0;     // DIR_MACRO, DIR_REPT, DIR_IRP or DIR_IRPC, 0 when no block is open
+    uint32_t depth = 0;
+    Macro macro = {};     // Name and body, only the body for a .rept or .irp
+    Expansion expansion = {}; // Count and values of a .rept or .irp
+};
+
+// Definitions of one number within the chunk
+struct Numeric_Label
+{
+    std::string_view number;
+    uint32_t last; // Unit label of the last N:, or the entry for Nb before any, UNIT_NONE if neither
+    uint32_t next; // Unit label the next N: defines, referred to by Nf, UNIT_NONE if none yet
+};
+
+// A label difference waiting for a label to be defined. Chained per label
+struct Backpatch
+{
+    uint32_t section; // Unit section of the fixup
+    uint32_t fixup;
+    uint32_t next;
+};
+
+struct Parser
+{
+    const Object &obj;
+    std::string_view file;
+    Unit *unit = nullptr; // Null in the prescan, which only evaluates constants
+    Lexer lexer = {};
+    std::vector<Token> tokens = {};
+    std::size_t pos = 0;
+    uint32_t first_line = 1;
+    uint32_t line = 0;
+    uint32_t section = 0; // Unit section in use
+    uint32_t def_label = UNIT_NONE; // Label described by the open .def
+    bool quiet = false;
+    bool ok = true;
+    Name_Pool *names = nullptr;            // Where text joined by expansions is kept
+    std::vector<Expansion> expansions = {}; // Innermost last
+    Block block = {};
+    uint64_t counter_base = 0;             // \@ of the first macro called in the chunk
+    uint64_t calls = 0;
+    std::vector<Numeric_Label> numeric = {};
+    Name_Index numeric_index = {};
+    std::vector<Backpatch> backpatches = {};
+    std::vector<uint32_t> waiting = {};    // First backpatch waiting on each unit label
+    uint32_t fused_var = UNIT_NONE;        // Boundary item of the last instruction if a jcc may fuse with it
+    uint32_t fused_section = 0;
+    uint32_t fused_end = 0;                // Where the jcc has to start to fuse
+    uint32_t seh_proc = UNIT_NONE;         // Frame of the open .seh_proc, the prescan only sets it to 0
+    uint32_t seh_slots = 0;                // Unwind code slots of its prologue
+    bool seh_prologue = false;             // Before its .seh_endprologue
+    bool seh_frame = false;                // Has a .seh_setframe
+    uint8_t seh_handler = 0;               // UNW_FLAG_ bits of its .seh_handler
+    bool seh_data = false;                 // .seh_handlerdata has placed its unwind information
+    uint32_t cfi_proc = UNIT_NONE;         // Frame of the open .cfi_startproc, the prescan only sets it to 0
+};
+
+// Chunks are parsed on pool threads, so their messages are kept in the unit
+// and printed whole by the merge. The prescan runs on the calling thread and
+// prints at once
+static void report(Parser &p, std::string_view kind, std::string_view msg, std::string_view detail)
+{
+    std::string line = std::string(p.file) + ":" + std::to_string(p.line) + ": " + std::string(kind) + ": " + std::string(msg);
+
+    if (!detail.empty())
+    {
+        line += " '" + std::string(detail) + "'";
+    }
+
+    line += '\n';
+
+    if (p.unit)
+    {
+        p.unit->messages += line;
+    }
+    else
+    {
+        diag() << line << std::flush;
+    }
+}
+
+static void error(Parser &p, std::string_view msg, std::string_view detail = "")
+{
+    p.ok = false;
+
+    if (!p.quiet)
+    {
+        report(p, "error", msg, detail);
+    }
+}
+
+static const Token &peek(const Parser &p, std::size_t ahead = 0)
+{
+    return p.tokens[std::min(p.pos + ahead, p.tokens.size() - 1)];
+}
+
+static bool at_end(const Parser &p)
+{
+    return peek(p).kind == TOK_EOL;
+}
+
+static void skip_statement(Parser &p)
+{
+    p.pos = p.tokens.size() - 1;
+}
+
+static bool at_punct(const Parser &p, char c, std::size_t ahead = 0)
+{
+    const Token &tok = peek(p, ahead);
+
+    return tok.kind == TOK_PUNCT && tok.text[0] == c;
+}
+
+static bool accept(Parser &p, char c)
+{
+    if (at_punct(p, c))
+    {
+        p.pos++;
+        return true;
+    }
+
+    return false;
+}
+
+static bool expect(Parser &p, char c)
+{
+    if (accept(p, c))
+    {
+        return true;
+    }
+
+    char str[2] = {c, 0};
+    error(p, "expected", str);
+
+    return false;
+}
+
+static void put_value(uint8_t *dest, uint64_t value, uint8_t size)
+{
+    for (uint8_t i = 0; i < size; i++)
+    {
+        dest[i] = value >> (i * 8);
+    }
+}
+
+// Patches a field in section data that has already been emitted
+// A difference in the format of its field, a LEB128 one padded to size
+// bytes. False if the value does not fit
+static bool put_diff(uint8_t *dest, int64_t value, uint8_t size, uint16_t format)
+{
+    if (format == DIFF_FIXED)
+    {
+        put_value(dest, value, size);
+        return true;
+    }
+
+    int64_t limit = (int64_t)(1) << (7 * size - (format == DIFF_SLEB128));
+
+    if (format == DIFF_ULEB128 ? value < 0 || value >= limit : value < -limit || value >= limit)
+    {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < size; i++)
+    {
+        dest[i] = ((value >> (7 * i)) & 0x7f) | (i + 1 < size ? 0x80 : 0);
+    }
+
+    return true;
+}
+
+static void write_value(Section &section, uint64_t offset, uint64_t value, uint8_t size)
+{
+    uint8_t bytes[8];
+
+    put_value(bytes, value, size);
+    section.write(offset, bytes, size);
+}
+
+// Units
+
+static uint32_t unit_section(Unit &unit, Sect_Handle handle)
+{
+    uint32_t &idx = unit.section_map[handle.idx];
+
+    if (idx == UNIT_NONE)
+    {
+        idx = unit.sections.size();
+        unit.sections.emplace_back();
+        unit.sections.back().section = handle;
+    }
+
+    return idx;
+}
+
+static uint32_t unit_label(Unit &unit, std::string_view name)
+{
+    uint32_t idx = unit.label_index.insert(name, unit.labels.size(), [&unit](uint32_t i)
+                                           { return unit.labels[i].name; });
+
+    if (idx == unit.labels.size())
+    {
+        Unit_Label label = {};
+
+        label.name = name;
+        label.section = UNIT_NONE;
+        label.global = UNIT_NONE;
+
+        unit.labels.emplace_back(label);
+    }
+
+    return idx;
+}
+
+// Adds a definition of a numeric label, or the entry a reference stands for
+static uint32_t new_numeric(Parser &p, std::string_view number, uint8_t flags)
+{
+    Unit_Label label = {};
+
+    label.name = number;
+    label.section = UNIT_NONE;
+    label.line = p.line;
+    label.flags = ULABEL_NUMERIC | flags;
+    label.global = UNIT_NONE;
+
+    p.unit->labels.emplace_back(label);
+
+    return p.unit->labels.size() - 1;
+}
+
+static Numeric_Label &find_numeric(Parser &p, std::string_view number)
+{
+    uint32_t idx = p.numeric_index.insert(number, p.numeric.size(), [&p](uint32_t i)
+                                          { return p.numeric[i].number; });
+
+    if (idx == p.numeric.size())
+    {
+        p.numeric.emplace_back(Numeric_Label{number, UNIT_NONE, UNIT_NONE});
+    }
+
+    return p.numeric[idx];
+}
+
+static bool is_decimal(std::string_view text)
+{
+    for (char c : text)
+    {
+        if (c < '0' || c > '9')
+        {
+            return false;
+        }
+    }
+
+    return !text.empty();
+}
+
+// Whether a number token is a reference like 1f or 1b
+static bool is_numeric_ref(std::string_view text)
+{
+    return text.length() > 1 && (text.back() == 'f' || text.back() == 'b') && is_decimal(text.substr(0, text.length() - 1));
+}
+
+// Unit label a reference to a numeric label stands for
+static uint32_t numeric_ref(Parser &p, std::string_view ref)
+{
+    std::string_view number = ref.substr(0, ref.length() - 1);
+    bool backward = ref.back() == 'b';
+    Numeric_Label &numeric = find_numeric(p, number);
+    uint32_t &label = backward ? numeric.last : numeric.next;
+
+    if (label == UNIT_NONE)
+    {
+        label = new_numeric(p, number, backward ? ULABEL_BACKWARD : 0);
+    }
+
+    return label;
+}
+
+static Unit_Section &current(Parser &p)
+{
+    return p.unit->sections[p.section];
+}
+
+static const Section &current_header(const Parser &p)
+{
+    return p.obj.sections[p.unit->sections[p.section].section];
+}
+
+static Unit_Pos here(const Unit_Section &section, uint32_t offset = 0)
+{
+    return Unit_Pos{section.size + offset, (uint32_t)(section.vars.size())};
+}
+
+static void append(Unit_Section &section, const uint8_t *data, std::size_t size)
+{
+    section.data.insert(section.data.end(), data, data + size);
+    section.size += size;
+}
+
+// Constants set earlier in the chunk take precedence over the value the prescan left
+static bool find_constant(const Parser &p, std::string_view name, int64_t &value)
+{
+    if (p.unit)
+    {
+        uint32_t idx = p.unit->label_index.find(name, [&p](uint32_t i)
+                                                { return p.unit->labels[i].name; });
+
+        if (idx != NAME_NOT_FOUND && (p.unit->labels[idx].flags & LABEL_ABSOLUTE))
+        {
+            value = p.unit->labels[idx].value;
+            return true;
+        }
+    }
+
+    uint32_t idx = find_label(p.obj, name);
+
+    if (idx != NAME_NOT_FOUND && (p.obj.labels[idx].flags & LABEL_ABSOLUTE))
+    {
+        value = p.obj.labels[idx].value;
+        return true;
+    }
+
+    return false;
+}
+
+static std::string_view label_name(const Parser &p, uint32_t label)
+{
+    return p.unit ? p.unit->labels[label].name : "";
+}
+
+// Literals
+
+static bool parse_int(std::string_view text, int64_t &value)
+{
+    uint64_t result = 0;
+    uint32_t base = 10;
+    std::size_t i = 0;
+
+    if (text.length() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X'))
+    {
+        base = 16;
+        i = 2;
+    }
+    else if (text.length() > 2 && text[0] == '0' && (text[1] == 'b' || text[1] == 'B'))
+    {
+        base = 2;
+        i = 2;
+    }
+    else if (text.length() > 1 && text[0] == '0')
+    {
+        base = 8;
+        i = 1;
+    }
+
+    for (; i < text.length(); i++)
+    {
+        char c = text[i];
+        uint32_t digit;
+
+        if (c >= '0' && c <= '9')
+        {
+            digit = c - '0';
+        }
+        else if (c >= 'a' && c <= 'f')
+        {
+            digit = c - 'a' + 10;
+        }
+        else if (c >= 'A' && c <= 'F')
+        {
+            digit = c - 'A' + 10;
+        }
+        else
+        {
+            return false;
+        }
+
+        if (digit >= base)
+        {
+            return false;
+        }
+
+        result = result * base + digit;
+    }
+
+    value = result;
+
+    return true;
+}
+
+// Decodes the escape sequence at text[i] (just after the backslash), advancing i
+static uint8_t parse_escape(std::string_view text, std::size_t &i)
+{
+    char c = text[i++];
+
+    switch (c)
+    {
+    case 'n':
+        return '\n';
+    case 't':
+        return '\t';
+    case 'r':
+        return '\r';
+    case 'b':
+        return '\b';
+    case 'f':
+        return '\f';
+    case 'v':
+        return '\v';
+    case 'x':
+    case 'X':
+    {
+        uint8_t value = 0;
+
+        while (i < text.length() && isxdigit((unsigned char)(text[i])))
+        {
+            char d = text[i++];
+            value = value * 16 + (d <= '9' ? d - '0' : (d | 0x20) - 'a' + 10);
+        }
+
+        return value;
+    }
+    }
+
+    if (c >= '0' && c <= '7')
+    {
+        uint8_t value = c - '0';
+
+        for (int n = 0; n < 2 && i < text.length() && text[i] >= '0' && text[i] <= '7'; n++)
+        {
+            value = value * 8 + (text[i++] - '0');
+        }
+
+        return value;
+    }
+
+    return c;
+}
+
+static int64_t parse_char(std::string_view text)
+{
+    std::size_t i = 1;
+
+    if (text.length() < 2)
+    {
+        return 0;
+    }
+
+    if (text[i] == '\\' && text.length() > 2)
+    {
+        i++;
+        return parse_escape(text, i);
+    }
+
+    return (uint8_t)(text[i]);
+}
+
+// Appends a string token to the section, copying runs without escapes in one go
+static void emit_string(Unit_Section &section, std::string_view text, bool terminate)
+{
+    text = text.substr(1, text.length() >= 2 && text.back() == '"' ? text.length() - 2 : text.length() - 1);
+
+    std::size_t run = 0;
+    std::size_t i = 0;
+
+    while (i < text.length())
+    {
+        if (text[i] != '\\' || i + 1 >= text.length())
+        {
+            i++;
+            continue;
+        }
+
+        append(section, (const uint8_t *)(text.data() + run), i - run);
+
+        i++;
+        uint8_t c = parse_escape(text, i);
+        append(section, &c, 1);
+        run = i;
+    }
+
+    append(section, (const uint8_t *)(text.data() + run), text.length() - run);
+
+    if (terminate)
+    {
+        uint8_t zero = 0;
+        append(section, &zero, 1);
+    }
+}
+
+// Expressions
+
+static bool parse_expr(Parser &p, Expr &expr);
+static void place_label(Parser &p, uint32_t idx);
+
+// sym@GOTPCREL and the like, the case of the name does not matter
+static bool parse_modifier(Parser &p, Expr &expr)
+{
+    std::string_view name = peek(p, 1).text;
+
+    p.pos++;
+
+    for (const Sym_Modifier &modifier : SYM_MODIFIERS)
+    {
+        if (name.length() == modifier.name.length() &&
+            std::equal(name.begin(), name.end(), modifier.name.begin(), [](char a, char b)
+                       { return tolower(a) == tolower(b); }))
+        {
+            if (modifier.modifier != SYM_MOD_NONE && !p.obj.elf)
+            {
+                error(p, "relocation modifier needs ELF output", name);
+                return false;
+            }
+
+            p.pos++;
+            expr.modifier = modifier.modifier;
+
+            return true;
+        }
+    }
+
+    error(p, "unknown relocation modifier", name);
+    return false;
+}
+
+static bool parse_primary(Parser &p, Expr &expr)
+{
+    const Token &tok = peek(p);
+
+    expr.value = 0;
+    expr.label = UNIT_NONE;
+    expr.sub_label = UNIT_NONE;
+    expr.modifier = SYM_MOD_NONE;
+
+    if (tok.kind == TOK_PUNCT)
+    {
+        char c = tok.text[0];
+        p.pos++;
+
+        if (c == '(')
+        {
+            return parse_expr(p, expr) && expect(p, ')');
+        }
+
+        if (c == '-' || c == '~' || c == '+')
+        {
+            if (!parse_primary(p, expr))
+            {
+                return false;
+            }
+
+            if (expr.label != UNIT_NONE && c != '+')
+            {
+                error(p, "operator cannot be applied to a symbol", label_name(p, expr.label));
+                return false;
+            }
+
+            expr.value = c == '-' ? -expr.value : (c == '~' ? ~expr.value : expr.value);
+
+            return true;
+        }
+
+        error(p, "expected expression", tok.text);
+        return false;
+    }
+
+    p.pos++;
+
+    switch (tok.kind)
+    {
+    case TOK_NUMBER:
+        // 1b and 1f refer to the last and the next 1:
+        if (is_numeric_ref(tok.text))
+        {
+            if (!p.unit)
+            {
+                error(p, "expected a constant", tok.text);
+                return false;
+            }
+
+            expr.label = numeric_ref(p, tok.text);
+            return true;
+        }
+
+        if (!parse_int(tok.text, expr.value))
+        {
+            error(p, "invalid number", tok.text);
+            return false;
+        }
+
+        return true;
+    case TOK_CHAR:
+        expr.value = parse_char(tok.text);
+        return true;
+    case TOK_IDENT:
+        // . is where the statement starts, a label of its own named like N:
+        if (tok.text == "." && p.unit)
+        {
+            expr.label = new_numeric(p, tok.text, 0);
+            place_label(p, expr.label);
+            return true;
+        }
+
+        // Constants set before they are used are folded
+        if (find_constant(p, tok.text, expr.value))
+        {
+            return true;
+        }
+
+        if (!p.unit)
+        {
+            error(p, "expected a constant", tok.text);
+            return false;
+        }
+
+        expr.label = unit_label(*p.unit, tok.text);
+
+        return !at_punct(p, '@') || parse_modifier(p, expr);
+    }
+
+    error(p, "expected expression", tok.text);
+    return false;
+}
+
+static bool binary_op(Parser &p, std::string_view ops, char &op)
+{
+    const Token &tok = peek(p);
+
+    if (tok.kind != TOK_PUNCT || ops.find(tok.text[0]) == std::string_view::npos)
+    {
+        return false;
+    }
+
+    op = tok.text[0];
+
+    // Shifts are written as two characters
+    if (op == '<' || op == '>')
+    {
+        if (!at_punct(p, op, 1))
+        {
+            return false;
+        }
+
+        p.pos++;
+    }
+
+    p.pos++;
+
+    return true;
+}
+
+static bool parse_term(Parser &p, Expr &expr)
+{
+    char op;
+
+    if (!parse_primary(p, expr))
+    {
+        return false;
+    }
+
+    while (binary_op(p, "*/%<>&|^", op))
+    {
+        Expr rhs;
+
+        if (!parse_primary(p, rhs))
+        {
+            return false;
+        }
+
+        if (expr.label != UNIT_NONE || rhs.label != UNIT_NONE)
+        {
+            error(p, "operator cannot be applied to a symbol");
+            return false;
+        }
+
+        if ((op == '/' || op == '%') && rhs.value == 0)
+        {
+            error(p, "division by zero");
+            return false;
+        }
+
+        switch (op)
+        {
+        case '*':
+            expr.value *= rhs.value;
+            break;
+        case '/':
+            expr.value /= rhs.value;
+            break;
+        case '%':
+            expr.value %= rhs.value;
+            break;
+        case '<':
+            expr.value = (uint64_t)(expr.value) << (rhs.value & 63);
+            break;
+        case '>':
+            expr.value >>= rhs.value & 63;
+            break;
+        case '&':
+            expr.value &= rhs.value;
+            break;
+        case '|':
+            expr.value |= rhs.value;
+            break;
+        case '^':
+            expr.value ^= rhs.value;
+            break;
+        }
+    }
+
+    return true;
+}
+
+// A constant, a label plus a constant or the difference of two labels. A
+// difference between labels already placed in the same stretch of a section
+// is folded, any other is left for the merge to resolve
+static bool parse_expr(Parser &p, Expr &expr)
+{
+    char op;
+
+    if (!parse_term(p, expr))
+    {
+        return false;
+    }
+
+    while (binary_op(p, "+-", op))
+    {
+        Expr rhs;
+
+        if (!parse_term(p, rhs))
+        {
+            return false;
+        }
+
+        if (rhs.sub_label != UNIT_NONE || (rhs.label != UNIT_NONE && (expr.label != UNIT_NONE) == (op == '+')) || (rhs.label != UNIT_NONE && expr.sub_label != UNIT_NONE) ||
+            (op == '-' && rhs.label != UNIT_NONE && (expr.modifier || rhs.modifier)))
+        {
+            error(p, "expression is too complex");
+            return false;
+        }
+
+        if (op == '+')
+        {
+            expr.value += rhs.value;
+            expr.modifier = expr.label != UNIT_NONE ? expr.modifier : rhs.modifier;
+            expr.label = expr.label != UNIT_NONE ? expr.label : rhs.label;
+            continue;
+        }
+
+        expr.value -= rhs.value;
+
+        if (rhs.label == UNIT_NONE)
+        {
+            continue;
+        }
+
+        const Unit_Label &a = p.unit->labels[expr.label];
+        const Unit_Label &b = p.unit->labels[rhs.label];
+
+        if ((a.flags & LABEL_DEFINED) && (b.flags & LABEL_DEFINED) && a.section == b.section && a.pos.vars == b.pos.vars)
+        {
+            expr.value += (int64_t)(a.pos.offset) - (int64_t)(b.pos.offset);
+            expr.label = UNIT_NONE;
+        }
+        else
+        {
+            expr.sub_label = rhs.label;
+        }
+    }
+
+    return true;
+}
+
+static bool parse_const(Parser &p, int64_t &value)
+{
+    Expr expr;
+
+    if (!parse_expr(p, expr))
+    {
+        return false;
+    }
+
+    if (expr.label != UNIT_NONE)
+    {
+        error(p, "expected a constant", label_name(p, expr.label));
+        return false;
+    }
+
+    value = expr.value;
+
+    return true;
+}
+
+// A label plus a constant, as instruction operands allow
+static bool parse_address(Parser &p, Expr &expr)
+{
+    if (!parse_expr(p, expr))
+    {
+        return false;
+    }
+
+    if (expr.sub_label != UNIT_NONE)
+    {
+        error(p, "symbol difference is not a constant here", label_name(p, expr.label));
+        return false;
+    }
+
+    return true;
+}
+
+// Operands
+
+static bool parse_register(Parser &p, const Register *&reg)
+{
+    p.pos++;
+
+    const Token &tok = peek(p);
+
+    reg = tok.kind == TOK_IDENT ? find_register(tok.text) : nullptr;
+
+    if (!reg)
+    {
+        error(p, "unknown register", tok.text);
+        return false;
+    }
+
+    p.pos++;
+
+    return true;
+}
+
+static bool parse_memory(Parser &p, Operand &op)
+{
+    op.type = OPND_MEM;
+
+    // A '(' directly followed by a register or ',' starts the base and index
+    if (!(at_punct(p, '(') && (at_punct(p, '%', 1) || at_punct(p, ',', 1))))
+    {
+        Expr disp;
+
+        if (!parse_address(p, disp))
+        {
+            return false;
+        }
+
+        op.value = disp.value;
+        op.sym = disp.label == UNIT_NONE ? SYM_NONE : disp.label;
+        op.modifier = disp.modifier;
+    }
+
+    if (!accept(p, '('))
+    {
+        return true;
+    }
+
+    const Register *reg;
+
+    if (at_punct(p, '%'))
+    {
+        if (!parse_register(p, reg))
+        {
+            return false;
+        }
+
+        if (reg->reg_class == RC_RIP)
+        {
+            op.base = REG_RIP;
+        }
+        else if (reg->reg_class == RC_GP && reg->size == 8)
+        {
+            op.base = reg->num;
+        }
+        else
+        {
+            error(p, "invalid base register", reg->name);
+            return false;
+        }
+    }
+
+    if (accept(p, ','))
+    {
+        if (at_punct(p, '%'))
+        {
+            if (!parse_register(p, reg))
+            {
+                return false;
+            }
+
+            if (reg->reg_class != RC_GP || reg->size != 8)
+            {
+                error(p, "invalid index register", reg->name);
+                return false;
+            }
+
+            op.index = reg->num;
+        }
+
+        if (accept(p, ','))
+        {
+            int64_t scale;
+
+            if (!parse_const(p, scale))
+            {
+                return false;
+            }
+
+            if (scale != 1 && scale != 2 && scale != 4 && scale != 8)
+            {
+                error(p, "scale factor must be 1, 2, 4 or 8");
+                return false;
+            }
+
+            op.scale = scale;
+        }
+    }
+
+    return expect(p, ')');
+}
+
+// A segment override in front of a memory operand is stored in segment
+static bool parse_operand(Parser &p, Operand &op, uint8_t &segment)
+{
+    op = {};
+    op.base = REG_NONE;
+    op.index = REG_NONE;
+    op.scale = 1;
+    op.sym = SYM_NONE;
+
+    op.indirect = accept(p, '*');
+
+    if (at_punct(p, '%'))
+    {
+        const Register *reg;
+
+        if (at_punct(p, ':', 2))
+        {
+            if (!parse_register(p, reg))
+            {
+                return false;
+            }
+
+            if (reg->reg_class != RC_SEG)
+            {
+                error(p, "invalid segment register", reg->name);
+                return false;
+            }
+
+            if (segment)
+            {
+                error(p, "more than one segment override");
+                return false;
+            }
+
+            segment = SEGMENT_PREFIXES[reg->num];
+            p.pos++;
+
+            return parse_memory(p, op);
+        }
+
+        if (!parse_register(p, reg))
+        {
+            return false;
+        }
+
+        op.type = OPND_REG;
+        op.reg = reg->num;
+        op.size = reg->size;
+        op.reg_class = reg->reg_class;
+        op.reg_flags = reg->flags;
+
+        return true;
+    }
+
+    if (accept(p, '$'))
+    {
+        Expr imm;
+
+        if (!parse_address(p, imm))
+        {
+            return false;
+        }
+
+        op.type = OPND_IMM;
+        op.value = imm.value;
+        op.sym = imm.label == UNIT_NONE ? SYM_NONE : imm.label;
+        op.modifier = imm.modifier;
+
+        return true;
+    }
+
+    return parse_memory(p, op);
+}
+
+// Emission
+
+// Makes the difference in fixup wait for label to be defined
+static void wait_for(Parser &p, uint32_t label, uint32_t section, uint32_t fixup)
+{
+    if (label >= p.waiting.size())
+    {
+        p.waiting.resize(p.unit->labels.size(), UNIT_NONE);
+    }
+
+    p.backpatches.emplace_back(Backpatch{section, fixup, p.waiting[label]});
+    p.waiting[label] = p.backpatches.size() - 1;
+}
+
+// Patches the differences that were waiting for label. One between labels
+// in the same stretch of a section is written in place, any other is left
+// for the merge
+static void backpatch(Parser &p, uint32_t label)
+{
+    if (label >= p.waiting.size())
+    {
+        return;
+    }
+
+    uint32_t next = p.waiting[label];
+    p.waiting[label] = UNIT_NONE;
+
+    while (next != UNIT_NONE)
+    {
+        Backpatch bp = p.backpatches[next];
+        Unit_Section &section = p.unit->sections[bp.section];
+        Unit_Fixup &fixup = section.fixups[bp.fixup];
+        const Unit_Label &a = p.unit->labels[fixup.label];
+        const Unit_Label &b = p.unit->labels[fixup.sub_label];
+
+        next = bp.next;
+
+        if (!(a.flags & LABEL_DEFINED))
+        {
+            wait_for(p, fixup.label, bp.section, bp.fixup);
+        }
+        else if (!(b.flags & LABEL_DEFINED))
+        {
+            wait_for(p, fixup.sub_label, bp.section, bp.fixup);
+        }
+        else if (a.section == b.section && a.pos.vars == b.pos.vars &&
+                 put_diff(section.data.data() + fixup.pos.offset, (int64_t)(a.pos.offset) - (int64_t)(b.pos.offset) + fixup.addend, fixup.size, fixup.type))
+        {
+            fixup.kind = UFIX_DONE;
+        }
+    }
+}
+
+// The ELF relocation of a field with a modifier. gotpcrelx is the type a
+// GOT load gets when the linker can rewrite its instruction, 0 if it cannot
+static bool modifier_type(Parser &p, const Enc_Fixup &fixup, uint32_t gotpcrelx, uint16_t &type)
+{
+    bool pcrel = fixup.flags & FIX_PCREL;
+    uint32_t elf_type = R_X86_64_NONE;
+
+    switch (fixup.modifier)
+    {
+    case SYM_MOD_GOTPCREL:
+        elf_type = pcrel && gotpcrelx ? gotpcrelx : fixup.size == 4 ? R_X86_64_GOTPCREL : R_X86_64_NONE;
+        break;
+    case SYM_MOD_GOTTPOFF:
+        elf_type = pcrel && fixup.size == 4 ? R_X86_64_GOTTPOFF : R_X86_64_NONE;
+        break;
+    case SYM_MOD_TPOFF:
+        elf_type = pcrel ? R_X86_64_NONE : fixup.size == 4 ? R_X86_64_TPOFF32 : fixup.size == 8 ? R_X86_64_TPOFF64 : R_X86_64_NONE;
+        break;
+    case SYM_MOD_DTPOFF:
+        elf_type = pcrel ? R_X86_64_NONE : fixup.size == 4 ? R_X86_64_DTPOFF32 : fixup.size == 8 ? R_X86_64_DTPOFF64 : R_X86_64_NONE;
+        break;
+    case SYM_MOD_TLSGD:
+        elf_type = pcrel && fixup.size == 4 ? R_X86_64_TLSGD : R_X86_64_NONE;
+        break;
+    case SYM_MOD_TLSLD:
+        elf_type = pcrel && fixup.size == 4 ? R_X86_64_TLSLD : R_X86_64_NONE;
+        break;
+    }
+
+    if (elf_type == R_X86_64_NONE)
+    {
+        error(p, "relocation modifier does not fit the operand", label_name(p, fixup.sym));
+        return false;
+    }
+
+    type = IMAGE_REL_ELF | elf_type;
+
+    return true;
+}
+
+static bool add_fixup(Parser &p, uint32_t offset, uint8_t *field, const Enc_Fixup &fixup, uint32_t gotpcrelx = 0)
+{
+    uint16_t type;
+    int64_t addend = fixup.addend;
+
+    if (fixup.modifier != SYM_MOD_NONE)
+    {
+        if (!modifier_type(p, fixup, gotpcrelx, type))
+        {
+            return false;
+        }
+
+        // ELF addends of PC relative fields count from the field
+        if (fixup.flags & FIX_PCREL)
+        {
+            addend -= 4 + fixup.trail;
+        }
+    }
+    else if (fixup.flags & FIX_PCREL)
+    {
+        if (fixup.size != 4 || fixup.trail > 5)
+        {
+            error(p, "relocation does not fit", label_name(p, fixup.sym));
+            return false;
+        }
+
+        type = IMAGE_REL_AMD64_REL32 + fixup.trail;
+    }
+    else if (fixup.size == 8)
+    {
+        type = IMAGE_REL_AMD64_ADDR64;
+    }
+    else if (fixup.size == 4)
+    {
+        type = IMAGE_REL_AMD64_ADDR32;
+    }
+    else
+    {
+        error(p, "relocation does not fit", label_name(p, fixup.sym));
+        return false;
+    }
+
+    Unit_Section &section = current(p);
+    Unit_Fixup unit_fixup = {};
+
+    unit_fixup.pos = here(section, offset);
+    unit_fixup.kind = UFIX_RELOC;
+    unit_fixup.size = fixup.size;
+    unit_fixup.type = type;
+    unit_fixup.label = fixup.sym;
+    unit_fixup.sub_label = UNIT_NONE;
+    unit_fixup.addend = fixup.addend;
+    unit_fixup.line = p.line;
+
+    section.fixups.emplace_back(unit_fixup);
+
+    // COFF addends live in the relocated field
+    put_value(field, addend, fixup.size);
+
+    return true;
+}
+
+// Adds the fixup of a label difference written at the end of the section
+static void add_diff(Parser &p, const Expr &expr, uint8_t size, uint16_t format)
+{
+    Unit_Section &section = current(p);
+    Unit_Fixup fixup = {here(section), UFIX_DIFF, size, format, expr.label, expr.sub_label, expr.value, p.line};
+
+    section.fixups.emplace_back(fixup);
+
+    // A label not defined yet patches the field when it is
+    if (!(p.unit->labels[expr.label].flags & LABEL_DEFINED))
+    {
+        wait_for(p, expr.label, p.section, section.fixups.size() - 1);
+    }
+    else if (!(p.unit->labels[expr.sub_label].flags & LABEL_DEFINED))
+    {
+        wait_for(p, expr.sub_label, p.section, section.fixups.size() - 1);
+    }
+}
+
+static void emit_value(Parser &p, const Expr &expr, uint8_t size)
+{
+    Unit_Section &section = current(p);
+    uint8_t bytes[8];
+
+    if (current_header(p).is_bss())
+    {
+        error(p, "initialised data in a bss section");
+        return;
+    }
+
+    put_value(bytes, expr.value, size);
+
+    if (expr.sub_label != UNIT_NONE)
+    {
+        add_diff(p, expr, size, DIFF_FIXED);
+    }
+    else if (expr.label != UNIT_NONE)
+    {
+        Enc_Fixup fixup = {0, size, 0, 0, expr.modifier, expr.label, expr.value};
+
+        if (!add_fixup(p, 0, bytes, fixup))
+        {
+            return;
+        }
+    }
+
+    append(section, bytes, size);
+}
+
+// .uleb128 and .sleb128. A constant takes the fewest bytes, a label
+// difference takes LEB128_DIFF_SIZE so the layout does not wait for it
+static void emit_leb(Parser &p, const Expr &expr, bool is_signed)
+{
+    Unit_Section &section = current(p);
+
+    if (current_header(p).is_bss())
+    {
+        error(p, "initialised data in a bss section");
+        return;
+    }
+
+    if (expr.label != UNIT_NONE && expr.sub_label == UNIT_NONE)
+    {
+        error(p, "expected a constant", label_name(p, expr.label));
+        return;
+    }
+
+    if (expr.label != UNIT_NONE)
+    {
+        uint8_t bytes[LEB128_DIFF_SIZE] = {};
+
+        add_diff(p, expr, LEB128_DIFF_SIZE, is_signed ? DIFF_SLEB128 : DIFF_ULEB128);
+        append(section, bytes, LEB128_DIFF_SIZE);
+        return;
+    }
+
+    uint64_t value = expr.value;
+    bool more = true;
+
+    while (more)
+    {
+        uint8_t byte = value & 0x7f;
+
+        value = is_signed ? (uint64_t)((int64_t)(value) >> 7) : value >> 7;
+        more = is_signed ? !(((int64_t)(value) == 0 && !(byte & 0x40)) || ((int64_t)(value) == -1 && (byte & 0x40))) : value != 0;
+        byte |= more ? 0x80 : 0;
+        append(section, &byte, 1);
+    }
+}
+
+// count copies of value, which is width bytes long
+static void emit_fill(Parser &p, uint64_t count, int64_t value, uint8_t width)
+{
+    Unit_Section &section = current(p);
+
+    if (count > UINT32_MAX / width)
+    {
+        error(p, "size too large");
+        return;
+    }
+
+    uint32_t size = count * width;
+
+    if (width < 8)
+    {
+        value &= ((int64_t)(1) << (width * 8)) - 1;
+    }
+
+    if (current_header(p).is_bss())
+    {
+        if (value != 0)
+        {
+            error(p, "initialised data in a bss section");
+            return;
+        }
+
+        section.size += size;
+        return;
+    }
+
+    if (size >= FILL_ITEM_MIN)
+    {
+        Unit_Var var = {};
+
+        var.offset = section.size;
+        var.kind = RVAR_FILL;
+        var.width = width;
+        var.size = size;
+        var.addend = value;
+
+        section.vars.emplace_back(var);
+        return;
+    }
+
+    if (width == 1)
+    {
+        section.data.resize(section.data.size() + size, value);
+        section.size += size;
+        return;
+    }
+
+    uint8_t bytes[8];
+    put_value(bytes, value, width);
+
+    for (uint64_t i = 0; i < count; i++)
+    {
+        append(section, bytes, width);
+    }
+}
+
+// Text of a string token with the escapes decoded
+static std::string string_value(std::string_view text)
+{
+    std::string value;
+
+    text = text.substr(1, text.length() >= 2 && text.back() == '"' ? text.length() - 2 : text.length() - 1);
+
+    for (std::size_t i = 0; i < text.length();)
+    {
+        if (text[i] == '\\' && i + 1 < text.length())
+        {
+            i++;
+            value += (char)(parse_escape(text, i));
+        }
+        else
+        {
+            value += text[i++];
+        }
+    }
+
+    return value;
+}
+
+// .incbin "file"[,skip[,count]]. The file is mapped and stays mapped until the
+// object is written, which copies a large one straight from the mapping. A
+// relative path is taken from the source's directory, not the working
+// directory, which for the server is not the client's
+static void parse_incbin(Parser &p)
+{
+    const Token &tok = peek(p);
+    int64_t skip = 0;
+    int64_t count = -1;
+
+    if (tok.kind != TOK_STRING)
+    {
+        error(p, "expected a string", tok.text);
+        return;
+    }
+
+    p.pos++;
+
+    if (accept(p, ',') && (!parse_const(p, skip) || (accept(p, ',') && !parse_const(p, count))))
+    {
+        return;
+    }
+
+    if (current_header(p).is_bss())
+    {
+        error(p, "initialised data in a bss section");
+        return;
+    }
+
+    std::string path = string_value(tok.text);
+    std::unique_ptr<Source_File> file(new Source_File);
+    std::size_t slash = p.file.rfind('/');
+
+    if (!file->open(path, slash == std::string_view::npos ? std::string_view() : p.file.substr(0, slash == 0 ? 1 : slash)))
+    {
+        error(p, "cannot open", path);
+        return;
+    }
+
+    if (skip < 0 || (uint64_t)(skip) > file->size || (count >= 0 && (uint64_t)(count) > file->size - skip))
+    {
+        error(p, "range past the end of", path);
+        return;
+    }
+
+    uint64_t size = count >= 0 ? count : file->size - skip;
+
+    if (size > UINT32_MAX)
+    {
+        error(p, "size too large", path);
+        return;
+    }
+
+    Unit_Section &section = current(p);
+
+    if (size < FILL_ITEM_MIN)
+    {
+        append(section, (const uint8_t *)(file->data) + skip, size);
+    }
+    else
+    {
+        Unit_Var var = {};
+
+        var.offset = section.size;
+        var.kind = RVAR_FILL;
+        var.flags = UVAR_BINARY;
+        var.label = p.unit->binaries.size();
+        var.size = size;
+        var.addend = skip;
+
+        section.vars.emplace_back(var);
+    }
+
+    // Kept for a small file too, which keeps the unit out of the cache
+    p.unit->binaries.emplace_back(std::move(file));
+}
+
+static void place_label(Parser &p, uint32_t idx)
+{
+    Unit_Label &label = p.unit->labels[idx];
+
+    label.flags |= LABEL_DEFINED;
+    label.section = p.section;
+    label.pos = here(current(p));
+    label.line = p.line;
+
+    backpatch(p, idx);
+}
+
+static void define_unit_label(Parser &p, std::string_view name)
+{
+    uint32_t idx = unit_label(*p.unit, name);
+
+    if (p.unit->labels[idx].flags & (LABEL_DEFINED | LABEL_ABSOLUTE | LABEL_COMMON | LABEL_ALIAS))
+    {
+        error(p, "symbol already defined", name);
+        return;
+    }
+
+    place_label(p, idx);
+}
+
+// N: defines the label that Nf referred to until now
+static void define_numeric_label(Parser &p, std::string_view number)
+{
+    if (!is_decimal(number))
+    {
+        error(p, "invalid local label", number);
+        return;
+    }
+
+    Numeric_Label &numeric = find_numeric(p, number);
+    uint32_t idx = numeric.next != UNIT_NONE ? numeric.next : new_numeric(p, number, 0);
+
+    numeric.next = UNIT_NONE;
+    numeric.last = idx;
+
+    place_label(p, idx);
+}
+
+// Jumps, and instructions fused with the jcc after them, that cross or end
+// on a 32-byte boundary are not cached in the decoded instruction cache of
+// Skylake derived cores once the JCC erratum microcode update is applied
+#define BRANCH_BOUNDARY 32
+
+static std::string_view instr_name(const Instr &instr)
+{
+    return INSTRUCTIONS[instr.mnemonic != MNEMONIC_NONE ? instr.mnemonic : instr.base_mnemonic].name;
+}
+
+static bool is_jump(std::string_view name)
+{
+    return name[0] == 'j' || name == "call" || name == "ret";
+}
+
+// Macro fusion takes a register or memory operand, not both memory and an
+// immediate, and not a RIP-relative one
+static bool is_fusible(const Instr &instr, std::string_view name)
+{
+    bool mem = false;
+    bool imm = false;
+
+    for (uint8_t i = 0; i < instr.num_ops; i++)
+    {
+        mem |= instr.ops[i].type == OPND_MEM;
+        imm |= instr.ops[i].type == OPND_IMM;
+
+        if (instr.ops[i].type == OPND_MEM && instr.ops[i].base == REG_RIP)
+        {
+            return false;
+        }
+    }
+
+    if (mem && imm)
+    {
+        return false;
+    }
+
+    return name == "cmp" || name == "test" || name == "add" || name == "sub" || name == "and" || name == "inc" || name == "dec";
+}
+
+// Puts a boundary item before a jump, or before an instruction a jcc may fuse
+// with, which only guards anything once the jcc follows. size is the encoded
+// size unless the jump is a relaxable branch
+static void guard_branch(Parser &p, const Instr &instr, std::size_t size, bool relaxable)
+{
+    Unit_Section &section = current(p);
+    std::string_view name = instr_name(instr);
+    uint32_t fused_var = p.fused_var;
+
+    p.fused_var = UNIT_NONE;
+
+    bool jcc = name[0] == 'j' && name != "jmp";
+
+    if (jcc && fused_var != UNIT_NONE && p.fused_section == p.section && p.fused_end == section.size &&
+        fused_var + 1 == section.vars.size())
+    {
+        // The pair is kept together
+        Unit_Var &var = section.vars[fused_var];
+
+        var.guard = p.fused_end - var.offset + (relaxable ? 0 : size);
+        var.flags |= relaxable ? UVAR_GUARD_NEXT : 0;
+        return;
+    }
+
+    bool fusible = is_fusible(instr, name);
+
+    if (!fusible && !is_jump(name))
+    {
+        return;
+    }
+
+    Unit_Var var = {};
+
+    var.offset = section.size;
+    var.kind = RVAR_BOUNDARY;
+    var.alignment = BRANCH_BOUNDARY;
+
+    if (!fusible)
+    {
+        var.guard = relaxable ? 0 : size;
+        var.flags = relaxable ? UVAR_GUARD_NEXT : 0;
+    }
+    else
+    {
+        p.fused_var = section.vars.size();
+        p.fused_section = p.section;
+        p.fused_end = section.size + size;
+    }
+
+    section.vars.emplace_back(var);
+}
+
+// A GOT load through mov, test, an arithmetic instruction, call or jmp gets
+// the GOTPCRELX type that lets the linker rewrite the instruction when the
+// symbol turns out to be local, as GNU as does
+static uint32_t gotpcrelx_type(const Opcode_Form &form, const uint8_t *encoded, const Enc_Fixup &fixup)
+{
+    uint8_t op = form.opcode[0];
+
+    if (fixup.modifier != SYM_MOD_GOTPCREL || !(fixup.flags & FIX_PCREL) || fixup.trail != 0 || form.opcode_len != 1 || form.enc == ENC_D)
+    {
+        return 0;
+    }
+
+    if (!(op == 0x8b || op == 0x85 || (op & 0xc7) == 0x03 || (op == 0xff && (form.digit == 2 || form.digit == 4))))
+    {
+        return 0;
+    }
+
+    // The rip relative ModR/M directly follows the opcode, and a REX prefix directly precedes it
+    bool rex = fixup.offset >= 3 && (encoded[fixup.offset - 3] & 0xf0) == 0x40;
+
+    return rex ? R_X86_64_REX_GOTPCRELX : R_X86_64_GOTPCRELX;
+}
+
+// Records an encoded instruction for --verify with what its operands were
+// written as, the bytes they were encoded to and the label a PC relative
+// field has to reach
+static void record_instr(Parser &p, const Instr &instr, uint16_t form, uint8_t size, const uint8_t *encoded, const Enc_Fixup *fixups,
+                         std::size_t num_fixups)
+{
+    uint8_t bytes[ENCODING_HASH_BYTES] = {};
+
+    memcpy(bytes, encoded, MAX_INSTR_SIZE);
+
+    for (std::size_t i = 0; i < num_fixups; i++)
+    {
+        memset(bytes + fixups[i].offset, 0, fixups[i].size);
+    }
+
+    Unit_Section &section = current(p);
+    Instr_Record record = {section.size, p.line, hash_operands(instr, FORMS[form]), hash_encoding(bytes, size), form, size, 0};
+    Instr_Target target = {UNIT_NONE, 0};
+
+    record.flags |= instr.prefix == PREFIX_REP ? INSTR_REP : instr.prefix == PREFIX_REPNZ ? INSTR_REPNZ : 0;
+
+    for (uint8_t i = 0; i < instr.num_ops; i++)
+    {
+        const Operand &op = instr.ops[i];
+
+        if (op.sym == SYM_NONE)
+        {
+            continue;
+        }
+
+        record.flags |= 1 << i;
+
+        if (op.type == OPND_MEM && (op.base == REG_RIP || FORMS[form].enc == ENC_D))
+        {
+            target = {op.sym, (int32_t)(op.value)};
+        }
+    }
+
+    if (target.label != UNIT_NONE)
+    {
+        record.flags |= INSTR_TARGET;
+        section.targets.emplace_back(target);
+    }
+
+    section.instrs.emplace_back(record);
+    section.instr_vars.emplace_back(section.vars.size());
+}
+
+static void parse_instruction(Parser &p, std::string_view name)
+{
+    Instr instr = {};
+    Operand ops[3];
+    uint8_t num_ops = 0;
+
+    // Prefixes written as words in front of the mnemonic, as in rep stosq
+    for (const Prefix *prefix = find_prefix(name); prefix; prefix = find_prefix(name))
+    {
+        uint8_t &field = prefix->segment ? instr.segment : instr.prefix;
+
+        if (peek(p).kind != TOK_IDENT)
+        {
+            // On its own, as in rep; ret, the byte goes in front of whatever follows
+            if (at_end(p) && !instr.prefix && !instr.segment && !current_header(p).is_bss())
+            {
+                append(current(p), &prefix->byte, 1);
+                return;
+            }
+
+            error(p, "expected an instruction after", name);
+            return;
+        }
+
+        // Not a prefix of the form, so the byte goes in as data, as in data16 leaq
+        if (prefix->raw)
+        {
+            if (instr.prefix || instr.segment || current_header(p).is_bss())
+            {
+                error(p, "prefix must come first", name);
+                return;
+            }
+
+            append(current(p), &prefix->byte, 1);
+            name = peek(p).text;
+            p.pos++;
+            continue;
+        }
+
+        if (field)
+        {
+            error(p, "more than one prefix of the same kind", name);
+            return;
+        }
+
+        field = prefix->byte;
+        name = peek(p).text;
+        p.pos++;
+    }
+
+    if (!lookup_mnemonic(name, instr))
+    {
+        error(p, "unknown instruction", name);
+        return;
+    }
+
+    if (!at_end(p))
+    {
+        do
+        {
+            if (num_ops == 3)
+            {
+                error(p, "too many operands");
+                return;
+            }
+
+            if (!parse_operand(p, ops[num_ops++], instr.segment))
+            {
+                return;
+            }
+        } while (accept(p, ','));
+    }
+
+    // AT&T order is source first, the encoder expects Intel order
+    instr.num_ops = num_ops;
+
+    for (uint8_t i = 0; i < num_ops; i++)
+    {
+        instr.ops[i] = ops[num_ops - 1 - i];
+    }
+
+    uint8_t encoded[MAX_INSTR_SIZE];
+    std::size_t size;
+    Enc_Fixup fixups[MAX_FIXUPS];
+    std::size_t num_fixups;
+    uint16_t form;
+
+    if (!encode(instr, encoded, size, fixups, num_fixups, &p.unit->size_stats, &form))
+    {
+        error(p, "invalid operands for", name);
+        return;
+    }
+
+    if (current_header(p).is_bss())
+    {
+        error(p, "instruction in a bss section");
+        return;
+    }
+
+    p.unit->num_instrs++;
+
+    // Branches to labels are sized once the whole section is laid out
+    uint8_t opcode = relaxable_branch(instr);
+
+    if (p.obj.align_branches)
+    {
+        guard_branch(p, instr, size, opcode != 0);
+    }
+
+    if (p.obj.verify)
+    {
+        record_instr(p, instr, form, opcode != 0 ? 0 : size, encoded, fixups, num_fixups);
+    }
+
+    if (opcode != 0)
+    {
+        Unit_Section &section = current(p);
+        Unit_Var var = {};
+
+        var.offset = section.size;
+        var.kind = RVAR_BRANCH;
+        var.opcode = opcode;
+        var.label = instr.ops[0].sym;
+        var.addend = instr.ops[0].value;
+
+        section.vars.emplace_back(var);
+        return;
+    }
+
+    for (std::size_t i = 0; i < num_fixups; i++)
+    {
+        if (!add_fixup(p, fixups[i].offset, encoded + fixups[i].offset, fixups[i], gotpcrelx_type(FORMS[form], encoded, fixups[i])))
+        {
+            return;
+        }
+    }
+
+    append(current(p), encoded, size);
+}
+
+// Directives
+
+static bool parse_name(Parser &p, std::string_view &name)
+{
+    const Token &tok = peek(p);
+
+    if (tok.kind != TOK_IDENT)
+    {
+        error(p, "expected a symbol name", tok.text);
+        return false;
+    }
+
+    p.pos++;
+    name = tok.text;
+
+    return true;
+}
+
+static bool parse_section_name(Parser &p, std::string_view &name)
+{
+    const Token &tok = peek(p);
+
+    if (tok.kind == TOK_STRING)
+    {
+        name = tok.text.substr(1, tok.text.length() - 2);
+        p.pos++;
+        return true;
+    }
+
+    if (!parse_name(p, name))
+    {
+        return false;
+    }
+
+    // Names like .note.GNU-stack lex as several tokens, join the ones that touch
+    while (peek(p).text.data() == name.data() + name.length() &&
+           (at_punct(p, '-') || peek(p).kind == TOK_IDENT || peek(p).kind == TOK_NUMBER))
+    {
+        name = std::string_view(name.data(), name.length() + peek(p).text.length());
+        p.pos++;
+    }
+
+    return true;
+}
+
+// The SHT_ type of a .section @type, SHT_NULL if it is not one
+static uint32_t section_type(std::string_view type)
+{
+    static const std::pair<std::string_view, uint32_t> types[] = {
+        {"progbits", SHT_PROGBITS}, {"nobits", SHT_NOBITS}, {"note", SHT_NOTE}, {"init_array", SHT_INIT_ARRAY},
+        {"fini_array", SHT_FINI_ARRAY}, {"preinit_array", SHT_PREINIT_ARRAY}, {"unwind", SHT_X86_64_UNWIND},
+    };
+
+    for (const auto &t : types)
+    {
+        if (t.first == type)
+        {
+            return t.second;
+        }
+    }
+
+    return SHT_NULL;
+}
+
+// Symbol types .type gives outside of .def, as an ELF st_info. A unique
+// object is a global with a binding of its own
+static const std::pair<std::string_view, uint8_t> SYMBOL_TYPES[] = {
+    {"function", STT_FUNC}, {"object", STT_OBJECT}, {"tls_object", STT_TLS}, {"notype", STT_NOTYPE},
+    {"gnu_indirect_function", STT_GNU_IFUNC}, {"gnu_unique_object", STB_GNU_UNIQUE << 4 | STT_OBJECT},
+};
+
+// .type sym, @type. Only functions have a COFF equivalent, the other types
+// describe the symbol and are left out of COFF objects unless they change
+// how it is linked
+static void parse_symbol_type(Parser &p)
+{
+    std::string_view sym;
+
+    if (!parse_name(p, sym) || !expect(p, ','))
+    {
+        return;
+    }
+
+    if (!accept(p, '@') && !accept(p, '%'))
+    {
+        error(p, "expected a symbol type", peek(p).text);
+        return;
+    }
+
+    std::string_view type = peek(p).text;
+    const std::pair<std::string_view, uint8_t> *found = nullptr;
+
+    for (const auto &t : SYMBOL_TYPES)
+    {
+        if (t.first == type)
+        {
+            found = &t;
+        }
+    }
+
+    if (!found)
+    {
+        error(p, "unknown symbol type", type);
+        return;
+    }
+
+    p.pos++;
+
+    uint8_t info = found->second;
+
+    if (!p.obj.elf && (info & 0xf) == STT_GNU_IFUNC)
+    {
+        error(p, "indirect functions need ELF output", sym);
+        return;
+    }
+
+    if (!p.obj.elf && (info >> 4) == STB_GNU_UNIQUE)
+    {
+        error(p, "unique symbols need ELF output", sym);
+        return;
+    }
+
+    Unit_Label &label = p.unit->labels[unit_label(*p.unit, sym)];
+
+    label.elf_info = info;
+
+    if ((info & 0xf) == STT_FUNC || (info & 0xf) == STT_GNU_IFUNC)
+    {
+        label.type = IMAGE_SYM_DTYPE_FUNCTION << 4;
+    }
+}
+
+// .size sym, expr. The expression is a constant or a difference of labels,
+// usually .-sym at the end of a function
+static void parse_symbol_size(Parser &p)
+{
+    std::string_view sym;
+    Expr expr;
+
+    // COFF symbols have no size
+    if (!p.obj.elf)
+    {
+        skip_statement(p);
+        return;
+    }
+
+    if (!parse_name(p, sym) || !expect(p, ',') || !parse_expr(p, expr))
+    {
+        return;
+    }
+
+    if (expr.label != UNIT_NONE && expr.sub_label == UNIT_NONE)
+    {
+        error(p, "expected a constant", label_name(p, expr.label));
+        return;
+    }
+
+    if (expr.label == UNIT_NONE && expr.value < 0)
+    {
+        error(p, "negative symbol size", sym);
+        return;
+    }
+
+    uint32_t label = unit_label(*p.unit, sym);
+
+    p.unit->sizes.emplace_back(Unit_Size{label, expr.label, expr.sub_label, p.line, expr.value});
+}
+
+// What follows the name of a .section: the flags, the ELF @type and, with
+// the 'G' flag, the group and whether it is a COMDAT group
+struct Section_Spec
+{
+    std::string_view flags = "";
+    std::string_view type = "";
+    std::string_view group = "";
+    bool has_flags = false;
+    bool comdat = false;
+};
+
+static bool parse_section_spec(Parser &p, Section_Spec &spec)
+{
+    if (accept(p, ',') && peek(p).kind == TOK_STRING)
+    {
+        spec.flags = peek(p).text.substr(1, peek(p).text.length() - 2);
+        spec.has_flags = true;
+        p.pos++;
+
+        if (accept(p, ',') && (accept(p, '@') || accept(p, '%')) && peek(p).kind == TOK_IDENT)
+        {
+            spec.type = peek(p).text;
+            p.pos++;
+        }
+    }
+
+    if (spec.flags.find('G') == std::string_view::npos)
+    {
+        return true;
+    }
+
+    if (spec.type.empty())
+    {
+        error(p, "a section group needs a section type");
+        return false;
+    }
+
+    if (!expect(p, ',') || !parse_section_name(p, spec.group))
+    {
+        return false;
+    }
+
+    if (accept(p, ','))
+    {
+        if (peek(p).text != "comdat")
+        {
+            error(p, "expected comdat", peek(p).text);
+            return false;
+        }
+
+        spec.comdat = true;
+        p.pos++;
+    }
+
+    return true;
+}
+
+// Creates the section named by a .section directive if it does not exist yet
+static Sect_Handle create_section(Parser &p, Object &obj, std::string_view name)
+{
+    // Flags follow the GNU PE conventions, or the ELF ones when they hold 'a'
+    // or a section type follows. Without flags the name decides
+    Section_Spec spec;
+
+    if (!parse_section_spec(p, spec))
+    {
+        return obj.text;
+    }
+
+    std::string_view flags = spec.flags;
+    std::string_view type = spec.type;
+    bool has_flags = spec.has_flags;
+    std::size_t idx = obj.sections.find(name, spec.group);
+
+    if (idx != (std::size_t)(-1))
+    {
+        // Any member naming the group COMDAT makes the whole group COMDAT, as with GNU as
+        obj.sections[idx].comdat = obj.sections[idx].comdat || spec.comdat;
+
+        return Sect_Handle{(uint32_t)(idx)};
+    }
+
+    if (!spec.group.empty() && !obj.elf)
+    {
+        error(p, "section groups need ELF output", spec.group);
+        return obj.text;
+    }
+
+    bool code = false;
+    bool bss = false;
+    bool read_only = false;
+    bool write = false;
+    bool discard = false;
+    bool shared = false;
+    bool elf = !type.empty() || flags.find('a') != std::string_view::npos;
+    uint32_t elf_type = SHT_NULL;
+
+    if (!type.empty())
+    {
+        elf_type = section_type(type);
+
+        if (elf_type == SHT_NULL)
+        {
+            error(p, "unknown section type", type);
+        }
+    }
+
+    if (!has_flags)
+    {
+        code = name.substr(0, 5) == ".text";
+        bss = name.substr(0, 4) == ".bss";
+        read_only = name.substr(0, 6) == ".rdata" || name.substr(0, 7) == ".rodata";
+    }
+
+    for (char c : flags)
+    {
+        switch (c)
+        {
+        case 'x':
+            code = true;
+            break;
+        case 'b':
+            bss = true;
+            break;
+        case 'r':
+            read_only = true;
+            break;
+        case 'w':
+            write = true;
+            break;
+        case 'n':
+        case 'D':
+            discard = true;
+            break;
+        case 's':
+            shared = true;
+            break;
+        }
+    }
+
+    if (elf)
+    {
+        bss = elf_type == SHT_NOBITS;
+        read_only = !write;
+
+        // Sections that are not allocated only carry information for the linker
+        if (flags.find('a') == std::string_view::npos)
+        {
+            Sect_Hdr header = {};
+
+            header.flags = IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_LNK_INFO | IMAGE_SCN_LNK_REMOVE | IMAGE_SCN_ALIGN_1BYTES;
+
+            Sect_Handle handle = add_section(obj.sections, obj.sym_tab, obj.str_tab, header, name, spec.group);
+
+            obj.sections[handle].elf_type = elf_type;
+            obj.sections[handle].comdat = spec.comdat;
+
+            return handle;
+        }
+    }
+
+    Sect_Hdr header = {};
+
+    if (code)
+    {
+        header.flags = IMAGE_SCN_CNT_CODE | IMAGE_SCN_MEM_EXECUTE | IMAGE_SCN_MEM_READ | (write ? IMAGE_SCN_MEM_WRITE : 0);
+    }
+    else if (bss)
+    {
+        header.flags = IMAGE_SCN_CNT_UNINITIALIZED_DATA | IMAGE_SCN_MEM_READ | IMAGE_SCN_MEM_WRITE;
+    }
+    else
+    {
+        header.flags = IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ | (read_only && !write ? 0 : IMAGE_SCN_MEM_WRITE);
+    }
+
+    // ELF sections are only as aligned as the .align directives in them ask,
+    // which is what keeps .init_array a plain array of pointers
+    header.flags |= obj.elf ? IMAGE_SCN_ALIGN_1BYTES : IMAGE_SCN_ALIGN_16BYTES;
+    header.flags |= discard ? IMAGE_SCN_MEM_DISCARDABLE : 0;
+    header.flags |= shared ? IMAGE_SCN_MEM_SHARED : 0;
+
+    Sect_Handle handle = add_section(obj.sections, obj.sym_tab, obj.str_tab, header, name, spec.group);
+
+    obj.sections[handle].elf_type = elf_type;
+    obj.sections[handle].comdat = spec.comdat;
+
+    return handle;
+}
+
+static void add_align(Unit_Section &section, int64_t alignment, int64_t max, uint8_t fill)
+{
+    Unit_Var var = {};
+
+    var.offset = section.size;
+    var.kind = RVAR_ALIGN;
+    var.fill = fill;
+    var.alignment = alignment;
+    var.max = max;
+
+    section.vars.emplace_back(var);
+}
+
+static void parse_align(Parser &p, bool power)
+{
+    int64_t alignment;
+    int64_t fill = -1;
+    int64_t max = 0;
+
+    if (!parse_const(p, alignment))
+    {
+        return;
+    }
+
+    if (accept(p, ','))
+    {
+        if (!at_punct(p, ',') && !parse_const(p, fill))
+        {
+            return;
+        }
+
+        if (accept(p, ',') && !parse_const(p, max))
+        {
+            return;
+        }
+    }
+
+    if (power)
+    {
+        if (alignment < 0 || alignment > 13)
+        {
+            error(p, "alignment too large");
+            return;
+        }
+
+        alignment = (int64_t)(0x1) << alignment;
+    }
+
+    if (alignment <= 0 || (alignment & (alignment - 1)) != 0 || alignment > 0x2000)
+    {
+        error(p, "alignment must be a power of two up to 8192");
+        return;
+    }
+
+    const Section &header = current_header(p);
+
+    if (fill < 0)
+    {
+        fill = header.header.flags & IMAGE_SCN_CNT_CODE ? NOP_BYTE : 0;
+    }
+
+    if (header.is_bss() && fill != 0)
+    {
+        error(p, "initialised data in a bss section");
+        return;
+    }
+
+    // The padding depends on where the chunk lands, so it is added when merging
+    Unit_Section &section = current(p);
+
+    add_align(section, alignment, max, fill);
+}
+
+// Macros
+
+#define DIR_NONE 0xff
+
+// Directive a statement starts with once its labels are skipped, DIR_NONE if
+// it does not start with one. first is set to the token after the labels
+static uint8_t statement_directive(const std::vector<Token> &tokens, std::size_t &first)
+{
+    first = 0;
+
+    while (first + 1 < tokens.size() && tokens[first].kind == TOK_IDENT && tokens[first + 1].kind == TOK_PUNCT && tokens[first + 1].text[0] == ':')
+    {
+        first += 2;
+    }
+
+    uint32_t idx = tokens[first].kind == TOK_IDENT ? find_directive(tokens[first].text) : PERFECT_HASH_NOT_FOUND;
+
+    return idx == PERFECT_HASH_NOT_FOUND ? DIR_NONE : DIRECTIVES[idx].id;
+}
+
+static void push_expansion(Parser &p, Expansion &expansion)
+{
+    if (p.expansions.size() >= MAX_EXPANSION_DEPTH)
+    {
+        error(p, "macros nested too deeply");
+        return;
+    }
+
+    p.expansions.emplace_back(std::move(expansion));
+}
+
+// Reads the next statement, from the innermost expansion while one is running
+static bool next_statement(Parser &p)
+{
+    p.pos = 0;
+
+    while (!p.expansions.empty())
+    {
+        if (next_expanded(p.expansions.back(), p.tokens, *p.names))
+        {
+            return true;
+        }
+
+        p.expansions.pop_back();
+    }
+
+    p.line = p.first_line + p.lexer.line;
+
+    return p.lexer.next_statement(p.tokens);
+}
+
+// An argument written as one string stands for the text inside the quotes,
+// as in GNU as, so it may hold blanks and commas. The last token of tokens
+// is replaced by those of the text. Escapes are left as written
+static void unquote_arg(std::vector<Token> &tokens)
+{
+    std::string_view text = tokens.back().text;
+    std::vector<Token> statement;
+    Lexer lexer;
+
+    tokens.pop_back();
+    lexer.reset(text.substr(1, text.length() - 2));
+
+    // A ';' inside the quotes does not end a statement here
+    while (lexer.next_statement(statement))
+    {
+        if (lexer.pos < lexer.end)
+        {
+            statement.back() = Token{TOK_PUNCT, ";"};
+        }
+        else
+        {
+            statement.pop_back();
+        }
+
+        tokens.insert(tokens.end(), statement.begin(), statement.end());
+    }
+}
+
+// Tokens up to a comma outside parentheses, or to the end of the statement
+static Macro_Arg read_arg(Parser &p, Expansion &expansion, bool rest)
+{
+    Macro_Arg arg = {(uint32_t)(expansion.arg_tokens.size()), 0};
+    int depth = 0;
+
+    while (!at_end(p) && (rest || depth > 0 || !at_punct(p, ',')))
+    {
+        depth += at_punct(p, '(') ? 1 : at_punct(p, ')') ? -1 : 0;
+
+        expansion.arg_tokens.emplace_back(peek(p));
+        arg.count++;
+        p.pos++;
+    }
+
+    // Quotes are kept on the rest of the statement a vararg parameter takes
+    if (!rest && arg.count == 1 && expansion.arg_tokens.back().kind == TOK_STRING)
+    {
+        unquote_arg(expansion.arg_tokens);
+        arg.count = expansion.arg_tokens.size() - arg.first;
+    }
+
+    return arg;
+}
+
+// Reads the statement that opens a block, the body follows statement by statement
+static void open_block(Parser &p, uint8_t kind)
+{
+    Block &block = p.block;
+    Macro_Body &body = block.macro.body;
+    Expansion &expansion = block.expansion;
+
+    block.kind = kind;
+    block.depth = 0;
+    block.macro = {};
+    block.expansion = {};
+
+    if (kind == DIR_MACRO)
+    {
+        // Macros are defined by the prescan, chunks only skip the definition
+        if (p.unit || !parse_name(p, block.macro.name))
+        {
+            skip_statement(p);
+            return;
+        }
+
+        while (accept(p, ',') || !at_end(p))
+        {
+            Macro_Param param;
+            std::string_view qualifier;
+
+            if (!parse_name(p, param.name))
+            {
+                skip_statement(p);
+                return;
+            }
+
+            if (accept(p, ':') && parse_name(p, qualifier))
+            {
+                param.required = qualifier == "req";
+                param.vararg = qualifier == "vararg";
+
+                if (!param.required && !param.vararg)
+                {
+                    error(p, "unknown parameter qualifier", qualifier);
+                }
+            }
+
+            if (accept(p, '='))
+            {
+                while (!at_end(p) && !at_punct(p, ','))
+                {
+                    param.value.emplace_back(peek(p));
+                    p.pos++;
+                }
+
+                if (param.value.size() == 1 && param.value[0].kind == TOK_STRING)
+                {
+                    unquote_arg(param.value);
+                }
+            }
+
+            body.params.emplace_back(param);
+        }
+
+        return;
+    }
+
+    if (kind == DIR_REPT)
+    {
+        int64_t count;
+
+        expansion.count = parse_const(p, count) && count > 0 ? count : 0;
+        return;
+    }
+
+    // .irp and .irpc name a parameter, then list its values
+    Macro_Param param;
+
+    if (!parse_name(p, param.name))
+    {
+        expansion.count = 0;
+        skip_statement(p);
+        return;
+    }
+
+    body.params.emplace_back(param);
+    accept(p, ',');
+
+    if (kind == DIR_IRP)
+    {
+        do
+        {
+            expansion.args.emplace_back(read_arg(p, expansion, false));
+        } while (accept(p, ','));
+    }
+    else
+    {
+        // One value for each character
+        for (; !at_end(p); p.pos++)
+        {
+            std::string_view text = peek(p).text;
+
+            for (std::size_t c = 0; c < text.length(); c++)
+            {
+                uint8_t char_kind = text[c] >= '0' && text[c] <= '9' ? TOK_NUMBER : peek(p).kind == TOK_PUNCT ? TOK_PUNCT : TOK_IDENT;
+
+                expansion.args.emplace_back(Macro_Arg{(uint32_t)(expansion.arg_tokens.size()), 1});
+                expansion.arg_tokens.emplace_back(Token{char_kind, text.substr(c, 1)});
+            }
+        }
+
+        if (expansion.args.empty())
+        {
+            expansion.args.emplace_back(Macro_Arg{0, 0});
+        }
+    }
+
+    expansion.count = expansion.args.size();
+}
+
+// Adds a statement to the open block. Returns true at the .endm or .endr
+// that closes it
+static bool read_block_statement(Parser &p)
+{
+    Block &block = p.block;
+    std::size_t first;
+    uint8_t id = statement_directive(p.tokens, first);
+
+    if (id == DIR_MACRO || id == DIR_REPT || id == DIR_IRP || id == DIR_IRPC)
+    {
+        block.depth++;
+    }
+    else if (id == DIR_ENDM || id == DIR_ENDR)
+    {
+        if (block.depth == 0)
+        {
+            if ((id == DIR_ENDM) != (block.kind == DIR_MACRO))
+            {
+                error(p, block.kind == DIR_MACRO ? "expected .endm instead of" : "expected .endr instead of", p.tokens[first].text);
+            }
+
+            return true;
+        }
+
+        block.depth--;
+    }
+
+    // Chunks only skip macro definitions
+    if (p.tokens.size() == 1 || (p.unit && block.kind == DIR_MACRO))
+    {
+        return false;
+    }
+
+    add_template_statement(block.macro.body, p.tokens);
+
+    // The prescan only runs the bodies that change sections or constants
+    if (!p.unit && !block.macro.body.prescan)
+    {
+        const Macro *macro = p.tokens[first].kind == TOK_IDENT ? find_macro(p.obj, p.tokens[first].text) : nullptr;
+
+        block.macro.body.prescan = id == DIR_SET || id == DIR_SECTION || id == DIR_TEXT || id == DIR_DATA || id == DIR_BSS ||
+                                   id == DIR_MACRO || id == DIR_SEH_PROC || id == DIR_SEH_ENDPROC || id == DIR_SEH_HANDLERDATA ||
+                                   (macro && macro->body.prescan);
+    }
+
+    return false;
+}
+
+// Closes the open block. The prescan defines macros, a .rept or .irp starts
+// expanding. obj is null when parsing a chunk
+static void end_block(Parser &p, Object *obj)
+{
+    Block &block = p.block;
+    uint8_t kind = block.kind;
+
+    block.kind = 0;
+
+    if (kind == DIR_MACRO)
+    {
+        std::string_view name = block.macro.name;
+
+        if (!obj || name.empty())
+        {
+            return;
+        }
+
+        if (find_macro(*obj, name))
+        {
+            error(p, "macro already defined", name);
+            return;
+        }
+
+        obj->macros.emplace_back(std::move(block.macro));
+        obj->macro_index.insert(name, obj->macros.size() - 1, [obj](uint32_t i)
+                                { return obj->macros[i].name; });
+        return;
+    }
+
+    if (obj && !block.macro.body.prescan)
+    {
+        return;
+    }
+
+    Expansion &expansion = block.expansion;
+
+    expansion.owned = std::make_unique<Macro_Body>(std::move(block.macro.body));
+    expansion.body = expansion.owned.get();
+    expansion.counter = p.counter_base + p.calls;
+
+    push_expansion(p, expansion);
+}
+
+// Reads the arguments of a call and starts expanding the macro
+static void call_macro(Parser &p, const Macro &macro)
+{
+    const std::vector<Macro_Param> &params = macro.body.params;
+    Expansion expansion;
+    std::size_t next = 0;
+
+    expansion.args.assign(params.size(), Macro_Arg{0, 0});
+
+    while (!at_end(p))
+    {
+        std::size_t param = next;
+
+        // Arguments may be given by name
+        if (peek(p).kind == TOK_IDENT && at_punct(p, '=', 1))
+        {
+            for (param = 0; param < params.size() && params[param].name != peek(p).text; param++)
+            {
+            }
+
+            if (param == params.size())
+            {
+                error(p, "no such macro parameter", peek(p).text);
+                return;
+            }
+
+            p.pos += 2;
+        }
+
+        if (param >= params.size())
+        {
+            error(p, "too many arguments for", macro.name);
+            return;
+        }
+
+        expansion.args[param] = read_arg(p, expansion, params[param].vararg);
+        next = param + 1;
+
+        if (!at_end(p) && !expect(p, ','))
+        {
+            return;
+        }
+    }
+
+    for (std::size_t i = 0; i < params.size(); i++)
+    {
+        if (expansion.args[i].count > 0)
+        {
+            continue;
+        }
+
+        if (params[i].required)
+        {
+            error(p, "missing argument for macro parameter", params[i].name);
+            return;
+        }
+
+        expansion.args[i] = Macro_Arg{(uint32_t)(expansion.arg_tokens.size()), (uint32_t)(params[i].value.size())};
+        expansion.arg_tokens.insert(expansion.arg_tokens.end(), params[i].value.begin(), params[i].value.end());
+    }
+
+    expansion.body = &macro.body;
+    expansion.macro = true;
+    expansion.counter = p.counter_base + p.calls++;
+
+    push_expansion(p, expansion);
+}
+
+// Ends the innermost macro call and the blocks running inside it
+static void exit_macro(Parser &p)
+{
+    while (!p.expansions.empty())
+    {
+        bool macro = p.expansions.back().macro;
+
+        p.expansions.pop_back();
+
+        if (macro)
+        {
+            return;
+        }
+    }
+
+    error(p, ".exitm outside a macro");
+}
+
+// Unwind directives
+
+static void add_frame(Parser &p, uint8_t op, uint8_t reg = 0, int64_t value = 0, uint32_t label = UNIT_NONE)
+{
+    p.unit->frames.emplace_back(Unit_Frame{here(current(p)), p.section, p.line, op, reg, label, value});
+}
+
+// A register of the class and size an unwind directive names
+static bool parse_frame_register(Parser &p, uint8_t reg_class, const Register *&reg)
+{
+    if (!at_punct(p, '%'))
+    {
+        error(p, "expected a register", peek(p).text);
+        return false;
+    }
+
+    if (!parse_register(p, reg))
+    {
+        return false;
+    }
+
+    if (reg->reg_class != reg_class || (reg_class == RC_GP && reg->size != 8))
+    {
+        error(p, reg_class == RC_GP ? "expected a 64-bit register" : "expected an xmm register", reg->name);
+        return false;
+    }
+
+    return true;
+}
+
+// .seh_* directives, the unwind information of x64 Windows. Everything that
+// has no encoding is rejected here, so building the tables from the frames
+// only has to place them
+static void parse_seh(Parser &p, std::string_view name, uint8_t id)
+{
+    Unit &unit = *p.unit;
+    const Register *reg = nullptr;
+    std::string_view sym;
+    int64_t value = 0;
+    uint8_t op = id - DIR_SEH_PROC + FRAME_SEH_PROC;
+
+    if (id == DIR_SEH_PROC)
+    {
+        if (!parse_name(p, sym))
+        {
+            return;
+        }
+
+        if (p.seh_proc != UNIT_NONE)
+        {
+            error(p, ".seh_proc before the .seh_endproc of the last", sym);
+            return;
+        }
+
+        p.seh_proc = unit.frames.size();
+        p.seh_slots = 0;
+        p.seh_prologue = true;
+        p.seh_frame = false;
+        p.seh_handler = 0;
+        p.seh_data = false;
+        add_frame(p, op);
+        return;
+    }
+
+    if (p.seh_proc == UNIT_NONE)
+    {
+        error(p, "unwind directive outside .seh_proc", name);
+        return;
+    }
+
+    bool prologue_op = id != DIR_SEH_ENDPROC && id != DIR_SEH_HANDLER && id != DIR_SEH_HANDLERDATA;
+
+    if (prologue_op && !p.seh_prologue)
+    {
+        error(p, "unwind directive after .seh_endprologue", name);
+        return;
+    }
+
+    switch (id)
+    {
+    case DIR_SEH_ENDPROC:
+        if (p.seh_prologue)
+        {
+            error(p, "missing .seh_endprologue");
+        }
+        else if (p.section != unit.frames[p.seh_proc].section)
+        {
+            error(p, ".seh_endproc in another section than its .seh_proc");
+        }
+
+        add_frame(p, op);
+        p.seh_proc = UNIT_NONE;
+        return;
+    case DIR_SEH_ENDPROLOGUE:
+        p.seh_prologue = false;
+        break;
+    case DIR_SEH_PUSHREG:
+        if (!parse_frame_register(p, RC_GP, reg))
+        {
+            return;
+        }
+        break;
+    case DIR_SEH_SETFRAME:
+        if (!parse_frame_register(p, RC_GP, reg) || !expect(p, ',') || !parse_const(p, value))
+        {
+            return;
+        }
+
+        if (p.seh_frame)
+        {
+            error(p, "second .seh_setframe");
+            return;
+        }
+
+        if (value < 0 || value > UNW_MAX_FRAME_OFFSET || value % 16 != 0)
+        {
+            error(p, "frame offset must be a multiple of 16 up to 240");
+            return;
+        }
+
+        p.seh_frame = true;
+        break;
+    case DIR_SEH_STACKALLOC:
+        if (!parse_const(p, value))
+        {
+            return;
+        }
+
+        if (value <= 0 || value > UINT32_MAX || value % 8 != 0)
+        {
+            error(p, "stack allocation must be a positive multiple of 8");
+            return;
+        }
+        break;
+    case DIR_SEH_SAVEREG:
+    case DIR_SEH_SAVEXMM:
+    {
+        int64_t scale = id == DIR_SEH_SAVEREG ? 8 : 16;
+
+        if (!parse_frame_register(p, id == DIR_SEH_SAVEREG ? RC_GP : RC_XMM, reg) || !expect(p, ',') || !parse_const(p, value))
+        {
+            return;
+        }
+
+        if (value < 0 || value > UINT32_MAX || value % scale != 0)
+        {
+            error(p, id == DIR_SEH_SAVEREG ? "save offset must be a multiple of 8" : "save offset must be a multiple of 16");
+            return;
+        }
+        break;
+    }
+    case DIR_SEH_PUSHFRAME:
+        if ((accept(p, '@') || accept(p, '%')) && parse_name(p, sym))
+        {
+            if (sym != "code")
+            {
+                error(p, "expected @code", sym);
+                return;
+            }
+
+            value = 1;
+        }
+        break;
+    case DIR_SEH_HANDLER:
+    {
+        uint8_t flags = 0;
+
+        if (!parse_name(p, sym))
+        {
+            return;
+        }
+
+        while (accept(p, ','))
+        {
+            std::string_view flag;
+
+            if (!(accept(p, '@') || accept(p, '%')) || !parse_name(p, flag))
+            {
+                return;
+            }
+
+            if (flag == "except")
+            {
+                flags |= UNW_FLAG_EHANDLER;
+            }
+            else if (flag == "unwind")
+            {
+                flags |= UNW_FLAG_UHANDLER;
+            }
+            else
+            {
+                error(p, "expected @except or @unwind", flag);
+                return;
+            }
+        }
+
+        if (flags == 0 || p.seh_handler)
+        {
+            error(p, flags == 0 ? "handler needs @except or @unwind" : "second .seh_handler", sym);
+            return;
+        }
+
+        p.seh_handler = flags;
+        add_frame(p, op, 0, flags, unit_label(unit, sym));
+        return;
+    }
+    case DIR_SEH_HANDLERDATA:
+    {
+        if (!p.seh_handler || p.seh_prologue || p.seh_data)
+        {
+            error(p, !p.seh_handler ? ".seh_handlerdata without .seh_handler" : p.seh_prologue ? ".seh_handlerdata before .seh_endprologue" : "second .seh_handlerdata");
+            return;
+        }
+
+        // The data follows the unwind information in .xdata, which the
+        // prescan created. The space is filled in once the prologue is placed
+        p.section = unit_section(unit, Sect_Handle{(uint32_t)(p.obj.sections.find(".xdata"))});
+        add_align(current(p), 4, 0, 0);
+
+        uint32_t size = seh_info_size(p.seh_slots, true);
+        std::vector<uint8_t> space(size, 0);
+
+        add_frame(p, op, 0, size);
+        append(current(p), space.data(), space.size());
+        p.seh_data = true;
+        return;
+    }
+    }
+
+    p.seh_slots += prologue_op ? seh_slots(op, value) : 0;
+
+    if (p.seh_slots > UNW_MAX_SLOTS)
+    {
+        error(p, "too many unwind codes for one prologue");
+        return;
+    }
+
+    add_frame(p, op, reg ? reg->num : 0, value);
+}
+
+// DWARF numbers of the general purpose registers, which order them differently
+static const uint8_t DWARF_GP_REGS[16] = {0, 2, 1, 3, 7, 6, 4, 5, 8, 9, 10, 11, 12, 13, 14, 15};
+
+// A register of a .cfi_ directive, by name or by DWARF number
+static bool parse_cfi_register(Parser &p, uint8_t &dwarf)
+{
+    const Register *reg = nullptr;
+    int64_t value;
+
+    if (!at_punct(p, '%'))
+    {
+        if (!parse_const(p, value))
+        {
+            return false;
+        }
+
+        if (value < 0 || value > DWARF_MAX_REG)
+        {
+            error(p, "invalid register number", std::to_string(value));
+            return false;
+        }
+
+        dwarf = value;
+        return true;
+    }
+
+    if (!parse_register(p, reg))
+    {
+        return false;
+    }
+
+    if (reg->reg_class == RC_GP && reg->size == 8)
+    {
+        dwarf = DWARF_GP_REGS[reg->num];
+    }
+    else if (reg->reg_class == RC_XMM && reg->num < 16)
+    {
+        dwarf = DWARF_XMM0 + reg->num;
+    }
+    else if (reg->reg_class == RC_RIP)
+    {
+        dwarf = DWARF_RETURN_REG;
+    }
+    else
+    {
+        error(p, "register has no DWARF number", reg->name);
+        return false;
+    }
+
+    return true;
+}
+
+// The pointer encoding of .cfi_personality or .cfi_lsda, and its symbol
+// unless the encoding omits it
+static bool parse_cfi_pointer(Parser &p, uint8_t &encoding, uint32_t &label)
+{
+    int64_t value;
+    std::string_view sym;
+
+    if (!parse_const(p, value))
+    {
+        return false;
+    }
+
+    encoding = value;
+    label = UNIT_NONE;
+
+    if (value == DW_EH_PE_OMIT)
+    {
+        return true;
+    }
+
+    if (value & ~(int64_t)(DW_EH_PE_INDIRECT | DW_EH_PE_PCREL | DW_EH_PE_FORMAT) || dwarf_pointer_size(encoding) == 0 ||
+        ((encoding & DW_EH_PE_PCREL) && dwarf_pointer_size(encoding) != 4))
+    {
+        error(p, "unsupported pointer encoding", std::to_string(value));
+        return false;
+    }
+
+    if (!expect(p, ',') || !parse_name(p, sym))
+    {
+        return false;
+    }
+
+    label = unit_label(*p.unit, sym);
+
+    return true;
+}
+
+// .cfi_* directives, the DWARF call frame information ELF objects unwind
+// with. Each is kept as a frame and .eh_frame is built from them once the
+// code is placed
+static void parse_cfi(Parser &p, std::string_view name, uint8_t id)
+{
+    Unit &unit = *p.unit;
+    uint8_t op = id - DIR_CFI_STARTPROC + FRAME_CFI_STARTPROC;
+    uint8_t reg = 0;
+    uint32_t label = UNIT_NONE;
+    int64_t value = 0;
+
+    if (id == DIR_CFI_SECTIONS)
+    {
+        std::string_view sect;
+
+        do
+        {
+            if (!parse_section_name(p, sect))
+            {
+                return;
+            }
+
+            if (sect != ".eh_frame")
+            {
+                error(p, "only .eh_frame call frame information is generated", sect);
+                return;
+            }
+        } while (accept(p, ','));
+
+        return;
+    }
+
+    if (id == DIR_CFI_STARTPROC)
+    {
+        std::string_view simple;
+
+        if (p.cfi_proc != UNIT_NONE)
+        {
+            error(p, ".cfi_startproc before the .cfi_endproc of the last");
+            return;
+        }
+
+        if (!at_end(p))
+        {
+            if (!parse_name(p, simple))
+            {
+                return;
+            }
+
+            if (simple != "simple")
+            {
+                error(p, "expected simple", simple);
+                return;
+            }
+        }
+
+        p.cfi_proc = unit.frames.size();
+        add_frame(p, op, 0, !simple.empty());
+        return;
+    }
+
+    if (p.cfi_proc == UNIT_NONE)
+    {
+        error(p, "call frame directive outside .cfi_startproc", name);
+        return;
+    }
+
+    if (p.section != unit.frames[p.cfi_proc].section)
+    {
+        error(p, "call frame directive in another section than its .cfi_startproc", name);
+        return;
+    }
+
+    switch (id)
+    {
+    case DIR_CFI_ENDPROC:
+        p.cfi_proc = UNIT_NONE;
+        break;
+    case DIR_CFI_PERSONALITY:
+    case DIR_CFI_LSDA:
+        if (!parse_cfi_pointer(p, reg, label))
+        {
+            return;
+        }
+        break;
+    case DIR_CFI_DEF_CFA:
+    case DIR_CFI_OFFSET:
+    case DIR_CFI_REL_OFFSET:
+        if (!parse_cfi_register(p, reg) || !expect(p, ',') || !parse_const(p, value))
+        {
+            return;
+        }
+
+        if (id != DIR_CFI_DEF_CFA && value % DWARF_DATA_ALIGN != 0)
+        {
+            error(p, "save offset must be a multiple of 8");
+            return;
+        }
+        break;
+    case DIR_CFI_DEF_CFA_REGISTER:
+    case DIR_CFI_RESTORE:
+    case DIR_CFI_UNDEFINED:
+    case DIR_CFI_SAME_VALUE:
+        if (!parse_cfi_register(p, reg))
+        {
+            return;
+        }
+        break;
+    case DIR_CFI_REGISTER:
+    {
+        uint8_t second;
+
+        if (!parse_cfi_register(p, reg) || !expect(p, ',') || !parse_cfi_register(p, second))
+        {
+            return;
+        }
+
+        value = second;
+        break;
+    }
+    case DIR_CFI_DEF_CFA_OFFSET:
+    case DIR_CFI_ADJUST_CFA_OFFSET:
+        if (!parse_const(p, value))
+        {
+            return;
+        }
+        break;
+    case DIR_CFI_ESCAPE:
+        // One frame per byte, the bytes go into the instructions as they are
+        do
+        {
+            if (!parse_const(p, value))
+            {
+                return;
+            }
+
+            add_frame(p, op, 0, value & 0xff);
+        } while (accept(p, ','));
+
+        return;
+    }
+
+    add_frame(p, op, reg, value, label);
+}
+
+static void parse_directive(Parser &p, std::string_view name)
+{
+    uint32_t idx = find_directive(name);
+
+    // Dropping unwind information would leave an object that links but cannot unwind
+    if (idx == PERFECT_HASH_NOT_FOUND && (name.substr(0, 5) == ".seh_" || name.substr(0, 5) == ".cfi_"))
+    {
+        error(p, "unsupported unwind directive", name);
+        skip_statement(p);
+        return;
+    }
+
+    if (idx == PERFECT_HASH_NOT_FOUND)
+    {
+        error(p, "unknown directive", name);
+        skip_statement(p);
+        return;
+    }
+
+    Unit &unit = *p.unit;
+    std::string_view sym;
+    Expr expr;
+    int64_t value;
+
+    switch (DIRECTIVES[idx].id)
+    {
+    case DIR_IGNORED:
+        skip_statement(p);
+        break;
+    case DIR_FILE:
+        // DWARF file entries start with a number
+        if (peek(p).kind == TOK_STRING)
+        {
+            std::string_view str = peek(p).text;
+
+            unit.files.emplace_back(str.substr(1, str.length() - 2));
+        }
+
+        skip_statement(p);
+        break;
+    case DIR_TEXT:
+        p.section = unit_section(unit, p.obj.text);
+        break;
+    case DIR_DATA:
+        p.section = unit_section(unit, p.obj.data);
+        break;
+    case DIR_BSS:
+        p.section = unit_section(unit, p.obj.bss);
+        break;
+    case DIR_SECTION:
+    {
+        // The prescan has created every section and reported errors in the flags
+        Section_Spec spec;
+        bool quiet = p.quiet;
+
+        if (!parse_section_name(p, sym))
+        {
+            break;
+        }
+
+        p.quiet = true;
+        bool ok = parse_section_spec(p, spec) && (spec.group.empty() || p.obj.elf);
+        p.quiet = quiet;
+
+        if (!ok)
+        {
+            p.ok = false;
+            skip_statement(p);
+            break;
+        }
+
+        std::size_t section = p.obj.sections.find(sym, spec.group);
+
+        if (section == (std::size_t)(-1))
+        {
+            error(p, "section directive must start a line", sym);
+            break;
+        }
+
+        p.section = unit_section(unit, Sect_Handle{(uint32_t)(section)});
+
+        skip_statement(p);
+        break;
+    }
+    case DIR_GLOBL:
+        do
+        {
+            if (parse_name(p, sym))
+            {
+                unit.labels[unit_label(unit, sym)].flags |= LABEL_GLOBAL;
+            }
+        } while (p.ok && accept(p, ','));
+        break;
+    case DIR_EXTERN:
+        do
+        {
+            if (parse_name(p, sym))
+            {
+                unit_label(unit, sym);
+            }
+        } while (p.ok && accept(p, ','));
+        break;
+    case DIR_LOCAL:
+        do
+        {
+            if (parse_name(p, sym))
+            {
+                unit.labels[unit_label(unit, sym)].flags |= ULABEL_LOCAL;
+            }
+        } while (p.ok && accept(p, ','));
+        break;
+    case DIR_WEAK:
+        // COFF weak externals name a default symbol, which .weak has no way to give
+        if (!p.obj.elf)
+        {
+            error(p, "weak symbols need ELF output");
+            skip_statement(p);
+            break;
+        }
+
+        do
+        {
+            if (parse_name(p, sym))
+            {
+                Unit_Label &label = unit.labels[unit_label(unit, sym)];
+
+                label.flags |= LABEL_GLOBAL;
+                label.storage_class = IMAGE_SYM_CLASS_WEAK_EXTERNAL;
+            }
+        } while (p.ok && accept(p, ','));
+        break;
+    case DIR_INTERNAL:
+    case DIR_HIDDEN:
+    case DIR_PROTECTED:
+        if (!p.obj.elf)
+        {
+            error(p, "symbol visibility needs ELF output");
+            skip_statement(p);
+            break;
+        }
+
+        do
+        {
+            if (parse_name(p, sym))
+            {
+                unit.labels[unit_label(unit, sym)].visibility = DIRECTIVES[idx].id - DIR_INTERNAL + STV_INTERNAL;
+            }
+        } while (p.ok && accept(p, ','));
+        break;
+    case DIR_COMM:
+    case DIR_LCOMM:
+    {
+        int64_t alignment = 0;
+
+        if (!parse_name(p, sym) || !expect(p, ',') || !parse_const(p, value))
+        {
+            break;
+        }
+
+        if (accept(p, ',') && !parse_const(p, alignment))
+        {
+            break;
+        }
+
+        if (DIRECTIVES[idx].id == DIR_COMM && !(unit.labels[unit_label(unit, sym)].flags & ULABEL_LOCAL))
+        {
+            Unit_Label &label = unit.labels[unit_label(unit, sym)];
+
+            label.flags |= LABEL_COMMON;
+            label.value = value;
+            break;
+        }
+
+        // Local common symbols are allocated in .bss directly
+        uint32_t section = p.section;
+        p.section = unit_section(unit, p.obj.bss);
+
+        Unit_Section &bss = current(p);
+
+        if (alignment > 1 && (alignment & (alignment - 1)) == 0)
+        {
+            add_align(bss, alignment, 0, 0);
+        }
+
+        define_unit_label(p, sym);
+        bss.size += value;
+
+        p.section = section;
+        break;
+    }
+    case DIR_SET:
+    {
+        if (!parse_name(p, sym) || !expect(p, ',') || !parse_address(p, expr))
+        {
+            break;
+        }
+
+        Unit_Label &label = unit.labels[unit_label(unit, sym)];
+
+        if ((label.flags & (LABEL_DEFINED | LABEL_COMMON | LABEL_ALIAS)) || (expr.label != UNIT_NONE && (label.flags & LABEL_ABSOLUTE)))
+        {
+            error(p, "symbol already defined", sym);
+            break;
+        }
+
+        if (expr.label == UNIT_NONE)
+        {
+            label.flags |= LABEL_ABSOLUTE;
+            label.value = expr.value;
+            break;
+        }
+
+        // A symbol plus a constant makes the name an alias, placed by the merge
+        if (expr.modifier != SYM_MOD_NONE || (unit.labels[expr.label].flags & ULABEL_NUMERIC))
+        {
+            error(p, "expression is too complex", label_name(p, expr.label));
+            break;
+        }
+
+        label.flags |= LABEL_ALIAS;
+        label.alias = expr.label;
+        label.value = expr.value;
+        label.line = p.line;
+        break;
+    }
+    case DIR_ALIGN:
+        parse_align(p, false);
+        break;
+    case DIR_P2ALIGN:
+        parse_align(p, true);
+        break;
+    case DIR_BYTE:
+    case DIR_WORD:
+    case DIR_LONG:
+    case DIR_QUAD:
+    {
+        uint8_t size = 1 << (DIRECTIVES[idx].id - DIR_BYTE);
+
+        do
+        {
+            if (parse_expr(p, expr))
+            {
+                emit_value(p, expr, size);
+            }
+        } while (p.ok && accept(p, ','));
+        break;
+    }
+    case DIR_ULEB128:
+    case DIR_SLEB128:
+        do
+        {
+            if (parse_expr(p, expr))
+            {
+                emit_leb(p, expr, DIRECTIVES[idx].id == DIR_SLEB128);
+            }
+        } while (p.ok && accept(p, ','));
+        break;
+    case DIR_ASCII:
+    case DIR_ASCIZ:
+        do
+        {
+            const Token &tok = peek(p);
+
+            if (tok.kind != TOK_STRING)
+            {
+                error(p, "expected a string", tok.text);
+                break;
+            }
+
+            if (current_header(p).is_bss())
+            {
+                error(p, "initialised data in a bss section");
+                break;
+            }
+
+            p.pos++;
+            emit_string(current(p), tok.text, DIRECTIVES[idx].id == DIR_ASCIZ);
+        } while (accept(p, ','));
+        break;
+    case DIR_SPACE:
+    {
+        int64_t fill = 0;
+
+        if (!parse_const(p, value) || (accept(p, ',') && !parse_const(p, fill)))
+        {
+            break;
+        }
+
+        if (value < 0)
+        {
+            error(p, "negative size");
+            break;
+        }
+
+        emit_fill(p, value, fill, 1);
+        break;
+    }
+    case DIR_FILL:
+    {
+        int64_t size = 1;
+        int64_t fill = 0;
+
+        if (!parse_const(p, value))
+        {
+            break;
+        }
+
+        if (accept(p, ',') && !parse_const(p, size))
+        {
+            break;
+        }
+
+        if (accept(p, ',') && !parse_const(p, fill))
+        {
+            break;
+        }
+
+        if (value < 0 || size < 0)
+        {
+            error(p, "negative size");
+            break;
+        }
+
+        size = std::min<int64_t>(size, 8);
+
+        if (size > 0)
+        {
+            emit_fill(p, value, fill, size);
+        }
+        break;
+    }
+    case DIR_INCBIN:
+        parse_incbin(p);
+        break;
+    case DIR_DEF:
+        if (parse_name(p, sym))
+        {
+            p.def_label = unit_label(unit, sym);
+        }
+        break;
+    case DIR_SCL:
+    case DIR_TYPE:
+        // Outside of .def this is the ELF form
+        if (p.def_label == UNIT_NONE && DIRECTIVES[idx].id == DIR_TYPE)
+        {
+            parse_symbol_type(p);
+            break;
+        }
+
+        if (p.def_label == UNIT_NONE)
+        {
+            skip_statement(p);
+            break;
+        }
+
+        if (!parse_const(p, value))
+        {
+            break;
+        }
+
+        if (DIRECTIVES[idx].id == DIR_TYPE)
+        {
+            unit.labels[p.def_label].type = value;
+        }
+        else if (value == IMAGE_SYM_CLASS_EXTERNAL)
+        {
+            unit.labels[p.def_label].flags |= LABEL_GLOBAL;
+        }
+        else if (value != IMAGE_SYM_CLASS_STATIC)
+        {
+            unit.labels[p.def_label].storage_class = value;
+        }
+        break;
+    case DIR_ENDEF:
+        p.def_label = UNIT_NONE;
+        break;
+    case DIR_SIZE:
+        parse_symbol_size(p);
+        break;
+    case DIR_MACRO:
+    case DIR_REPT:
+    case DIR_IRP:
+    case DIR_IRPC:
+        open_block(p, DIRECTIVES[idx].id);
+        break;
+    case DIR_ENDM:
+        error(p, ".endm without .macro");
+        break;
+    case DIR_ENDR:
+        error(p, ".endr without .rept or .irp");
+        break;
+    case DIR_EXITM:
+        exit_macro(p);
+        break;
+    case DIR_SEH_PROC:
+    case DIR_SEH_ENDPROC:
+    case DIR_SEH_ENDPROLOGUE:
+    case DIR_SEH_PUSHREG:
+    case DIR_SEH_SETFRAME:
+    case DIR_SEH_STACKALLOC:
+    case DIR_SEH_SAVEREG:
+    case DIR_SEH_SAVEXMM:
+    case DIR_SEH_PUSHFRAME:
+    case DIR_SEH_HANDLER:
+    case DIR_SEH_HANDLERDATA:
+        parse_seh(p, name, DIRECTIVES[idx].id);
+        break;
+    case DIR_CFI_SECTIONS:
+    case DIR_CFI_STARTPROC:
+    case DIR_CFI_ENDPROC:
+    case DIR_CFI_PERSONALITY:
+    case DIR_CFI_LSDA:
+    case DIR_CFI_SIGNAL_FRAME:
+    case DIR_CFI_DEF_CFA:
+    case DIR_CFI_DEF_CFA_REGISTER:
+    case DIR_CFI_DEF_CFA_OFFSET:
+    case DIR_CFI_ADJUST_CFA_OFFSET:
+    case DIR_CFI_OFFSET:
+    case DIR_CFI_REL_OFFSET:
+    case DIR_CFI_RESTORE:
+    case DIR_CFI_UNDEFINED:
+    case DIR_CFI_SAME_VALUE:
+    case DIR_CFI_REGISTER:
+    case DIR_CFI_REMEMBER_STATE:
+    case DIR_CFI_RESTORE_STATE:
+    case DIR_CFI_ESCAPE:
+        parse_cfi(p, name, DIRECTIVES[idx].id);
+        break;
+    }
+}
+
+// Runs a statement if the prescan cares about it: section changes, constants
+// and macro definitions, and the blocks and macro calls that hold them
+static void prescan_statement(Parser &p, Object &obj, Sect_Handle &section)
+{
+    if (p.block.kind)
+    {
+        if (read_block_statement(p))
+        {
+            end_block(p, &obj);
+        }
+
+        return;
+    }
+
+    while ((peek(p).kind == TOK_IDENT || peek(p).kind == TOK_NUMBER) && at_punct(p, ':', 1))
+    {
+        p.pos += 2;
+    }
+
+    const Token &tok = peek(p);
+    const Macro *macro = tok.kind == TOK_IDENT && !obj.macros.empty() ? find_macro(obj, tok.text) : nullptr;
+    uint32_t idx = tok.kind == TOK_IDENT ? find_directive(tok.text) : PERFECT_HASH_NOT_FOUND;
+    bool ok = p.ok;
+
+    p.pos++;
+
+    // Errors in calls and in the statements opening blocks are reported
+    // when the chunk is parsed
+    if (macro)
+    {
+        if (macro->body.prescan)
+        {
+            p.quiet = true;
+            call_macro(p, *macro);
+            p.ok = ok;
+        }
+
+        return;
+    }
+
+    if (idx == PERFECT_HASH_NOT_FOUND)
+    {
+        return;
+    }
+
+    std::string_view name;
+    int64_t value;
+
+    switch (DIRECTIVES[idx].id)
+    {
+    case DIR_TEXT:
+        section = obj.text;
+        break;
+    case DIR_DATA:
+        section = obj.data;
+        break;
+    case DIR_BSS:
+        section = obj.bss;
+        break;
+    case DIR_SECTION:
+        p.quiet = false;
+
+        if (parse_section_name(p, name))
+        {
+            section = create_section(p, obj, name);
+        }
+        break;
+    case DIR_SET:
+        p.quiet = true;
+
+        if (parse_name(p, name) && accept(p, ',') && parse_const(p, value))
+        {
+            Label &label = obj.labels[get_label(obj, name)];
+
+            label.flags |= LABEL_ABSOLUTE;
+            label.value = value;
+        }
+
+        p.ok = ok;
+        break;
+    case DIR_MACRO:
+        p.quiet = false;
+        open_block(p, DIR_MACRO);
+        break;
+    case DIR_REPT:
+    case DIR_IRP:
+    case DIR_IRPC:
+        p.quiet = true;
+        open_block(p, DIRECTIVES[idx].id);
+        p.ok = ok;
+        break;
+    case DIR_EXITM:
+        p.quiet = true;
+        exit_macro(p);
+        p.ok = ok;
+        break;
+    case DIR_SEH_PROC:
+        p.seh_proc = 0;
+        break;
+    case DIR_SEH_ENDPROC:
+        p.seh_proc = UNIT_NONE;
+        break;
+    case DIR_CFI_STARTPROC:
+        p.cfi_proc = 0;
+        break;
+    case DIR_CFI_ENDPROC:
+        p.cfi_proc = UNIT_NONE;
+        break;
+    case DIR_SEH_HANDLERDATA:
+        section = unwind_section(obj, ".xdata");
+        break;
+    }
+}
+
+// Runs the statements of a line through the prescan. Returns the section in
+// use after the line
+static Sect_Handle prescan_line(Parser &p, Object &obj, Sect_Handle section)
+{
+    while (p.lexer.next_statement(p.tokens))
+    {
+        p.pos = 0;
+        prescan_statement(p, obj, section);
+
+        // Blocks and calls the statement started run before the next one
+        while (!p.expansions.empty())
+        {
+            if (!next_expanded(p.expansions.back(), p.tokens, *p.names))
+            {
+                p.expansions.pop_back();
+                continue;
+            }
+
+            p.pos = 0;
+            prescan_statement(p, obj, section);
+        }
+
+        if (p.lexer.pos == p.lexer.end || p.lexer.pos[-1] == '\n')
+        {
+            break;
+        }
+    }
+
+    return section;
+}
+
+static bool is_ident_char(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '.' || c == '$';
+}
+
+// Skips blanks and a leading label, returning the first character of the statement
+static const char *statement_start(const char *pos, const char *end)
+{
+    while (pos < end && (*pos == ' ' || *pos == '\t'))
+    {
+        pos++;
+    }
+
+    const char *ident = pos;
+
+    while (ident < end && is_ident_char(*ident))
+    {
+        ident++;
+    }
+
+    if (ident > pos && ident < end && *ident == ':')
+    {
+        pos = ident + 1;
+
+        while (pos < end && (*pos == ' ' || *pos == '\t'))
+        {
+            pos++;
+        }
+    }
+
+    return pos;
+}
+
+static bool starts_with(const char *pos, const char *end, std::string_view word)
+{
+    return (std::size_t)(end - pos) > word.length() && std::string_view(pos, word.length()) == word && !is_ident_char(pos[word.length()]);
+}
+
+// Whether the statement at pos calls a macro
+static bool is_macro_call(const Object &obj, const char *pos, const char *end)
+{
+    const char *ident = pos;
+
+    while (ident < end && is_ident_char(*ident))
+    {
+        ident++;
+    }
+
+    return ident > pos && find_macro(obj, std::string_view(pos, ident - pos));
+}
+
+// Lines that open a function or section are where chunks may start
+static bool is_boundary(const char *pos, const char *end)
+{
+    return starts_with(pos, end, ".globl") || starts_with(pos, end, ".global") || starts_with(pos, end, ".def") ||
+           starts_with(pos, end, ".type") || starts_with(pos, end, ".text") || starts_with(pos, end, ".data") ||
+           starts_with(pos, end, ".bss") || starts_with(pos, end, ".section");
+}
+
+// Whether a chunk may end before the boundary at pos. Depending on the text
+// that follows rather than on the length so far keeps the chunks of unchanged
+// code the same when something before them grows, so cached chunks still match
+static bool is_anchor(const char *pos, const char *end)
+{
+    return (hash_name(std::string_view(pos, std::min<std::size_t>(end - pos, CHUNK_ANCHOR_BYTES))) & CHUNK_ANCHOR_MASK) == 0;
+}
+
+bool split_source(std::string_view source, std::string_view file, Object &obj, std::vector<Chunk> &chunks, std::size_t chunk_size)
+{
+    Parser p = {obj, file};
+    Name_Pool names;
+
+    p.names = &names;
+
+    const char *pos = source.data();
+    const char *end = source.data() + source.size();
+    const char *chunk_start = pos;
+    uint32_t line = 1;
+    uint32_t chunk_line = 1;
+    Sect_Handle section = obj.text;
+    Sect_Handle chunk_section = obj.text;
+
+    chunks.clear();
+
+    while (pos < end)
+    {
+        const char *stmt = statement_start(pos, end);
+        std::size_t length = pos - chunk_start;
+
+        // Chunks end at anchors, past twice the target size at any boundary and
+        // past four times the target size at any line, but never inside a
+        // block or a function described by unwind directives
+        if (!p.block.kind && p.seh_proc == UNIT_NONE && p.cfi_proc == UNIT_NONE && length >= chunk_size / 4 &&
+            (length >= chunk_size * 4 || (is_boundary(stmt, end) && (length >= chunk_size * 2 || is_anchor(stmt, end)))))
+        {
+            chunks.emplace_back(Chunk{std::string_view(chunk_start, pos - chunk_start), chunk_line, chunk_section});
+
+            chunk_start = pos;
+            chunk_line = line;
+            chunk_section = section;
+        }
+
+        if (p.block.kind || (stmt < end && *stmt == '.') || (!obj.macros.empty() && is_macro_call(obj, stmt, end)))
+        {
+            p.lexer.reset(std::string_view(pos, end - pos));
+            p.line = line;
+            section = prescan_line(p, obj, section);
+        }
+
+        const char *newline = (const char *)(memchr(pos, '\n', end - pos));
+
+        pos = newline ? newline + 1 : end;
+        line++;
+    }
+
+    if (pos > chunk_start || chunks.empty())
+    {
+        chunks.emplace_back(Chunk{std::string_view(chunk_start, pos - chunk_start), chunk_line, chunk_section});
+    }
+
+    if (!names.empty())
+    {
+        obj.names.emplace_back(std::move(names));
+    }
+
+    return p.ok;
+}
+
+void parse_chunk(const Chunk &chunk, std::string_view file, const Object &obj, Unit &unit)
+{
+    Parser p = {obj, file, &unit};
+
+    unit.section_map.assign(obj.sections.size(), UNIT_NONE);
+
+    p.lexer.reset(chunk.text);
+    p.first_line = chunk.first_line;
+    p.section = unit_section(unit, chunk.section);
+    p.names = &unit.names;
+
+    // Records are moved whole into the object, so they are sized for the
+    // chunk up front rather than copied as they grow
+    if (obj.verify)
+    {
+        unit.sections[p.section].instrs.reserve(chunk.text.size() / 16);
+        unit.sections[p.section].instr_vars.reserve(chunk.text.size() / 16);
+    }
+
+    // Chunks start on different lines, which keeps \@ unique in the file
+    p.counter_base = (uint64_t)(chunk.first_line - 1) << 32;
+
+    while (next_statement(p))
+    {
+        // Block bodies are read until the block closes, then expanded
+        if (p.block.kind)
+        {
+            if (read_block_statement(p))
+            {
+                end_block(p, nullptr);
+            }
+
+            unit.ok = unit.ok && p.ok;
+            p.ok = true;
+            continue;
+        }
+
+        // Labels
+        while ((peek(p).kind == TOK_IDENT || peek(p).kind == TOK_NUMBER) && at_punct(p, ':', 1))
+        {
+            if (peek(p).kind == TOK_IDENT)
+            {
+                define_unit_label(p, peek(p).text);
+            }
+            else
+            {
+                define_numeric_label(p, peek(p).text);
+            }
+
+            p.pos += 2;
+        }
+
+        if (at_end(p))
+        {
+            unit.ok = unit.ok && p.ok;
+            p.ok = true;
+            continue;
+        }
+
+        const Token &tok = peek(p);
+
+        if (tok.kind != TOK_IDENT)
+        {
+            error(p, "expected an instruction or directive", tok.text);
+            unit.ok = false;
+            continue;
+        }
+
+        p.pos++;
+
+        const Macro *macro = obj.macros.empty() ? nullptr : find_macro(obj, tok.text);
+
+        if (macro)
+        {
+            call_macro(p, *macro);
+        }
+        else if (tok.text[0] == '.')
+        {
+            parse_directive(p, tok.text);
+        }
+        else
+        {
+            parse_instruction(p, tok.text);
+        }
+
+        if (p.ok && !at_end(p))
+        {
+            error(p, "junk at end of statement", peek(p).text);
+        }
+
+        unit.ok = unit.ok && p.ok;
+        p.ok = true;
+    }
+
+    if (p.block.kind)
+    {
+        error(p, p.block.kind == DIR_MACRO ? "missing .endm" : "missing .endr");
+        unit.ok = false;
+    }
+
+    // Only the last chunk can end inside a function
+    if (p.seh_proc != UNIT_NONE)
+    {
+        error(p, "missing .seh_endproc");
+        unit.ok = false;
+    }
+
+    if (p.cfi_proc != UNIT_NONE)
+    {
+        error(p, "missing .cfi_endproc");
+        unit.ok = false;
+    }
+
+    // Differences patched in place need no more work
+    for (Unit_Section &us : unit.sections)
+    {
+        us.fixups.erase(std::remove_if(us.fixups.begin(), us.fixups.end(), [](const Unit_Fixup &fixup)
+                                       { return fixup.kind == UFIX_DONE; }),
+                        us.fixups.end());
+    }
+}
+
+// Merging
+
+struct Pending_Diff
+{
+    Sect_Handle section;
+    uint32_t offset;
+    uint8_t size;
+    uint16_t format; // DIFF_
+    uint32_t label;
+    uint32_t sub_label;
+    int64_t addend;
+    uint32_t line;
+};
+
+// A label .set to another, placed once the labels have their offsets
+struct Pending_Alias
+{
+    uint32_t label;
+    uint32_t line;
+};
+
+// The fixed bytes and variable sized items of one section in source order
+struct Stream
+{
+    std::vector<Relax_Var> vars;
+    std::vector<uint64_t> sizes; // Size of the items before each item once relaxed
+    uint64_t fixed = 0;
+};
+
+// Where a label was defined in the stream of its section
+struct Stream_Pos
+{
+    uint32_t section = UNIT_NONE;
+    uint64_t fixed;
+    uint32_t var;
+};
+
+// Definitions of one number in the units merged so far
+struct Numeric_State
+{
+    std::string_view number;
+    uint32_t last = UNIT_NONE;          // Object label of the last N:
+    uint32_t count = 0;                 // Definitions so far
+    std::vector<Unit_Label *> pending; // Nf past the end of their chunk, waiting for the next N:
+};
+
+struct Numeric_Merge
+{
+    std::vector<Numeric_State> states;
+    Name_Index index = {};
+    Name_Pool names = {}; // Names given to the definitions
+};
+
+static Numeric_State &numeric_state(Numeric_Merge &numeric, std::string_view number)
+{
+    uint32_t idx = numeric.index.insert(number, numeric.states.size(), [&numeric](uint32_t i)
+                                        { return numeric.states[i].number; });
+
+    if (idx == numeric.states.size())
+    {
+        numeric.states.emplace_back();
+        numeric.states.back().number = number;
+    }
+
+    return numeric.states[idx];
+}
+
+static void merge_error(std::string_view file, uint32_t line, std::string_view msg, std::string_view detail)
+{
+    diag() << file << ":" << line << ": error: " << msg << " '" << detail << "'" << std::endl;
+}
+
+// Adds the labels of the unit to the object and its items to the streams
+static bool map_unit(Unit &unit, std::string_view file, Object &obj, std::vector<Stream> &streams, std::vector<Stream_Pos> &positions, Numeric_Merge &numeric,
+                     std::vector<Pending_Alias> &aliases)
+{
+    bool ok = true;
+
+    for (Unit_Section &us : unit.sections)
+    {
+        Stream &stream = streams[us.section.idx];
+
+        us.fixed_base = stream.fixed;
+        us.var_base = stream.vars.size();
+
+        for (const Unit_Var &var : us.vars)
+        {
+            Relax_Var rv = {};
+
+            rv.fixed = us.fixed_base + var.offset;
+            rv.kind = var.kind;
+            rv.alignment = var.alignment;
+            rv.max = var.max;
+            rv.guard = var.guard;
+            rv.guard_next = var.flags & UVAR_GUARD_NEXT;
+            rv.short_size = 2;
+            rv.long_size = var.opcode == 0xeb ? 5 : 6;
+            rv.target_var = RELAX_NONE;
+            rv.addend = var.addend;
+            rv.size = var.size;
+
+            stream.vars.emplace_back(rv);
+        }
+
+        stream.fixed += us.size;
+    }
+
+    for (std::string_view name : unit.files)
+    {
+        add_symbol(".file", obj.sym_tab, obj.sections, obj.str_tab, IMAGE_SYM_CLASS_FILE, name);
+    }
+
+    // Nb before any N: in the chunk is the last N: of the chunks before
+    for (Unit_Label &ul : unit.labels)
+    {
+        if (!(ul.flags & ULABEL_BACKWARD))
+        {
+            continue;
+        }
+
+        ul.global = numeric_state(numeric, ul.name).last;
+
+        if (ul.global == UNIT_NONE)
+        {
+            merge_error(file, ul.line, "undefined local label", std::string(ul.name) + "b");
+            ul.global = get_label(obj, ul.name);
+            ok = false;
+        }
+    }
+
+    for (Unit_Label &ul : unit.labels)
+    {
+        if (!(ul.flags & ULABEL_NUMERIC))
+        {
+            ul.global = get_label(obj, ul.name);
+        }
+        else if (ul.flags & LABEL_DEFINED)
+        {
+            Numeric_State &state = numeric_state(numeric, ul.name);
+
+            // Each definition has a name of its own, dropped from ELF objects like other .L labels
+            ul.global = get_label(obj, numeric.names.add(".L" + std::string(ul.name) + "^B" + std::to_string(++state.count)));
+
+            for (Unit_Label *ref : state.pending)
+            {
+                ref->global = ul.global;
+            }
+
+            state.pending.clear();
+            state.last = ul.global;
+        }
+        else
+        {
+            if (!(ul.flags & ULABEL_BACKWARD))
+            {
+                numeric_state(numeric, ul.name).pending.emplace_back(&ul);
+            }
+
+            continue;
+        }
+
+        if (positions.size() < obj.labels.size())
+        {
+            positions.resize(obj.labels.size());
+        }
+
+        Label &label = obj.labels[ul.global];
+
+        label.flags |= ul.flags & LABEL_GLOBAL;
+
+        if (ul.flags & LABEL_DEFINED)
+        {
+            const Unit_Section &us = unit.sections[ul.section];
+
+            // The offset is filled in once the sections are relaxed
+            if (define_label(obj, ul.global, us.section, 0))
+            {
+                positions[ul.global] = Stream_Pos{us.section.idx, us.fixed_base + ul.pos.offset, us.var_base + ul.pos.vars};
+            }
+            else
+            {
+                merge_error(file, ul.line, "symbol already defined", ul.name);
+                ok = false;
+            }
+        }
+
+        if (ul.flags & LABEL_COMMON)
+        {
+            label.flags |= LABEL_COMMON;
+            label.loc = ul.value;
+        }
+
+        if (ul.flags & LABEL_ABSOLUTE)
+        {
+            label.flags |= LABEL_ABSOLUTE;
+            label.value = ul.value;
+        }
+
+        if (ul.storage_class)
+        {
+            label.storage_class = ul.storage_class;
+        }
+
+        if (ul.type)
+        {
+            label.type = ul.type;
+        }
+
+        if (ul.visibility)
+        {
+            label.visibility = ul.visibility;
+        }
+
+        if (ul.elf_info)
+        {
+            label.elf_info = ul.elf_info;
+        }
+    }
+
+    // The target of an alias may come after it in the unit
+    for (const Unit_Label &ul : unit.labels)
+    {
+        if (!(ul.flags & LABEL_ALIAS))
+        {
+            continue;
+        }
+
+        Label &label = obj.labels[ul.global];
+
+        if (label.flags & (LABEL_DEFINED | LABEL_ABSOLUTE | LABEL_COMMON | LABEL_ALIAS))
+        {
+            merge_error(file, ul.line, "symbol already defined", ul.name);
+            ok = false;
+            continue;
+        }
+
+        label.flags |= LABEL_ALIAS;
+        label.alias = unit.labels[ul.alias].global;
+        label.value = ul.value;
+        aliases.emplace_back(Pending_Alias{ul.global, ul.line});
+    }
+
+    return ok;
+}
+
+// Places each alias where its target is, following aliases of aliases
+static bool place_aliases(const std::vector<Pending_Alias> &aliases, std::string_view file, Object &obj)
+{
+    bool ok = true;
+
+    for (const Pending_Alias &alias : aliases)
+    {
+        Label &label = obj.labels[alias.label];
+        uint32_t target = label.alias;
+        int64_t value = label.value;
+
+        // A chain longer than the aliases is a cycle
+        for (std::size_t steps = 0; steps <= aliases.size() && (obj.labels[target].flags & LABEL_ALIAS) &&
+                                    !(obj.labels[target].flags & (LABEL_DEFINED | LABEL_ABSOLUTE));
+             steps++)
+        {
+            value += obj.labels[target].value;
+            target = obj.labels[target].alias;
+        }
+
+        const Label &place = obj.labels[target];
+
+        if (place.flags & LABEL_DEFINED)
+        {
+            label.flags |= LABEL_DEFINED;
+            label.section = place.section;
+            label.loc = place.loc + value;
+        }
+        else if (place.flags & LABEL_ABSOLUTE)
+        {
+            label.flags |= LABEL_ABSOLUTE;
+            label.value = place.value + value;
+        }
+        else
+        {
+            merge_error(file, alias.line, "alias of an undefined symbol", label.name);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+// Gives the symbols named by .size their sizes, now that the labels are placed
+static bool size_labels(const Unit &unit, std::string_view file, Object &obj)
+{
+    bool ok = true;
+
+    for (const Unit_Size &us : unit.sizes)
+    {
+        Label &label = obj.labels[unit.labels[us.label].global];
+        int64_t size = us.value;
+
+        if (us.end != UNIT_NONE)
+        {
+            const Label &end = obj.labels[unit.labels[us.end].global];
+            const Label &start = obj.labels[unit.labels[us.start].global];
+
+            if (!(end.flags & LABEL_DEFINED) || !(start.flags & LABEL_DEFINED) || end.section.idx != start.section.idx)
+            {
+                merge_error(file, us.line, "symbol difference must be between labels in one section", end.name);
+                ok = false;
+                continue;
+            }
+
+            size += (int64_t)(end.loc) - (int64_t)(start.loc);
+        }
+
+        if (size < 0)
+        {
+            merge_error(file, us.line, "negative symbol size", label.name);
+            ok = false;
+            continue;
+        }
+
+        label.size = size;
+    }
+
+    return ok;
+}
+
+// Points the branches of the unit at their targets. Only a target in the
+// same section can be reached with a short branch, any other keeps the long
+// form and a relocation
+static void target_branches(const Unit &unit, std::vector<Stream> &streams, const std::vector<Stream_Pos> &positions)
+{
+    for (const Unit_Section &us : unit.sections)
+    {
+        for (std::size_t i = 0; i < us.vars.size(); i++)
+        {
+            if (us.vars[i].kind != RVAR_BRANCH)
+            {
+                continue;
+            }
+
+            Relax_Var &rv = streams[us.section.idx].vars[us.var_base + i];
+            const Stream_Pos &target = positions[unit.labels[us.vars[i].label].global];
+
+            if (target.section == us.section.idx)
+            {
+                rv.target_fixed = target.fixed;
+                rv.target_var = target.var;
+            }
+            else
+            {
+                rv.short_size = rv.long_size;
+            }
+        }
+    }
+}
+
+// Appends the unit to the object now that every item has its size
+static void emit_unit(Unit &unit, Object &obj, const std::vector<Stream> &streams, std::vector<Pending_Diff> &diffs)
+{
+    for (const Unit_Frame &uf : unit.frames)
+    {
+        const Unit_Section &us = unit.sections[uf.section];
+        uint32_t offset = us.fixed_base + uf.pos.offset + streams[us.section.idx].sizes[us.var_base + uf.pos.vars];
+        uint32_t label = uf.label == UNIT_NONE ? FRAME_NONE : unit.labels[uf.label].global;
+
+        obj.frames.emplace_back(Frame_Op{us.section, offset, uf.line, uf.op, uf.reg, label, uf.value});
+    }
+
+    for (Unit_Section &us : unit.sections)
+    {
+        const Stream &stream = streams[us.section.idx];
+        Section &section = obj.sections[us.section];
+        uint32_t prev = 0;
+        std::size_t next_fixup = 0;
+
+        // Fixups before item k, so relocations come out in offset order
+        auto add_fixups = [&](std::size_t k)
+        {
+            for (; next_fixup < us.fixups.size() && us.fixups[next_fixup].pos.vars <= k; next_fixup++)
+            {
+                const Unit_Fixup &fixup = us.fixups[next_fixup];
+                uint32_t offset = us.fixed_base + fixup.pos.offset + stream.sizes[us.var_base + fixup.pos.vars];
+
+                if (fixup.kind == UFIX_RELOC)
+                {
+                    const Label &target = obj.labels[unit.labels[fixup.label].global];
+
+                    // A PC-relative reference to a local label of the same section is
+                    // a known distance. Global symbols keep the relocation, as they
+                    // may be preempted when linking
+                    if (fixup.type >= IMAGE_REL_AMD64_REL32 && fixup.type <= IMAGE_REL_AMD64_REL32_5 && (target.flags & LABEL_DEFINED) &&
+                        !(target.flags & LABEL_GLOBAL) && target.section.idx == us.section.idx)
+                    {
+                        int64_t end = (int64_t)(offset) + 4 + (fixup.type - IMAGE_REL_AMD64_REL32);
+
+                        write_value(section, offset, (int64_t)(target.loc) + fixup.addend - end, 4);
+                        STAT_INC(obj.stats.resolved_relocations);
+                        continue;
+                    }
+
+                    relocate_symbol(target.sym, us.section, obj.sections, offset, fixup.type);
+                }
+                else
+                {
+                    diffs.emplace_back(Pending_Diff{us.section, offset, fixup.size, fixup.type, unit.labels[fixup.label].global, unit.labels[fixup.sub_label].global, fixup.addend, fixup.line});
+                }
+            }
+        };
+
+        // The records are made final in place and moved, not copied
+        if (!us.instrs.empty())
+        {
+            for (std::size_t i = 0; i < us.instrs.size(); i++)
+            {
+                us.instrs[i].offset += us.fixed_base + stream.sizes[us.var_base + us.instr_vars[i]];
+            }
+
+            for (Instr_Target &target : us.targets)
+            {
+                target.label = unit.labels[target.label].global;
+            }
+
+            obj.instrs.emplace_back(Instr_Run{us.section.idx, std::move(us.instrs), std::move(us.targets)});
+        }
+
+        for (std::size_t k = 0; k <= us.vars.size(); k++)
+        {
+            uint32_t offset = k < us.vars.size() ? us.vars[k].offset : us.size;
+
+            if (section.is_bss())
+            {
+                section.reserve(offset - prev);
+            }
+            else
+            {
+                section.append(us.data.data() + prev, offset - prev);
+            }
+
+            prev = offset;
+            add_fixups(k);
+
+            if (k == us.vars.size())
+            {
+                break;
+            }
+
+            const Unit_Var &var = us.vars[k];
+            const Relax_Var &rv = stream.vars[us.var_base + k];
+
+            if (var.kind == RVAR_ALIGN)
+            {
+                // Padding skipped for exceeding the limit still raises the section
+                // alignment, as GNU as does
+                if (align_padding(section.loc(), var.alignment, 0) == rv.size)
+                {
+                    section.align(var.alignment, var.fill);
+                }
+                else
+                {
+                    section.raise_alignment(var.alignment);
+                }
+
+                continue;
+            }
+
+            if (var.kind == RVAR_BOUNDARY)
+            {
+                section.append_nops(rv.size);
+                continue;
+            }
+
+            if (var.kind == RVAR_FILL)
+            {
+                if (var.flags & UVAR_BINARY)
+                {
+                    const Source_File &file = *unit.binaries[var.label];
+
+                    section.append_mapped((const uint8_t *)(file.data) + var.addend, var.size, file.fd, var.addend);
+                }
+                else
+                {
+                    section.append_run(var.size, var.addend, var.width);
+                }
+
+                continue;
+            }
+
+            uint8_t bytes[6];
+            uint8_t len = 0;
+            uint32_t address = section.loc();
+            const Label &target = obj.labels[unit.labels[var.label].global];
+            int64_t disp = (int64_t)(target.loc) + var.addend - (address + rv.size);
+
+            if (rv.size == rv.short_size && rv.target_var != RELAX_NONE)
+            {
+                bytes[len++] = var.opcode;
+                bytes[len++] = disp;
+            }
+            else
+            {
+                if (var.opcode == 0xeb)
+                {
+                    bytes[len++] = 0xe9;
+                }
+                else
+                {
+                    bytes[len++] = 0x0f;
+                    bytes[len++] = var.opcode + 0x10;
+                }
+
+                if (rv.target_var != RELAX_NONE)
+                {
+                    put_value(bytes + len, disp, 4);
+                }
+                else
+                {
+                    // COFF addends live in the relocated field
+                    put_value(bytes + len, var.addend, 4);
+                    relocate_symbol(target.sym, us.section, obj.sections, address + len, IMAGE_REL_AMD64_REL32);
+                }
+
+                len += 4;
+            }
+
+            section.append(bytes, len);
+        }
+    }
+}
+
+bool merge_units(std::vector<Unit> &units, std::string_view file, Object &obj)
+{
+    bool ok = true;
+
+    // Merging in source order keeps symbols, sections and relocations in the same order for any thread count
+    std::vector<Stream> streams(obj.sections.size());
+    std::vector<Stream_Pos> positions(obj.labels.size());
+    std::vector<Pending_Alias> aliases;
+    Numeric_Merge numeric;
+
+    {
+        PHASE(obj.stats, "labels");
+
+        for (Unit &unit : units)
+        {
+            if (!unit.messages.empty())
+            {
+                diag() << unit.messages << std::flush;
+            }
+
+            ok = unit.ok && ok;
+            ok = map_unit(unit, file, obj, streams, positions, numeric, aliases) && ok;
+            obj.stats.instructions += unit.num_instrs;
+            add_size_stats(obj.stats.sizes, unit.size_stats);
+        }
+
+        // Nf after the last N: of the file
+        for (Numeric_State &state : numeric.states)
+        {
+            for (Unit_Label *ref : state.pending)
+            {
+                merge_error(file, ref->line, "undefined local label", std::string(ref->name) + "f");
+                ref->global = get_label(obj, ref->name);
+                ok = false;
+            }
+        }
+
+        if (!numeric.names.empty())
+        {
+            obj.names.emplace_back(std::move(numeric.names));
+        }
+    }
+
+    positions.resize(obj.labels.size());
+
+    {
+        PHASE(obj.stats, "relax");
+
+        for (const Unit &unit : units)
+        {
+            target_branches(unit, streams, positions);
+        }
+
+        for (Stream &stream : streams)
+        {
+            relax(stream.vars, obj.relax_stats);
+
+            stream.sizes.resize(stream.vars.size() + 1);
+            stream.sizes[0] = 0;
+
+            for (std::size_t i = 0; i < stream.vars.size(); i++)
+            {
+                stream.sizes[i + 1] = stream.sizes[i] + stream.vars[i].size;
+            }
+        }
+
+        for (std::size_t i = 0; i < positions.size(); i++)
+        {
+            const Stream_Pos &pos = positions[i];
+
+            if (pos.section != UNIT_NONE)
+            {
+                obj.labels[i].loc = pos.fixed + streams[pos.section].sizes[pos.var];
+            }
+        }
+
+        ok = place_aliases(aliases, file, obj) && ok;
+
+        for (const Unit &unit : units)
+        {
+            ok = size_labels(unit, file, obj) && ok;
+        }
+    }
+
+    std::vector<Pending_Diff> diffs;
+
+    {
+        PHASE(obj.stats, "emit");
+
+        // Each unit is released once it is in the sections, so its bytes are
+        // not held twice
+        for (Unit &unit : units)
+        {
+            emit_unit(unit, obj, streams, diffs);
+
+            // Labels may be named by text the unit's macros joined
+            if (!unit.names.empty())
+            {
+                obj.names.emplace_back(std::move(unit.names));
+            }
+
+            // The sections point into the files .incbin mapped
+            for (std::unique_ptr<Source_File> &binary : unit.binaries)
+            {
+                obj.binaries.emplace_back(std::move(binary));
+            }
+
+            unit = {};
+        }
+    }
+
+    PHASE(obj.stats, "differences");
+
+    for (const Pending_Diff &diff : diffs)
+    {
+        const Label &a = obj.labels[diff.label];
+        const Label &b = obj.labels[diff.sub_label];
+
+        // a - b with b in the section of the field is a - . plus a constant,
+        // which a PC-relative relocation covers (jump tables in .rodata)
+        if ((b.flags & LABEL_DEFINED) && b.section.idx == diff.section.idx && diff.size == 4 && diff.format == DIFF_FIXED &&
+            !((a.flags & LABEL_DEFINED) && a.section.idx == b.section.idx))
+        {
+            int64_t value = (int64_t)(diff.offset) - (int64_t)(b.loc) + diff.addend + 4;
+
+            write_value(obj.sections[diff.section], diff.offset, value, 4);
+            relocate_symbol(a.sym, diff.section, obj.sections, diff.offset, IMAGE_REL_AMD64_REL32);
+            continue;
+        }
+
+        if (!(a.flags & LABEL_DEFINED) || !(b.flags & LABEL_DEFINED) || a.section.idx != b.section.idx)
+        {
+            merge_error(file, diff.line, "symbol difference must be between labels in one section", a.name);
+            ok = false;
+            continue;
+        }
+
+        int64_t value = (int64_t)(a.loc) - (int64_t)(b.loc) + diff.addend;
+        uint8_t bytes[8];
+
+        if (!put_diff(bytes, value, diff.size, diff.format))
+        {
+            merge_error(file, diff.line, "symbol difference does not fit its LEB128 field", a.name);
+            ok = false;
+            continue;
+        }
+
+        obj.sections[diff.section].write(diff.offset, bytes, diff.size);
+    }
+
+    return ok;
+}
+
+bool assemble_source(std::string_view source, std::string_view file, Object &obj, Thread_Pool &pool, Asm_Cache *cache)
+{
+    std::vector<Chunk> chunks;
+    bool ok;
+
+    {
+        PHASE(obj.stats, "split");
+        ok = split_source(source, file, obj, chunks);
+    }
+
+    if (cache)
+    {
+        cache_context(*cache, obj);
+    }
+
+    std::vector<Unit> units(chunks.size());
+
+    {
+        PHASE(obj.stats, "parse");
+
+        // Chunks are timed one by one so the trace shows each thread's work
+        pool.run(chunks.size(), [&](std::size_t i)
+                 {
+                     PHASE(obj.stats, "parse chunk");
+
+                     if (!cache)
+                     {
+                         parse_chunk(chunks[i], file, obj, units[i]);
+                         return;
+                     }
+
+                     Cache_Key key = chunk_key(*cache, chunks[i]);
+
+                     if (!load_unit(*cache, key, chunks[i], obj, units[i]))
+                     {
+                         parse_chunk(chunks[i], file, obj, units[i]);
+                         store_unit(*cache, key, chunks[i], units[i]);
+                     }
+                 });
+    }
+
+    obj.stats.chunks = chunks.size();
+
+    return merge_units(units, file, obj) && ok;
+}
@@ -0,0 +1,312 @@
+#include <algorithm>
+
+#include <relax.h>
+
+// Branches that can reach across a change. A short branch spans at most 130
+// bytes including itself, and every branch in between takes at least 2 bytes
+#define RELAX_WINDOW_BYTES 132
+#define RELAX_WINDOW_BRANCHES 66
+
+// Full passes continue while at least one branch in this many grows
+#define RELAX_FULL_PASS_RATIO 64
+
+// Fenwick tree of item sizes, prefix(i) is the size of the items before i
+struct Size_Tree
+{
+    std::vector<int64_t> tree;
+
+    void build(const std::vector<Relax_Var> &vars)
+    {
+        tree.assign(vars.size() + 1, 0);
+
+        for (std::size_t i = 0; i < vars.size(); i++)
+        {
+            tree[i + 1] += vars[i].size;
+
+            std::size_t parent = (i + 1) + ((i + 1) & -(i + 1));
+
+            if (parent < tree.size())
+            {
+                tree[parent] += tree[i + 1];
+            }
+        }
+    }
+
+    void add(std::size_t idx, int64_t delta)
+    {
+        for (std::size_t i = idx + 1; i < tree.size(); i += i & -i)
+        {
+            tree[i] += delta;
+        }
+    }
+
+    int64_t prefix(std::size_t idx) const
+    {
+        int64_t sum = 0;
+
+        for (std::size_t i = idx; i > 0; i -= i & -i)
+        {
+            sum += tree[i];
+        }
+
+        return sum;
+    }
+};
+
+uint32_t align_padding(uint64_t address, uint32_t alignment, uint32_t max)
+{
+    uint32_t padding = (alignment - address % alignment) % alignment;
+
+    return max != 0 && padding > max ? 0 : padding;
+}
+
+uint32_t boundary_padding(uint64_t address, uint32_t boundary, uint32_t length)
+{
+    uint32_t offset = address % boundary;
+
+    return length > 0 && length <= boundary && offset + length >= boundary ? boundary - offset : 0;
+}
+
+static bool is_padding(uint8_t kind)
+{
+    return kind == RVAR_ALIGN || kind == RVAR_BOUNDARY;
+}
+
+// Size of padding item i at address with the sizes of the items after it as they are now
+static uint32_t padding_size(const std::vector<Relax_Var> &vars, std::size_t i, uint64_t address)
+{
+    const Relax_Var &var = vars[i];
+
+    if (var.kind == RVAR_ALIGN)
+    {
+        return align_padding(address, var.alignment, var.max);
+    }
+
+    return boundary_padding(address, var.alignment, var.guard + (var.guard_next ? vars[i + 1].size : 0));
+}
+
+void relax(std::vector<Relax_Var> &vars, Relax_Stats &stats)
+{
+    std::vector<uint32_t> branches;
+    std::vector<uint32_t> next_align(vars.size(), RELAX_NONE);
+    std::vector<uint32_t> tail_align(vars.size(), 1); // Largest alignment from each item on
+
+    for (std::size_t i = 0; i < vars.size(); i++)
+    {
+        Relax_Var &var = vars[i];
+
+        var.size = var.kind == RVAR_BRANCH ? var.short_size : var.kind == RVAR_FILL ? var.size : 0;
+
+        if (var.kind == RVAR_BRANCH && var.short_size != var.long_size)
+        {
+            branches.emplace_back(i);
+        }
+    }
+
+    for (std::size_t i = vars.size(), next = RELAX_NONE; i-- > 0;)
+    {
+        next_align[i] = next;
+        tail_align[i] = i + 1 < vars.size() ? tail_align[i + 1] : 1;
+
+        if (is_padding(vars[i].kind))
+        {
+            next = i;
+            tail_align[i] = std::max(tail_align[i], vars[i].alignment);
+        }
+    }
+
+    stats.branches += branches.size();
+
+    // Items whose size changed since every short branch was last checked
+    std::vector<uint32_t> changed;
+    std::vector<uint64_t> sizes(vars.size() + 1, 0);
+
+    auto layout = [&]()
+    {
+        for (std::size_t i = 0; i < vars.size(); i++)
+        {
+            Relax_Var &var = vars[i];
+
+            if (is_padding(var.kind))
+            {
+                uint32_t padding = padding_size(vars, i, var.fixed + sizes[i]);
+
+                if (padding != var.size)
+                {
+                    var.size = padding;
+                    changed.emplace_back(i);
+                }
+            }
+
+            sizes[i + 1] = sizes[i] + var.size;
+        }
+    };
+
+    auto fits = [&](const Relax_Var &var, int64_t address, int64_t target)
+    {
+        int64_t disp = target + var.addend - (address + var.size);
+
+        return disp >= -0x80 && disp <= 0x7f;
+    };
+
+    // While many branches grow at once a plain pass over the section is the
+    // cheapest way to find the rest
+    layout();
+
+    for (;;)
+    {
+        std::size_t grown = 0;
+
+        changed.clear();
+
+        for (uint32_t i : branches)
+        {
+            Relax_Var &var = vars[i];
+
+            if (var.size == var.long_size)
+            {
+                continue;
+            }
+
+            stats.checks++;
+
+            if (!fits(var, var.fixed + sizes[i], var.target_fixed + sizes[var.target_var]))
+            {
+                var.size = var.long_size;
+                changed.emplace_back(i);
+                grown++;
+            }
+        }
+
+        if (grown == 0)
+        {
+            break;
+        }
+
+        layout();
+
+        if (grown * RELAX_FULL_PASS_RATIO < branches.size())
+        {
+            break;
+        }
+    }
+
+    // Then only the branches around each change are checked again, with the
+    // addresses kept in a tree as the sizes keep changing
+    Size_Tree tree;
+    tree.build(vars);
+
+    std::vector<uint32_t> work;
+    std::vector<bool> queued(vars.size(), false);
+
+    // Queues the short branches that may span item idx
+    auto recheck = [&](std::size_t idx)
+    {
+        std::size_t mid = std::lower_bound(branches.begin(), branches.end(), idx) - branches.begin();
+        uint64_t fixed = vars[idx].fixed;
+
+        for (std::size_t b = mid, n = 0; b < branches.size() && n <= RELAX_WINDOW_BRANCHES; b++, n++)
+        {
+            uint32_t i = branches[b];
+
+            if (vars[i].fixed - fixed > RELAX_WINDOW_BYTES)
+            {
+                break;
+            }
+
+            if (!queued[i] && vars[i].size != vars[i].long_size)
+            {
+                queued[i] = true;
+                work.emplace_back(i);
+            }
+        }
+
+        for (std::size_t b = mid, n = 0; b-- > 0 && n <= RELAX_WINDOW_BRANCHES; n++)
+        {
+            uint32_t i = branches[b];
+
+            if (fixed - vars[i].fixed > RELAX_WINDOW_BYTES)
+            {
+                break;
+            }
+
+            if (!queued[i] && vars[i].size != vars[i].long_size)
+            {
+                queued[i] = true;
+                work.emplace_back(i);
+            }
+        }
+    };
+
+    for (uint32_t i : changed)
+    {
+        recheck(i);
+    }
+
+    while (!work.empty())
+    {
+        uint32_t idx = work.back();
+        work.pop_back();
+        queued[idx] = false;
+
+        Relax_Var &var = vars[idx];
+
+        if (var.size == var.long_size)
+        {
+            continue;
+        }
+
+        stats.checks++;
+
+        if (fits(var, var.fixed + tree.prefix(idx), var.target_fixed + tree.prefix(var.target_var)))
+        {
+            continue;
+        }
+
+        // Grow the branch, then follow the shift through the padding after it
+        // until it is a multiple of every alignment left
+        int64_t shift = var.long_size - var.size;
+
+        tree.add(idx, shift);
+        var.size = var.long_size;
+        recheck(idx);
+
+        // Padding that guards the branch depends on its size as well
+        if (idx > 0 && vars[idx - 1].kind == RVAR_BOUNDARY && vars[idx - 1].guard_next)
+        {
+            Relax_Var &guard = vars[idx - 1];
+            uint32_t padding = padding_size(vars, idx - 1, guard.fixed + tree.prefix(idx - 1));
+
+            if (padding != guard.size)
+            {
+                int64_t delta = (int64_t)(padding) - guard.size;
+
+                tree.add(idx - 1, delta);
+                guard.size = padding;
+                shift += delta;
+                recheck(idx - 1);
+            }
+        }
+
+        for (uint32_t a = next_align[idx]; a != RELAX_NONE && shift % tail_align[a] != 0; a = next_align[a])
+        {
+            Relax_Var &align = vars[a];
+            uint32_t padding = padding_size(vars, a, align.fixed + tree.prefix(a));
+
+            if (padding != align.size)
+            {
+                int64_t delta = (int64_t)(padding) - align.size;
+
+                tree.add(a, delta);
+                align.size = padding;
+                shift += delta;
+                recheck(a);
+            }
+        }
+    }
+
+    for (uint32_t i : branches)
+    {
+        stats.short_branches += vars[i].size == vars[i].short_size;
+    }
+}
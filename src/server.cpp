@@ -0,0 +1,276 @@
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#include <server.h>
+#include <batch.h>
+#include <lexer.h>
+#include <diag.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+struct Server
+{
+    int listen_fd = -1;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<int> waiting; // Accepted connections no thread has taken yet
+    std::vector<int> active; // Connections being served
+    bool stopping = false;
+};
+
+static void stop_server(Server &server)
+{
+    std::lock_guard<std::mutex> lock(server.mutex);
+
+    server.stopping = true;
+
+    // Wakes the accept and any thread waiting on an idle connection
+    shutdown(server.listen_fd, SHUT_RDWR);
+
+    for (int fd : server.active)
+    {
+        shutdown(fd, SHUT_RD);
+    }
+
+    server.wake.notify_all();
+}
+
+// Assembles one request into reply, which holds the reply header, the
+// messages and the object once done
+static void assemble_request(const Server_Request &request, const std::string &input, const std::string &output, std::string_view source,
+                             Thread_Pool &pool, std::vector<uint8_t> &reply)
+{
+    std::ostringstream messages;
+    Asm_Options options;
+    Object obj;
+    Source_File file;
+    ELF_File elf_file;
+    Out_File out = {};
+    bool ok = true;
+
+    options.elf = request.flags & SERVE_ELF;
+    obj.sections.arena_pool = &thread_arena_pool();
+    set_diag(&messages);
+
+    if (!(request.flags & SERVE_INLINE))
+    {
+        ok = file.open(input);
+        source = std::string_view(file.data, file.size);
+
+        if (!ok)
+        {
+            diag() << "error: cannot open " << input << std::endl;
+        }
+    }
+
+    ok = ok && assemble_text(source, input, options, obj, pool, nullptr, elf_file, out);
+
+    if (ok && !(request.flags & SERVE_REPLY))
+    {
+        ok = write_out_file(output.empty() ? default_output(input, options.elf) : output, out, options.write_mode);
+    }
+
+    set_diag(nullptr);
+
+    Server_Reply header = {};
+    std::string text = messages.str();
+
+    memcpy(header.magic, SERVER_REPLY_MAGIC, 4);
+    header.ok = ok;
+    header.message_length = text.length();
+    header.object_length = ok && (request.flags & SERVE_REPLY) ? out.size : 0;
+
+    reply.assign((const uint8_t *)(&header), (const uint8_t *)(&header) + sizeof(header));
+    reply.insert(reply.end(), text.begin(), text.end());
+
+    if (header.object_length > 0)
+    {
+        gather_out_file(out, reply);
+    }
+}
+
+// Answers the requests of one connection until the client closes it
+static void serve_connection(Server &server, int fd, Thread_Pool &pool, std::string &source, std::vector<uint8_t> &reply)
+{
+    Server_Request request;
+    std::string input;
+    std::string output;
+
+    while (recv_all(fd, &request, sizeof(request)))
+    {
+        if (memcmp(request.magic, SERVER_REQUEST_MAGIC, 4) != 0 || request.input_length > SERVER_MAX_PATH || request.output_length > SERVER_MAX_PATH ||
+            request.source_length > SERVER_MAX_SOURCE)
+        {
+            return;
+        }
+
+        input.resize(request.input_length);
+        output.resize(request.output_length);
+        source.resize(request.flags & SERVE_INLINE ? request.source_length : 0);
+
+        if (!recv_all(fd, input.data(), input.length()) || !recv_all(fd, output.data(), output.length()) || !recv_all(fd, source.data(), source.length()))
+        {
+            return;
+        }
+
+        if (request.flags & SERVE_STOP)
+        {
+            Server_Reply header = {};
+
+            memcpy(header.magic, SERVER_REPLY_MAGIC, 4);
+            header.ok = 1;
+            send_all(fd, &header, sizeof(header));
+            stop_server(server);
+            return;
+        }
+
+        assemble_request(request, input, output, source, pool, reply);
+
+        if (!send_all(fd, reply.data(), reply.size()))
+        {
+            return;
+        }
+    }
+}
+
+static void serve(Server &server)
+{
+    // Requests are assembled on this thread alone, the other threads serve other clients
+    Thread_Pool pool(1);
+    std::string source;
+    std::vector<uint8_t> reply;
+
+    while (true)
+    {
+        int fd;
+
+        {
+            std::unique_lock<std::mutex> lock(server.mutex);
+            server.wake.wait(lock, [&server]
+                             { return server.stopping || !server.waiting.empty(); });
+
+            if (server.waiting.empty())
+            {
+                return;
+            }
+
+            fd = server.waiting.front();
+            server.waiting.pop_front();
+            server.active.emplace_back(fd);
+
+            if (server.stopping)
+            {
+                shutdown(fd, SHUT_RD);
+            }
+        }
+
+        serve_connection(server, fd, pool, source, reply);
+
+        {
+            std::lock_guard<std::mutex> lock(server.mutex);
+            server.active.erase(std::find(server.active.begin(), server.active.end(), fd));
+        }
+
+        close(fd);
+    }
+}
+
+bool run_server(const std::string &path, std::size_t num_threads)
+{
+    Server server;
+    sockaddr_un addr = {};
+
+    addr.sun_family = AF_UNIX;
+
+    if (path.length() >= sizeof(addr.sun_path))
+    {
+        std::cerr << "error: socket path is too long " << path << std::endl;
+        return false;
+    }
+
+    memcpy(addr.sun_path, path.c_str(), path.length() + 1);
+
+    // A socket left by a server that died is replaced
+    unlink(path.c_str());
+
+    server.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (server.listen_fd < 0 || bind(server.listen_fd, (const sockaddr *)(&addr), sizeof(addr)) != 0 || listen(server.listen_fd, SOMAXCONN) != 0)
+    {
+        std::cerr << "error: cannot listen on " << path << ": " << strerror(errno) << std::endl;
+
+        if (server.listen_fd >= 0)
+        {
+            close(server.listen_fd);
+        }
+
+        return false;
+    }
+
+    std::vector<std::thread> threads;
+
+    for (std::size_t i = 0; i < std::max<std::size_t>(num_threads, 1); i++)
+    {
+        threads.emplace_back(serve, std::ref(server));
+    }
+
+    while (true)
+    {
+        int fd = accept(server.listen_fd, nullptr, nullptr);
+
+        if (fd < 0)
+        {
+            std::lock_guard<std::mutex> lock(server.mutex);
+
+            if (server.stopping)
+            {
+                break;
+            }
+
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+
+            std::cerr << "error: cannot accept connections: " << strerror(errno) << std::endl;
+            break;
+        }
+
+        std::lock_guard<std::mutex> lock(server.mutex);
+
+        server.waiting.emplace_back(fd);
+        server.wake.notify_one();
+    }
+
+    stop_server(server);
+
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    close(server.listen_fd);
+    unlink(path.c_str());
+
+    return true;
+}
+
+#else
+
+bool run_server(const std::string &path, std::size_t num_threads)
+{
+    std::cerr << "error: the assembler server is not supported on this platform" << std::endl;
+    return false;
+}
+
+#endif
@@ -0,0 +1,149 @@
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+
+#include <server.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+bool send_all(int fd, const void *data, std::size_t size)
+{
+    const char *pos = (const char *)(data);
+
+    while (size > 0)
+    {
+        ssize_t sent = send(fd, pos, size, MSG_NOSIGNAL);
+
+        if (sent <= 0)
+        {
+            return false;
+        }
+
+        pos += sent;
+        size -= sent;
+    }
+
+    return true;
+}
+
+bool recv_all(int fd, void *data, std::size_t size)
+{
+    char *pos = (char *)(data);
+
+    while (size > 0)
+    {
+        ssize_t got = recv(fd, pos, size, 0);
+
+        if (got <= 0)
+        {
+            return false;
+        }
+
+        pos += got;
+        size -= got;
+    }
+
+    return true;
+}
+
+int connect_server(const std::string &path)
+{
+    sockaddr_un addr = {};
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    addr.sun_family = AF_UNIX;
+
+    if (fd < 0 || path.length() >= sizeof(addr.sun_path))
+    {
+        std::cerr << "error: cannot connect to " << path << std::endl;
+
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+
+        return -1;
+    }
+
+    memcpy(addr.sun_path, path.c_str(), path.length() + 1);
+
+    if (connect(fd, (const sockaddr *)(&addr), sizeof(addr)) != 0)
+    {
+        std::cerr << "error: no assembler server at " << path << ": " << strerror(errno) << std::endl;
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+bool call_server(int fd, uint32_t flags, std::string_view input, std::string_view output, std::string_view source, Server_Reply &reply,
+                 std::string &messages, std::vector<uint8_t> &object)
+{
+    Server_Request request = {};
+
+    memcpy(request.magic, SERVER_REQUEST_MAGIC, 4);
+    request.flags = flags;
+    request.input_length = input.length();
+    request.output_length = output.length();
+    request.source_length = flags & SERVE_INLINE ? source.length() : 0;
+
+    // Small requests go out in one send
+    std::string buffer((const char *)(&request), sizeof(request));
+
+    buffer.append(input);
+    buffer.append(output);
+
+    if (!send_all(fd, buffer.data(), buffer.length()) || !send_all(fd, source.data(), request.source_length))
+    {
+        return false;
+    }
+
+    if (!recv_all(fd, &reply, sizeof(reply)) || memcmp(reply.magic, SERVER_REPLY_MAGIC, 4) != 0)
+    {
+        return false;
+    }
+
+    messages.resize(reply.message_length);
+    object.resize(reply.object_length);
+
+    return recv_all(fd, messages.data(), messages.length()) && recv_all(fd, object.data(), object.size());
+}
+
+void close_server(int fd)
+{
+    close(fd);
+}
+
+#else
+
+int connect_server(const std::string &path)
+{
+    std::cerr << "error: the assembler server is not supported on this platform" << std::endl;
+    return -1;
+}
+
+bool call_server(int fd, uint32_t flags, std::string_view input, std::string_view output, std::string_view source, Server_Reply &reply,
+                 std::string &messages, std::vector<uint8_t> &object)
+{
+    return false;
+}
+
+void close_server(int fd)
+{
+}
+
+bool send_all(int fd, const void *data, std::size_t size)
+{
+    return false;
+}
+
+bool recv_all(int fd, void *data, std::size_t size)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,194 @@
+#include <stats.h>
+
+#include <fstream>
+#include <iomanip>
+#include <atomic>
+
+uint32_t stats_thread_id()
+{
+    static std::atomic<uint32_t> next_id = 0;
+    thread_local uint32_t id = next_id++;
+
+    return id;
+}
+
+Phase_Timer::Phase_Timer(Stats &stats, const char *name) : stats(stats), name(name)
+{
+    if (stats.enabled)
+    {
+        start = std::chrono::steady_clock::now();
+    }
+}
+
+Phase_Timer::~Phase_Timer()
+{
+    if (!stats.enabled)
+    {
+        return;
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    Trace_Event event = {};
+
+    event.name = name;
+    event.tid = stats_thread_id();
+    event.start = std::chrono::duration_cast<std::chrono::microseconds>(start - stats.origin).count();
+    event.duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+    std::lock_guard<std::mutex> lock(stats.mutex);
+    stats.events.emplace_back(event);
+}
+
+void add_stats(Stats &total, const Stats &stats)
+{
+    int64_t shift = std::chrono::duration_cast<std::chrono::microseconds>(stats.origin - total.origin).count();
+    std::lock_guard<std::mutex> lock(total.mutex);
+
+    for (Trace_Event event : stats.events)
+    {
+        event.start = std::max<int64_t>(0, (int64_t)(event.start) + shift);
+        total.events.emplace_back(event);
+    }
+
+    total.input_bytes += stats.input_bytes;
+    total.output_bytes += stats.output_bytes;
+    total.chunks += stats.chunks;
+    total.instructions += stats.instructions;
+    total.labels += stats.labels;
+    total.symbols += stats.symbols;
+    total.relocations += stats.relocations;
+    total.resolved_relocations += stats.resolved_relocations;
+    total.str_tab_bytes += stats.str_tab_bytes;
+    total.str_tab_requested += stats.str_tab_requested;
+    total.str_tab_emitted += stats.str_tab_emitted;
+    total.section_appends += stats.section_appends;
+    total.section_chunks += stats.section_chunks;
+    total.branches += stats.branches;
+    total.short_branches += stats.short_branches;
+    total.cache_hits += stats.cache_hits;
+    total.cache_misses += stats.cache_misses;
+    add_size_stats(total.sizes, stats.sizes);
+}
+
+void print_stats(const Stats &stats, std::ostream &os)
+{
+    // Phases in the order they first finished, with repeats summed
+    std::vector<const char *> names;
+    std::vector<uint64_t> totals;
+    std::vector<uint64_t> counts;
+
+    for (const Trace_Event &event : stats.events)
+    {
+        std::size_t i = 0;
+
+        while (i < names.size() && std::string_view(names[i]) != event.name)
+        {
+            i++;
+        }
+
+        if (i == names.size())
+        {
+            names.emplace_back(event.name);
+            totals.emplace_back(0);
+            counts.emplace_back(0);
+        }
+
+        totals[i] += event.duration;
+        counts[i]++;
+    }
+
+    os << std::fixed << std::setprecision(3);
+    os << "phase                    ms    count" << std::endl;
+
+    for (std::size_t i = 0; i < names.size(); i++)
+    {
+        os << std::left << std::setw(16) << names[i] << std::right << std::setw(12) << totals[i] / 1000.0 << std::setw(9) << counts[i] << std::endl;
+    }
+
+    const std::pair<const char *, uint64_t> counters[] = {
+        {"input bytes", stats.input_bytes},
+        {"output bytes", stats.output_bytes},
+        {"source chunks", stats.chunks},
+        {"instructions", stats.instructions},
+        {"labels", stats.labels},
+        {"symbols", stats.symbols},
+        {"relocations", stats.relocations},
+        {"resolved relocations", stats.resolved_relocations},
+        {"string table bytes", stats.str_tab_bytes},
+        {"section appends", stats.section_appends},
+        {"section chunks", stats.section_chunks},
+        {"relaxable branches", stats.branches},
+        {"short branches", stats.short_branches},
+        {"cache hits", stats.cache_hits},
+        {"cache misses", stats.cache_misses},
+    };
+
+    os << std::endl;
+
+    for (const auto &counter : counters)
+    {
+        os << std::left << std::setw(20) << counter.first << std::right << std::setw(14) << counter.second << std::endl;
+    }
+
+    // Bytes the strings would take written one by one, over the bytes written
+    double dedup_ratio = stats.str_tab_emitted ? (double)(stats.str_tab_requested) / stats.str_tab_emitted : 1.0;
+
+    os << std::left << std::setw(20) << "string dedup ratio" << std::right << std::setw(14) << std::setprecision(2) << dedup_ratio << std::endl;
+}
+
+void print_size_stats(const Stats &stats, std::ostream &os)
+{
+    const char *names[NUM_SIZE_RULES] = {"imm8", "accumulator", "mov reg, imm", "disp8"};
+    uint64_t instrs = 0;
+    uint64_t bytes = 0;
+
+    os << "rule              instrs   bytes saved" << std::endl;
+
+    for (std::size_t i = 0; i < NUM_SIZE_RULES; i++)
+    {
+        os << std::left << std::setw(14) << names[i] << std::right << std::setw(10) << stats.sizes.instrs[i] << std::setw(14) << stats.sizes.bytes[i] << std::endl;
+        instrs += stats.sizes.instrs[i];
+        bytes += stats.sizes.bytes[i];
+    }
+
+    os << std::left << std::setw(14) << "total" << std::right << std::setw(10) << instrs << std::setw(14) << bytes << std::endl;
+}
+
+bool write_trace(const Stats &stats, const std::string &path)
+{
+    std::ofstream fs(path);
+
+    if (!fs)
+    {
+        return false;
+    }
+
+    fs << "{\"traceEvents\":[";
+
+    for (std::size_t i = 0; i < stats.events.size(); i++)
+    {
+        const Trace_Event &event = stats.events[i];
+
+        fs << (i ? ",\n" : "\n") << "{\"name\":\"" << event.name << "\",\"cat\":\"assembler\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.tid
+           << ",\"ts\":" << event.start << ",\"dur\":" << event.duration << "}";
+    }
+
+    // Counters as one counter event at the end of the run
+    uint64_t end = 0;
+
+    for (const Trace_Event &event : stats.events)
+    {
+        end = std::max(end, event.start + event.duration);
+    }
+
+    fs << (stats.events.empty() ? "\n" : ",\n") << "{\"name\":\"counters\",\"ph\":\"C\",\"pid\":1,\"tid\":0,\"ts\":" << end << ",\"args\":{"
+       << "\"instructions\":" << stats.instructions << ",\"symbols\":" << stats.symbols << ",\"relocations\":" << stats.relocations
+       << ",\"resolved_relocations\":" << stats.resolved_relocations
+       << ",\"string_table_bytes\":" << stats.str_tab_bytes << ",\"string_table_requested_bytes\":" << stats.str_tab_requested
+       << ",\"section_appends\":" << stats.section_appends
+       << ",\"section_chunks\":" << stats.section_chunks << "}}";
+
+    fs << "\n],\"displayTimeUnit\":\"ms\"}" << std::endl;
+
+    return (bool)(fs);
+}
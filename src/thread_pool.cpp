@@ -0,0 +1,140 @@
+#include <thread_pool.h>
+
+Thread_Pool::Thread_Pool(std::size_t num_threads)
+{
+    if (num_threads == 0)
+    {
+        num_threads = 1;
+    }
+
+    for (std::size_t i = 0; i < num_threads; i++)
+    {
+        queues.emplace_back(new Work_Queue());
+    }
+
+    for (std::size_t i = 1; i < num_threads; i++)
+    {
+        threads.emplace_back(&Thread_Pool::worker, this, i);
+    }
+}
+
+Thread_Pool::~Thread_Pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    wake.notify_all();
+
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+void Thread_Pool::run(std::size_t count, const std::function<void(std::size_t)> &task)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    this->task = &task;
+    remaining = count;
+
+    // Workers start on neighbouring tasks, which keeps stealing rare when tasks are even
+    std::size_t num_queues = queues.size();
+
+    for (std::size_t q = 0; q < num_queues; q++)
+    {
+        std::lock_guard<std::mutex> lock(queues[q]->mutex);
+
+        for (std::size_t i = q * count / num_queues; i < (q + 1) * count / num_queues; i++)
+        {
+            queues[q]->tasks.push_back(i);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        generation++;
+    }
+
+    wake.notify_all();
+
+    drain(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]
+              { return remaining == 0; });
+}
+
+void Thread_Pool::worker(std::size_t id)
+{
+    uint64_t seen = 0;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this, seen]
+                      { return stopping || generation != seen; });
+
+            if (stopping)
+            {
+                return;
+            }
+
+            seen = generation;
+        }
+
+        drain(id);
+    }
+}
+
+void Thread_Pool::drain(std::size_t id)
+{
+    std::size_t task_idx;
+
+    while (next_task(id, task_idx))
+    {
+        (*task)(task_idx);
+
+        if (--remaining == 0)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done.notify_all();
+        }
+    }
+}
+
+bool Thread_Pool::next_task(std::size_t id, std::size_t &task_idx)
+{
+    {
+        Work_Queue &own = *queues[id];
+        std::lock_guard<std::mutex> lock(own.mutex);
+
+        if (!own.tasks.empty())
+        {
+            task_idx = own.tasks.back();
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    for (std::size_t i = 1; i < queues.size(); i++)
+    {
+        Work_Queue &victim = *queues[(id + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+
+        if (!victim.tasks.empty())
+        {
+            task_idx = victim.tasks.front();
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,744 @@
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+#include <unwind.h>
+#include <diag.h>
+
+static void frame_error(std::string_view file, const Frame_Op &op, std::string_view msg)
+{
+    diag() << file << ":" << op.line << ": error: " << msg << std::endl;
+}
+
+uint32_t seh_slots(uint8_t op, int64_t value)
+{
+    switch (op)
+    {
+    case FRAME_SEH_STACKALLOC:
+        return value <= 128 ? 1 : value <= 0x7fff8 ? 2 : 3;
+    case FRAME_SEH_SAVEREG:
+        return value / 8 <= 0xffff ? 2 : 3;
+    case FRAME_SEH_SAVEXMM:
+        return value / 16 <= 0xffff ? 2 : 3;
+    default:
+        return 1;
+    }
+}
+
+uint32_t seh_info_size(uint32_t slots, bool handler)
+{
+    // The slots are padded to an even count, which keeps the handler aligned
+    return 4 + 2 * ((slots + 1) & ~1u) + (handler ? 4 : 0);
+}
+
+uint32_t dwarf_pointer_size(uint8_t encoding)
+{
+    switch (encoding & DW_EH_PE_FORMAT)
+    {
+    case DW_EH_PE_ABSPTR:
+    case DW_EH_PE_UDATA8:
+    case DW_EH_PE_SDATA8:
+        return 8;
+    case DW_EH_PE_UDATA4:
+    case DW_EH_PE_SDATA4:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+Sect_Handle unwind_section(Object &obj, std::string_view name, uint32_t alignment)
+{
+    std::size_t idx = obj.sections.find(name);
+
+    if (idx != (std::size_t)(-1))
+    {
+        return Sect_Handle{(uint32_t)(idx)};
+    }
+
+    Sect_Hdr header = {};
+
+    header.flags = IMAGE_SCN_CNT_INITIALIZED_DATA | alignment | IMAGE_SCN_MEM_READ;
+
+    return add_section(obj.sections, obj.sym_tab, obj.str_tab, header, name);
+}
+
+// Appends the unwind codes of one operation, the first slot holding where the
+// prologue has got to, the operation and its info bits
+static void add_codes(std::vector<uint16_t> &codes, const Frame_Op &op, uint8_t prologue_offset)
+{
+    uint8_t uwop = UWOP_PUSH_NONVOL;
+    uint8_t info = op.reg & 0xf;
+    uint32_t slots = seh_slots(op.op, op.value);
+    uint32_t scaled = 0;
+
+    switch (op.op)
+    {
+    case FRAME_SEH_PUSHREG:
+        uwop = UWOP_PUSH_NONVOL;
+        break;
+    case FRAME_SEH_SETFRAME:
+        uwop = UWOP_SET_FPREG;
+        info = 0;
+        break;
+    case FRAME_SEH_STACKALLOC:
+        uwop = slots == 1 ? UWOP_ALLOC_SMALL : UWOP_ALLOC_LARGE;
+        info = slots == 1 ? op.value / 8 - 1 : slots == 2 ? 0 : 1;
+        scaled = op.value / 8;
+        break;
+    case FRAME_SEH_SAVEREG:
+        uwop = slots == 2 ? UWOP_SAVE_NONVOL : UWOP_SAVE_NONVOL_FAR;
+        scaled = op.value / 8;
+        break;
+    case FRAME_SEH_SAVEXMM:
+        uwop = slots == 2 ? UWOP_SAVE_XMM128 : UWOP_SAVE_XMM128_FAR;
+        scaled = op.value / 16;
+        break;
+    case FRAME_SEH_PUSHFRAME:
+        uwop = UWOP_PUSH_MACHFRAME;
+        info = op.value;
+        break;
+    }
+
+    codes.emplace_back(prologue_offset | (uint16_t)(uwop | info << 4) << 8);
+
+    // The operand follows scaled in one slot, or unscaled in two
+    if (slots == 2)
+    {
+        codes.emplace_back(scaled);
+    }
+    else if (slots == 3)
+    {
+        codes.emplace_back(op.value & 0xffff);
+        codes.emplace_back(op.value >> 16);
+    }
+}
+
+// Builds the UNWIND_INFO and RUNTIME_FUNCTION of the .seh_proc at frames[first]
+static bool build_seh_proc(Object &obj, std::string_view file, std::size_t first, std::size_t end, Sect_Handle xdata, Sect_Handle pdata)
+{
+    const Frame_Op &proc = obj.frames[first];
+    const Frame_Op *endproc = nullptr;
+    const Frame_Op *handler = nullptr;
+    const Frame_Op *handler_data = nullptr;
+    uint32_t prologue_end = proc.offset;
+    uint8_t frame = 0;
+    bool ok = true;
+
+    // Codes are listed from the end of the prologue back, one operation at a time
+    std::vector<std::vector<uint16_t>> op_codes;
+
+    for (std::size_t i = first + 1; i < end; i++)
+    {
+        const Frame_Op &op = obj.frames[i];
+
+        switch (op.op)
+        {
+        case FRAME_SEH_ENDPROC:
+            endproc = &op;
+            break;
+        case FRAME_SEH_ENDPROLOGUE:
+            prologue_end = op.offset;
+            break;
+        case FRAME_SEH_HANDLER:
+            handler = &op;
+            break;
+        case FRAME_SEH_HANDLERDATA:
+            handler_data = &op;
+            break;
+        case FRAME_SEH_PUSHREG:
+        case FRAME_SEH_SETFRAME:
+        case FRAME_SEH_STACKALLOC:
+        case FRAME_SEH_SAVEREG:
+        case FRAME_SEH_SAVEXMM:
+        case FRAME_SEH_PUSHFRAME:
+            if (op.offset - proc.offset > UNW_MAX_PROLOGUE)
+            {
+                frame_error(file, op, "prologue too long for its unwind codes");
+                ok = false;
+                break;
+            }
+
+            if (op.op == FRAME_SEH_SETFRAME)
+            {
+                frame = (op.reg & 0xf) | (op.value / 16) << 4;
+            }
+
+            op_codes.emplace_back();
+            add_codes(op_codes.back(), op, op.offset - proc.offset);
+            break;
+        }
+    }
+
+    if (prologue_end - proc.offset > UNW_MAX_PROLOGUE)
+    {
+        frame_error(file, proc, "prologue longer than 255 bytes");
+        ok = false;
+    }
+
+    if (!ok)
+    {
+        return false;
+    }
+
+    std::vector<uint8_t> info;
+    uint32_t slots = 0;
+
+    for (const std::vector<uint16_t> &codes : op_codes)
+    {
+        slots += codes.size();
+    }
+
+    info.push_back(UNW_VERSION | (handler ? handler->value : 0) << 3);
+    info.push_back(prologue_end - proc.offset);
+    info.push_back(slots);
+    info.push_back(frame);
+
+    for (std::size_t i = op_codes.size(); i-- > 0;)
+    {
+        for (uint16_t code : op_codes[i])
+        {
+            info.push_back(code & 0xff);
+            info.push_back(code >> 8);
+        }
+    }
+
+    info.resize(seh_info_size(slots, handler), 0);
+
+    Section &unwind = obj.sections[xdata];
+    uint32_t info_offset;
+
+    if (handler_data)
+    {
+        // The parser counted the same slots when it reserved the space
+        info_offset = handler_data->offset;
+        unwind.write(info_offset, info.data(), info.size());
+    }
+    else
+    {
+        unwind.align(4);
+        info_offset = unwind.loc();
+        unwind.append(info.data(), info.size());
+    }
+
+    if (handler)
+    {
+        relocate_symbol(obj.labels[handler->label].sym, xdata, obj.sections, info_offset + info.size() - 4, IMAGE_REL_AMD64_ADDR32NB);
+    }
+
+    // BeginAddress, EndAddress and UnwindInfoAddress, the image relative
+    // relocations adding the offsets held in the fields
+    Section &table = obj.sections[pdata];
+    uint32_t entry = table.loc();
+    uint32_t fields[3] = {proc.offset, endproc->offset, info_offset};
+
+    table.append((const uint8_t *)(fields), sizeof(fields));
+    relocate_symbol(obj.sections[proc.section].sym, pdata, obj.sections, entry, IMAGE_REL_AMD64_ADDR32NB);
+    relocate_symbol(obj.sections[proc.section].sym, pdata, obj.sections, entry + 4, IMAGE_REL_AMD64_ADDR32NB);
+    relocate_symbol(unwind.sym, pdata, obj.sections, entry + 8, IMAGE_REL_AMD64_ADDR32NB);
+
+    return true;
+}
+
+// DWARF call frame information
+
+#define CFA_ADVANCE 0 // An instruction moving past code, value is the number of bytes
+
+// A call frame instruction, with the CFA relative forms of the directives
+// resolved. op is a FRAME_CFI_ value or CFA_ADVANCE
+struct CFA_Insn
+{
+    uint8_t op;
+    uint8_t reg;
+    int64_t value;
+
+    bool operator==(const CFA_Insn &other) const
+    {
+        return op == other.op && reg == other.reg && value == other.value;
+    }
+};
+
+// A CIE written to .eh_frame, which later FDEs with the same key share
+struct CIE_Entry
+{
+    uint32_t offset;
+    uint32_t personality; // Object label, FRAME_NONE for none
+    uint8_t personality_encoding;
+    uint8_t lsda_encoding;
+    bool signal;
+    std::vector<CFA_Insn> insns;
+};
+
+// A relocated field of an entry being built
+struct EH_Reloc
+{
+    uint32_t offset; // In the entry
+    uint32_t sym;
+    uint16_t type;
+};
+
+// The .cfi_startproc at frames[first] and what its FDE needs
+struct CFI_Proc
+{
+    const Frame_Op *proc;
+    const Frame_Op *endproc;
+    const Frame_Op *personality;
+    const Frame_Op *lsda;
+    bool signal;
+    std::vector<CFA_Insn> insns;
+};
+
+static void put_uleb(std::vector<uint8_t> &out, uint64_t value)
+{
+    do
+    {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        out.push_back(byte | (value ? 0x80 : 0));
+    } while (value);
+}
+
+static void put_sleb(std::vector<uint8_t> &out, int64_t value)
+{
+    bool more = true;
+
+    while (more)
+    {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        more = !((value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40)));
+        out.push_back(byte | (more ? 0x80 : 0));
+    }
+}
+
+static void put_bytes(std::vector<uint8_t> &out, uint64_t value, uint32_t size)
+{
+    for (uint32_t i = 0; i < size; i++)
+    {
+        out.push_back(value >> (i * 8));
+    }
+}
+
+// A pointer to sym plus addend in encoding. PC relative fields use the COFF
+// form, which holds the addend from the end of the field
+static void put_pointer(std::vector<uint8_t> &out, std::vector<EH_Reloc> &relocs, uint32_t sym, uint8_t encoding, int64_t addend)
+{
+    uint32_t size = dwarf_pointer_size(encoding);
+    uint16_t type = size == 8 ? IMAGE_REL_AMD64_ADDR64 : IMAGE_REL_AMD64_ADDR32;
+
+    if (encoding & DW_EH_PE_PCREL)
+    {
+        type = IMAGE_REL_AMD64_REL32;
+        addend += 4;
+    }
+
+    relocs.emplace_back(EH_Reloc{(uint32_t)(out.size()), sym, type});
+    put_bytes(out, addend, size);
+}
+
+// Collects the parts of the proc from frames[first] to its .cfi_endproc,
+// turning its directives into instructions. Returns the index of the
+// .cfi_endproc
+static std::size_t read_cfi_proc(const Object &obj, std::size_t first, CFI_Proc &proc)
+{
+    const Frame_Op &start = obj.frames[first];
+    uint32_t loc = start.offset;
+    int64_t cfa_offset = 0;
+    std::vector<int64_t> remembered;
+    std::size_t i = first + 1;
+
+    proc = {};
+    proc.proc = &start;
+
+    // Unless simple, the CFA starts past the return address
+    if (!start.value)
+    {
+        cfa_offset = 8;
+        proc.insns.emplace_back(CFA_Insn{FRAME_CFI_DEF_CFA, DWARF_RSP, cfa_offset});
+        proc.insns.emplace_back(CFA_Insn{FRAME_CFI_OFFSET, DWARF_RETURN_REG, -8});
+    }
+
+    for (; i < obj.frames.size() && obj.frames[i].op != FRAME_CFI_ENDPROC; i++)
+    {
+        const Frame_Op &op = obj.frames[i];
+        CFA_Insn insn = {op.op, op.reg, op.value};
+
+        switch (op.op)
+        {
+        case FRAME_CFI_PERSONALITY:
+            proc.personality = op.reg == DW_EH_PE_OMIT ? nullptr : &op;
+            continue;
+        case FRAME_CFI_LSDA:
+            proc.lsda = op.reg == DW_EH_PE_OMIT ? nullptr : &op;
+            continue;
+        case FRAME_CFI_SIGNAL_FRAME:
+            proc.signal = true;
+            continue;
+        case FRAME_CFI_DEF_CFA:
+        case FRAME_CFI_DEF_CFA_OFFSET:
+            cfa_offset = op.value;
+            break;
+        case FRAME_CFI_ADJUST_CFA_OFFSET:
+            cfa_offset += op.value;
+            insn = CFA_Insn{FRAME_CFI_DEF_CFA_OFFSET, 0, cfa_offset};
+            break;
+        case FRAME_CFI_REL_OFFSET:
+            insn = CFA_Insn{FRAME_CFI_OFFSET, op.reg, op.value - cfa_offset};
+            break;
+        case FRAME_CFI_REMEMBER_STATE:
+            remembered.emplace_back(cfa_offset);
+            break;
+        case FRAME_CFI_RESTORE_STATE:
+            if (!remembered.empty())
+            {
+                cfa_offset = remembered.back();
+                remembered.pop_back();
+            }
+            break;
+        }
+
+        if (op.offset != loc)
+        {
+            proc.insns.emplace_back(CFA_Insn{CFA_ADVANCE, 0, op.offset - loc});
+            loc = op.offset;
+        }
+
+        proc.insns.emplace_back(insn);
+    }
+
+    proc.endproc = i < obj.frames.size() ? &obj.frames[i] : nullptr;
+
+    return i;
+}
+
+// Instructions from the first that follows code belong to the FDE, the
+// ones before go in the CIE when the proc needs a new one
+static std::size_t initial_insns(const std::vector<CFA_Insn> &insns)
+{
+    std::size_t i = 0;
+
+    while (i < insns.size() && insns[i].op != CFA_ADVANCE && insns[i].op != FRAME_CFI_REMEMBER_STATE && insns[i].op != FRAME_CFI_ESCAPE)
+    {
+        i++;
+    }
+
+    return i;
+}
+
+static void put_insn(std::vector<uint8_t> &out, const CFA_Insn &insn)
+{
+    switch (insn.op)
+    {
+    case CFA_ADVANCE:
+        if (insn.value < 0x40)
+        {
+            out.push_back(DW_CFA_ADVANCE_LOC | insn.value);
+        }
+        else if (insn.value <= 0xff)
+        {
+            out.push_back(DW_CFA_ADVANCE_LOC1);
+            put_bytes(out, insn.value, 1);
+        }
+        else if (insn.value <= 0xffff)
+        {
+            out.push_back(DW_CFA_ADVANCE_LOC2);
+            put_bytes(out, insn.value, 2);
+        }
+        else
+        {
+            out.push_back(DW_CFA_ADVANCE_LOC4);
+            put_bytes(out, insn.value, 4);
+        }
+        break;
+    case FRAME_CFI_DEF_CFA:
+        out.push_back(insn.value < 0 ? DW_CFA_DEF_CFA_SF : DW_CFA_DEF_CFA);
+        put_uleb(out, insn.reg);
+
+        if (insn.value < 0)
+        {
+            put_sleb(out, insn.value / -DWARF_DATA_ALIGN);
+        }
+        else
+        {
+            put_uleb(out, insn.value);
+        }
+        break;
+    case FRAME_CFI_DEF_CFA_REGISTER:
+        out.push_back(DW_CFA_DEF_CFA_REGISTER);
+        put_uleb(out, insn.reg);
+        break;
+    case FRAME_CFI_DEF_CFA_OFFSET:
+        if (insn.value < 0)
+        {
+            out.push_back(DW_CFA_DEF_CFA_OFFSET_SF);
+            put_sleb(out, insn.value / -DWARF_DATA_ALIGN);
+        }
+        else
+        {
+            out.push_back(DW_CFA_DEF_CFA_OFFSET);
+            put_uleb(out, insn.value);
+        }
+        break;
+    case FRAME_CFI_OFFSET:
+    {
+        int64_t factored = insn.value / -DWARF_DATA_ALIGN;
+
+        if (factored < 0)
+        {
+            out.push_back(DW_CFA_OFFSET_EXTENDED_SF);
+            put_uleb(out, insn.reg);
+            put_sleb(out, factored);
+        }
+        else if (insn.reg < 0x40)
+        {
+            out.push_back(DW_CFA_OFFSET | insn.reg);
+            put_uleb(out, factored);
+        }
+        else
+        {
+            out.push_back(DW_CFA_OFFSET_EXTENDED);
+            put_uleb(out, insn.reg);
+            put_uleb(out, factored);
+        }
+        break;
+    }
+    case FRAME_CFI_RESTORE:
+        if (insn.reg < 0x40)
+        {
+            out.push_back(DW_CFA_RESTORE | insn.reg);
+        }
+        else
+        {
+            out.push_back(DW_CFA_RESTORE_EXTENDED);
+            put_uleb(out, insn.reg);
+        }
+        break;
+    case FRAME_CFI_UNDEFINED:
+    case FRAME_CFI_SAME_VALUE:
+        out.push_back(insn.op == FRAME_CFI_UNDEFINED ? DW_CFA_UNDEFINED : DW_CFA_SAME_VALUE);
+        put_uleb(out, insn.reg);
+        break;
+    case FRAME_CFI_REGISTER:
+        out.push_back(DW_CFA_REGISTER);
+        put_uleb(out, insn.reg);
+        put_uleb(out, insn.value);
+        break;
+    case FRAME_CFI_REMEMBER_STATE:
+        out.push_back(DW_CFA_REMEMBER_STATE);
+        break;
+    case FRAME_CFI_RESTORE_STATE:
+        out.push_back(DW_CFA_RESTORE_STATE);
+        break;
+    case FRAME_CFI_ESCAPE:
+        out.push_back(insn.value);
+        break;
+    }
+}
+
+// Pads an entry with DW_CFA_nop to a multiple of alignment, counting from
+// base, and fills in its length
+static void finish_entry(std::vector<uint8_t> &entry, uint32_t base, uint32_t alignment)
+{
+    while ((base + entry.size()) % alignment != 0)
+    {
+        entry.push_back(DW_CFA_NOP);
+    }
+
+    uint32_t length = entry.size() - 4;
+
+    memcpy(entry.data(), &length, 4);
+}
+
+static void append_entry(Object &obj, Sect_Handle eh_frame, const std::vector<uint8_t> &entry, const std::vector<EH_Reloc> &relocs)
+{
+    Section &section = obj.sections[eh_frame];
+    uint32_t base = section.loc();
+
+    section.append(entry.data(), entry.size());
+
+    for (const EH_Reloc &reloc : relocs)
+    {
+        relocate_symbol(reloc.sym, eh_frame, obj.sections, base + reloc.offset, reloc.type);
+    }
+}
+
+// Returns the CIE the proc uses, writing it unless an earlier one fits. Like
+// GNU as, the last CIE whose instructions start those of the proc is taken
+static const CIE_Entry &find_cie(Object &obj, Sect_Handle eh_frame, std::vector<CIE_Entry> &cies, const CFI_Proc &proc)
+{
+    CIE_Entry key = {};
+
+    key.personality = proc.personality ? proc.personality->label : FRAME_NONE;
+    key.personality_encoding = proc.personality ? proc.personality->reg : DW_EH_PE_OMIT;
+    key.lsda_encoding = proc.lsda ? proc.lsda->reg : DW_EH_PE_OMIT;
+    key.signal = proc.signal;
+
+    for (std::size_t i = cies.size(); i-- > 0;)
+    {
+        const CIE_Entry &cie = cies[i];
+
+        if (cie.personality == key.personality && cie.personality_encoding == key.personality_encoding && cie.lsda_encoding == key.lsda_encoding &&
+            cie.signal == key.signal && cie.insns.size() <= proc.insns.size() && std::equal(cie.insns.begin(), cie.insns.end(), proc.insns.begin()))
+        {
+            return cie;
+        }
+    }
+
+    key.insns.assign(proc.insns.begin(), proc.insns.begin() + initial_insns(proc.insns));
+
+    std::vector<uint8_t> entry(4, 0);
+    std::vector<uint8_t> data;
+    std::vector<EH_Reloc> relocs;
+    std::string augmentation = "z";
+
+    put_bytes(entry, 0, 4); // CIE id
+    entry.push_back(1);     // Version
+
+    if (key.personality != FRAME_NONE)
+    {
+        augmentation += 'P';
+        data.push_back(key.personality_encoding);
+        put_pointer(data, relocs, obj.labels[key.personality].sym, key.personality_encoding, 0);
+    }
+
+    if (key.lsda_encoding != DW_EH_PE_OMIT)
+    {
+        augmentation += 'L';
+        data.push_back(key.lsda_encoding);
+    }
+
+    augmentation += 'R';
+    data.push_back(DW_EH_PE_PCREL | DW_EH_PE_SDATA4);
+
+    if (key.signal)
+    {
+        augmentation += 'S';
+    }
+
+    entry.insert(entry.end(), augmentation.begin(), augmentation.end() + 1);
+    put_uleb(entry, 1);                 // Code alignment
+    put_sleb(entry, -DWARF_DATA_ALIGN); // Data alignment
+    entry.push_back(DWARF_RETURN_REG);
+    put_uleb(entry, data.size());
+
+    for (EH_Reloc &reloc : relocs)
+    {
+        reloc.offset += entry.size();
+    }
+
+    entry.insert(entry.end(), data.begin(), data.end());
+
+    for (const CFA_Insn &insn : key.insns)
+    {
+        put_insn(entry, insn);
+    }
+
+    Section &section = obj.sections[eh_frame];
+
+    key.offset = section.loc();
+    finish_entry(entry, key.offset, EH_FRAME_ALIGN);
+    append_entry(obj, eh_frame, entry, relocs);
+    cies.emplace_back(std::move(key));
+
+    return cies.back();
+}
+
+// Writes the FDE of the proc at frames[first], and its CIE if it is the first
+// to need it
+static void build_cfi_proc(Object &obj, Sect_Handle eh_frame, std::vector<CIE_Entry> &cies, const CFI_Proc &proc, bool last)
+{
+    const CIE_Entry &cie = find_cie(obj, eh_frame, cies, proc);
+    uint32_t base = obj.sections[eh_frame].loc();
+    std::vector<uint8_t> entry(4, 0);
+    std::vector<EH_Reloc> relocs;
+
+    // The CIE pointer counts back from its own field
+    put_bytes(entry, base + 4 - cie.offset, 4);
+    put_pointer(entry, relocs, obj.sections[proc.proc->section].sym, DW_EH_PE_PCREL | DW_EH_PE_SDATA4, proc.proc->offset);
+    put_bytes(entry, proc.endproc->offset - proc.proc->offset, 4);
+
+    if (proc.lsda)
+    {
+        put_uleb(entry, dwarf_pointer_size(proc.lsda->reg));
+        put_pointer(entry, relocs, obj.labels[proc.lsda->label].sym, proc.lsda->reg, 0);
+    }
+    else
+    {
+        put_uleb(entry, 0);
+    }
+
+    for (std::size_t i = cie.insns.size(); i < proc.insns.size(); i++)
+    {
+        put_insn(entry, proc.insns[i]);
+    }
+
+    finish_entry(entry, base, last ? 8 : EH_FRAME_ALIGN);
+    append_entry(obj, eh_frame, entry, relocs);
+}
+
+bool build_unwind_tables(Object &obj, std::string_view file, bool elf)
+{
+    bool ok = true;
+    Sect_Handle xdata = {};
+    Sect_Handle pdata = {};
+    bool seh = false;
+    std::vector<CFI_Proc> procs;
+
+    // The parser only lets a .seh_proc end with .seh_endproc, and nest nothing
+    for (std::size_t i = 0; i < obj.frames.size(); i++)
+    {
+        if (obj.frames[i].op != FRAME_SEH_PROC)
+        {
+            continue;
+        }
+
+        if (elf)
+        {
+            frame_error(file, obj.frames[i], "SEH unwind directives need COFF output");
+            return false;
+        }
+
+        if (!seh)
+        {
+            xdata = unwind_section(obj, ".xdata");
+            pdata = unwind_section(obj, ".pdata");
+            seh = true;
+        }
+
+        std::size_t end = i + 1;
+
+        while (end + 1 < obj.frames.size() && obj.frames[end].op != FRAME_SEH_ENDPROC)
+        {
+            end++;
+        }
+
+        ok = build_seh_proc(obj, file, i, end + 1, xdata, pdata) && ok;
+        i = end;
+    }
+
+    // The parser only lets a .cfi_startproc end with .cfi_endproc, in the same section
+    for (std::size_t i = 0; i < obj.frames.size(); i++)
+    {
+        if (obj.frames[i].op == FRAME_CFI_STARTPROC)
+        {
+            procs.emplace_back();
+            i = read_cfi_proc(obj, i, procs.back());
+        }
+    }
+
+    if (procs.empty())
+    {
+        return ok;
+    }
+
+    Sect_Handle eh_frame = unwind_section(obj, ".eh_frame", IMAGE_SCN_ALIGN_8BYTES);
+    std::vector<CIE_Entry> cies;
+
+    for (std::size_t i = 0; i < procs.size(); i++)
+    {
+        build_cfi_proc(obj, eh_frame, cies, procs[i], i + 1 == procs.size());
+    }
+
+    return ok;
+}
@@ -0,0 +1,318 @@
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+
+#include <verify.h>
+#include <decoder.h>
+#include <diag.h>
+
+// Any symbol, an operand under a relocation is only encoded as referring to one
+#define VERIFY_SYM 0
+
+// Instructions of one run checked by one task
+struct Verify_Block
+{
+    uint32_t run;
+    std::size_t first;
+    std::size_t count;
+    std::size_t first_target; // Target of the first record with INSTR_TARGET in the block
+    std::string messages;
+    bool ok = true;
+};
+
+static void verify_error(Verify_Block &block, std::string_view file, const Section &section, const Instr_Record &record, const uint8_t *bytes,
+                         std::size_t size, std::string_view msg, const Dec_Instr *dec = nullptr)
+{
+    std::ostringstream os;
+
+    os << file << ":" << record.line << ": error: " << msg << " at " << section.name << "+0x" << std::hex << record.offset << ":";
+
+    for (std::size_t i = 0; i < size; i++)
+    {
+        os << " " << std::setfill('0') << std::setw(2) << (uint32_t)(bytes[i]);
+    }
+
+    os << std::dec << ", encoded as '" << FORMS[record.form].mnemonic << "'";
+
+    if (dec)
+    {
+        os << ", decoded as '";
+        print_decoded(os, *dec);
+        os << "'";
+    }
+
+    os << std::endl;
+
+    block.messages += os.str();
+    block.ok = false;
+}
+
+// Whether a PC relative field reaches the target of the record: through a
+// relocation against its symbol, or with the distance to it
+static bool reaches_target(const Object &obj, uint32_t section, const Instr_Record &record, const Instr_Target &to, const Dec_Instr &dec, const Operand &op,
+                           uint32_t reloc_sym)
+{
+    const Label &target = obj.labels[to.label];
+
+    if (op.sym != SYM_NONE)
+    {
+        return reloc_sym == target.sym;
+    }
+
+    return (target.flags & LABEL_DEFINED) && target.section.idx == section &&
+           (int64_t)(record.offset) + dec.size + op.value == (int64_t)(target.loc) + to.addend;
+}
+
+// Checks one instruction. reloc is the first relocation not checked yet,
+// relocations are in offset order like the instructions, and target is the
+// label of a record with INSTR_TARGET
+static void verify_instr(Verify_Block &block, std::string_view file, const Object &obj, uint32_t section_idx, const Instr_Record &record,
+                         const Instr_Target *target, const Reloc *&reloc, const Reloc *relocs_end)
+{
+    const Section &section = obj.sections[Sect_Handle{section_idx}];
+    uint8_t bytes[ENCODING_HASH_BYTES] = {};
+    std::size_t avail = std::min<uint64_t>(MAX_INSTR_SIZE, section.data_size() - record.offset);
+    Dec_Instr dec;
+
+    section.read(record.offset, bytes, avail);
+
+    // Relocations between instructions are on data
+    while (reloc < relocs_end && reloc->virt_addr < record.offset)
+    {
+        reloc++;
+    }
+
+    // A repeat prefix written over an instruction can read as the mandatory
+    // prefix of another (rep bsf and tzcnt), the record says which was meant
+    uint8_t prefix = record.flags & INSTR_REP ? PREFIX_REP : record.flags & INSTR_REPNZ ? PREFIX_REPNZ : 0;
+
+    if (!decode(bytes, avail, dec, prefix))
+    {
+        verify_error(block, file, section, record, bytes, std::min<std::size_t>(avail, record.size ? record.size : 6), "instruction does not decode");
+        return;
+    }
+
+    // A branch sized by relax was recorded with its rel32 form, which its rel8 form follows
+    const Opcode_Form &form = FORMS[dec.form];
+
+    if (!same_encoding(form, FORMS[record.form]) && !(record.size == 0 && same_encoding(form, FORMS[record.form + 1])))
+    {
+        verify_error(block, file, section, record, bytes, dec.size, "instruction decodes to another form", &dec);
+        return;
+    }
+
+    if (record.size != 0 && dec.size != record.size)
+    {
+        verify_error(block, file, section, record, bytes, dec.size, "instruction decodes to another length", &dec);
+        return;
+    }
+
+    // Relocations may only be on the displacement or the immediate
+    uint8_t fields[MAX_FIXUPS];
+    std::size_t num_fields = 0;
+    uint32_t reloc_syms[3] = {};
+
+    for (; reloc < relocs_end && reloc->virt_addr < record.offset + dec.size; reloc++)
+    {
+        uint8_t field = reloc->virt_addr - record.offset;
+        bool found = false;
+
+        for (uint8_t i = 0; i < dec.instr.num_ops && num_fields < MAX_FIXUPS; i++)
+        {
+            Operand &op = dec.instr.ops[i];
+            bool imm_field = op.type == OPND_IMM || form.enc == ENC_D;
+
+            if (field == (imm_field ? dec.imm_offset : dec.disp_offset) && (imm_field || op.type == OPND_MEM) && op.sym == SYM_NONE)
+            {
+                op.sym = VERIFY_SYM;
+                reloc_syms[i] = reloc->sym_tab_idx;
+                fields[num_fields++] = field;
+                found = (record.flags >> i) & 1;
+                break;
+            }
+        }
+
+        if (!found)
+        {
+            verify_error(block, file, section, record, bytes, dec.size, "relocation outside the symbol fields of the instruction", &dec);
+            return;
+        }
+    }
+
+    // The operands as written, with the ones that referred to a symbol
+    // counting as such even where the value could be filled in. The form
+    // decoded may list operands the one written implies, which do not count.
+    // The symbols relocations gave the operands are put back afterwards.
+    // Without symbols there were no relocations, and nothing to change
+    uint8_t sym_ops = record.flags & INSTR_SYM_OPS;
+    uint32_t syms[3];
+
+    for (uint8_t i = 0; sym_ops && i < dec.instr.num_ops; i++)
+    {
+        syms[i] = dec.instr.ops[i].sym;
+        dec.instr.ops[i].sym = (sym_ops >> i) & 1 ? VERIFY_SYM : SYM_NONE;
+    }
+
+    uint32_t operands = hash_operands(dec.instr, FORMS[record.form]);
+
+    for (uint8_t i = 0; sym_ops && i < dec.instr.num_ops; i++)
+    {
+        dec.instr.ops[i].sym = syms[i];
+    }
+
+    if (operands != record.operands)
+    {
+        verify_error(block, file, section, record, bytes, dec.size, "instruction decodes to other operands", &dec);
+        return;
+    }
+
+    for (uint8_t i = 0; target && i < dec.instr.num_ops; i++)
+    {
+        const Operand &op = dec.instr.ops[i];
+
+        if (op.type == OPND_MEM && (op.base == REG_RIP || form.enc == ENC_D) && !reaches_target(obj, section_idx, record, *target, dec, op, reloc_syms[i]))
+        {
+            verify_error(block, file, section, record, bytes, dec.size, "instruction does not reach its target", &dec);
+            return;
+        }
+    }
+
+    // With the target checked, the displacement of a branch is the only
+    // thing that changes between its forms
+    if (form.enc == ENC_D)
+    {
+        return;
+    }
+
+    // The encoder gives the same operands the same bytes, so bytes the same
+    // as the parser encoded the operands to, fields of symbols aside, encode
+    // back. Only other bytes are encoded again, to tell whether they do
+    uint8_t masked[ENCODING_HASH_BYTES];
+
+    memcpy(masked, bytes, ENCODING_HASH_BYTES);
+
+    for (uint8_t i = 0; sym_ops && i < dec.instr.num_ops; i++)
+    {
+        const Operand &op = dec.instr.ops[i];
+
+        if (!((sym_ops >> i) & 1))
+        {
+            continue;
+        }
+
+        if (op.type == OPND_MEM && dec.disp_offset != DEC_FIELD_NONE)
+        {
+            memset(masked + dec.disp_offset, 0, dec.disp_size);
+        }
+        else if (op.type == OPND_IMM && dec.imm_offset != DEC_FIELD_NONE)
+        {
+            memset(masked + dec.imm_offset, 0, dec.imm_size);
+        }
+    }
+
+    if (hash_encoding(masked, dec.size) == record.encoding)
+    {
+        return;
+    }
+
+    // Encoded again under the mnemonic it was written with, which picks one
+    // alias over another (movabs and mov)
+    Instr instr = dec.instr;
+    uint8_t encoded[MAX_INSTR_SIZE];
+    std::size_t size;
+    Enc_Fixup fixups[MAX_FIXUPS];
+    std::size_t num_fixups;
+    bool same;
+
+    instr.base_mnemonic = form_mnemonic(record.form);
+    instr.size = form_size(FORMS[record.form]);
+
+    same = encode(instr, encoded, size, fixups, num_fixups) && size == dec.size && num_fixups == num_fields;
+
+    // Fields under a relocation hold the addend, which the encoder leaves out
+    for (std::size_t i = 0; same && i < num_fixups; i++)
+    {
+        same = std::find(fields, fields + num_fields, fixups[i].offset) != fields + num_fields;
+        memcpy(encoded + fixups[i].offset, bytes + fixups[i].offset, fixups[i].size);
+    }
+
+    if (!same || memcmp(encoded, bytes, size) != 0)
+    {
+        verify_error(block, file, section, record, bytes, dec.size, "instruction does not encode back to its bytes", &dec);
+    }
+}
+
+static bool reloc_before(const Reloc &a, const Reloc &b)
+{
+    return a.virt_addr < b.virt_addr;
+}
+
+bool verify_object(const Object &obj, std::string_view file, Thread_Pool &pool)
+{
+    std::vector<const std::vector<Reloc> *> relocs(obj.sections.size());
+    std::vector<std::vector<Reloc>> sorted(obj.sections.size()); // Copies of the sections whose relocations are out of order
+    std::vector<Verify_Block> blocks;
+
+    for (uint32_t r = 0; r < obj.instrs.size(); r++)
+    {
+        const Instr_Run &run = obj.instrs[r];
+        uint32_t i = run.section;
+
+        if (!relocs[i])
+        {
+            relocs[i] = &obj.sections[Sect_Handle{i}].relocations.relocations;
+
+            // Differences become relocations after the rest of the section
+            if (!std::is_sorted(relocs[i]->begin(), relocs[i]->end(), reloc_before))
+            {
+                sorted[i] = *relocs[i];
+                std::sort(sorted[i].begin(), sorted[i].end(), reloc_before);
+                relocs[i] = &sorted[i];
+            }
+        }
+
+        std::size_t target = 0;
+
+        for (std::size_t first = 0; first < run.records.size(); first += VERIFY_BLOCK)
+        {
+            std::size_t count = std::min<std::size_t>(VERIFY_BLOCK, run.records.size() - first);
+
+            blocks.emplace_back(Verify_Block{r, first, count, target});
+
+            for (std::size_t k = first; k < first + count; k++)
+            {
+                target += (run.records[k].flags & INSTR_TARGET) != 0;
+            }
+        }
+    }
+
+    pool.run(blocks.size(), [&](std::size_t b)
+             {
+                 Verify_Block &block = blocks[b];
+                 const Instr_Run &run = obj.instrs[block.run];
+                 const std::vector<Reloc> &section_relocs = *relocs[run.section];
+                 const Reloc *end = section_relocs.data() + section_relocs.size();
+                 const Reloc *reloc = std::lower_bound(section_relocs.data(), end, run.records[block.first].offset,
+                                                       [](const Reloc &r, uint32_t offset) { return r.virt_addr < offset; });
+                 const Instr_Target *target = run.targets.data() + block.first_target;
+
+                 for (std::size_t i = block.first; i < block.first + block.count; i++)
+                 {
+                     bool has_target = run.records[i].flags & INSTR_TARGET;
+
+                     verify_instr(block, file, obj, run.section, run.records[i], has_target ? target : nullptr, reloc, end);
+                     target += has_target;
+                 }
+             });
+
+    bool ok = true;
+
+    for (const Verify_Block &block : blocks)
+    {
+        diag() << block.messages;
+        ok = ok && block.ok;
+    }
+
+    return ok;
+}
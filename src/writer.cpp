@@ -0,0 +1,314 @@
+#include <writer.h>
+#include <diag.h>
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#endif
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+void gather_out_file(const Out_File &out, std::vector<uint8_t> &bytes)
+{
+    std::size_t base = bytes.size();
+
+    bytes.resize(base + out.size, 0);
+
+    for (const Out_Region &region : out.regions)
+    {
+        memcpy(bytes.data() + base + region.offset, region.data, region.size);
+    }
+}
+
+#ifdef _WIN32
+
+bool write_out_file(const std::string &path, const Out_File &out, Write_Mode mode)
+{
+    std::ofstream fs(path, std::ios::out | std::ios::binary | std::ios::trunc);
+
+    if (!fs)
+    {
+        diag() << "error: cannot open " << path << std::endl;
+        return false;
+    }
+
+    for (const Out_Region &region : out.regions)
+    {
+        fs.seekp(region.offset);
+        fs.write((const char *)(region.data), region.size);
+    }
+
+    // Trailing gaps still have to extend the file
+    if (out.regions.empty() || out.regions.back().offset + out.regions.back().size < out.size)
+    {
+        fs.seekp(out.size - 1);
+        fs.put(0);
+    }
+
+    return fs.good();
+}
+
+#else
+
+// Copies a region of a mapped file with copy_file_range, which leaves the
+// copying to the kernel instead of reading the file in through the mapping,
+// and writes it from the mapping where that fails
+static bool write_file_region(int fd, const Out_Region &region)
+{
+    std::size_t done = 0;
+
+#ifdef __linux__
+    while (done < region.size)
+    {
+        loff_t from = region.file_offset + done;
+        loff_t to = region.offset + done;
+        ssize_t copied = copy_file_range(region.fd, &from, fd, &to, region.size - done, 0);
+
+        if (copied <= 0)
+        {
+            break;
+        }
+
+        done += copied;
+    }
+#endif
+
+    while (done < region.size)
+    {
+        ssize_t written = pwrite(fd, (const uint8_t *)(region.data) + done, region.size - done, region.offset + done);
+
+        if (written == 0)
+        {
+            errno = EIO;
+        }
+
+        if (written <= 0)
+        {
+            return false;
+        }
+
+        done += written;
+    }
+
+    return true;
+}
+
+// Writes all of iov at offset, or at the current position of a file that
+// cannot seek if offset is -1. A call that writes nothing is an error, as
+// the loop would not end
+static bool write_iov(int fd, std::vector<iovec> &iov, int64_t offset)
+{
+    std::size_t first = 0;
+
+    while (first < iov.size())
+    {
+        int count = iov.size() - first;
+        ssize_t written = offset < 0 ? writev(fd, &iov[first], count) : pwritev(fd, &iov[first], count, offset);
+
+        if (written == 0)
+        {
+            errno = EIO;
+        }
+
+        if (written <= 0)
+        {
+            return false;
+        }
+
+        if (offset >= 0)
+        {
+            offset += written;
+        }
+
+        // Drop fully written entries and trim a partially written one
+        while (first < iov.size() && (std::size_t)(written) >= iov[first].iov_len)
+        {
+            written -= iov[first].iov_len;
+            first++;
+        }
+
+        if (first < iov.size())
+        {
+            iov[first].iov_base = (uint8_t *)(iov[first].iov_base) + written;
+            iov[first].iov_len -= written;
+        }
+    }
+
+    return true;
+}
+
+static bool write_pwritev(int fd, const Out_File &out)
+{
+    std::vector<iovec> iov;
+    iov.reserve(IOV_MAX);
+
+    std::size_t i = 0;
+
+    while (i < out.regions.size())
+    {
+        if (out.regions[i].fd >= 0)
+        {
+            if (!write_file_region(fd, out.regions[i++]))
+            {
+                return false;
+            }
+
+            continue;
+        }
+
+        // Gather a run of contiguous regions into one call
+        uint64_t offset = out.regions[i].offset;
+        uint64_t end = offset;
+
+        iov.clear();
+
+        while (i < out.regions.size() && iov.size() < IOV_MAX && out.regions[i].offset == end && out.regions[i].fd < 0)
+        {
+            iov.emplace_back(iovec{(void *)(out.regions[i].data), out.regions[i].size});
+            end += out.regions[i].size;
+            i++;
+        }
+
+        if (!write_iov(fd, iov, offset))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Writes the regions in order, gaps as zeros, for an output that is not a
+// regular file, such as /dev/null or a pipe, which cannot be sized or seeked
+static bool write_sequential(int fd, const Out_File &out)
+{
+    static const uint8_t zeros[0x10000] = {};
+
+    std::vector<iovec> iov;
+    iov.reserve(IOV_MAX);
+
+    uint64_t pos = 0;
+    std::size_t i = 0;
+
+    while (pos < out.size)
+    {
+        iov.clear();
+
+        while (iov.size() < IOV_MAX && pos < out.size)
+        {
+            uint64_t next = i < out.regions.size() ? out.regions[i].offset : out.size;
+
+            if (pos < next)
+            {
+                std::size_t gap = std::min<uint64_t>(next - pos, sizeof(zeros));
+
+                iov.emplace_back(iovec{(void *)(zeros), gap});
+                pos += gap;
+            }
+            else
+            {
+                iov.emplace_back(iovec{(void *)(out.regions[i].data), out.regions[i].size});
+                pos += out.regions[i].size;
+                i++;
+            }
+        }
+
+        if (!write_iov(fd, iov, -1))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool write_mmap(int fd, const Out_File &out)
+{
+    if (out.size == 0)
+    {
+        return true;
+    }
+
+    void *map = mmap(NULL, out.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (map == MAP_FAILED)
+    {
+        return false;
+    }
+
+    for (const Out_Region &region : out.regions)
+    {
+        if (region.fd < 0)
+        {
+            memcpy((uint8_t *)(map) + region.offset, region.data, region.size);
+        }
+    }
+
+    if (munmap(map, out.size) != 0)
+    {
+        return false;
+    }
+
+    for (const Out_Region &region : out.regions)
+    {
+        if (region.fd >= 0 && !write_file_region(fd, region))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool write_out_file(const std::string &path, const Out_File &out, Write_Mode mode)
+{
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0)
+    {
+        diag() << "error: cannot open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+
+    if (ok && !S_ISREG(st.st_mode))
+    {
+        ok = write_sequential(fd, out);
+    }
+    else if (ok)
+    {
+        // Sizing the file first leaves any gaps zero filled
+        ok = ftruncate(fd, out.size) == 0;
+
+        if (ok)
+        {
+            ok = mode == WRITE_MMAP ? write_mmap(fd, out) : write_pwritev(fd, out);
+        }
+    }
+
+    if (!ok)
+    {
+        diag() << "error: cannot write " << path << ": " << strerror(errno) << std::endl;
+    }
+
+    close(fd);
+
+    return ok;
+}
+
+#endif
@@ -0,0 +1,193 @@
+// Encoder tests
+// Encodes instructions with prefixes, segment overrides and the forms compiler
+// output needs, checking the bytes against GNU as, then decodes them and
+// encodes the decoded instruction again to check the round trip
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <cstdint>
+
+#include <decoder.h>
+
+struct Test
+{
+    const char *text; // The instruction as GNU as takes it
+    Instr instr;
+    std::vector<uint8_t> bytes;
+};
+
+static Operand reg(std::string_view name)
+{
+    const Register *r = find_register(name);
+    Operand op = {};
+
+    op.type = OPND_REG;
+    op.reg = r->num;
+    op.size = r->size;
+    op.reg_class = r->reg_class;
+    op.reg_flags = r->flags;
+    op.base = REG_NONE;
+    op.index = REG_NONE;
+    op.sym = SYM_NONE;
+
+    return op;
+}
+
+static Operand imm(int64_t value)
+{
+    Operand op = {};
+
+    op.type = OPND_IMM;
+    op.value = value;
+    op.base = REG_NONE;
+    op.index = REG_NONE;
+    op.sym = SYM_NONE;
+
+    return op;
+}
+
+static Operand mem(std::string_view base, int64_t disp, std::string_view index = {}, uint8_t scale = 1)
+{
+    Operand op = {};
+
+    op.type = OPND_MEM;
+    op.base = base.empty() ? REG_NONE : base == "rip" ? REG_RIP : find_register(base)->num;
+    op.index = index.empty() ? REG_NONE : find_register(index)->num;
+    op.scale = scale;
+    op.value = disp;
+    op.sym = SYM_NONE;
+
+    return op;
+}
+
+// Operands in Intel order
+static Instr instr(std::string_view mnemonic, std::vector<Operand> ops, uint8_t prefix = 0, uint8_t segment = 0)
+{
+    Instr instr = {};
+
+    lookup_mnemonic(mnemonic, instr);
+    instr.num_ops = ops.size();
+    instr.prefix = prefix;
+    instr.segment = segment;
+
+    for (std::size_t i = 0; i < ops.size(); i++)
+    {
+        instr.ops[i] = ops[i];
+    }
+
+    return instr;
+}
+
+static void print_bytes(const uint8_t *bytes, std::size_t size)
+{
+    for (std::size_t i = 0; i < size; i++)
+    {
+        std::cerr << " " << std::hex << std::setw(2) << std::setfill('0') << (int)(bytes[i]) << std::dec;
+    }
+}
+
+// Encodes test.instr, false with a message if it fails or the bytes differ
+static bool check_encode(const Test &test, const Instr &instr, const char *what)
+{
+    uint8_t encoded[MAX_INSTR_SIZE];
+    std::size_t size = 0;
+    Enc_Fixup fixups[MAX_FIXUPS];
+    std::size_t num_fixups = 0;
+
+    if (!encode(instr, encoded, size, fixups, num_fixups))
+    {
+        std::cerr << test.text << ": " << what << " failed" << std::endl;
+        return false;
+    }
+
+    if (size != test.bytes.size() || !std::equal(test.bytes.begin(), test.bytes.end(), encoded))
+    {
+        std::cerr << test.text << ": " << what << " gave";
+        print_bytes(encoded, size);
+        std::cerr << ", expected";
+        print_bytes(test.bytes.data(), test.bytes.size());
+        std::cerr << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+// Decodes the expected bytes, false with a message unless they decode to one
+// instruction that encodes to the same bytes
+static bool check_decode(const Test &test)
+{
+    Dec_Instr dec;
+
+    if (!decode(test.bytes.data(), test.bytes.size(), dec, test.instr.prefix) || dec.size != test.bytes.size())
+    {
+        std::cerr << test.text << ": decode failed" << std::endl;
+        return false;
+    }
+
+    if (dec.instr.prefix != test.instr.prefix || dec.instr.segment != test.instr.segment)
+    {
+        std::cerr << test.text << ": decoded the wrong prefixes" << std::endl;
+        return false;
+    }
+
+    return check_encode(test, dec.instr, "encoding the decoded instruction");
+}
+
+int main()
+{
+    std::vector<Test> tests = {
+        // Prefixes and segment overrides
+        {"lock addl $1,%fs:(%rax)", instr("addl", {mem("rax", 0), imm(1)}, PREFIX_LOCK, 0x64), {0x64, 0xf0, 0x83, 0x00, 0x01}},
+        {"lock cmpxchgq %rcx,(%rdi)", instr("cmpxchgq", {mem("rdi", 0), reg("rcx")}, PREFIX_LOCK), {0xf0, 0x48, 0x0f, 0xb1, 0x0f}},
+        {"lock xaddl %eax,(%rdx)", instr("xaddl", {mem("rdx", 0), reg("eax")}, PREFIX_LOCK), {0xf0, 0x0f, 0xc1, 0x02}},
+        {"rep stosq", instr("stosq", {}, PREFIX_REP), {0xf3, 0x48, 0xab}},
+        {"rep movsq", instr("movsq", {}, PREFIX_REP), {0xf3, 0x48, 0xa5}},
+        {"movsb", instr("movsb", {}), {0xa4}},
+        {"rep stosw", instr("stosw", {}, PREFIX_REP), {0x66, 0xf3, 0xab}},
+        {"repnz scasb", instr("scasb", {}, PREFIX_REPNZ), {0xf2, 0xae}},
+        {"rep bsfl %eax,%edx", instr("bsfl", {reg("edx"), reg("eax")}, PREFIX_REP), {0xf3, 0x0f, 0xbc, 0xd0}},
+        {"movq %fs:40,%rax", instr("movq", {reg("rax"), mem("", 40)}, 0, 0x64), {0x64, 0x48, 0x8b, 0x04, 0x25, 0x28, 0x00, 0x00, 0x00}},
+        {"movl %gs:(%rax),%ecx", instr("movl", {reg("ecx"), mem("rax", 0)}, 0, 0x65), {0x65, 0x8b, 0x08}},
+        {"cs nopw 0(%rax,%rax,1)", instr("nopw", {mem("rax", 0, "rax", 1)}, 0, 0x2e), {0x2e, 0x66, 0x0f, 0x1f, 0x04, 0x00}},
+
+        // General purpose forms
+        {"prefetcht0 (%rdi)", instr("prefetcht0", {mem("rdi", 0)}), {0x0f, 0x18, 0x0f}},
+        {"prefetchnta 64(%rsi)", instr("prefetchnta", {mem("rsi", 64)}), {0x0f, 0x18, 0x46, 0x40}},
+        {"shldq $3,%rax,%rdx", instr("shldq", {reg("rdx"), reg("rax"), imm(3)}), {0x48, 0x0f, 0xa4, 0xc2, 0x03}},
+        {"shrdl %cl,%eax,%ebx", instr("shrdl", {reg("ebx"), reg("eax"), reg("cl")}), {0x0f, 0xad, 0xc3}},
+        {"crc32b %cl,%eax", instr("crc32b", {reg("eax"), reg("cl")}), {0xf2, 0x0f, 0x38, 0xf0, 0xc1}},
+        {"crc32w %cx,%eax", instr("crc32w", {reg("eax"), reg("cx")}), {0x66, 0xf2, 0x0f, 0x38, 0xf1, 0xc1}},
+        {"crc32q %rcx,%rax", instr("crc32q", {reg("rax"), reg("rcx")}), {0xf2, 0x48, 0x0f, 0x38, 0xf1, 0xc1}},
+        {"movbel (%rdi),%eax", instr("movbel", {reg("eax"), mem("rdi", 0)}), {0x0f, 0x38, 0xf0, 0x07}},
+        {"movbeq %rax,(%rdi)", instr("movbeq", {mem("rdi", 0), reg("rax")}), {0x48, 0x0f, 0x38, 0xf1, 0x07}},
+        {"popcntw %ax,%cx", instr("popcntw", {reg("cx"), reg("ax")}), {0x66, 0xf3, 0x0f, 0xb8, 0xc8}},
+        {"btsq %rax,%rdx", instr("btsq", {reg("rdx"), reg("rax")}), {0x48, 0x0f, 0xab, 0xc2}},
+        {"setne 88(%rsp)", instr("setne", {mem("rsp", 88)}), {0x0f, 0x95, 0x44, 0x24, 0x58}},
+
+        // SSE forms
+        {"pmovmskb %xmm1,%eax", instr("pmovmskb", {reg("eax"), reg("xmm1")}), {0x66, 0x0f, 0xd7, 0xc1}},
+        {"punpcklbw %xmm1,%xmm0", instr("punpcklbw", {reg("xmm0"), reg("xmm1")}), {0x66, 0x0f, 0x60, 0xc1}},
+        {"punpckhqdq %xmm3,%xmm2", instr("punpckhqdq", {reg("xmm2"), reg("xmm3")}), {0x66, 0x0f, 0x6d, 0xd3}},
+        {"movhps (%rax),%xmm1", instr("movhps", {reg("xmm1"), mem("rax", 0)}), {0x0f, 0x16, 0x08}},
+        {"movhlps %xmm1,%xmm0", instr("movhlps", {reg("xmm0"), reg("xmm1")}), {0x0f, 0x12, 0xc1}},
+        {"movd (%rax),%xmm0", instr("movd", {reg("xmm0"), mem("rax", 0)}), {0x66, 0x0f, 0x6e, 0x00}},
+        {"psrldq $8,%xmm1", instr("psrldq", {reg("xmm1"), imm(8)}), {0x66, 0x0f, 0x73, 0xd9, 0x08}},
+        {"pshuflw $27,%xmm1,%xmm2", instr("pshuflw", {reg("xmm2"), reg("xmm1"), imm(27)}), {0xf2, 0x0f, 0x70, 0xd1, 0x1b}},
+    };
+
+    std::size_t failed = 0;
+
+    for (const Test &test : tests)
+    {
+        if (!check_encode(test, test.instr, "encode") || !check_decode(test))
+        {
+            failed++;
+        }
+    }
+
+    std::cout << tests.size() - failed << " of " << tests.size() << " passed" << std::endl;
+
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,717 @@
+// Object tests
+// Assembles each source in test/object to ELF, and GNU as assembles it too.
+// The two objects are compared section by section by name: type, flags,
+// alignment, contents and relocations, then symbol by symbol. Then each
+// program in test/run is compiled with gcc -S, assembled, linked and run, and
+// has to print what the same program built by gcc alone prints. COFF objects
+// past the limits of their header fields are read back with objdump, and an
+// object written to a pipe has to match the one written to a file. Needs
+// GNU as, objdump and gcc on the path
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <thread>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <batch.h>
+#include <elf.h>
+
+// Flags that only let the linker merge contents, which are not written
+#define SHF_MERGE_STRINGS 0x30
+
+// Compiled by gcc -S and linked as a program, or as a shared library the
+// program is linked against
+struct Run_Test
+{
+    const char *name;
+    std::vector<const char *> sources;
+    std::vector<const char *> lib_sources;
+    const char *flags = ""; // Passed to gcc when compiling
+};
+
+// An ELF object as the tests see it
+struct Elf_Object
+{
+    std::vector<uint8_t> bytes;
+    std::vector<Elf64_Shdr> sections;
+    std::vector<Elf64_Sym> symbols;
+    std::vector<uint32_t> symtab_shndx; // Empty if the object has no SHT_SYMTAB_SHNDX
+    std::vector<std::string> groups;    // Signature of the group of each section, empty if it is in none
+    std::vector<std::size_t> relas;     // Relocation section of each section, 0 if it has none
+    std::size_t symtab = 0;
+
+    const char *str(std::size_t section, uint32_t offset) const
+    {
+        return (const char *)(bytes.data() + sections[section].offset + offset);
+    }
+
+    std::string section_name(std::size_t idx) const
+    {
+        return idx < sections.size() ? str(get_shstrndx(), sections[idx].name) : "?";
+    }
+
+    std::size_t get_shstrndx() const
+    {
+        const Elf64_Ehdr *header = (const Elf64_Ehdr *)(bytes.data());
+
+        return header->shstrndx == SHN_XINDEX ? sections[0].link : header->shstrndx;
+    }
+
+    // Section index of a symbol, SHN_ABS and SHN_COMMON as they are
+    std::size_t sym_section(uint32_t idx) const
+    {
+        return symbols[idx].shndx == SHN_XINDEX ? symtab_shndx[idx] : symbols[idx].shndx;
+    }
+
+    // What a symbol stands for in messages: its name, or its section
+    std::string sym_name(uint32_t idx) const
+    {
+        const Elf64_Sym &sym = symbols[idx];
+
+        if ((sym.info & 0xf) == STT_SECTION)
+        {
+            return "section " + section_name(sym_section(idx));
+        }
+
+        return str(sections[symtab].link, sym.name);
+    }
+
+    const uint8_t *contents(std::size_t idx) const
+    {
+        return bytes.data() + sections[idx].offset;
+    }
+
+    // A group as its flags and the names of its members, which have other
+    // indices in each object
+    std::string describe_group(std::size_t idx) const
+    {
+        const uint32_t *words = (const uint32_t *)(contents(idx));
+        std::vector<std::string> members;
+
+        for (std::size_t i = 1; i < sections[idx].size / 4; i++)
+        {
+            members.emplace_back(section_name(words[i]));
+        }
+
+        std::sort(members.begin(), members.end());
+
+        std::string text = "flags " + std::to_string(words[0]);
+
+        for (const std::string &member : members)
+        {
+            text += " " + member;
+        }
+
+        return text;
+    }
+};
+
+static std::string temp_dir;
+static bool test_failed = false;
+
+static void fail(const std::string &test, const std::string &msg)
+{
+    std::cerr << test << ": " << msg << std::endl;
+    test_failed = true;
+}
+
+static bool read_file(const std::string &path, std::vector<uint8_t> &bytes)
+{
+    std::ifstream fs(path, std::ios::binary);
+
+    if (!fs)
+    {
+        return false;
+    }
+
+    bytes.assign(std::istreambuf_iterator<char>(fs), std::istreambuf_iterator<char>());
+
+    return true;
+}
+
+static bool load_elf(const std::string &path, Elf_Object &obj)
+{
+    if (!read_file(path, obj.bytes) || obj.bytes.size() < sizeof(Elf64_Ehdr))
+    {
+        return false;
+    }
+
+    const Elf64_Ehdr *header = (const Elf64_Ehdr *)(obj.bytes.data());
+    const Elf64_Shdr *headers = (const Elf64_Shdr *)(obj.bytes.data() + header->shoff);
+
+    // With SHN_LORESERVE sections or more the count is in section 0
+    obj.sections.assign(headers, headers + (header->shnum ? header->shnum : headers[0].size));
+    obj.groups.assign(obj.sections.size(), "");
+    obj.relas.assign(obj.sections.size(), 0);
+
+    for (std::size_t i = 0; i < obj.sections.size(); i++)
+    {
+        if (obj.sections[i].type == SHT_SYMTAB)
+        {
+            const Elf64_Sym *syms = (const Elf64_Sym *)(obj.contents(i));
+
+            obj.symtab = i;
+            obj.symbols.assign(syms, syms + obj.sections[i].size / sizeof(Elf64_Sym));
+        }
+        else if (obj.sections[i].type == SHT_RELA)
+        {
+            obj.relas[obj.sections[i].info] = i;
+        }
+        else if (obj.sections[i].type == SHT_SYMTAB_SHNDX)
+        {
+            const uint32_t *indices = (const uint32_t *)(obj.contents(i));
+
+            obj.symtab_shndx.assign(indices, indices + obj.sections[i].size / 4);
+        }
+    }
+
+    for (std::size_t i = 0; i < obj.sections.size(); i++)
+    {
+        const uint32_t *words = (const uint32_t *)(obj.contents(i));
+
+        for (std::size_t w = 1; obj.sections[i].type == SHT_GROUP && w < obj.sections[i].size / 4; w++)
+        {
+            obj.groups[words[w]] = obj.sym_name(obj.sections[i].info);
+        }
+    }
+
+    return true;
+}
+
+static std::string hex(uint64_t value)
+{
+    std::ostringstream ss;
+    ss << "0x" << std::hex << value;
+    return ss.str();
+}
+
+// Relocations of a section as text, one per line in offset order
+static std::string describe_relocations(const Elf_Object &obj, std::size_t section)
+{
+    std::vector<std::pair<uint64_t, std::string>> lines;
+    std::size_t i = obj.relas[section];
+
+    if (i != 0)
+    {
+        const Elf64_Rela *relas = (const Elf64_Rela *)(obj.contents(i));
+
+        for (std::size_t r = 0; r < obj.sections[i].size / sizeof(Elf64_Rela); r++)
+        {
+            const Elf64_Rela &rela = relas[r];
+            std::ostringstream ss;
+
+            ss << hex(rela.offset) << " type " << (rela.info & 0xffffffff) << " " << obj.sym_name(rela.info >> 32) << " " << rela.addend;
+            lines.emplace_back(rela.offset, ss.str());
+        }
+    }
+
+    std::stable_sort(lines.begin(), lines.end(), [](const auto &a, const auto &b)
+                     { return a.first < b.first; });
+
+    std::string text;
+
+    for (const auto &line : lines)
+    {
+        text += "  " + line.second + "\n";
+    }
+
+    return text;
+}
+
+// Symbols other than sections and files, by name
+static std::map<std::string, std::string> describe_symbols(const Elf_Object &obj)
+{
+    std::map<std::string, std::string> symbols;
+
+    for (std::size_t i = 1; i < obj.symbols.size(); i++)
+    {
+        const Elf64_Sym &sym = obj.symbols[i];
+        uint8_t type = sym.info & 0xf;
+
+        if (type == STT_SECTION || type == STT_FILE)
+        {
+            continue;
+        }
+
+        std::ostringstream ss;
+        std::string where = sym.shndx == SHN_UNDEF ? "undefined" : sym.shndx == SHN_ABS ? "absolute" : sym.shndx == SHN_COMMON ? "common" : obj.section_name(obj.sym_section(i));
+
+        ss << "bind " << (sym.info >> 4) << " type " << (int)(type) << " visibility " << (int)(sym.other) << " in " << where << " value " << hex(sym.value) << " size " << sym.size;
+        symbols[obj.sym_name(i)] = ss.str();
+    }
+
+    return symbols;
+}
+
+// The sections compared, by name and group, and groups by their signature
+static std::map<std::string, std::size_t> content_sections(const Elf_Object &obj)
+{
+    std::map<std::string, std::size_t> sections;
+
+    for (std::size_t i = 1; i < obj.sections.size(); i++)
+    {
+        uint32_t type = obj.sections[i].type;
+        const std::string &group = obj.groups[i];
+
+        if (type == SHT_GROUP)
+        {
+            sections[".group " + obj.sym_name(obj.sections[i].info)] = i;
+        }
+        else if (type != SHT_RELA && type != SHT_SYMTAB && type != SHT_SYMTAB_SHNDX && type != SHT_STRTAB)
+        {
+            sections[obj.section_name(i) + (group.empty() ? "" : " in group " + group)] = i;
+        }
+    }
+
+    return sections;
+}
+
+static void compare_section(const std::string &test, const std::string &name, const Elf_Object &ours, std::size_t a, const Elf_Object &gnu, std::size_t b)
+{
+    const Elf64_Shdr &x = ours.sections[a];
+    const Elf64_Shdr &y = gnu.sections[b];
+    std::string where = test + ": " + name;
+
+    auto check = [&](const char *field, uint64_t got, uint64_t expected)
+    {
+        if (got != expected)
+        {
+            fail(where, std::string(field) + " " + hex(got) + ", GNU as gives " + hex(expected));
+        }
+    };
+
+    check("type", x.type, y.type);
+    check("flags", x.flags, y.flags & ~(uint64_t)(SHF_MERGE_STRINGS));
+    check("alignment", x.addralign, y.addralign);
+    check("size", x.size, y.size);
+
+    if (!(y.flags & SHF_MERGE_STRINGS))
+    {
+        check("entsize", x.entsize, y.entsize);
+    }
+
+    if (x.type == SHT_GROUP)
+    {
+        if (ours.describe_group(a) != gnu.describe_group(b))
+        {
+            fail(where, "holds " + ours.describe_group(a) + ", GNU as gives " + gnu.describe_group(b));
+        }
+    }
+    else if (x.type != SHT_NOBITS && x.size == y.size && memcmp(ours.contents(a), gnu.contents(b), x.size) != 0)
+    {
+        fail(where, "contents differ from GNU as");
+    }
+
+    std::string relocs = describe_relocations(ours, a);
+    std::string expected = describe_relocations(gnu, b);
+
+    if (relocs != expected)
+    {
+        fail(where, "relocations\n" + relocs + "GNU as gives\n" + expected);
+    }
+}
+
+static void compare_objects(const std::string &test, const Elf_Object &ours, const Elf_Object &gnu)
+{
+    std::map<std::string, std::size_t> a = content_sections(ours);
+    std::map<std::string, std::size_t> b = content_sections(gnu);
+
+    for (const auto &[name, idx] : b)
+    {
+        if (a.find(name) == a.end())
+        {
+            fail(test, "no section " + name);
+        }
+        else
+        {
+            compare_section(test, name, ours, a[name], gnu, idx);
+        }
+    }
+
+    for (const auto &[name, idx] : a)
+    {
+        if (b.find(name) == b.end())
+        {
+            fail(test, "section " + name + " that GNU as does not write");
+        }
+    }
+
+    std::map<std::string, std::string> x = describe_symbols(ours);
+    std::map<std::string, std::string> y = describe_symbols(gnu);
+
+    for (const auto &[name, desc] : y)
+    {
+        if (x.find(name) == x.end())
+        {
+            fail(test, "no symbol " + name);
+        }
+        else if (x[name] != desc)
+        {
+            fail(test, "symbol " + name + ": " + x[name] + ", GNU as gives " + desc);
+        }
+    }
+
+    for (const auto &[name, desc] : x)
+    {
+        if (y.find(name) == y.end())
+        {
+            fail(test, "symbol " + name + " that GNU as does not write");
+        }
+    }
+}
+
+static bool assemble(const std::string &input, const std::string &output, bool elf = true)
+{
+    Asm_Options options;
+    Thread_Pool pool(1);
+    Object obj;
+
+    options.elf = elf;
+
+    return assemble_file(File_Job{input, output}, options, obj, pool);
+}
+
+// Runs a shell command, its output in output if it is not null
+static int run(const std::string &command, std::string *output = nullptr)
+{
+    FILE *pipe = popen((command + " 2>&1").c_str(), "r");
+    std::string text;
+    char buffer[4096];
+
+    if (!pipe)
+    {
+        return -1;
+    }
+
+    while (std::size_t n = fread(buffer, 1, sizeof(buffer), pipe))
+    {
+        text.append(buffer, n);
+    }
+
+    int status = pclose(pipe);
+
+    if (output)
+    {
+        *output = text;
+    }
+    else if (status != 0)
+    {
+        std::cerr << text;
+    }
+
+    return status;
+}
+
+// Assembles source with this assembler and with GNU as and compares the objects
+static void compare_with_gnu(const std::string &source, const std::string &name)
+{
+    std::string ours = temp_dir + "/" + name + ".o";
+    std::string gnu = temp_dir + "/" + name + ".gnu.o";
+    Elf_Object a, b;
+
+    if (!assemble(source, ours))
+    {
+        fail(source, "does not assemble");
+        return;
+    }
+
+    if (run("as " + source + " -o " + gnu) != 0)
+    {
+        fail(source, "GNU as does not assemble it");
+        return;
+    }
+
+    if (!load_elf(ours, a) || !load_elf(gnu, b))
+    {
+        fail(source, "cannot read the objects");
+        return;
+    }
+
+    compare_objects(source, a, b);
+}
+
+static void object_test(const std::string &name)
+{
+    compare_with_gnu("test/object/" + name + ".s", name);
+}
+
+// More sections than the ELF header can count, which moves the count, the
+// index of .shstrtab and the section indices of symbols out of their 16-bit fields
+static void many_sections_test()
+{
+    std::string source = temp_dir + "/many_sections.s";
+    std::ofstream fs(source);
+
+    for (int i = 0; i < 70000; i++)
+    {
+        fs << "\t.section .t" << i << ",\"ax\",@progbits\nf" << i << ":\n\tret\n";
+    }
+
+    fs << "\t.globl last\nlast:\n\tjmp f0\n";
+    fs.close();
+
+    compare_with_gnu(source, "many_sections");
+}
+
+// More relocations in a section than a COFF header can count, which puts the
+// count in an extra first relocation. objdump has to find all of them
+static void coff_relocations_test()
+{
+    std::string source = temp_dir + "/coff_relocations.s";
+    std::string object = temp_dir + "/coff_relocations.o";
+    std::string output;
+    std::ofstream fs(source);
+
+    fs << "\t.data\n";
+
+    for (int i = 0; i < 70000; i++)
+    {
+        fs << "\t.quad x\n";
+    }
+
+    fs.close();
+
+    if (!assemble(source, object, false))
+    {
+        fail(source, "does not assemble");
+        return;
+    }
+
+    if (run("objdump -r " + object, &output) != 0)
+    {
+        fail(source, "objdump cannot read it: " + output);
+        return;
+    }
+
+    std::size_t count = 0;
+
+    for (std::size_t at = output.find("ADDR64"); at != std::string::npos; at = output.find("ADDR64", at + 1))
+    {
+        count++;
+    }
+
+    if (count != 70000)
+    {
+        fail(source, "objdump finds " + std::to_string(count) + " relocations, not 70000");
+    }
+}
+
+// Section numbers are signed 16-bit in COFF symbols, so more sections are an error
+static void coff_sections_test()
+{
+    std::string source = temp_dir + "/coff_sections.s";
+    std::ofstream fs(source);
+
+    for (int i = 0; i < 33000; i++)
+    {
+        fs << "\t.section .t" << i << ",\"x\"\n\tret\n";
+    }
+
+    fs.close();
+
+    if (assemble(source, temp_dir + "/coff_sections.o", false))
+    {
+        fail(source, "assembles, with more sections than COFF can number");
+    }
+}
+
+// An object written to a pipe or to /dev/null, which cannot be sized or
+// seeked, has to come out as it does in a regular file
+static void pipe_output_test()
+{
+    std::string source = "test/object/sections.s";
+    std::string fifo = temp_dir + "/pipe.o";
+    std::vector<uint8_t> file, piped;
+    bool ok = false;
+
+    if (!assemble(source, temp_dir + "/file.o") || !read_file(temp_dir + "/file.o", file))
+    {
+        fail(source, "does not assemble");
+        return;
+    }
+
+    if (!assemble(source, "/dev/null"))
+    {
+        fail(source, "cannot be written to /dev/null");
+    }
+
+    if (mkfifo(fifo.c_str(), 0600) != 0)
+    {
+        fail(source, "cannot create a pipe");
+        return;
+    }
+
+    std::thread writer([&]
+                       { ok = assemble(source, fifo); });
+
+    read_file(fifo, piped);
+    writer.join();
+
+    if (!ok || piped != file)
+    {
+        fail(source, "written to a pipe differs from the file");
+    }
+}
+
+// Compiles sources to assembly with gcc, assembles it and returns the objects
+static bool build_objects(const Run_Test &test, const std::vector<const char *> &sources, const std::string &flags, std::string &objects)
+{
+    for (const char *source : sources)
+    {
+        std::string base = temp_dir + "/" + test.name + "_" + source;
+        std::string compiler = strstr(source, ".cpp") ? "g++" : "gcc";
+
+        if (run(compiler + " -O2 -S " + flags + " " + test.flags + " test/run/" + source + " -o " + base + ".s") != 0)
+        {
+            fail(source, "gcc -S failed");
+            return false;
+        }
+
+        if (!assemble(base + ".s", base + ".o"))
+        {
+            fail(source, "does not assemble");
+            return false;
+        }
+
+        objects += " " + base + ".o";
+    }
+
+    return true;
+}
+
+static std::string source_list(const std::vector<const char *> &sources)
+{
+    std::string list;
+
+    for (const char *source : sources)
+    {
+        list += " test/run/" + std::string(source);
+    }
+
+    return list;
+}
+
+static void run_test(const Run_Test &test)
+{
+    std::string dir = temp_dir + "/" + test.name;
+    std::string objects, lib_objects;
+    std::string output, expected;
+
+    if (!build_objects(test, test.sources, "", objects) || !build_objects(test, test.lib_sources, "-fPIC", lib_objects))
+    {
+        return;
+    }
+
+    run("mkdir -p " + dir + "/gnu");
+
+    // Linked with g++ so C++ programs get their library
+    std::string lib = test.lib_sources.empty() ? "" : " -L" + dir + " -ltest -Wl,-rpath," + dir;
+    std::string gnu_lib = test.lib_sources.empty() ? "" : " -L" + dir + "/gnu -ltest -Wl,-rpath," + dir + "/gnu";
+
+    if ((!test.lib_sources.empty() && run("g++ -shared" + lib_objects + " -o " + dir + "/libtest.so") != 0) || run("g++" + objects + lib + " -o " + dir + "/ours") != 0)
+    {
+        fail(test.name, "does not link");
+        return;
+    }
+
+    // gcc rather than g++, which would compile C sources as C++
+    if ((!test.lib_sources.empty() && run("gcc -O2 -fPIC -shared " + std::string(test.flags) + source_list(test.lib_sources) + " -o " + dir + "/gnu/libtest.so -lstdc++") != 0) ||
+        run("gcc -O2 " + std::string(test.flags) + source_list(test.sources) + gnu_lib + " -o " + dir + "/gnu/prog -lstdc++") != 0)
+    {
+        fail(test.name, "gcc cannot build it");
+        return;
+    }
+
+    int status = run(dir + "/ours", &output);
+    int expected_status = run(dir + "/gnu/prog", &expected);
+
+    if (status != expected_status || output != expected)
+    {
+        fail(test.name, "printed \"" + output + "\" with status " + std::to_string(status) + ", gcc's build printed \"" + expected + "\" with status " +
+                            std::to_string(expected_status));
+    }
+}
+
+int main()
+{
+    std::vector<std::string> object_tests = {
+        "sections",
+        "symbols",
+        "groups",
+        "cfi",
+        "tls",
+        "visibility",
+        "macros",
+    };
+
+    std::vector<Run_Test> run_tests = {
+        {"iostream", {"iostream.cpp"}, {}},
+        {"constructor", {"constructor.c"}, {}},
+        {"copy", {"copy_main.c"}, {"copy_lib.c"}},
+        {"ifunc", {"ifunc.c"}, {}},
+        {"comdat", {"comdat_main.cpp", "comdat_bump.cpp"}, {}},
+        {"exceptions", {"exceptions.cpp"}, {}},
+        {"tls", {"tls_main.c"}, {"tls_lib.c"}, "-pthread"},
+        {"weak", {"weak_main.c", "weak_strong.c"}, {"weak_lib.c"}},
+    };
+
+    char dir[] = "/tmp/object_test_XXXXXX";
+
+    if (!mkdtemp(dir))
+    {
+        std::cerr << "cannot create a temporary directory" << std::endl;
+        return 1;
+    }
+
+    temp_dir = dir;
+
+    std::size_t failed = 0;
+
+    for (const std::string &name : object_tests)
+    {
+        test_failed = false;
+        object_test(name);
+        failed += test_failed;
+    }
+
+    test_failed = false;
+    many_sections_test();
+    failed += test_failed;
+
+    test_failed = false;
+    coff_relocations_test();
+    failed += test_failed;
+
+    test_failed = false;
+    coff_sections_test();
+    failed += test_failed;
+
+    test_failed = false;
+    pipe_output_test();
+    failed += test_failed;
+
+    for (const Run_Test &test : run_tests)
+    {
+        test_failed = false;
+        run_test(test);
+        failed += test_failed;
+    }
+
+    run("rm -rf " + temp_dir);
+
+    std::size_t total = object_tests.size() + 4 + run_tests.size();
+
+    std::cout << total - failed << " of " << total << " passed" << std::endl;
+
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+# .eh_frame built from the .cfi_ directives
+
+	.text
+	.globl	f
+	.type	f, @function
+f:
+	.cfi_startproc
+	pushq	%rbp
+	.cfi_def_cfa_offset 16
+	.cfi_offset 6, -16
+	movq	%rsp, %rbp
+	.cfi_def_cfa_register 6
+	pushq	%rbx
+	subq	$8, %rsp
+	.cfi_offset 3, -24
+	.cfi_remember_state
+	testl	%edi, %edi
+	je	1f
+	movq	-8(%rbp), %rbx
+	leave
+	.cfi_def_cfa 7, 8
+	ret
+1:
+	.cfi_restore_state
+	.fill	300, 1, 0x90
+	movq	-8(%rbp), %rbx
+	.cfi_restore 3
+	leave
+	.cfi_def_cfa 7, 8
+	ret
+	.cfi_endproc
+	.size	f, .-f
+
+	.globl	g
+	.type	g, @function
+g:
+	.cfi_startproc
+	.cfi_personality 0x9b,DW.ref.__gxx_personality_v0
+	.cfi_lsda 0x1b,.LLSDA0
+	subq	$24, %rsp
+	.cfi_adjust_cfa_offset 24
+	call	f
+	.cfi_undefined 12
+	.cfi_same_value 13
+	.cfi_register 14, 15
+	.cfi_rel_offset 15, 8
+	.cfi_escape 0x2e, 0x10
+	addq	$24, %rsp
+	.cfi_adjust_cfa_offset -24
+	ret
+	.cfi_endproc
+
+	.type	s, @function
+s:
+	.cfi_startproc simple
+	.cfi_signal_frame
+	.cfi_def_cfa 7, 160
+	nop
+	.cfi_endproc
+
+	.section	.gcc_except_table,"a",@progbits
+.LLSDA0:
+	.byte	0xff
+
+	.hidden	DW.ref.__gxx_personality_v0
+	.weak	DW.ref.__gxx_personality_v0
+	.section	.data.rel.local.DW.ref.__gxx_personality_v0,"awG",@progbits,DW.ref.__gxx_personality_v0,comdat
+	.align	8
+	.type	DW.ref.__gxx_personality_v0, @object
+	.size	DW.ref.__gxx_personality_v0, 8
+DW.ref.__gxx_personality_v0:
+	.quad	__gxx_personality_v0
+
+	.section	.note.GNU-stack,"",@progbits
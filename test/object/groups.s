@@ -0,0 +1,30 @@
+# Sections in COMDAT groups, named by a label or by a symbol of their own,
+# and a section name used in two groups
+
+	.text
+	.globl	main
+main:
+	call	_Z1fv
+	ret
+
+	.section	.text._Z1fv,"axG",@progbits,_Z1fv,comdat
+	.weak	_Z1fv
+	.type	_Z1fv, @function
+_Z1fv:
+	movq	x(%rip), %rax
+	ret
+
+	.section	.data.x,"awG",@progbits,sig,comdat
+x:
+	.quad	_Z1fv
+
+	.section	.rodata.n,"aG",@progbits,sig,comdat
+	.byte	1
+
+	.section	.text._Z1fv,"axG",@progbits,other,comdat
+	nop
+
+	.section	.text._Z1fv,"axG",@progbits,_Z1fv,comdat
+	nop
+
+	.section	.note.GNU-stack,"",@progbits
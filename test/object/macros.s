@@ -0,0 +1,43 @@
+# Macro arguments: quoted, default and vararg, and recursion
+
+	.macro	str s
+	.ascii	"\s"
+	.endm
+
+	.macro	words a, b=2, c="3, 4"
+	.long	\a, \b, \c
+	.endm
+
+	# The rest of the line keeps its quotes
+	.macro	text first, rest:vararg
+	.byte	\first
+	.ascii	\rest
+	.endm
+
+	# Each level repeats the next n times
+	.macro	down n
+	.byte	\n
+	.rept	\n
+	down	"(\n - 1)"
+	.endr
+	.endm
+
+	.macro	move src, dst
+	movq	\src, \dst
+	.endm
+
+	.data
+	str	"hello, world"
+	str	hi
+	words	1
+	words	"5 + 1", c=7
+	words	8, "9", "10, 11"
+	text	1, "a", "b, c"
+	down	3
+	.irp	r, "1, 2", 3
+	.byte	\r
+	.endr
+
+	.text
+	move	"%rax", "%rbx"
+	move	"8(%rsp)", %rcx
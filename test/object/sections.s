@@ -0,0 +1,42 @@
+# Section alignment comes from the .align directives in each section, and the
+# section type from @type or the name
+
+	.text
+	.globl	f
+f:
+	ret
+	.p2align 4,,2
+	ret
+
+	.data
+	.byte	1
+	.balign	4
+	.long	2
+
+	.section	.init_array,"aw"
+	.align	8
+	.quad	f
+
+	.section	.fini_array,"aw",@fini_array
+	.align	8
+	.quad	f
+
+	.section	.preinit_array,"aw"
+	.align	8
+	.quad	f
+
+	.section	.note.test,"a",@note
+	.balign	4
+	.long	4, 4, 1
+	.ascii	"GNU\0"
+	.long	0
+
+	.section	.rodata.unaligned,"a",@progbits
+	.byte	3
+	.byte	4
+
+	.section	.bss.x,"aw",@nobits
+	.p2align 5
+	.zero	8
+
+	.section	.note.GNU-stack,"",@progbits
@@ -0,0 +1,45 @@
+# Symbol types and sizes from .type and .size
+
+	.text
+	.globl	f
+	.type	f, @function
+f:
+	testl	%edi, %edi
+	je	1f
+	movl	$1, %eax
+1:
+	ret
+	.size	f, .-f
+
+	.type	g, @gnu_indirect_function
+g:
+	leaq	f(%rip), %rax
+	ret
+	.size	g, .-g
+
+	.type	n, @notype
+n:
+	ret
+
+	.data
+	.globl	o
+	.type	o, @object
+	.size	o, 12
+o:
+	.long	1, 2, 3
+
+	.section	.data.u,"aw"
+	.type	u, @gnu_unique_object
+	.globl	u
+u:
+	.quad	0
+	.size	u, 8
+
+	.section	.tbss,"awT",@nobits
+	.globl	t
+	.type	t, @tls_object
+	.size	t, 4
+t:
+	.zero	4
+
+	.section	.note.GNU-stack,"",@progbits
@@ -0,0 +1,48 @@
+# GOT and thread local storage relocations
+
+	.text
+	.globl	f
+	.type	f, @function
+f:
+	movq	ext@GOTPCREL(%rip), %rax
+	movl	ext@GOTPCREL(%rip), %ecx
+	movq	ext@GOTPCREL(%rip), %r8
+	addq	ext@GOTPCREL(%rip), %rax
+	call	*ext@GOTPCREL(%rip)
+	jmp	*ext@GOTPCREL(%rip)
+	leaq	ext@GOTPCREL(%rip), %rax
+	call	ext@PLT
+	movl	%fs:local@tpoff, %eax
+	movq	$local@tpoff, %rax
+	movq	ie@gottpoff(%rip), %rax
+	addq	%fs:0, %rax
+	.byte	0x66
+	leaq	gd@tlsgd(%rip), %rdi
+	.value	0x6666
+	rex64
+	call	__tls_get_addr@PLT
+	leaq	ld@tlsld(%rip), %rdi
+	call	__tls_get_addr@PLT
+	movl	ld@dtpoff(%rax), %eax
+	ret
+	.size	f, .-f
+
+	.section	.tbss,"awT",@nobits
+	.align	4
+	.type	local, @object
+	.size	local, 4
+local:
+	.zero	4
+
+	.section	.tdata,"awT",@progbits
+	.align	8
+	.type	ld, @object
+	.size	ld, 8
+ld:
+	.quad	7
+
+	.section	.tls_offsets,"",@progbits
+	.long	ld@dtpoff
+	.quad	ld@dtpoff
+
+	.section	.note.GNU-stack,"",@progbits
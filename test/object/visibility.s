@@ -0,0 +1,40 @@
+# Weak symbols and symbol visibility
+
+	.text
+	.weak	wf
+	.type	wf, @function
+wf:
+	call	wu
+	call	hf
+	ret
+
+	.globl	hf
+	.hidden	hf
+	.type	hf, @function
+hf:
+	ret
+
+	.globl	pf
+	.protected	pf
+pf:
+	ret
+
+	.globl	inf
+	.internal	inf
+inf:
+	ret
+
+	.weak	wu
+	.hidden	hu
+	.protected	pu
+	.data
+	.quad	hu
+	.quad	pu
+	.quad	wf
+
+	.weak	wd
+	.hidden	wd
+wd:
+	.long	1
+
+	.section	.note.GNU-stack,"",@progbits
@@ -0,0 +1,15 @@
+// Inline functions are emitted in every file that uses them, each in a COMDAT
+// group, and the linker keeps one copy
+inline int &counter()
+{
+    static int count = 0;
+    return count;
+}
+
+struct Shape
+{
+    virtual int sides() const { return 0; }
+    virtual ~Shape() {}
+};
+
+int bump();
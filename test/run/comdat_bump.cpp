@@ -0,0 +1,8 @@
+#include "comdat.h"
+
+int bump()
+{
+    Shape shape;
+
+    return ++counter() + shape.sides();
+}
@@ -0,0 +1,13 @@
+#include <cstdio>
+
+#include "comdat.h"
+
+int main()
+{
+    Shape shape;
+
+    counter()++;
+    bump();
+    std::printf("%d %d\n", counter(), shape.sides());
+    return 0;
+}
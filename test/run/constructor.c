@@ -0,0 +1,20 @@
+// Constructors and destructors are called through .init_array and .fini_array
+#include <stdio.h>
+
+static int value;
+
+__attribute__((constructor)) static void init(void)
+{
+    value = 42;
+}
+
+__attribute__((destructor)) static void fini(void)
+{
+    printf("fini\n");
+}
+
+int main(void)
+{
+    printf("%d\n", value);
+    return 0;
+}
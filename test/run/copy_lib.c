@@ -0,0 +1 @@
+int pair[2] = {2, 7};
@@ -0,0 +1,11 @@
+// The executable refers to data of the library directly, so the linker
+// copies it into the executable using the size .size gave the symbol
+#include <stdio.h>
+
+extern int pair[2];
+
+int main(void)
+{
+    printf("%d %d\n", pair[0], pair[1]);
+    return 0;
+}
@@ -0,0 +1,58 @@
+// Exceptions unwind through the .eh_frame built from the .cfi_ directives and
+// find their handlers through the LSDA in .gcc_except_table
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+struct Guard
+{
+    const char *name;
+
+    ~Guard()
+    {
+        std::printf("unwound %s\n", name);
+    }
+};
+
+__attribute__((noinline)) static int inner(int depth)
+{
+    Guard guard{"inner"};
+
+    if (depth == 0)
+    {
+        throw std::runtime_error("bottom");
+    }
+
+    return inner(depth - 1) + 1;
+}
+
+__attribute__((noinline)) static int outer(int depth)
+{
+    Guard guard{"outer"};
+    std::string padding(depth, 'x');
+
+    return inner(depth) + (int)(padding.size());
+}
+
+int main()
+{
+    try
+    {
+        outer(3);
+    }
+    catch (const std::exception &e)
+    {
+        std::printf("caught %s\n", e.what());
+    }
+
+    try
+    {
+        throw 42;
+    }
+    catch (int value)
+    {
+        std::printf("caught %d\n", value);
+    }
+
+    return 0;
+}
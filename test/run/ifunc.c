@@ -0,0 +1,20 @@
+// An indirect function is called through the implementation its resolver returns
+#include <stdio.h>
+
+static int answer(void)
+{
+    return 42;
+}
+
+static int (*resolve(void))(void)
+{
+    return answer;
+}
+
+int get(void) __attribute__((ifunc("resolve")));
+
+int main(void)
+{
+    printf("%d\n", get());
+    return 0;
+}
@@ -0,0 +1,11 @@
+// Static constructors reach main through .init_array
+#include <iostream>
+#include <string>
+
+static std::string greeting = "static init";
+
+int main()
+{
+    std::cout << 5 << " " << greeting << std::endl;
+    return 0;
+}
@@ -0,0 +1,9 @@
+__thread int shared_counter = 1;
+
+static __thread int calls;
+
+int bump_shared(void)
+{
+    calls++;
+    return shared_counter += calls;
+}
@@ -0,0 +1,31 @@
+// Thread local variables of the executable and of a shared library, reached
+// through the local exec, initial exec and general dynamic models
+#include <stdio.h>
+#include <pthread.h>
+
+extern __thread int shared_counter;
+int bump_shared(void);
+
+__thread int counter = 5;
+static __thread int hidden[4];
+
+static void *run(void *arg)
+{
+    counter += (int)(long)(arg);
+    hidden[2] = counter * 2;
+    bump_shared();
+    bump_shared();
+    return (void *)(long)(counter + hidden[2] + shared_counter);
+}
+
+int main(void)
+{
+    pthread_t thread;
+    void *result;
+
+    pthread_create(&thread, NULL, run, (void *)10);
+    pthread_join(thread, &result);
+    bump_shared();
+    printf("%ld %d %d %d\n", (long)result, counter, hidden[2], shared_counter);
+    return 0;
+}
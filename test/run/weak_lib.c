@@ -0,0 +1,14 @@
+__attribute__((visibility("hidden"))) int clash(void)
+{
+    return 5;
+}
+
+__attribute__((visibility("protected"))) int protected_value(void)
+{
+    return 30;
+}
+
+int lib_value(void)
+{
+    return clash() + protected_value();
+}
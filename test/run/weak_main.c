@@ -0,0 +1,22 @@
+// Weak definitions are overridden by strong ones, undefined weak symbols are
+// null, and hidden symbols do not clash with the library's
+#include <stdio.h>
+
+int lib_value(void);
+int missing(void) __attribute__((weak));
+
+__attribute__((weak)) int overridden(void)
+{
+    return 1;
+}
+
+__attribute__((visibility("hidden"))) int clash(void)
+{
+    return 100;
+}
+
+int main(void)
+{
+    printf("%d %d %d %d\n", overridden(), missing ? 1 : 0, clash(), lib_value());
+    return 0;
+}
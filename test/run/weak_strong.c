@@ -0,0 +1,4 @@
+int overridden(void)
+{
+    return 2;
+}